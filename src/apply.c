@@ -42,6 +42,8 @@
 #include "hashing.h"
 #include "fenmatcher.h"
 #include "zobrist.h"
+#include "profile.h"
+#include "engine.h"
 
 /* Define a positional search depth that should look at the
  * full length of a game.  This is used in play_moves().
@@ -56,7 +58,11 @@ static Boolean play_moves(Game *game_details, Board *board, Move *moves,
 static Boolean apply_variations(const Game *game_details, const Board *board,
         Variation *variation, Boolean check_move_validity);
 static Boolean rewrite_variations(const Board *board, Variation *variation);
+static Boolean play_move(Move *move_details, Board *board);
+static void visit_move_positions(Move *moves, Board *board, unsigned ply,
+                                 PositionVisitor visit);
 static Boolean rewrite_moves(Game *game, Board *board, Move *move_details);
+static Boolean rewrite_SAN_string(Colour colour, Move *move_details, Board *board);
 static void build_FEN_components(const Board *board, char *epd, char *fen_suffix);
 static unsigned plies_in_move_sequence(Move *moves);
 static Boolean drop_plies_from_start(Game *game, Move *moves, int plies_to_drop);
@@ -181,7 +187,7 @@ copy_string(const char *str)
 }
 
 /* Allocate space for a new board. */
-static Board *
+Board *
 allocate_new_board(void)
 {
     return (Board *) malloc_or_die(sizeof (Board));
@@ -345,6 +351,8 @@ new_fen_board(const char *fen)
         FALSE, 0, 0,
         /* Initial hash value. */
         0ul,
+        /* Initial Zobrist piece hash. */
+        0ul,
         /* half-move_clock */
         0,
     };
@@ -662,8 +670,7 @@ void add_fen_castling(Game *game_details, Board *board)
         board->BQueenCastle = '\0';
     }
     if(added) {
-        char *old_fen = game_details->tags[FEN_TAG];
-        free(old_fen);
+        free_tag_value(game_details->tags[FEN_TAG]);
         game_details->tags[FEN_TAG] = get_FEN_string(board);
     }
 }
@@ -711,6 +718,8 @@ new_game_board(const char *fen)
         FALSE, 0, 0,
         /* Initial hash value. */
         0ul,
+        /* Initial Zobrist piece hash. */
+        0ul,
         /* half-move_clock */
         0,
     };
@@ -742,6 +751,7 @@ new_game_board(const char *fen)
 
             if (coloured_piece != EMPTY) {
                 new_board->weak_hash_value ^= hash_lookup(col, rank, piece, colour);
+                new_board->zobrist ^= zobrist_piece_hash(col, rank, piece, colour);
             }
         }
     }
@@ -863,6 +873,34 @@ half_moves_played(const Board *board)
  */
 Boolean
 apply_move(Move *move_details, Board *board)
+{
+    if (play_move(move_details, board)) {
+        if (GlobalState.output_format == EPD || GlobalState.add_FEN_comments) {
+            char epd[FEN_SPACE], fen_suffix[FEN_SPACE];
+            build_FEN_components(board, epd, fen_suffix);
+            MoveAnnotation *annotation = annotate_move(move_details);
+            size_t epd_length = strlen(epd);
+            /* Both parts share the one allocation, owned by epd. */
+            char *fen = (char *) malloc_or_die(epd_length + 1 +
+                                               strlen(fen_suffix) + 1);
+
+            memcpy((void *) fen, (const void *) epd, epd_length + 1);
+            strcpy(&fen[epd_length + 1], fen_suffix);
+            annotation->epd = fen;
+            annotation->fen_suffix = &fen[epd_length + 1];
+        }
+        return TRUE;
+    }
+    else {
+        return FALSE;
+    }
+}
+
+/* Make move_details on board, as apply_move, but without
+ * annotating the move with the resulting position.
+ */
+static Boolean
+play_move(Move *move_details, Board *board)
 {   /* Assume success. */
     Boolean Ok = TRUE;
     Colour colour = board->to_move;
@@ -921,13 +959,6 @@ apply_move(Move *move_details, Board *board)
             if (board->to_move == WHITE) {
                 board->move_number++;
             }
-            if (GlobalState.output_format == EPD || GlobalState.add_FEN_comments) {
-                char epd[FEN_SPACE], fen_suffix[FEN_SPACE];
-                build_FEN_components(board, epd, fen_suffix);
-                move_details->epd = copy_string(epd);
-                move_details->fen_suffix = copy_string(fen_suffix);
-            }
-
         }
     }
     else {
@@ -936,6 +967,104 @@ apply_move(Move *move_details, Board *board)
     return Ok;
 }
 
+/* Call visit with the piece placement hash value of every position
+ * in game_details, including those in its variations, together
+ * with the ply at which it occurs.
+ * Play stops at the first move that cannot be made.
+ */
+void
+visit_game_positions(Game *game_details, PositionVisitor visit)
+{
+    Board *board = new_game_board(game_details->tags[FEN_TAG]);
+
+    (*visit)(board->zobrist, 0);
+    visit_move_positions(game_details->moves, board, 0, visit);
+    free_board(board);
+}
+
+/* Visit the positions of moves and their variations, following
+ * ply with board.
+ */
+static void
+visit_move_positions(Move *moves, Board *board, unsigned ply,
+                     PositionVisitor visit)
+{
+    Boolean ok = TRUE;
+    Move *move;
+
+    for (move = moves; ok && move != NULL; move = move->next) {
+        if (*(move->move) != '\0') {
+            Variation *variation;
+
+            for (variation = move->Variants; variation != NULL;
+                    variation = variation->next) {
+                Board variation_board = *board;
+                visit_move_positions(variation->moves, &variation_board, ply, visit);
+            }
+            ok = play_move(move, board);
+            if (ok) {
+                ply++;
+                (*visit)(board->zobrist, ply);
+            }
+        }
+    }
+}
+
+/* Call visit with the board of each position in the main line of
+ * game_details, from the initial position up to and including
+ * ply max_ply.
+ * Play stops at the first move that cannot be made.
+ */
+void
+visit_main_line(Game *game_details, unsigned max_ply, BoardVisitor visit)
+{
+    Board *board = new_game_board(game_details->tags[FEN_TAG]);
+    Boolean ok = TRUE;
+    unsigned ply = 0;
+    Move *move;
+
+    (*visit)(board);
+    for (move = game_details->moves; ok && ply < max_ply && move != NULL;
+            move = move->next) {
+        if (*(move->move) != '\0') {
+            ok = play_move(move, board);
+            if (ok) {
+                ply++;
+                (*visit)(board);
+            }
+        }
+    }
+    free_board(board);
+}
+
+/* Rewrite the text of the main line of game_details in SAN, as it
+ * is played, for moves whose text is in some other form, such as
+ * those read from a binary game file.
+ * Play stops at the first move that cannot be made, leaving it
+ * to be reported when the game is replayed.
+ */
+void
+rewrite_main_line_SAN(Game *game_details)
+{
+    Board *board = new_game_board(game_details->tags[FEN_TAG]);
+    Board *before = allocate_new_board();
+    Boolean ok = TRUE;
+    Move *move;
+
+    for (move = game_details->moves; ok && move != NULL; move = move->next) {
+        if (*(move->move) != '\0') {
+            /* The SAN is of the move on the board before it is made,
+             * once its details and check status are known.
+             */
+            *before = *board;
+            ok = play_move(move, board) &&
+                    rewrite_SAN_string(before->to_move, move, before);
+        }
+    }
+    free_board(before);
+    free_board(board);
+}
+
 /* Play out the moves on the given board.
  * These could be either the main line or a variation.
  * game_details is updated with the final_ and cumulative_ hash values.
@@ -957,6 +1086,8 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
     Move *next_move = moves;
     /* Keep track of the final ECO match. */
     EcoLog *eco_match = NULL;
+    /* The latest half move at which an ECO match is still possible. */
+    unsigned eco_limit = 0;
     Boolean null_move_in_main_line = FALSE;
     /* Whether the fifty-move rule was available in the main line. */
     Boolean N_move_rule_applies = FALSE;
@@ -983,11 +1114,15 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
         }
     }
 
+    if (GlobalState.add_ECO && !GlobalState.parsing_ECO_file) {
+        eco_limit = eco_horizon(board);
+    }
+
     /* Ensure that the RESULT_TAG (if present) is valid. */
     if(game_details->tags[RESULT_TAG] != NULL &&
             !valid_result(game_details->tags[RESULT_TAG])) {
         /* Assume an indefinite one rather than an invalid one. */
-        free((void *) game_details->tags[RESULT_TAG]);
+        free_tag_value(game_details->tags[RESULT_TAG]);
         game_details->tags[RESULT_TAG] = copy_string("*");
     }
 
@@ -1124,7 +1259,7 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
                             }
 
                             if (corrected_result != NULL) {
-                                free((void *) result);
+                                free_tag_value(game_details->tags[RESULT_TAG]);
                                 game_details->tags[RESULT_TAG] = copy_string(corrected_result);
                                 if(next_move->terminating_result != NULL) {
                                     free((void *) next_move->terminating_result);
@@ -1152,7 +1287,7 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
                                        used in that case. However, if there are no moves the result is largely
                                        irrelevant.
                                      */
-                                    free((void *) result_tag);
+                                    free_tag_value(game_details->tags[RESULT_TAG]);
                                     game_details->tags[RESULT_TAG] = copy_string(move_result);
                                     report = FALSE;
                                 }
@@ -1177,7 +1312,8 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
                         }
                     }
 
-                    if (GlobalState.add_ECO && !GlobalState.parsing_ECO_file) {
+                    if (GlobalState.add_ECO && !GlobalState.parsing_ECO_file &&
+                            (unsigned) half_moves_played(board) <= eco_limit) {
                         int half_moves = half_moves_played(board);
                         EcoLog *entry = eco_matches(
                                 board,
@@ -1206,6 +1342,12 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
                                 eco_match = entry;
                             }
                         }
+                        /* Only pawn moves and captures can move the
+                         * horizon closer.
+                         */
+                        if (board->halfmove_clock == 0) {
+                            eco_limit = eco_horizon(board);
+                        }
                     }
                     next_move = next_move->next;
                 }
@@ -1265,19 +1407,19 @@ play_moves(Game *game_details, Board *board, Move *moves, unsigned max_depth,
         if (eco_match != NULL) {
             /* Free any details of the old one. */
             if (game_details->tags[ECO_TAG] != NULL) {
-                (void) free((void *) game_details->tags[ECO_TAG]);
+                free_tag_value(game_details->tags[ECO_TAG]);
                 game_details->tags[ECO_TAG] = NULL;
             }
             if (game_details->tags[OPENING_TAG] != NULL) {
-                (void) free((void *) game_details->tags[OPENING_TAG]);
+                free_tag_value(game_details->tags[OPENING_TAG]);
                 game_details->tags[OPENING_TAG] = NULL;
             }
             if (game_details->tags[VARIATION_TAG] != NULL) {
-                (void) free((void *) game_details->tags[VARIATION_TAG]);
+                free_tag_value(game_details->tags[VARIATION_TAG]);
                 game_details->tags[VARIATION_TAG] = NULL;
             }
             if (game_details->tags[SUB_VARIATION_TAG] != NULL) {
-                (void) free((void *) game_details->tags[SUB_VARIATION_TAG]);
+                free_tag_value(game_details->tags[SUB_VARIATION_TAG]);
                 game_details->tags[SUB_VARIATION_TAG] = NULL;
             }
 
@@ -1462,9 +1604,12 @@ Boolean
 apply_move_list(Game *game_details, unsigned *plycount, unsigned max_depth)
 {
     Move *moves = game_details->moves;
-    Board *board = new_game_board(game_details->tags[FEN_TAG]);
+    Board *board;
     Boolean game_matches;
+    ProfileMark mark;
 
+    PROFILE_BEGIN(mark);
+    board = new_game_board(game_details->tags[FEN_TAG]);
     /* Ensure that we have a sensible search depth. */
     if (max_depth == 0) {
         /* No positional variations specified. */
@@ -1475,7 +1620,7 @@ apply_move_list(Game *game_details, unsigned *plycount, unsigned max_depth)
     game_details->cumulative_hash_value = 0;
 
     if (GlobalState.check_for_repetition > 0 && game_details->position_counts == NULL) {
-        game_details->position_counts = new_position_count_list(board);
+        game_details->position_counts = new_position_counts(board);
     }
 
     /* Play through the moves and see if we have a match.
@@ -1497,9 +1642,40 @@ apply_move_list(Game *game_details, unsigned *plycount, unsigned max_depth)
     }
 
     free_board(board);
+    PROFILE_COUNT(PROFILE_PLIES_APPLIED, *plycount);
+    PROFILE_END(PROFILE_APPLY, mark);
     return game_matches;
 }
 
+/* Check the move bounds (-b) on the number of plies that the game
+ * will have been played to if all of its moves are legal, so that a
+ * game of the wrong length can be rejected without replaying its moves.
+ * The moves of a broken game that is kept stop at its first error,
+ * so its length is only known once they have been replayed.
+ */
+Boolean
+check_move_bounds_before_replay(const Game *game_details)
+{
+    if (GlobalState.check_move_bounds && !GlobalState.keep_broken_games) {
+        unsigned plycount = plies_in_move_sequence(game_details->moves);
+
+        if (game_details->tags[FEN_TAG] != NULL) {
+            Board *board = new_fen_board(game_details->tags[FEN_TAG]);
+
+            if (board != NULL) {
+                /* The plies before the starting position. */
+                plycount += 2 * (board->move_number - 1) +
+                        (board->to_move == BLACK ? 1 : 0);
+                free_board(board);
+            }
+        }
+        return check_move_bounds(plycount);
+    }
+    else {
+        return TRUE;
+    }
+}
+
 /* game_details contains a complete move score.
  * Try to apply each move on a new board.
  * Store in number_of_moves the length of the game.
@@ -1764,6 +1940,7 @@ rewrite_move(Game *game, Colour colour, Move *move_details, Board *board)
         Ok = FALSE;
     }
     else if (GlobalState.output_format == SOURCE || 
+            GlobalState.output_format == BIN ||
             rewrite_SAN_string(colour, move_details, board)) {
         Piece piece_to_move = move_details->piece_to_move;
         MoveClass class = move_details->class;
@@ -1829,6 +2006,84 @@ rewrite_move(Game *game, Colour colour, Move *move_details, Board *board)
     return Ok;
 }
 
+/* Rewrite move_details as it is played on board, and annotate it
+ * as required.
+ * plies_to_drop is set if a comment of the move shows where the
+ * game should start.
+ * Return FALSE if the move could not be rewritten.
+ */
+static Boolean
+rewrite_played_move(Game *game, Board *board, Move *move_details, int *plies_to_drop)
+{
+    if (!rewrite_move(game, board->to_move, move_details, board)) {
+        return FALSE;
+    }
+    if(move_details->class == NULL_MOVE && game != NULL) {
+        /* NULL_MOVE not allowed in the main line. */
+    }
+    board->to_move = OPPOSITE_COLOUR(board->to_move);
+    if (board->to_move == WHITE) {
+        board->move_number++;
+    }
+
+    if (GlobalState.output_evaluation) {
+        if (GlobalState.engine_command != NULL) {
+            /* Filled in by complete_engine_evaluations. */
+            queue_engine_evaluation(board, annotate_move(move_details));
+        }
+        else {
+            annotate_move(move_details)->evaluation = evaluate(board);
+        }
+    }
+
+    if (GlobalState.add_hashcode_comments) {
+        /* Append a hashcode comment using the new state of the board
+         * with the move having been played.
+         */
+        annotate_move(move_details)->zobrist = generate_zobrist_hash_from_board(board);
+    }
+    
+    if(GlobalState.drop_comment_pattern != NULL &&
+            move_details->comment_list != NULL) {
+        if(find_matching_comment(GlobalState.drop_comment_pattern,
+                                  move_details->comment_list) != NULL) {
+            /* We have a match. */
+            *plies_to_drop = (board->move_number - 1) * 2;
+            if(board->to_move == BLACK) {
+                (*plies_to_drop)++;
+            }
+        }
+    }
+    /* See if a comment should be replaced by a FEN comment. */
+    if(GlobalState.FEN_comment_pattern != NULL &&
+            move_details->comment_list != NULL) {
+        StringList *comment_to_replace =
+            find_matching_comment(GlobalState.FEN_comment_pattern,
+                                  move_details->comment_list);
+        if(comment_to_replace != NULL) {
+            /* Replace it. */
+            (void) free((void *) comment_to_replace->str);
+            comment_to_replace->str = get_FEN_string(board);
+        }
+    }
+    return TRUE;
+}
+
+/* Rewrite a single move of a line, as it is played on board,
+ * without its variations.
+ * This is for --splitvariants, which rewrites a line after its
+ * first move_number moves have been rewritten as part of an
+ * earlier line, so it must not be used when plies are to be dropped.
+ * Return FALSE if the move could not be rewritten.
+ */
+Boolean
+rewrite_line_move(Game *game, Board *board, Move *move_details)
+{
+    int plies_to_drop = 0;
+    return *(move_details->move) != '\0' &&
+        rewrite_played_move(game, board, move_details, &plies_to_drop);
+}
+
 /* Rewrite the list of moves by playing through the game.
  * If game is NULL then the moves are a variation rather than
  * the main line.
@@ -1849,50 +2104,7 @@ rewrite_moves(Game *game, Board *board, Move *moves)
                 /* Something wrong with the variations. */
                 game_ok = FALSE;
             }
-            if (rewrite_move(game, board->to_move, move_details, board)) {
-                if(move_details->class == NULL_MOVE && game != NULL) {
-                    /* NULL_MOVE not allowed in the main line. */
-                }
-                board->to_move = OPPOSITE_COLOUR(board->to_move);
-                if (board->to_move == WHITE) {
-                    board->move_number++;
-                }
-
-                if (GlobalState.output_evaluation) {
-                    move_details->evaluation = evaluate(board);
-                }
-
-                if (GlobalState.add_hashcode_comments) {
-                    /* Append a hashcode comment using the new state of the board
-                     * with the move having been played.
-                     */
-                    move_details->zobrist = generate_zobrist_hash_from_board(board);
-                }
-                
-                if(GlobalState.drop_comment_pattern != NULL &&
-                        move_details->comment_list != NULL) {
-                    if(find_matching_comment(GlobalState.drop_comment_pattern,
-                                              move_details->comment_list) != NULL) {
-                        /* We have a match. */
-                        plies_to_drop = (board->move_number - 1) * 2;
-                        if(board->to_move == BLACK) {
-                            plies_to_drop++;
-                        }
-                    }
-                }
-                /* See if a comment should be replaced by a FEN comment. */
-                if(GlobalState.FEN_comment_pattern != NULL &&
-                        move_details->comment_list != NULL) {
-                    StringList *comment_to_replace =
-                        find_matching_comment(GlobalState.FEN_comment_pattern,
-                                              move_details->comment_list);
-                    if(comment_to_replace != NULL) {
-                        /* Replace it. */
-                        (void) free((void *) comment_to_replace->str);
-                        comment_to_replace->str = get_FEN_string(board);
-                    }
-                }
-
+            if (rewrite_played_move(game, board, move_details, &plies_to_drop)) {
                 move_details = move_details->next;
             }
             else {
@@ -1923,7 +2135,7 @@ rewrite_moves(Game *game, Board *board, Move *moves)
     if (!game_ok) {
         if(GlobalState.keep_broken_games && move_details != NULL) {
             /* Try to place the remaining moves into a comment. */
-            CommentList *comment = (CommentList*) malloc_or_die(sizeof (*comment));
+            CommentList *comment = (CommentList*) arena_malloc(sizeof (*comment));
             /* Break the link from the previous move. */
             Move *prev;
             StringList *commented_move_list = NULL;
@@ -1945,7 +2157,7 @@ rewrite_moves(Game *game, Board *board, Move *moves)
             /* Build the comment string. */
             char *terminating_result = NULL;
             while (move_details != NULL) {
-                commented_move_list = save_string_list_item(commented_move_list, (char *) move_details->move);
+                commented_move_list = save_string_list_item(commented_move_list, copy_string((const char *) move_details->move));
                 if (move_details->next == NULL) {
                     /* Remove the terminating result. */
                     terminating_result = move_details->terminating_result;
@@ -2020,6 +2232,7 @@ rewrite_game(Game *current_game)
 
     /* No null-move found at the start of the game. */
     game_ok = rewrite_moves(current_game, board, current_game->moves);
+    complete_engine_evaluations();
     if (game_ok) {
     }
     else if (GlobalState.keep_broken_games) {
@@ -2083,9 +2296,7 @@ drop_plies_from_start(Game *game, Move *moves, int plies_to_drop)
         }
     }
     if(plies == plies_to_drop && game_ok) {
-        if(fen != NULL) {
-            (void) free((void *) fen);
-        }
+        free_tag_value(fen);
 #if 0
         /* Reset the move number. */
         board->move_number = 1;
@@ -2119,13 +2330,42 @@ drop_plies_from_start(Game *game, Move *moves, int plies_to_drop)
     return game_ok;
 }
 
-/* Define a table to hold the positional hash codes of interest.
- * Size should be a prime number for collision avoidance.
+/* A set of the hash codes of positions of interest.
+ * The codes are held in an open-addressed table that is sized as they
+ * are added.  In front of it is a Bloom filter with the bits of each
+ * code in a single word, so that the usual case of a position not being
+ * of interest costs one probe of the filter rather than of the table.
  */
-#define MAX_NON_POLYGLOT_CODE 541
-static HashLog *non_polyglot_codes_of_interest[MAX_NON_POLYGLOT_CODE];
+typedef struct {
+    /* The table of codes, in which EMPTY_CODE marks a free slot. */
+    HashCode *codes;
+    /* The number of slots in codes: zero or a power of two. */
+    size_t capacity;
+    /* The number of codes in the set. */
+    size_t count;
+    /* Whether EMPTY_CODE is itself in the set. */
+    Boolean has_empty_code;
+    HashCode *filter;
+    /* The number of words in filter, less one. */
+    size_t filter_mask;
+} CodeSet;
+
+#define EMPTY_CODE 0
+/* The minimum number of bits of the filter for each code. */
+#define FILTER_BITS_PER_CODE 16
+
+static void add_to_code_set(CodeSet *set, HashCode code);
+static Boolean code_set_contains(const CodeSet *set, HashCode code);
+
+/* The positional hash codes of interest. */
+static CodeSet non_polyglot_codes_of_interest;
 /* Whether or not the non-polyglot hashcodes are in use. */
-Boolean using_non_polyglot = FALSE;
+static Boolean using_non_polyglot = FALSE;
+/* The piece placement hash values of the positions stored by
+ * store_hash_value, for lookup in a position index.
+ */
+static uint64_t *query_placements = NULL;
+static size_t num_query_placements = 0, max_query_placements = 0;
 
 /* move_details is either the start of a variation in which we are interested
  * or it is NULL.
@@ -2160,17 +2400,17 @@ store_hash_value(Move *move_details, const char *fen)
     }
 
     if (Ok) {
-        HashLog *entry = (HashLog *) malloc_or_die(sizeof (*entry));
-        unsigned ix = board->weak_hash_value % MAX_NON_POLYGLOT_CODE;
+        if (num_query_placements == max_query_placements) {
+            max_query_placements = max_query_placements == 0 ? 16 : 2 * max_query_placements;
+            query_placements = (uint64_t *) realloc_or_die((void *) query_placements,
+                    max_query_placements * sizeof (*query_placements));
+        }
+        query_placements[num_query_placements++] = board->zobrist;
 
         /* We don't include the cumulative hash value as the sequence
          * of moves to reach this position is not important.
          */
-        entry->cumulative_hash_value = 0;
-        entry->final_hash_value = board->weak_hash_value;
-        /* Link it into the head at this index. */
-        entry->next = non_polyglot_codes_of_interest[ix];
-        non_polyglot_codes_of_interest[ix] = entry;
+        add_to_code_set(&non_polyglot_codes_of_interest, board->weak_hash_value);
         using_non_polyglot = TRUE;
     }
     else {
@@ -2179,11 +2419,8 @@ store_hash_value(Move *move_details, const char *fen)
     free_board(board);
 }
 
-/* Define a table to hold the positional hash codes of interest.
- * Size should be a prime number for collision avoidance.
- */
-#define MAX_POLYGLOT_CODE 541
-static HashLog *polyglot_codes_of_interest[MAX_POLYGLOT_CODE];
+/* The polyglot hash codes of interest (-H). */
+static CodeSet polyglot_codes_of_interest;
 /* Whether or not the polyglot hashcodes are in use. */
 static Boolean using_polyglot = FALSE;
 
@@ -2205,20 +2442,11 @@ Boolean save_polyglot_hashcode(const char *value)
              */
             uint64_t hash = 0x0;
             char *end;
+            errno = 0;
             hash = strtoull(value, &end, 16);
             Ok = (errno == 0 && *end == '\0');
             if (Ok) {
-                HashLog *entry = (HashLog *) malloc_or_die(sizeof (*entry));
-                unsigned ix = hash % MAX_POLYGLOT_CODE;
-
-                /* We don't include the cumulative hash value as the sequence
-                 * of moves to reach this position is not important.
-                 */
-                entry->cumulative_hash_value = 0;
-                entry->final_hash_value = hash;
-                /* Link it into the head at this index. */
-                entry->next = polyglot_codes_of_interest[ix];
-                polyglot_codes_of_interest[ix] = entry;
+                add_to_code_set(&polyglot_codes_of_interest, hash);
                 using_polyglot = TRUE;
             }
             else {
@@ -2235,6 +2463,143 @@ Boolean save_polyglot_hashcode(const char *value)
     return Ok;
 }
 
+/* Return the piece placement hash values of the positions of
+ * interest and set count to their number.
+ * Return NULL if a game might match on something other than
+ * one of those positions, such as a polyglot hash value or
+ * a FEN pattern.
+ */
+const uint64_t *
+position_query_placements(size_t *count)
+{
+    *count = num_query_placements;
+    if (using_polyglot || fen_patterns_in_use() || num_query_placements == 0) {
+        return NULL;
+    }
+    else {
+        return query_placements;
+    }
+}
+
+/* Mix the bits of code, which might not be well distributed, for
+ * use in locating it in a CodeSet.
+ */
+static HashCode
+mix_code(HashCode code)
+{
+    code ^= code >> 30;
+    code *= 0xbf58476d1ce4e5b9ULL;
+    code ^= code >> 27;
+    code *= 0x94d049bb133111ebULL;
+    code ^= code >> 31;
+    return code;
+}
+
+/* The three bits of the filter word of a code, from its mixed value. */
+static HashCode
+code_filter_bits(HashCode mixed)
+{
+    return ((HashCode) 1 << (mixed & 63)) |
+           ((HashCode) 1 << ((mixed >> 6) & 63)) |
+           ((HashCode) 1 << ((mixed >> 12) & 63));
+}
+
+/* The index of the filter word of a code. */
+#define CODE_FILTER_WORD(set, mixed) (((mixed) >> 18) & (set)->filter_mask)
+/* The first slot of the table to be probed for a code. */
+#define CODE_SLOT(set, mixed) (((mixed) >> 32) & ((set)->capacity - 1))
+
+/* Place code in the table and filter of set, both of which have room. */
+static void
+insert_code(CodeSet *set, HashCode code)
+{
+    HashCode mixed = mix_code(code);
+    size_t ix = CODE_SLOT(set, mixed);
+
+    while (set->codes[ix] != EMPTY_CODE) {
+        ix = (ix + 1) & (set->capacity - 1);
+    }
+    set->codes[ix] = code;
+    set->filter[CODE_FILTER_WORD(set, mixed)] |= code_filter_bits(mixed);
+}
+
+/* Add code to set, if it is not already there, enlarging the table
+ * to keep it no more than half full and the filter to have at least
+ * FILTER_BITS_PER_CODE bits for each code.
+ */
+static void
+add_to_code_set(CodeSet *set, HashCode code)
+{
+    if (code_set_contains(set, code)) {
+        /* Nothing to add. */
+    }
+    else if (code == EMPTY_CODE) {
+        set->has_empty_code = TRUE;
+    }
+    else {
+        size_t filter_words = set->filter_mask + 1;
+
+        set->count++;
+        if (2 * set->count > set->capacity ||
+                set->count * FILTER_BITS_PER_CODE > filter_words * 64) {
+            HashCode *old_codes = set->codes;
+            size_t old_capacity = set->capacity;
+            size_t ix;
+
+            if (set->capacity == 0) {
+                set->capacity = 64;
+            }
+            while (2 * set->count > set->capacity) {
+                set->capacity *= 2;
+            }
+            while (set->count * FILTER_BITS_PER_CODE > filter_words * 64) {
+                filter_words *= 2;
+            }
+            set->codes = (HashCode *) malloc_or_die(set->capacity * sizeof(*set->codes));
+            memset((void *) set->codes, 0, set->capacity * sizeof(*set->codes));
+            (void) free((void *) set->filter);
+            set->filter = (HashCode *) malloc_or_die(filter_words * sizeof(*set->filter));
+            memset((void *) set->filter, 0, filter_words * sizeof(*set->filter));
+            set->filter_mask = filter_words - 1;
+            for (ix = 0; ix < old_capacity; ix++) {
+                if (old_codes[ix] != EMPTY_CODE) {
+                    insert_code(set, old_codes[ix]);
+                }
+            }
+            (void) free((void *) old_codes);
+        }
+        insert_code(set, code);
+    }
+}
+
+/* Return whether code is in set. */
+static Boolean
+code_set_contains(const CodeSet *set, HashCode code)
+{
+    if (set->count == 0 || code == EMPTY_CODE) {
+        return code == EMPTY_CODE && set->has_empty_code;
+    }
+    else {
+        HashCode mixed = mix_code(code);
+        HashCode bits = code_filter_bits(mixed);
+
+        if ((set->filter[CODE_FILTER_WORD(set, mixed)] & bits) != bits) {
+            return FALSE;
+        }
+        else {
+            size_t ix = CODE_SLOT(set, mixed);
+
+            while (set->codes[ix] != EMPTY_CODE) {
+                if (set->codes[ix] == code) {
+                    return TRUE;
+                }
+                ix = (ix + 1) & (set->capacity - 1);
+            }
+            return FALSE;
+        }
+    }
+}
+
 /* Does the current board match a position of interest.
  * Look in codes_of_interest for current_hash_value.
  * Return NULL if no match, otherwise a possible label for the
@@ -2245,28 +2610,19 @@ static const char *
 position_matches(const Board *board)
 {
     Boolean found = FALSE;
-    
+    const char *match_label;
+    ProfileMark mark;
+
+    PROFILE_BEGIN(mark);
+
+    /* We can test against just the position value. */
     if(using_non_polyglot) {
-        HashCode current_hash_value = board->weak_hash_value;
-        unsigned ix = current_hash_value % MAX_NON_POLYGLOT_CODE;
-        for (HashLog *entry = non_polyglot_codes_of_interest[ix]; !found && (entry != NULL);
-                entry = entry->next) {
-            /* We can test against just the position value. */
-            if (entry->final_hash_value == current_hash_value) {
-                found = TRUE;
-            }
-        }
+        found = code_set_contains(&non_polyglot_codes_of_interest,
+                                  board->weak_hash_value);
     }
     if(!found && using_polyglot) {
-        uint64_t current_hash_value = generate_zobrist_hash_from_board(board);
-        unsigned ix = current_hash_value % MAX_POLYGLOT_CODE;
-        for (HashLog *entry = polyglot_codes_of_interest[ix]; !found && (entry != NULL);
-                entry = entry->next) {
-            /* We can test against just the position value. */
-            if (entry->final_hash_value == current_hash_value) {
-                found = TRUE;
-            }
-        }
+        found = code_set_contains(&polyglot_codes_of_interest,
+                                  generate_zobrist_hash_from_board(board));
     }
     if(found && GlobalState.whose_move != EITHER_TO_MOVE) {
         if(board->to_move == WHITE && GlobalState.whose_move == BLACK_TO_MOVE) {
@@ -2277,10 +2633,10 @@ position_matches(const Board *board)
 	}
     }
     if (found) {
-        return "";
+        match_label = "";
     }
     else {
-        const char *match_label = pattern_match_board(board);
+        match_label = pattern_match_board(board);
 	if(match_label != NULL && GlobalState.whose_move != EITHER_TO_MOVE) {
 	    if(board->to_move == WHITE && GlobalState.whose_move == BLACK_TO_MOVE) {
 		match_label = NULL;
@@ -2289,34 +2645,47 @@ position_matches(const Board *board)
 		match_label = NULL;
 	    }
 	}
-        return match_label;
     }
+    PROFILE_END(PROFILE_POSITION_MATCH, mark);
+    return match_label;
 }
 
-/* Build a basic EPD string from the given board. */
-void
-build_basic_EPD_string(const Board *board, char *epd)
+/* The encoding of each rank in the EPD strings built so far.
+ * Successive positions of a game usually differ in just one or two
+ * ranks, so the others are copied from here rather than re-encoded.
+ */
+static struct {
+    Piece squares[BOARDSIZE];
+    char text[BOARDSIZE + 1];
+    unsigned length;
+    Boolean valid;
+} encoded_ranks[BOARDSIZE];
+
+/* Return the encoding of rank of board as part of an EPD string,
+ * with its length in *length.
+ */
+static const char *
+encoded_rank(const Board *board, Rank rank, unsigned *length)
 {
-    Rank rank;
-    int ix = 0;
-#if 0
-    Boolean castling_allowed;
-#endif
-
-    /* The board. */
-    for (rank = LASTRANK; rank >= FIRSTRANK; rank--) {
-        Col col;
+    const Piece *squares = &board->board[RankConvert(rank)][ColConvert(FIRSTCOL)];
+    unsigned r = rank - FIRSTRANK;
+
+    if (!encoded_ranks[r].valid ||
+            memcmp((const void *) squares, (const void *) encoded_ranks[r].squares,
+                   sizeof (encoded_ranks[r].squares)) != 0) {
+        char *text = encoded_ranks[r].text;
+        unsigned ix = 0;
         int consecutive_spaces = 0;
-        for (col = FIRSTCOL; col <= LASTCOL; col++) {
-            int coloured_piece = 
-                board->board[RankConvert(rank)][ColConvert(col)];
-            if (coloured_piece != EMPTY) {
+        int c;
+
+        for (c = 0; c < BOARDSIZE; c++) {
+            if (squares[c] != EMPTY) {
                 if (consecutive_spaces > 0) {
-                    epd[ix] = '0' + consecutive_spaces;
+                    text[ix] = '0' + consecutive_spaces;
                     ix++;
                     consecutive_spaces = 0;
                 }
-                epd[ix] = coloured_piece_to_SAN_letter(coloured_piece);
+                text[ix] = coloured_piece_to_SAN_letter(squares[c]);
                 ix++;
             }
             else {
@@ -2324,9 +2693,36 @@ build_basic_EPD_string(const Board *board, char *epd)
             }
         }
         if (consecutive_spaces > 0) {
-            epd[ix] = '0' + consecutive_spaces;
+            text[ix] = '0' + consecutive_spaces;
             ix++;
         }
+        text[ix] = '\0';
+        encoded_ranks[r].length = ix;
+        memcpy((void *) encoded_ranks[r].squares, (const void *) squares,
+               sizeof (encoded_ranks[r].squares));
+        encoded_ranks[r].valid = TRUE;
+    }
+    *length = encoded_ranks[r].length;
+    return encoded_ranks[r].text;
+}
+
+/* Build a basic EPD string from the given board. */
+void
+build_basic_EPD_string(const Board *board, char *epd)
+{
+    Rank rank;
+    int ix = 0;
+#if 0
+    Boolean castling_allowed;
+#endif
+
+    /* The board. */
+    for (rank = LASTRANK; rank >= FIRSTRANK; rank--) {
+        unsigned length;
+        const char *text = encoded_rank(board, rank, &length);
+
+        memcpy((void *) &epd[ix], (const void *) text, length);
+        ix += length;
         /* Terminate the row. */
         if (rank != FIRSTRANK) {
             epd[ix] = '/';
@@ -2546,12 +2942,27 @@ build_basic_EPD_string(const Board *board, char *epd)
 /* Build and return a FEN string for the given board. */
 char *get_FEN_string(const Board *board)
 {
-    char epd[FEN_SPACE], fen_suffix[FEN_SPACE];
-    build_FEN_components(board, epd, fen_suffix);
-    char *FEN_string = (char *) malloc_or_die(strlen(epd) + 1 + 
-            strlen(fen_suffix) + 1);
-    sprintf(FEN_string, "%s %s", epd, fen_suffix);
-    return FEN_string;
+    char fen[FEN_SPACE];
+
+    build_FEN_string(board, fen);
+    return copy_string(fen);
+}
+
+/* Build a FEN string for the given board in fen, which
+ * must have at least FEN_SPACE characters.
+ * Return its length.
+ */
+size_t
+build_FEN_string(const Board *board, char *fen)
+{
+    size_t ix;
+
+    build_basic_EPD_string(board, fen);
+    ix = strlen(fen);
+    /* The half-move clock and the full move number. */
+    snprintf(&fen[ix], FEN_SPACE - ix, " %u %u",
+             board->halfmove_clock, board->move_number);
+    return ix + strlen(&fen[ix]);
 }
 
 /* Build a FEN string from the given board.
@@ -2583,7 +2994,7 @@ build_FEN_components(const Board *board, char *epd, char *fen_suffix)
 static void
 append_FEN_comment(Move *move_details, const Board *board)
 {
-    CommentList *comment = (CommentList*) malloc_or_die(sizeof (*comment));
+    CommentList *comment = (CommentList*) arena_malloc(sizeof (*comment));
     StringList *current_comment = save_string_list_item(NULL, get_FEN_string(board));
 
     comment->comment = current_comment;
@@ -2606,7 +3017,7 @@ append_hashcode_comment(Move *move_details, Board *board)
 {
     uint64_t hash = generate_zobrist_hash_from_board(board);
     char *hashcode_comment = (char *) malloc_or_die(HASH_64_BIT_SPACE + 1);
-    CommentList *comment = (CommentList*) malloc_or_die(sizeof (*comment));
+    CommentList *comment = (CommentList*) arena_malloc(sizeof (*comment));
     StringList *current_comment = save_string_list_item(NULL, hashcode_comment);
     
     sprintf(hashcode_comment, "%016" PRIx64, hash);
@@ -2623,7 +3034,7 @@ append_hashcode_comment(Move *move_details, Board *board)
 static void
 append_evaluation(Move *move_details, const Board *board)
 {
-    CommentList *comment = (CommentList*) malloc_or_die(sizeof (*comment));
+    CommentList *comment = (CommentList*) arena_malloc(sizeof (*comment));
     /* Space template for the value.
      * @@@ There is a buffer-overflow risk here if the evaluation value
      * is too large.
@@ -2663,7 +3074,7 @@ create_match_comment(const Board *board)
         match_comment = get_FEN_string(board);
     }
     StringList *current_comment = save_string_list_item(NULL, match_comment);
-    CommentList *comment = (CommentList*) malloc_or_die(sizeof (*comment));
+    CommentList *comment = (CommentList*) arena_malloc(sizeof (*comment));
 
     comment->comment = current_comment;
     comment->next = NULL;
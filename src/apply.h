@@ -22,25 +22,40 @@
 #ifndef APPLY_H
 #define APPLY_H
 
+/* A function to be told the piece placement hash value of a
+ * position and the ply at which it occurs.
+ */
+typedef void (*PositionVisitor)(uint64_t placement, unsigned ply);
+/* A function to be shown each position of a game's main line. */
+typedef void (*BoardVisitor)(const Board *board);
+
 void add_fen_castling(Game *game_details, Board *board);
 Boolean apply_move_list(Game *game_details,unsigned *plycount, unsigned max_depth);
 Boolean apply_move(Move *move_details, Board *board);
 Board *apply_eco_move_list(Game *game_details,unsigned *number_of_half_moves);
 void build_basic_EPD_string(const Board *board,char *fen);
+Boolean check_move_bounds_before_replay(const Game *game_details);
 char coloured_piece_to_SAN_letter(Piece coloured_piece);
 Piece convert_FEN_char_to_piece(char c);
 CommentList *create_match_comment(const Board *board);
+Board *allocate_new_board(void);
 void free_board(Board *board);
 char *get_FEN_string(const Board *board);
+size_t build_FEN_string(const Board *board, char *fen);
+const uint64_t *position_query_placements(size_t *count);
 Board *new_fen_board(const char *fen);
 Board *new_game_board(const char *fen);
 const char *piece_str(Piece piece);
 Board *rewrite_game(Game *game_details);
+Boolean rewrite_line_move(Game *game, Board *board, Move *move_details);
 char SAN_piece_letter(Piece piece);
 Boolean save_polyglot_hashcode(const char *value);
 /* letters should contain a string of the form: "PNBRQK" */
 void set_output_piece_characters(const char *letters);
 void store_hash_value(Move *move_details,const char *fen);
+void visit_game_positions(Game *game_details, PositionVisitor visit);
+void visit_main_line(Game *game_details, unsigned max_ply, BoardVisitor visit);
+void rewrite_main_line_SAN(Game *game_details);
 
 #endif	// APPLY_H
 
@@ -40,6 +40,9 @@
 #include "lists.h"
 #include "mymalloc.h"
 #include "fenmatcher.h"
+#include "profile.h"
+#include "compress.h"
+#include "statistics.h"
 
 #define CURRENT_VERSION "v22-11"
 #define URL "https://www.cs.kent.ac.uk/people/staff/djb/pgn-extract/"
@@ -83,6 +86,30 @@ stringcompare(const char *s1, const char *s2)
 #endif
 }
 
+/* If not NULL, the function called in place of exit(1) for an
+ * error in the arguments. See set_argument_error_handler.
+ */
+static ArgumentErrorHandler argument_error_handler = NULL;
+
+/* Set the function to be called for an error in the arguments,
+ * or NULL to exit. handler must not return.
+ */
+void
+set_argument_error_handler(ArgumentErrorHandler handler)
+{
+    argument_error_handler = handler;
+}
+
+/* Deal with an error in the arguments, which has been reported. */
+void
+argument_error(void)
+{
+    if (argument_error_handler != NULL) {
+        (*argument_error_handler)();
+    }
+    exit(1);
+}
+
 #if 0
 
 /* Return TRUE if str contains prefix as a prefix, FALSE otherwise. */
@@ -170,7 +197,7 @@ usage_and_exit(void)
         "-vvariations -- the file variations contains the textual lines of interest.",
         "-V -- don't include variations in the output. Ordinarily these are retained.",
         "-wwidth -- set width as an approximate line width for output.",
-        "-W[cm|epd|halg|lalg|elalg|xlalg|xolalg|san] -- specify the output format to use.",
+        "-W[bin|cm|epd|halg|lalg|elalg|xlalg|xolalg|san] -- specify the output format to use.",
         "      Default is SAN.",
         "      -W means use the input format.",
         "      -Wcm is (a possibly obsolete) ChessMaster format.",
@@ -183,11 +210,12 @@ usage_and_exit(void)
         "      -Wxlalg is enhanced long algebraic with x for captures and - for non capture moves.",
         "      -Wxolalg is -Wxlalg but with O-O and O-O-O for castling.",
         "      -Wuci is output compatible with the UCI protocol.",
+        "      -Wbin is a compact binary form for reading back in later.",
         "-xvariations -- the file variations contains the lines resulting in",
         "                positions of interest.",
         "-yfile -- file contains a material balance of interest.",
         "-zfile -- file contains a material balance of interest.",
-        "-Z -- use the file virtual.tmp as an external hash table for duplicates.",
+        "-Z -- obsolete; ignored (see --dupindex).",
         "      Use when MallocOrDie messages occur with big datasets.",
 
         "",
@@ -200,15 +228,30 @@ usage_and_exit(void)
         "--addmatchtag - output a MaterialMatch tag with -z",
         "--allownullmoves - allow NULL moves in the main line",
         "--append - see -a",
+        "--asyncoutput - write the output files from a separate thread",
+        "--batch file - run each of the jobs in file over a single pass of the input",
 	"--btm - match position only if Black is to move (see -t)",
         "--checkfile - see -c",
         "--checkmate - see -M",
+        "--checkpoint file - record the progress of the run in file, for --resume",
+        "--checkpointevery N - take a checkpoint every N games (default 10000)",
         "--commentlines - output each comment on a separate line",
+        "--compress gz|xz|zst - compress the output files of -# and -E",
         "--deletesamesetup - suppress games with the same initial position as one already processed",
         "--detag tag - don't include tag in the output",
         "--dropbefore - drop opening ply before a matching comment string",
         "--dropply - drop the given number of ply from the beginning of the game",
+        "--dupindex file - read and update a persistent index of games already seen, for duplicate detection",
         "--duplicates - see -d",
+        "--dupmerge file - merge the --dupscan shard files given as input into file",
+        "--dupresolve prefix - take the duplicates from the --dupmerge files prefix.0, prefix.1, ...",
+        "--dupscan prefix - write the hash values of games to prefix.0, prefix.1, ..., for --dupmerge",
+        "--dupshards N - the number of shard files of --dupscan and --dupresolve (default 16)",
+        "--ecoindex file - keep a compiled form of the -e ECO file in file, for faster startup",
+        "--engine command - evaluate the positions of --evaluation with the UCI engine run by command",
+        "--enginedepth N - the depth to which --engine searches each position (default 12)",
+        "--engines N - the number of --engine processes to run at once (default 1)",
+        "--evalcache file - keep the evaluations of --engine in file, for later runs",
         "--evaluation - include a position evaluation after each move",
         "--fencomments - include a FEN string after each move",
         "--fenpattern pattern - match games reaching a position matching the given FEN pattern",
@@ -218,9 +261,11 @@ usage_and_exit(void)
         "--fixresulttags - correct Result tags that conflict with the game outcome or terminating result.",
         "--fixtagstrings - attempt to correct tag strings that are not properly terminated.",
         "--fuzzydepth plies - positional duplicates match",
+        "--gameindex - build, or use to pass over the games before --firstgame, an index of each input file",
         "--gamelimit N - only process up to and including game number N.",
         "--hashcomments - include a hashcode string after each move",
         "--help - see -h",
+        "--job name - start a job of a --batch file",
         "--json - output the game in JSON format",
         "--keepbroken - retain games with errors",
         "--lichesscommentfix - move comments at the start of a variation to after the first move of the variation.",
@@ -247,14 +292,19 @@ usage_and_exit(void)
         "--notags - don't output any tags.",
         "--nounique - see -U",
         "--novars - see -V",
+        "--offsetchunks - with --threads, divide large files into chunks by offset.",
         "--onlysetuptags - only match games with a SetUp tag.",
         "--output - see -o",
         "--plycount - include a PlyCount tag.",
         "--plylimit - limit the number of plies output.",
+        "--posindex file - build, or use for -x, an index of the positions in the input files",
+        "--profile text|json - report the time spent in each stage of processing.",
         "--quiescent N - position quiescence length (default 0)",
         "--quiet - No status processing output (see, also, -s).",
         "--repetition - only output games that include 3-fold repetition.",
         "--repetition5 - only output games that include 5-fold repetition.",
+        "--resume - carry on from the --checkpoint file of an interrupted run;",
+        "      this option must follow --checkpoint and precede the -o, -a, -d and -n options.",
         "--selectonly range[,range ...] - only output the selected matched game(s)",
         "--seven - see -7",
         "--seventyfive - only output games that include seventy-five moves with no capture or pawn move.",
@@ -262,8 +312,13 @@ usage_and_exit(void)
         "--splitvariants [depth] - output each variation (to the given depth) as a separate game.",
         "--stalemate - only output games that end in stalemate.",
         "--startply N - only start matching after N ply (N >= 1).",
+        "--stats key - tally the results of the games matched by key: a tag name, Player,",
+        "      or a number of plies for the positions reached within them",
+        "--statsfile file - write the tallies of --stats to file rather than standard output",
+        "--statsformat csv|json - the format of the tallies of --stats (default csv)",
         "--stopafter N - stop after matching N games (N > 0)",
         "--tagsubstr - match in any part of a tag (see -T and -t).",
+        "--threads N - match games using N worker processes (N > 0).",
         "--totalplycount - include a tag with the total number of plies in a game.",
         "--underpromotion - match only games that contain an underpromotion.",
         "--version - print the current version number and exit.",
@@ -287,7 +342,154 @@ usage_and_exit(void)
     for (; *data != NULL; data++) {
         fprintf(GlobalState.logfile, "%s\n", *data);
     }
-    exit(1);
+    argument_error();
+}
+
+/* Act on line, one of the lines of the argument file infile.
+ * linetype is the type of argument to which lines with no leading
+ * colon character apply, and is updated by line.
+ */
+static void
+process_args_line(const char *infile, char *line, ArgType *linetype)
+{
+    ArgType nexttype = classify_arg(line);
+    if (nexttype == NO_ARGUMENT_MATCH) {
+        if (*line == argument_prefix[0]) {
+            /* Treat the line as a source file name. */
+            add_filename_to_source_list(&line[1], NORMALFILE);
+        }
+        else if (*linetype != NO_ARGUMENT_MATCH) {
+            /* Handle the line. */
+            switch (*linetype) {
+                case MOVES_ARGUMENT:
+                    add_textual_variation_from_line(line);
+                    break;
+                case POSITIONS_ARGUMENT:
+                    add_positional_variation_from_line(line);
+                    break;
+                case TAGS_ARGUMENT:
+                    process_tag_line(infile, line);
+                    break;
+                case TAG_ROSTER_ARGUMENT:
+                    process_roster_line(line);
+                    break;
+                case ENDINGS_ARGUMENT:
+                case ENDINGS_COLOURED_ARGUMENT:
+                    process_material_description(line, *linetype == ENDINGS_ARGUMENT, FALSE);
+                    (void) free((void *) line);
+                    break;
+                default:
+                    fprintf(GlobalState.logfile,
+                            "Internal error: unknown linetype %d in read_args_file\n",
+                            *linetype);
+                    (void) free((void *) line);
+                    exit(-1);
+            }
+        }
+        else {
+            /* It should have been a line applying to the
+             * current linetype.
+             */
+            fprintf(GlobalState.logfile,
+                    "Missing argument type for line %s in the argument file.\n",
+                    line);
+            argument_error();
+        }
+    }
+    else {
+        switch (nexttype) {
+                /* Arguments with a possible additional
+                 * argument value.
+                 * All of these apply only to the current
+                 * line in the argument file.
+                 */
+            case WRITE_TO_OUTPUT_FILE_ARGUMENT:
+            case APPEND_TO_OUTPUT_FILE_ARGUMENT:
+            case WRITE_TO_LOG_FILE_ARGUMENT:
+            case APPEND_TO_LOG_FILE_ARGUMENT:
+            case DUPLICATES_FILE_ARGUMENT:
+            case USE_ECO_FILE_ARGUMENT:
+            case CHECK_FILE_ARGUMENT:
+            case FILE_OF_FILES_ARGUMENT:
+            case MOVE_BOUNDS_ARGUMENT:
+            case PLY_BOUNDS_ARGUMENT:
+            case GAMES_PER_FILE_ARGUMENT:
+            case ECO_OUTPUT_LEVEL_ARGUMENT:
+            case FILE_OF_ARGUMENTS_ARGUMENT:
+            case NON_MATCHING_GAMES_ARGUMENT:
+            case TAG_EXTRACTION_ARGUMENT:
+            case LINE_WIDTH_ARGUMENT:
+            case OUTPUT_FORMAT_ARGUMENT:
+                process_argument(line[argument_prefix_len],
+                        &line[argument_prefix_len + 1]);
+                *linetype = NO_ARGUMENT_MATCH;
+                break;
+            case LONG_FORM_ARGUMENT:
+            {
+                char *arg = &line[argument_prefix_len + 1];
+                char *space = strchr(arg, ' ');
+                if (space != NULL) {
+                    /* We need to drop an associated value from arg. */
+                    int arglen = space - arg;
+                    char *just_arg = (char *) malloc_or_die(arglen + 1);
+                    strncpy(just_arg, arg, arglen);
+                    just_arg[arglen] = '\0';
+                    process_long_form_argument(just_arg,
+                            skip_leading_spaces(space));
+			    (void) free((void *) just_arg);
+                }
+                else {
+                    process_long_form_argument(arg, "");
+                    *linetype = NO_ARGUMENT_MATCH;
+                }
+            }
+                break;
+
+                /* Arguments with no additional
+                 * argument value.
+                 * All of these apply only to the current
+                 * line in the argument file.
+                 */
+            case SEVEN_TAG_ROSTER_ARGUMENT:
+            case HELP_ARGUMENT:
+            case ALTERNATIVE_HELP_ARGUMENT:
+            case DONT_KEEP_COMMENTS_ARGUMENT:
+            case DONT_KEEP_DUPLICATES_ARGUMENT:
+            case DONT_MATCH_PERMUTATIONS_ARGUMENT:
+            case DONT_KEEP_NAGS_ARGUMENT:
+            case CHECK_ONLY_ARGUMENT:
+            case KEEP_SILENT_ARGUMENT:
+            case USE_SOUNDEX_ARGUMENT:
+            case MATCH_CHECKMATE_ARGUMENT:
+            case SUPPRESS_ORIGINALS_ARGUMENT:
+            case DONT_KEEP_VARIATIONS_ARGUMENT:
+            case USE_VIRTUAL_HASH_TABLE_ARGUMENT:
+                process_argument(line[argument_prefix_len], "");
+                *linetype = NO_ARGUMENT_MATCH;
+                break;
+
+                /* Arguments whose values persist beyond
+                 * the current line.
+                 */
+            case ENDINGS_ARGUMENT:
+            case ENDINGS_COLOURED_ARGUMENT:
+            case HASHCODE_MATCH_ARGUMENT:
+            case MOVES_ARGUMENT:
+            case OUTPUT_FEN_STRING_ARGUMENT:
+            case POSITIONS_ARGUMENT:
+            case TAG_ROSTER_ARGUMENT:
+                process_argument(line[argument_prefix_len],
+                        &line[argument_prefix_len + 1]);
+            case TAGS_ARGUMENT:
+                /* Apply this type to subsequent lines. */
+                *linetype = nexttype;
+                break;
+            default:
+                *linetype = nexttype;
+                break;
+        }
+        (void) free((void *) line);
+    }
 }
 
 static void
@@ -298,156 +500,141 @@ read_args_file(const char *infile)
 
     if (fp == NULL) {
         fprintf(GlobalState.logfile, "Cannot open %s for reading.\n", infile);
-        exit(1);
+        argument_error();
     }
     else {
         ArgType linetype = NO_ARGUMENT_MATCH;
-        ArgType nexttype;
         while ((line = read_line(fp)) != NULL) {
             if (blank_line(line)) {
                 (void) free((void *) line);
                 continue;
             }
-            nexttype = classify_arg(line);
-            if (nexttype == NO_ARGUMENT_MATCH) {
-                if (*line == argument_prefix[0]) {
-                    /* Treat the line as a source file name. */
-                    add_filename_to_source_list(&line[1], NORMALFILE);
-                }
-                else if (linetype != NO_ARGUMENT_MATCH) {
-                    /* Handle the line. */
-                    switch (linetype) {
-                        case MOVES_ARGUMENT:
-                            add_textual_variation_from_line(line);
-                            break;
-                        case POSITIONS_ARGUMENT:
-                            add_positional_variation_from_line(line);
-                            break;
-                        case TAGS_ARGUMENT:
-                            process_tag_line(infile, line);
-                            break;
-                        case TAG_ROSTER_ARGUMENT:
-                            process_roster_line(line);
-                            break;
-                        case ENDINGS_ARGUMENT:
-                        case ENDINGS_COLOURED_ARGUMENT:
-                            process_material_description(line, linetype == ENDINGS_ARGUMENT, FALSE);
-                            (void) free((void *) line);
-                            break;
-                        default:
-                            fprintf(GlobalState.logfile,
-                                    "Internal error: unknown linetype %d in read_args_file\n",
-                                    linetype);
-                            (void) free((void *) line);
-                            exit(-1);
-                    }
-                }
-                else {
-                    /* It should have been a line applying to the
-                     * current linetype.
-                     */
+            process_args_line(infile, line, &linetype);
+        }
+        (void) fclose(fp);
+    }
+}
+
+/* The jobs of a --batch file.
+ * Each starts with a job line:
+ *         :--job name
+ * and has the argument lines that follow it, up to the next job line.
+ */
+typedef struct {
+    char *name;
+    char **lines;
+    unsigned num_lines;
+} BatchJob;
+
+static BatchJob *batch_jobs = NULL;
+static unsigned num_batch_jobs = 0;
+
+/* If line is a job line of a --batch file, return the name of the job. */
+static const char *
+job_line_name(const char *line)
+{
+    static const char job_argument[] = "job";
+    const size_t job_argument_len = sizeof (job_argument) - 1;
+
+    if (classify_arg(line) == LONG_FORM_ARGUMENT) {
+        const char *arg = &line[argument_prefix_len + 1];
+
+        if (strncmp(arg, job_argument, job_argument_len) == 0 &&
+                (arg[job_argument_len] == ' ' || arg[job_argument_len] == '\0')) {
+            return skip_leading_spaces(&arg[job_argument_len]);
+        }
+    }
+    return NULL;
+}
+
+/* Read the --batch file, batch_file.
+ * Any argument lines before the first job line apply to every job,
+ * and are acted on straight away. The lines of each job are kept
+ * for process_batch_job_arguments.
+ */
+static void
+read_batch_file(const char *batch_file)
+{
+    char *line;
+    FILE *fp = fopen(batch_file, "r");
+
+    if (fp == NULL) {
+        fprintf(GlobalState.logfile, "Cannot open %s for reading.\n", batch_file);
+        argument_error();
+    }
+    else {
+        ArgType linetype = NO_ARGUMENT_MATCH;
+        while ((line = read_line(fp)) != NULL) {
+            const char *name;
+
+            if (blank_line(line)) {
+                (void) free((void *) line);
+                continue;
+            }
+            name = job_line_name(line);
+            if (name != NULL) {
+                BatchJob *job;
+
+                if (*name == '\0') {
                     fprintf(GlobalState.logfile,
-                            "Missing argument type for line %s in the argument file.\n",
-                            line);
-                    exit(1);
+                            "Missing job name for line %s in the batch file %s.\n",
+                            line, batch_file);
+                    argument_error();
                 }
+                batch_jobs = (BatchJob *) realloc_or_die((void *) batch_jobs,
+                        (num_batch_jobs + 1) * sizeof (*batch_jobs));
+                job = &batch_jobs[num_batch_jobs];
+                job->name = copy_string(name);
+                job->lines = NULL;
+                job->num_lines = 0;
+                num_batch_jobs++;
+                (void) free((void *) line);
+            }
+            else if (num_batch_jobs == 0) {
+                process_args_line(batch_file, line, &linetype);
             }
             else {
-                switch (nexttype) {
-                        /* Arguments with a possible additional
-                         * argument value.
-                         * All of these apply only to the current
-                         * line in the argument file.
-                         */
-                    case WRITE_TO_OUTPUT_FILE_ARGUMENT:
-                    case APPEND_TO_OUTPUT_FILE_ARGUMENT:
-                    case WRITE_TO_LOG_FILE_ARGUMENT:
-                    case APPEND_TO_LOG_FILE_ARGUMENT:
-                    case DUPLICATES_FILE_ARGUMENT:
-                    case USE_ECO_FILE_ARGUMENT:
-                    case CHECK_FILE_ARGUMENT:
-                    case FILE_OF_FILES_ARGUMENT:
-                    case MOVE_BOUNDS_ARGUMENT:
-                    case PLY_BOUNDS_ARGUMENT:
-                    case GAMES_PER_FILE_ARGUMENT:
-                    case ECO_OUTPUT_LEVEL_ARGUMENT:
-                    case FILE_OF_ARGUMENTS_ARGUMENT:
-                    case NON_MATCHING_GAMES_ARGUMENT:
-                    case TAG_EXTRACTION_ARGUMENT:
-                    case LINE_WIDTH_ARGUMENT:
-                    case OUTPUT_FORMAT_ARGUMENT:
-                        process_argument(line[argument_prefix_len],
-                                &line[argument_prefix_len + 1]);
-                        linetype = NO_ARGUMENT_MATCH;
-                        break;
-                    case LONG_FORM_ARGUMENT:
-                    {
-                        char *arg = &line[argument_prefix_len + 1];
-                        char *space = strchr(arg, ' ');
-                        if (space != NULL) {
-                            /* We need to drop an associated value from arg. */
-                            int arglen = space - arg;
-                            char *just_arg = (char *) malloc_or_die(arglen + 1);
-                            strncpy(just_arg, arg, arglen);
-                            just_arg[arglen] = '\0';
-                            process_long_form_argument(just_arg,
-                                    skip_leading_spaces(space));
-			    (void) free((void *) just_arg);
-                        }
-                        else {
-                            process_long_form_argument(arg, "");
-                            linetype = NO_ARGUMENT_MATCH;
-                        }
-                    }
-                        break;
-
-                        /* Arguments with no additional
-                         * argument value.
-                         * All of these apply only to the current
-                         * line in the argument file.
-                         */
-                    case SEVEN_TAG_ROSTER_ARGUMENT:
-                    case HELP_ARGUMENT:
-                    case ALTERNATIVE_HELP_ARGUMENT:
-                    case DONT_KEEP_COMMENTS_ARGUMENT:
-                    case DONT_KEEP_DUPLICATES_ARGUMENT:
-                    case DONT_MATCH_PERMUTATIONS_ARGUMENT:
-                    case DONT_KEEP_NAGS_ARGUMENT:
-                    case CHECK_ONLY_ARGUMENT:
-                    case KEEP_SILENT_ARGUMENT:
-                    case USE_SOUNDEX_ARGUMENT:
-                    case MATCH_CHECKMATE_ARGUMENT:
-                    case SUPPRESS_ORIGINALS_ARGUMENT:
-                    case DONT_KEEP_VARIATIONS_ARGUMENT:
-                    case USE_VIRTUAL_HASH_TABLE_ARGUMENT:
-                        process_argument(line[argument_prefix_len], "");
-                        linetype = NO_ARGUMENT_MATCH;
-                        break;
-
-                        /* Arguments whose values persist beyond
-                         * the current line.
-                         */
-                    case ENDINGS_ARGUMENT:
-                    case ENDINGS_COLOURED_ARGUMENT:
-                    case HASHCODE_MATCH_ARGUMENT:
-                    case MOVES_ARGUMENT:
-                    case OUTPUT_FEN_STRING_ARGUMENT:
-                    case POSITIONS_ARGUMENT:
-                    case TAG_ROSTER_ARGUMENT:
-                        process_argument(line[argument_prefix_len],
-                                &line[argument_prefix_len + 1]);
-                    case TAGS_ARGUMENT:
-                        /* Apply this type to subsequent lines. */
-                        linetype = nexttype;
-                        break;
-                    default:
-                        linetype = nexttype;
-                        break;
-                }
-                (void) free((void *) line);
+                BatchJob *job = &batch_jobs[num_batch_jobs - 1];
+
+                job->lines = (char **) realloc_or_die((void *) job->lines,
+                        (job->num_lines + 1) * sizeof (*job->lines));
+                job->lines[job->num_lines] = line;
+                job->num_lines++;
             }
         }
         (void) fclose(fp);
+        if (num_batch_jobs == 0) {
+            fprintf(GlobalState.logfile, "There are no jobs in the batch file %s.\n",
+                    batch_file);
+            argument_error();
+        }
+    }
+}
+
+/* Return the number of jobs in the --batch file. */
+unsigned
+batch_job_count(void)
+{
+    return num_batch_jobs;
+}
+
+/* Return the name of the given job of the --batch file. */
+const char *
+batch_job_name(unsigned job)
+{
+    return batch_jobs[job].name;
+}
+
+/* Act on the argument lines of the given job of the --batch file. */
+void
+process_batch_job_arguments(unsigned job)
+{
+    ArgType linetype = NO_ARGUMENT_MATCH;
+    unsigned i;
+
+    for (i = 0; i < batch_jobs[job].num_lines; i++) {
+        process_args_line(GlobalState.batch_file,
+                copy_string(batch_jobs[job].lines[i]), &linetype);
     }
 }
 
@@ -515,7 +702,7 @@ classify_arg(const char *line)
                 fprintf(GlobalState.logfile,
                         "Unrecognized argument: %s in the argument file.\n",
                         line);
-                exit(1);
+                argument_error();
                 return NO_ARGUMENT_MATCH;
         }
     }
@@ -558,21 +745,22 @@ process_argument(char arg_letter, const char *associated_value)
                 fprintf(GlobalState.logfile,
                         "-%c: File %s has already been selected for output.\n",
                         arg_letter, GlobalState.output_filename);
-                exit(1);
+                argument_error();
             }
             else if (*filename == '\0') {
                 fprintf(GlobalState.logfile, "Usage: -%cfilename.\n", arg_letter);
-                exit(1);
+                argument_error();
             }
             else {
                 if (GlobalState.outputfile != NULL) {
-                    (void) fclose(GlobalState.outputfile);
+                    close_output_file(GlobalState.outputfile);
                 }
                 if (arg_letter == WRITE_TO_OUTPUT_FILE_ARGUMENT) {
-                    GlobalState.outputfile = must_open_file(filename, "w");
+                    GlobalState.outputfile = must_open_output_file(filename,
+                            GlobalState.resume ? "a" : "w");
                 }
                 else {
-                    GlobalState.outputfile = must_open_file(filename, "a");
+                    GlobalState.outputfile = must_open_output_file(filename, "a");
                 }
                 GlobalState.output_filename = filename;
             }
@@ -597,16 +785,17 @@ process_argument(char arg_letter, const char *associated_value)
         case DUPLICATES_FILE_ARGUMENT:
             if (*filename == '\0') {
                 fprintf(GlobalState.logfile, "Usage: -%cfilename.\n", arg_letter);
-                exit(1);
+                argument_error();
             }
             else if (GlobalState.suppress_duplicates) {
                 fprintf(GlobalState.logfile,
                         "-%c clashes with the -%c flag.\n", arg_letter,
                         DONT_KEEP_DUPLICATES_ARGUMENT);
-                exit(1);
+                argument_error();
             }
             else {
-                GlobalState.duplicate_file = must_open_file(filename, "w");
+                GlobalState.duplicate_file = must_open_output_file(filename,
+                        GlobalState.resume ? "a" : "w");
             }
             break;
         case USE_ECO_FILE_ARGUMENT:
@@ -631,25 +820,25 @@ process_argument(char arg_letter, const char *associated_value)
                         "-%c: File %s has already been selected for output.\n",
                         arg_letter,
                         GlobalState.output_filename);
-                exit(1);
+                argument_error();
             }
             else if (GlobalState.games_per_file > 0) {
                 fprintf(GlobalState.logfile,
                         "-%c conflicts with -#.\n",
                         arg_letter);
-                exit(1);
+                argument_error();
             }
             else if (sscanf(associated_value, "%u", &level) != 1) {
                 fprintf(GlobalState.logfile,
                         "-%c requires a number attached, e.g., -%c1.\n",
                         arg_letter, arg_letter);
-                exit(1);
+                argument_error();
             }
             else if ((level < MIN_ECO_LEVEL) || (level > MAX_ECO_LEVEL)) {
                 fprintf(GlobalState.logfile,
                         "-%c level should be between %u and %u.\n",
                         MIN_ECO_LEVEL, MAX_ECO_LEVEL, arg_letter);
-                exit(1);
+                argument_error();
             }
             else {
                 GlobalState.ECO_level = level;
@@ -728,7 +917,7 @@ process_argument(char arg_letter, const char *associated_value)
                 Ok = FALSE;
             }
             if (!Ok) {
-                exit(1);
+                argument_error();
             }
         }
             break;
@@ -736,14 +925,14 @@ process_argument(char arg_letter, const char *associated_value)
             if (GlobalState.ECO_level > 0) {
                 fprintf(GlobalState.logfile,
                         "-%c conflicts with -E.\n", arg_letter);
-                exit(1);
+                argument_error();
             }
             else if (GlobalState.output_filename != NULL) {
                 fprintf(GlobalState.logfile,
                         "-%c: File %s has already been selected for output.\n",
                         arg_letter,
                         GlobalState.output_filename);
-                exit(1);
+                argument_error();
             }
             else {
                 if(strchr(associated_value, ',') != NULL) {
@@ -756,7 +945,7 @@ process_argument(char arg_letter, const char *associated_value)
                         fprintf(GlobalState.logfile,
                                 "-%c should be followed by either one or two unsigned integers.\n",
                                 arg_letter);
-                        exit(1);
+                        argument_error();
                     }
                 }
                 else if (sscanf(associated_value, "%u",
@@ -764,7 +953,7 @@ process_argument(char arg_letter, const char *associated_value)
                     fprintf(GlobalState.logfile,
                             "-%c should be followed by an unsigned integer.\n",
                             arg_letter);
-                    exit(1);
+                    argument_error();
                 }
                 else {
                     /* Value set. */
@@ -784,13 +973,14 @@ process_argument(char arg_letter, const char *associated_value)
         case NON_MATCHING_GAMES_ARGUMENT:
             if (*filename != '\0') {
                 if (GlobalState.non_matching_file != NULL) {
-                    (void) fclose(GlobalState.non_matching_file);
+                    close_output_file(GlobalState.non_matching_file);
                 }
-                GlobalState.non_matching_file = must_open_file(filename, "w");
+                GlobalState.non_matching_file = must_open_output_file(filename,
+                        GlobalState.resume ? "a" : "w");
             }
             else {
                 fprintf(GlobalState.logfile, "Usage: -%cfilename.\n", arg_letter);
-                exit(1);
+                argument_error();
             }
             break;
         case TAG_EXTRACTION_ARGUMENT:
@@ -808,7 +998,7 @@ process_argument(char arg_letter, const char *associated_value)
                 fprintf(GlobalState.logfile,
                         "-%c should be followed by an unsigned integer.\n",
                         arg_letter);
-                exit(1);
+                argument_error();
             }
         }
             break;
@@ -848,7 +1038,7 @@ process_argument(char arg_letter, const char *associated_value)
                 fprintf(GlobalState.logfile,
                         "-%c clashes with another roster-related argument.\n",
                         SEVEN_TAG_ROSTER_ARGUMENT);
-                exit(1);
+                argument_error();
             }
             break;
         case DONT_KEEP_COMMENTS_ARGUMENT:
@@ -864,7 +1054,7 @@ process_argument(char arg_letter, const char *associated_value)
                         "-%c clashes with -%c flag.\n",
                         DONT_KEEP_DUPLICATES_ARGUMENT,
                         DUPLICATES_FILE_ARGUMENT);
-                exit(1);
+                argument_error();
             }
             break;
         case DONT_MATCH_PERMUTATIONS_ARGUMENT:
@@ -924,11 +1114,13 @@ process_argument(char arg_letter, const char *associated_value)
             else {
                 fprintf(GlobalState.logfile,
                         "-%c clashes with the --splitvariants flag.\n", arg_letter);
-                exit(1);
+                argument_error();
             }
             break;
         case USE_VIRTUAL_HASH_TABLE_ARGUMENT:
-            GlobalState.use_virtual_hash_table = TRUE;
+            /* Obsolete: the duplicate table is compact enough to be
+             * held in memory, and --dupindex keeps it on disk.
+             */
             break;
 
         case TAGS_ARGUMENT:
@@ -963,7 +1155,7 @@ process_argument(char arg_letter, const char *associated_value)
             if (*filename != '\0') {
                 if (!build_endings(filename,
                                    arg_letter == ENDINGS_ARGUMENT)) {
-                    exit(1);
+                    argument_error();
                 }
             }
             break;
@@ -975,7 +1167,7 @@ process_argument(char arg_letter, const char *associated_value)
                 fprintf(GlobalState.logfile, 
                         "-%c must be followed by a hexadecimal hash value rather than %s.\n", 
                         arg_letter, associated_value);
-                exit(1);
+                argument_error();
             }
             break;
         default:
@@ -1017,6 +1209,19 @@ process_long_form_argument(const char *argument, const char *associated_value)
         process_argument(APPEND_TO_OUTPUT_FILE_ARGUMENT, associated_value);
         return 2;
     }
+    else if (stringcompare(argument, "asyncoutput") == 0) {
+        GlobalState.async_output = TRUE;
+        return 1;
+    }
+    else if (stringcompare(argument, "batch") == 0) {
+        if (GlobalState.batch_file != NULL) {
+            fprintf(GlobalState.logfile, "Only one --batch file may be given.\n");
+            argument_error();
+        }
+        GlobalState.batch_file = copy_string(associated_value);
+        read_batch_file(GlobalState.batch_file);
+        return 2;
+    }
     else if(stringcompare(argument, "btm") == 0) {
         if(GlobalState.whose_move == EITHER_TO_MOVE) {
 	    GlobalState.whose_move = BLACK_TO_MOVE;
@@ -1034,10 +1239,55 @@ process_long_form_argument(const char *argument, const char *associated_value)
         process_argument(MATCH_CHECKMATE_ARGUMENT, "");
         return 1;
     }
+    else if (stringcompare(argument, "checkpoint") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.checkpoint_file = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "checkpointevery") == 0) {
+        int interval = 0;
+
+        if (associated_value != NULL &&
+                sscanf(associated_value, "%d", &interval) == 1 && interval > 0) {
+            GlobalState.checkpoint_interval = (unsigned long) interval;
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a number greater than zero to follow it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
     else if (stringcompare(argument, "commentlines") == 0) {
         GlobalState.separate_comment_lines = TRUE;
         return 1;
     }
+    else if (stringcompare(argument, "compress") == 0) {
+        Compression compression = associated_value != NULL ?
+                named_compression(associated_value) : NO_COMPRESSION;
+
+        if (compression == NO_COMPRESSION) {
+            fprintf(GlobalState.logfile,
+                    "--%s requires gz, xz or zst following it.\n", argument);
+            argument_error();
+        }
+        else if (!compression_supported(compression)) {
+            fprintf(GlobalState.logfile,
+                    "--%s %s is not supported by this build of pgn-extract.\n",
+                    argument, associated_value);
+            argument_error();
+        }
+        else {
+            GlobalState.output_compression = compression;
+        }
+        return 2;
+    }
     else if (stringcompare(argument, "deletesamesetup") == 0) {
         GlobalState.delete_same_setup = TRUE;
         return 1;
@@ -1050,7 +1300,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a tag name following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1062,7 +1312,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a string following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1076,7 +1326,18 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "dupindex") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.duplicate_index_file = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
         }
         return 2;
     }
@@ -1084,6 +1345,111 @@ process_long_form_argument(const char *argument, const char *associated_value)
         process_argument(DUPLICATES_FILE_ARGUMENT, associated_value);
         return 2;
     }
+    else if (stringcompare(argument, "dupmerge") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.duplicate_merge_file = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "dupresolve") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.duplicate_resolve_prefix = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename prefix following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "dupscan") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.duplicate_scan_prefix = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename prefix following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "dupshards") == 0) {
+        int shards = 0;
+
+        if (associated_value != NULL &&
+                sscanf(associated_value, "%d", &shards) == 1 && shards > 0) {
+            GlobalState.duplicate_shards = (unsigned) shards;
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a number greater than zero to follow it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "ecoindex") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.eco_index_file = copy_string(associated_value);
+            /* This implies -e with the ECO file already set up. */
+            GlobalState.add_ECO = TRUE;
+            initEcoTable();
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "engine") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.engine_command = copy_string(associated_value);
+            /* This implies --evaluation. */
+            GlobalState.output_evaluation = TRUE;
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires an engine command following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "enginedepth") == 0 ||
+            stringcompare(argument, "engines") == 0) {
+        int number = 0;
+
+        if (associated_value != NULL &&
+                sscanf(associated_value, "%d", &number) == 1 && number > 0) {
+            if (stringcompare(argument, "engines") == 0) {
+                GlobalState.num_engines = (unsigned) number;
+            }
+            else {
+                GlobalState.engine_depth = (unsigned) number;
+            }
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a number greater than zero to follow it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "evalcache") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.evaluation_cache_file = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
     else if (stringcompare(argument, "evaluation") == 0) {
         /* Output an evaluation is required with each move. */
         GlobalState.output_evaluation = TRUE;
@@ -1110,7 +1476,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a pattern following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1122,7 +1488,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a pattern following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1137,7 +1503,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile, "--%s conflicts with a previous setting of %u.\n",
                     argument, GlobalState.check_for_N_move_rule);
-            exit(1);
+            argument_error();
         }
     }
     else if (stringcompare(argument, "firstgame") == 0) {
@@ -1153,14 +1519,14 @@ process_long_form_argument(const char *argument, const char *associated_value)
                     fprintf(GlobalState.logfile,
                             "--%s %lu is incompatible with --gamelimit %lu.\n",
                             argument, number, GlobalState.game_limit);
-                    exit(1);
+                    argument_error();
                 }
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1183,7 +1549,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a positive number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1196,6 +1562,10 @@ process_long_form_argument(const char *argument, const char *associated_value)
         process_argument(HELP_ARGUMENT, "");
         return 1;
     }
+    else if (stringcompare(argument, "job") == 0) {
+        fprintf(GlobalState.logfile, "--job is only allowed in a --batch file.\n");
+        argument_error();
+    }
     else if (stringcompare(argument, "json") == 0) {
         GlobalState.json_format = TRUE;
         return 1;
@@ -1221,7 +1591,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a string following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1233,7 +1603,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a comment string following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1252,19 +1622,19 @@ process_long_form_argument(const char *argument, const char *associated_value)
                             argument,
                             limit,
                             GlobalState.depth_of_positional_search);
-                    exit(1);
+                    argument_error();
                 }
             }
             else {
                 fprintf(GlobalState.logfile,
                         "--%s requires a number greater than or equal to zero.\n", argument);
-                exit(1);
+                argument_error();
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1275,7 +1645,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a string of material following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1286,7 +1656,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a string of material following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1300,10 +1670,14 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
+    else if (stringcompare(argument, "gameindex") == 0) {
+        GlobalState.game_index = TRUE;
+        return 1;
+    }
     else if (stringcompare(argument, "gamelimit") == 0) {
         /* Extract the number. */
         unsigned long number = 0;
@@ -1316,13 +1690,13 @@ process_long_form_argument(const char *argument, const char *associated_value)
                 fprintf(GlobalState.logfile,
                         "--%s %lu is incompatible with --firstgame %lu.\n",
                         argument, number, GlobalState.first_game_number);
-                exit(1);
+                argument_error();
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1336,7 +1710,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1350,7 +1724,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1364,7 +1738,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1403,7 +1777,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
     else if (stringcompare(argument, "nosetuptags") == 0) {
         if (GlobalState.setup_status != SETUP_TAG_OK) {
             fprintf(GlobalState.logfile, "--%s conflicts with --onlysetuptagso\n", argument);
-            exit(1);
+            argument_error();
         }
         GlobalState.setup_status = NO_SETUP_TAG;
         return 1;
@@ -1420,7 +1794,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile,
                     "--notags clashes with another roster-related argument.\n");
-            exit(1);
+            argument_error();
         }
         return 1;
     }
@@ -1432,10 +1806,14 @@ process_long_form_argument(const char *argument, const char *associated_value)
         process_argument(DONT_KEEP_VARIATIONS_ARGUMENT, "");
         return 1;
     }
+    else if (stringcompare(argument, "offsetchunks") == 0) {
+        GlobalState.split_input_by_offset = TRUE;
+        return 1;
+    }
     else if (stringcompare(argument, "onlysetuptags") == 0) {
         if (GlobalState.setup_status != SETUP_TAG_OK) {
             fprintf(GlobalState.logfile, "--%s conflicts with --nosetuptags\n", argument);
-            exit(1);
+            argument_error();
         }
         GlobalState.setup_status = SETUP_TAG_ONLY;
         return 1;
@@ -1459,13 +1837,38 @@ process_long_form_argument(const char *argument, const char *associated_value)
             else {
                 fprintf(GlobalState.logfile,
                         "--%s requires a number greater than or equal to zero.\n", argument);
-                exit(1);
+                argument_error();
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "posindex") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.position_index_file = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "profile") == 0) {
+        if (associated_value != NULL && stringcompare(associated_value, "text") == 0) {
+            start_profile(PROFILE_TEXT);
+        }
+        else if (associated_value != NULL && stringcompare(associated_value, "json") == 0) {
+            start_profile(PROFILE_JSON);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires text or json following it.\n", argument);
+            argument_error();
         }
         return 2;
     }
@@ -1480,13 +1883,13 @@ process_long_form_argument(const char *argument, const char *associated_value)
             else {
                 fprintf(GlobalState.logfile,
                         "--%s requires a number greater than or equal to zero.\n", argument);
-                exit(1);
+                argument_error();
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number following it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1507,7 +1910,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile, "--%s conflicts with a previous setting.\n",
                     argument);
-            exit(1);
+            argument_error();
         }
     }
     else if (stringcompare(argument, "repetition5") == 0) {
@@ -1522,9 +1925,31 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile, "--%s clashes with a different setting.\n",
                     argument);
-            exit(1);
+            argument_error();
         }
     }
+    else if (stringcompare(argument, "resume") == 0) {
+        FILE *checkpoint;
+
+        if (GlobalState.checkpoint_file == NULL) {
+            fprintf(GlobalState.logfile, "--%s must follow --checkpoint.\n", argument);
+            argument_error();
+        }
+        else if (GlobalState.outputfile != stdout ||
+                GlobalState.duplicate_file != NULL ||
+                GlobalState.non_matching_file != NULL) {
+            fprintf(GlobalState.logfile,
+                    "--%s must precede the -o, -a, -d and -n options.\n", argument);
+            argument_error();
+        }
+        /* Without a checkpoint, the run starts from the beginning. */
+        checkpoint = fopen(GlobalState.checkpoint_file, "r");
+        if (checkpoint != NULL) {
+            (void) fclose(checkpoint);
+            GlobalState.resume = TRUE;
+        }
+        return 1;
+    }
     else if (stringcompare(argument, "selectonly") == 0) {
         /* Extract the selected match numbers from a list. */
         game_number *number_list = extract_game_number_list(associated_value);
@@ -1533,7 +1958,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
             GlobalState.next_game_number_to_output = number_list;
         }
         else {
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1552,7 +1977,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         else {
             fprintf(GlobalState.logfile, "--%s conflicts with a previous setting of %u.\n",
                     argument, GlobalState.check_for_N_move_rule);
-            exit(1);
+            argument_error();
         }
     }
     else if (stringcompare(argument, "skipmatching") == 0) {
@@ -1563,7 +1988,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
             GlobalState.next_game_number_to_skip = number_list;
         }
         else {
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1588,7 +2013,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
             fprintf(GlobalState.logfile,
                     "--%s clashes with the -%c flag.\n", argument,
                     DONT_KEEP_VARIATIONS_ARGUMENT);
-            exit(1);
+            argument_error();
             return 1;
         }
     }
@@ -1607,20 +2032,56 @@ process_long_form_argument(const char *argument, const char *associated_value)
                 else {
                     fprintf(GlobalState.logfile, 
                             "--%s must be greater than or equal to 1.\n", argument);
-                    exit(1);
+                    argument_error();
                 }
             }
             else {
                 fprintf(GlobalState.logfile,
                         "--%s requires a number greater than or equal to 1.\n", argument);
-                exit(1);
+                argument_error();
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number greater than or equal to 1.\n", argument);
-            exit(1);
+            argument_error();
+        }
+    }
+    else if (stringcompare(argument, "stats") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            set_statistics_key(associated_value);
         }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a tag name or a number of plies following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "statsfile") == 0) {
+        if (associated_value != NULL && *associated_value != '\0') {
+            GlobalState.statistics_file = copy_string(associated_value);
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a filename following it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
+    else if (stringcompare(argument, "statsformat") == 0) {
+        if (associated_value != NULL && stringcompare(associated_value, "csv") == 0) {
+            GlobalState.statistics_json = FALSE;
+        }
+        else if (associated_value != NULL && stringcompare(associated_value, "json") == 0) {
+            GlobalState.statistics_json = TRUE;
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires csv or json following it.\n", argument);
+            argument_error();
+        }
+        return 2;
     }
     else if (stringcompare(argument, "stopafter") == 0) {
         int limit = 0;
@@ -1633,13 +2094,13 @@ process_long_form_argument(const char *argument, const char *associated_value)
             else {
                 fprintf(GlobalState.logfile,
                         "--%s requires a number greater than zero.\n", argument);
-                exit(1);
+                argument_error();
             }
         }
         else {
             fprintf(GlobalState.logfile,
                     "--%s requires a number greater than zero to follow it.\n", argument);
-            exit(1);
+            argument_error();
         }
         return 2;
     }
@@ -1647,6 +2108,20 @@ process_long_form_argument(const char *argument, const char *associated_value)
         GlobalState.tag_match_anywhere = TRUE;
         return 1;
     }
+    else if (stringcompare(argument, "threads") == 0) {
+        int threads = 0;
+
+        if (associated_value != NULL &&
+                sscanf(associated_value, "%d", &threads) == 1 && threads > 0) {
+            GlobalState.num_threads = (unsigned) threads;
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--%s requires a number greater than zero to follow it.\n", argument);
+            argument_error();
+        }
+        return 2;
+    }
     else if (stringcompare(argument, "totalplycount") == 0) {
         GlobalState.output_total_plycount = TRUE;
         return 1;
@@ -1674,7 +2149,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
             fprintf(GlobalState.logfile,
                     "--%s clashes with -%c.\n",
                     argument, SEVEN_TAG_ROSTER_ARGUMENT);
-            exit(1);
+            argument_error();
         }
         GlobalState.only_output_wanted_tags = TRUE;
         return 1;
@@ -1683,7 +2158,7 @@ process_long_form_argument(const char *argument, const char *associated_value)
         fprintf(GlobalState.logfile,
                 "Unrecognised long-form argument: --%s\n",
                 argument);
-        exit(1);
+        argument_error();
         return 1;
     }
 }
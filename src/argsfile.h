@@ -67,8 +67,23 @@ typedef enum {
     NO_ARGUMENT_MATCH = '\0'        /* No argument match. */
 } ArgType;
 
+/* The function called for an error in the arguments, in place of exit. */
+typedef void (*ArgumentErrorHandler)(void);
+
+/* argument_error does not return, which the compiler is told
+ * where possible.
+ */
+#if defined(__GNUC__)
+void argument_error(void) __attribute__((noreturn));
+#else
+void argument_error(void);
+#endif
 void process_argument(char arg_letter,const char *associated_value);
+void set_argument_error_handler(ArgumentErrorHandler handler);
 int process_long_form_argument(const char *argument, const char *associated_value);
+unsigned batch_job_count(void);
+const char *batch_job_name(unsigned job);
+void process_batch_job_arguments(unsigned job);
 
 #endif	// ARGSFILE_H
 
@@ -0,0 +1,402 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+
+/* Support for --asyncoutput.
+ * Each output file is given a pair of buffers. Once the main thread
+ * has filled one of them, it is handed to a writer thread that writes
+ * it to the file while the other is filled. The main thread only waits
+ * if it fills the second buffer before the first has been written, so
+ * the time spent in writing overlaps that spent in processing games.
+ * A single writer thread serves every output file, writing the
+ * buffers in the order they were handed over.
+ * This relies on streams with user-defined write functions, as does
+ * compress.c, and on POSIX threads.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#define COOKIE_STREAMS 1
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+        defined(__OpenBSD__)
+#define FUNOPEN_STREAMS 1
+#endif
+#if COOKIE_STREAMS || FUNOPEN_STREAMS
+#define ASYNC_OUTPUT 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if ASYNC_OUTPUT
+#include <sys/types.h>
+#include <pthread.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "compress.h"
+#include "asyncout.h"
+
+#if ASYNC_OUTPUT
+typedef struct AsyncStream {
+    /* The stream written by the main thread. */
+    FILE *stream;
+    /* The file to which the buffers are written by the writer thread. */
+    FILE *fp;
+    char *name;
+    char *buffers[2];
+    size_t buffer_size;
+    /* The buffer being filled and how much of it has been. */
+    int filling;
+    size_t used;
+    /* The number of bytes written to stream, for ftell. */
+    long position;
+    /* The buffer handed to the writer thread, or NULL if
+     * it has been written.
+     */
+    const char *handed_over;
+    size_t handed_over_length;
+    /* Whether a buffer could not be written. */
+    Boolean failed;
+    /* The next stream in the queue of the writer thread. */
+    struct AsyncStream *next_job;
+    /* The next in the list of open streams. */
+    struct AsyncStream *next;
+} AsyncStream;
+
+/* The lock on the queue of buffers to be written and on the
+ * handed_over and failed fields of every stream.
+ */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when a buffer is queued or the writer should stop. */
+static pthread_cond_t buffer_queued = PTHREAD_COND_INITIALIZER;
+/* Signalled when a buffer has been written. */
+static pthread_cond_t buffer_written = PTHREAD_COND_INITIALIZER;
+static AsyncStream *first_job = NULL, *last_job = NULL;
+static Boolean stop_writing = FALSE;
+
+static pthread_t writer;
+/* Whether the writer has been started by start_async_output. */
+static Boolean writer_started = FALSE;
+/* The open streams, which are only used by the main thread. */
+static AsyncStream *open_async_streams = NULL;
+
+/* The writer thread: write each buffer handed over until told to stop. */
+static void *
+write_buffers(void *unused)
+{
+    (void) unused;
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        AsyncStream *job;
+        Boolean ok;
+
+        while (first_job == NULL && !stop_writing) {
+            pthread_cond_wait(&buffer_queued, &queue_lock);
+        }
+        if (first_job == NULL) {
+            break;
+        }
+        job = first_job;
+        first_job = job->next_job;
+        if (first_job == NULL) {
+            last_job = NULL;
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        ok = fwrite(job->handed_over, 1, job->handed_over_length, job->fp) ==
+                    job->handed_over_length &&
+                fflush(job->fp) == 0;
+
+        pthread_mutex_lock(&queue_lock);
+        if (!ok) {
+            job->failed = TRUE;
+        }
+        job->handed_over = NULL;
+        pthread_cond_broadcast(&buffer_written);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+/* Wait until the buffer last handed over by stream has been written.
+ * The queue must be locked.
+ */
+static void
+wait_for_writer(AsyncStream *stream)
+{
+    while (stream->handed_over != NULL) {
+        pthread_cond_wait(&buffer_written, &queue_lock);
+    }
+}
+
+/* Hand the buffer being filled to the writer thread, once the previous
+ * one has been written, and start filling that one.
+ * Return FALSE if an earlier buffer could not be written.
+ */
+static Boolean
+hand_over_buffer(AsyncStream *stream)
+{
+    Boolean ok;
+
+    pthread_mutex_lock(&queue_lock);
+    wait_for_writer(stream);
+    ok = !stream->failed;
+    if (stream->used > 0) {
+        stream->handed_over = stream->buffers[stream->filling];
+        stream->handed_over_length = stream->used;
+        stream->next_job = NULL;
+        if (last_job == NULL) {
+            first_job = stream;
+        }
+        else {
+            last_job->next_job = stream;
+        }
+        last_job = stream;
+        pthread_cond_signal(&buffer_queued);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    stream->filling = 1 - stream->filling;
+    stream->used = 0;
+    return ok;
+}
+
+/* Copy the size bytes of data to the buffers of the stream. */
+static ssize_t
+write_async(void *cookie, const char *data, size_t size)
+{
+    AsyncStream *stream = (AsyncStream *) cookie;
+    size_t remaining = size;
+
+    while (remaining > 0) {
+        size_t space = stream->buffer_size - stream->used;
+        size_t amount = remaining < space ? remaining : space;
+
+        memcpy(stream->buffers[stream->filling] + stream->used, data, amount);
+        stream->used += amount;
+        data += amount;
+        remaining -= amount;
+        if (stream->used == stream->buffer_size && !hand_over_buffer(stream)) {
+            return -1;
+        }
+    }
+    stream->position += (long) size;
+    return (ssize_t) size;
+}
+
+/* Write what is left in the buffers of a stream and close its file. */
+static int
+close_async(void *cookie)
+{
+    AsyncStream *stream = (AsyncStream *) cookie;
+    AsyncStream **link = &open_async_streams;
+    Boolean ok = hand_over_buffer(stream);
+
+    pthread_mutex_lock(&queue_lock);
+    wait_for_writer(stream);
+    if (stream->failed) {
+        ok = FALSE;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    while (*link != NULL && *link != stream) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = stream->next;
+    }
+    if (fclose(stream->fp) != 0) {
+        ok = FALSE;
+    }
+    if (!ok) {
+        fprintf(GlobalState.logfile, "Unable to write all of %s.\n",
+                stream->name);
+    }
+    (void) free((void *) stream->buffers[0]);
+    (void) free((void *) stream->buffers[1]);
+    (void) free((void *) stream->name);
+    (void) free((void *) stream);
+    return ok ? 0 : EOF;
+}
+
+/* Close the streams left open at exit and stop the writer thread. */
+static void
+close_async_output(void)
+{
+    while (open_async_streams != NULL) {
+        /* Closing the stream removes it from the list. */
+        (void) fclose(open_async_streams->stream);
+    }
+    pthread_mutex_lock(&queue_lock);
+    stop_writing = TRUE;
+    pthread_cond_signal(&buffer_queued);
+    pthread_mutex_unlock(&queue_lock);
+    (void) pthread_join(writer, NULL);
+}
+
+/* Only the current position can be found, for ftell. */
+#if COOKIE_STREAMS
+static int
+seek_async(void *cookie, off64_t *offset, int whence)
+{
+    AsyncStream *stream = (AsyncStream *) cookie;
+
+    if (whence == SEEK_CUR && *offset == 0) {
+        *offset = stream->position;
+        return 0;
+    }
+    else {
+        return -1;
+    }
+}
+#else
+static fpos_t
+funopen_seek(void *cookie, fpos_t offset, int whence)
+{
+    AsyncStream *stream = (AsyncStream *) cookie;
+
+    return whence == SEEK_CUR && offset == 0 ? (fpos_t) stream->position : -1;
+}
+
+static int
+funopen_write(void *cookie, const char *data, int size)
+{
+    return (int) write_async(cookie, data, (size_t) size);
+}
+#endif
+#endif
+
+/* Start the writer thread for --asyncoutput and hand it the
+ * output files that have already been opened.
+ * Error and exit if that is not possible.
+ */
+void
+start_async_output(void)
+{
+#if ASYNC_OUTPUT
+    const char *clash = NULL;
+
+    if (GlobalState.num_threads > 1) {
+        clash = "--threads";
+    }
+    else if (GlobalState.batch_file != NULL) {
+        clash = "--batch";
+    }
+    else if (GlobalState.checkpoint_file != NULL) {
+        clash = "--checkpoint";
+    }
+    if (clash != NULL) {
+        fprintf(GlobalState.logfile, "--asyncoutput cannot be used with %s.\n",
+                clash);
+        exit(1);
+    }
+    if (pthread_create(&writer, NULL, write_buffers, NULL) != 0) {
+        fprintf(GlobalState.logfile,
+                "Unable to start the writer thread for --asyncoutput.\n");
+        exit(1);
+    }
+    writer_started = TRUE;
+    /* A compressed file written by the writer thread must not be
+     * closed at exit before the writer has finished with it, so the
+     * handler for compressed files is registered first, to run last.
+     */
+    close_compressed_output_at_exit();
+    (void) atexit(close_async_output);
+
+    GlobalState.outputfile = async_output_file(GlobalState.outputfile,
+            GlobalState.outputfile == stdout || GlobalState.output_filename == NULL ?
+                "the standard output" : GlobalState.output_filename,
+            ASYNC_OUTPUT_BUFFER_SIZE);
+    if (GlobalState.non_matching_file != NULL) {
+        GlobalState.non_matching_file = async_output_file(
+                GlobalState.non_matching_file, "the file of -n",
+                ASYNC_OUTPUT_BUFFER_SIZE);
+    }
+    if (GlobalState.duplicate_file != NULL) {
+        GlobalState.duplicate_file = async_output_file(
+                GlobalState.duplicate_file, "the file of -d",
+                ASYNC_OUTPUT_BUFFER_SIZE);
+    }
+#else
+    fprintf(GlobalState.logfile,
+            "--asyncoutput is not supported on this system.\n");
+    exit(1);
+#endif
+}
+
+/* Return the stream to which output for fp, which is named name,
+ * should be written, whose buffers each have buffer_size bytes.
+ * This is fp unless --asyncoutput has been started, or fp cannot
+ * be written through the writer thread.
+ */
+FILE *
+async_output_file(FILE *fp, const char *name, size_t buffer_size)
+{
+#if ASYNC_OUTPUT
+    AsyncStream *stream;
+
+    if (!writer_started) {
+        return fp;
+    }
+    stream = (AsyncStream *) malloc_or_die(sizeof (*stream));
+    stream->fp = fp;
+    stream->name = copy_string(name);
+    stream->buffers[0] = (char *) malloc_or_die(buffer_size);
+    stream->buffers[1] = (char *) malloc_or_die(buffer_size);
+    stream->buffer_size = buffer_size;
+    stream->filling = 0;
+    stream->used = 0;
+    stream->position = 0;
+    stream->handed_over = NULL;
+    stream->handed_over_length = 0;
+    stream->failed = FALSE;
+    stream->next_job = NULL;
+#if COOKIE_STREAMS
+    cookie_io_functions_t functions;
+
+    functions.read = NULL;
+    functions.write = write_async;
+    functions.seek = seek_async;
+    functions.close = close_async;
+    stream->stream = fopencookie(stream, "w", functions);
+#else
+    stream->stream = funopen(stream, NULL, funopen_write, funopen_seek,
+                             close_async);
+#endif
+    if (stream->stream == NULL) {
+        (void) free((void *) stream->buffers[0]);
+        (void) free((void *) stream->buffers[1]);
+        (void) free((void *) stream->name);
+        (void) free((void *) stream);
+        return fp;
+    }
+    stream->next = open_async_streams;
+    open_async_streams = stream;
+    return stream->stream;
+#else
+    (void) name;
+    (void) buffer_size;
+    return fp;
+#endif
+}
@@ -0,0 +1,33 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+#ifndef ASYNCOUT_H
+#define ASYNCOUT_H
+
+/* The size of each of the pair of buffers of an output file. */
+#define ASYNC_OUTPUT_BUFFER_SIZE (1 << 20)
+
+void start_async_output(void);
+FILE *async_output_file(FILE *fp, const char *name, size_t buffer_size);
+
+#endif	// ASYNCOUT_H
+
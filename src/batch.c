@@ -0,0 +1,279 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for --batch file.
+ * Each job of the batch file selects games with its own criteria and
+ * writes them to its own output files. The input is read just once,
+ * by the parent process, which passes every game, in the binary form
+ * of -Wbin, to a process for each job.
+ * A job's process is forked once the command-line arguments have been
+ * processed, so it starts with their settings. It then acts on the
+ * arguments of its job and carries on exactly as if they had been
+ * given on the command line, except that its games come from the
+ * parent rather than being parsed from the input files.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define BATCH_JOBS 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#if BATCH_JOBS
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "grammar.h"
+#include "argsfile.h"
+#include "binary.h"
+#include "profile.h"
+#include "batch.h"
+
+#if BATCH_JOBS
+
+static void start_job(unsigned job, int input_fd);
+static void forward_game(Game *game);
+static void read_all_input(void);
+
+/* The pipes to the job processes, NULL once a job has stopped reading. */
+static FILE **job_pipes = NULL;
+static unsigned num_jobs = 0;
+
+/* Where the process of a job reads its games. */
+static FILE *job_input = NULL;
+
+/* Fork a process for each job of the --batch file.
+ * Only the job processes return from this. The parent reads all of
+ * the input, passes every game to each job and exits once they have
+ * all finished.
+ */
+void
+run_batch_jobs(void)
+{
+    pid_t *jobs;
+    int *write_fds;
+    unsigned job;
+    Boolean failed = FALSE;
+
+    if (GlobalState.num_threads > 1) {
+        fprintf(GlobalState.logfile, "--threads cannot be used with --batch.\n");
+        exit(1);
+    }
+    if (GlobalState.checkpoint_file != NULL) {
+        fprintf(GlobalState.logfile, "--checkpoint cannot be used with --batch.\n");
+        exit(1);
+    }
+    num_jobs = batch_job_count();
+    jobs = (pid_t *) malloc_or_die(num_jobs * sizeof(*jobs));
+    write_fds = (int *) malloc_or_die(num_jobs * sizeof(*write_fds));
+
+    /* Nothing buffered must be written twice. */
+    fflush(NULL);
+    for (job = 0; job < num_jobs; job++) {
+        int fds[2];
+
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            exit(1);
+        }
+        jobs[job] = fork();
+        if (jobs[job] < 0) {
+            perror("fork");
+            exit(1);
+        }
+        else if (jobs[job] == 0) {
+            unsigned other;
+
+            /* Only the parent writes to the pipes. */
+            for (other = 0; other < job; other++) {
+                (void) close(write_fds[other]);
+            }
+            (void) close(fds[1]);
+            (void) free((void *) jobs);
+            (void) free((void *) write_fds);
+            start_job(job, fds[0]);
+            return;
+        }
+        else {
+            (void) close(fds[0]);
+            write_fds[job] = fds[1];
+        }
+    }
+
+    job_pipes = (FILE **) malloc_or_die(num_jobs * sizeof(*job_pipes));
+    for (job = 0; job < num_jobs; job++) {
+        job_pipes[job] = fdopen(write_fds[job], "wb");
+        if (job_pipes[job] == NULL) {
+            perror("fdopen");
+            exit(1);
+        }
+    }
+    /* A job that stops early must not stop the others. */
+    (void) signal(SIGPIPE, SIG_IGN);
+    read_all_input();
+    for (job = 0; job < num_jobs; job++) {
+        int status;
+
+        if (job_pipes[job] != NULL) {
+            close_binary_output(job_pipes[job]);
+            (void) fclose(job_pipes[job]);
+        }
+        if (waitpid(jobs[job], &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(GlobalState.logfile, "Job %s of %s failed.\n",
+                    batch_job_name(job), GlobalState.batch_file);
+            failed = TRUE;
+        }
+    }
+    if (PROFILING) {
+        report_profile(GlobalState.logfile, "batch");
+    }
+    exit(failed ? 1 : 0);
+}
+
+/* Prepare the process of the given job, which reads its games
+ * from input_fd.
+ */
+static void
+start_job(unsigned job, int input_fd)
+{
+    unsigned num_files = 0, num_job_files = 0;
+    FILE *outputfile = GlobalState.outputfile;
+
+    while (input_file_name(num_files) != NULL) {
+        num_files++;
+    }
+    GlobalState.batch_job = batch_job_name(job);
+    process_batch_job_arguments(job);
+    while (input_file_name(num_job_files) != NULL) {
+        num_job_files++;
+    }
+    if (num_job_files != num_files) {
+        fprintf(GlobalState.logfile,
+                "Job %s of %s: the input files must be given on the command line.\n",
+                GlobalState.batch_job, GlobalState.batch_file);
+        exit(1);
+    }
+    if (GlobalState.checkpoint_file != NULL) {
+        fprintf(GlobalState.logfile,
+                "Job %s of %s: --checkpoint cannot be used with --batch.\n",
+                GlobalState.batch_job, GlobalState.batch_file);
+        exit(1);
+    }
+    if (GlobalState.outputfile == outputfile && !GlobalState.check_only &&
+            GlobalState.games_per_file == 0 &&
+            GlobalState.ECO_level == DONT_DIVIDE) {
+        fprintf(GlobalState.logfile,
+                "Job %s of %s has no output file of its own.\n",
+                GlobalState.batch_job, GlobalState.batch_file);
+        exit(1);
+    }
+    job_input = fdopen(input_fd, "rb");
+    if (job_input == NULL) {
+        perror("fdopen");
+        exit(1);
+    }
+}
+
+/* Read all of the input, passing every game to the jobs. */
+static void
+read_all_input(void)
+{
+    if (!binary_input() && !open_first_file()) {
+        exit(1);
+    }
+    set_game_forwarder(forward_game);
+    if (!process_binary_input()) {
+        yyparse(GlobalState.current_file_type);
+    }
+}
+
+/* The GameForwarder of the parent: pass game to every job
+ * that is still reading.
+ */
+static void
+forward_game(Game *game)
+{
+    unsigned job;
+
+    for (job = 0; job < num_jobs; job++) {
+        FILE *fp = job_pipes[job];
+
+        if (fp != NULL) {
+            output_batch_game(game, fp);
+            if (ferror(fp)) {
+                /* The job has finished early. */
+                close_binary_output(fp);
+                (void) fclose(fp);
+                job_pipes[job] = NULL;
+            }
+        }
+    }
+}
+
+/* Process the games passed to the process of a job.
+ * Return FALSE, having done nothing, if this is not a job's process.
+ */
+Boolean
+process_batch_job(void)
+{
+    if (job_input == NULL) {
+        return FALSE;
+    }
+    else {
+        char name[100];
+
+        sprintf(name, "passed to job %.50s", GlobalState.batch_job);
+        read_batch_games(job_input, name);
+        (void) fclose(job_input);
+        job_input = NULL;
+        return TRUE;
+    }
+}
+
+#else
+
+/* Batch jobs are only available on POSIX systems. */
+void
+run_batch_jobs(void)
+{
+    fprintf(GlobalState.logfile, "--batch is not supported on this system.\n");
+    exit(1);
+}
+
+Boolean
+process_batch_job(void)
+{
+    return FALSE;
+}
+
+#endif
@@ -0,0 +1,1075 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+
+/* Support for -Wbin: a compact binary form of games that have already
+ * been checked, which can be read back in place of PGN without the
+ * need to lex the text or disambiguate the moves.
+ *
+ * A file starts with binary_magic and each game is then a record
+ * starting with GAME_RECORD. A later binary_magic starts a new
+ * dictionary, so files can be concatenated.
+ * The games passed to the jobs of --batch are SOURCE_RECORDs instead,
+ * which give the number of the input file and the lines of the game
+ * before the game itself, and in which every move is a TEXT_MOVE so
+ * that it is kept exactly as it was read.
+ * Numbers are unsigned, in 7-bit groups with the least significant first
+ * and the top bit of each byte set if another group follows.
+ * A string is a number, n:
+ *     NEW_STRING: the next string of the dictionary, given by its
+ *                 length and its bytes;
+ *     LITERAL_STRING: a string outside the dictionary, given in the
+ *                     same way;
+ *     otherwise the dictionary string numbered n - FIRST_STRING_ID.
+ * Only tag names, tag values and results are added to the dictionary.
+ * A game is its tags, as a count of (name, value) pairs, its prefix
+ * comment list and its move list.
+ * A comment list is a count of comments, each a count of strings.
+ * A move list is a count of moves, each a 16-bit word, least significant
+ * byte first:
+ *     bits 0-5: from square, numbered from a1 = 0, b1 = 1, ... h8 = 63;
+ *     bits 6-11: to square;
+ *     bits 12-14: promoted piece, less PAWN, or 0;
+ *     bit 15: ANNOTATED_MOVE.
+ * When the from and to squares are the same the move is one of
+ * SpecialMove instead, and the text of a TEXT_MOVE follows it.
+ * An ANNOTATED_MOVE is followed by a byte of AnnotationFlags and then
+ * its NAGs, comment list, variations and result, as flagged.
+ * A NAG list is a count of NAGs, each a count of strings and a comment
+ * list, and variations are a count of (prefix comment list, move list,
+ * suffix comment list).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "decode.h"
+#include "grammar.h"
+#include "compress.h"
+#include "profile.h"
+#include "binary.h"
+
+static const char binary_magic[] = "PGNXBIN1";
+#define BINARY_MAGIC_LENGTH (sizeof(binary_magic) - 1)
+#define GAME_RECORD 'G'
+#define SOURCE_RECORD 'S'
+
+#define NEW_STRING 0
+#define LITERAL_STRING 1
+#define FIRST_STRING_ID 2
+/* Limits on the strings added to a dictionary. */
+#define MAX_DICTIONARY_STRINGS (1 << 20)
+#define MAX_INTERNED_LENGTH 80
+/* A sanity check on the lengths of strings read. */
+#define MAX_BINARY_STRING_LENGTH (1 << 24)
+
+#define ANNOTATED_MOVE 0x8000
+
+typedef enum {
+    NULL_MOVE_CODE, KINGSIDE_CASTLE_CODE, QUEENSIDE_CASTLE_CODE, TEXT_MOVE
+} SpecialMove;
+
+typedef enum {
+    NAGS_FLAG = 1, COMMENTS_FLAG = 2, VARIATIONS_FLAG = 4, RESULT_FLAG = 8
+} AnnotationFlags;
+
+/* The letters of the promoted pieces, indexed by their code. */
+static const char promotion_letters[] = "?NBRQK";
+
+/* A string of a dictionary being written and its id. */
+typedef struct {
+    char *string;
+    unsigned long id;
+} DictionaryEntry;
+
+/* The dictionary of an output file, as an open-addressed hash table. */
+typedef struct binary_output {
+    FILE *fp;
+    DictionaryEntry *entries;
+    /* The size of entries, which is a power of 2. */
+    unsigned long size;
+    unsigned long num_strings;
+    /* Whether every move is written as a TEXT_MOVE. */
+    Boolean move_text;
+    struct binary_output *next;
+} BinaryOutput;
+
+#define INITIAL_DICTIONARY_SIZE 1024
+
+static BinaryOutput *binary_outputs = NULL;
+
+/* The encoding of the game being written. */
+static struct {
+    unsigned char *bytes;
+    size_t length, size;
+} game_bytes;
+
+static void put_move_list(BinaryOutput *output, const Move *move);
+
+static void
+put_byte(unsigned byte)
+{
+    if (game_bytes.length == game_bytes.size) {
+        game_bytes.size = game_bytes.size == 0 ? 4096 : 2 * game_bytes.size;
+        game_bytes.bytes = (unsigned char *) realloc_or_die(
+                (void *) game_bytes.bytes, game_bytes.size);
+    }
+    game_bytes.bytes[game_bytes.length++] = (unsigned char) byte;
+}
+
+static void
+put_number(unsigned long n)
+{
+    while (n >= 0x80) {
+        put_byte((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    put_byte(n);
+}
+
+static unsigned long
+hash_string(const char *str)
+{
+    unsigned long hash = 2166136261UL;
+
+    while (*str != '\0') {
+        hash = (hash ^ (unsigned char) *str) * 16777619UL;
+        str++;
+    }
+    return hash;
+}
+
+/* Double the size of the dictionary of output. */
+static void
+grow_dictionary(BinaryOutput *output)
+{
+    DictionaryEntry *old_entries = output->entries;
+    unsigned long old_size = output->size;
+    unsigned long i;
+
+    output->size = old_size == 0 ? INITIAL_DICTIONARY_SIZE : 2 * old_size;
+    output->entries = (DictionaryEntry *) malloc_or_die(
+            output->size * sizeof(*output->entries));
+    for (i = 0; i < output->size; i++) {
+        output->entries[i].string = NULL;
+    }
+    for (i = 0; i < old_size; i++) {
+        if (old_entries[i].string != NULL) {
+            unsigned long slot = hash_string(old_entries[i].string) &
+                    (output->size - 1);
+            while (output->entries[slot].string != NULL) {
+                slot = (slot + 1) & (output->size - 1);
+            }
+            output->entries[slot] = old_entries[i];
+        }
+    }
+    if (old_entries != NULL) {
+        (void) free((void *) old_entries);
+    }
+}
+
+/* Return the code with which to write str to output: its id if it is
+ * already in the dictionary, otherwise NEW_STRING if there is room
+ * to add it or LITERAL_STRING if not.
+ */
+static unsigned long
+string_code(BinaryOutput *output, const char *str)
+{
+    unsigned long slot;
+
+    if (strlen(str) > MAX_INTERNED_LENGTH) {
+        return LITERAL_STRING;
+    }
+    if (2 * (output->num_strings + 1) > output->size) {
+        if (output->num_strings >= MAX_DICTIONARY_STRINGS) {
+            /* The dictionary is full, but str may be in it. */
+        }
+        else {
+            grow_dictionary(output);
+        }
+    }
+    slot = hash_string(str) & (output->size - 1);
+    while (output->entries[slot].string != NULL) {
+        if (strcmp(output->entries[slot].string, str) == 0) {
+            return output->entries[slot].id + FIRST_STRING_ID;
+        }
+        slot = (slot + 1) & (output->size - 1);
+    }
+    if (output->num_strings < MAX_DICTIONARY_STRINGS) {
+        output->entries[slot].string = copy_string(str);
+        output->entries[slot].id = output->num_strings;
+        output->num_strings++;
+        return NEW_STRING;
+    }
+    else {
+        return LITERAL_STRING;
+    }
+}
+
+/* Write str, through the dictionary of output if interned. */
+static void
+put_string(BinaryOutput *output, const char *str, Boolean interned)
+{
+    unsigned long code = interned ? string_code(output, str) : LITERAL_STRING;
+
+    put_number(code);
+    if (code == NEW_STRING || code == LITERAL_STRING) {
+        size_t length = strlen(str);
+
+        put_number(length);
+        while (*str != '\0') {
+            put_byte((unsigned char) *str);
+            str++;
+        }
+    }
+}
+
+static void
+put_string_list(BinaryOutput *output, const StringList *list)
+{
+    const StringList *item;
+    unsigned long count = 0;
+
+    for (item = list; item != NULL; item = item->next) {
+        count++;
+    }
+    put_number(count);
+    for (item = list; item != NULL; item = item->next) {
+        put_string(output, item->str, FALSE);
+    }
+}
+
+/* Write comments, unless comments are not being kept. */
+static void
+put_comment_list(BinaryOutput *output, const CommentList *comments)
+{
+    const CommentList *comment;
+    unsigned long count = 0;
+
+    if (GlobalState.keep_comments) {
+        for (comment = comments; comment != NULL; comment = comment->next) {
+            count++;
+        }
+    }
+    put_number(count);
+    for (comment = comments; count > 0; comment = comment->next, count--) {
+        put_string_list(output, comment->comment);
+    }
+}
+
+static void
+put_NAG_list(BinaryOutput *output, const Nag *NAGs)
+{
+    const Nag *nag;
+    unsigned long count = 0;
+
+    for (nag = NAGs; nag != NULL; nag = nag->next) {
+        count++;
+    }
+    put_number(count);
+    for (nag = NAGs; nag != NULL; nag = nag->next) {
+        put_string_list(output, nag->text);
+        put_comment_list(output, nag->comments);
+    }
+}
+
+static void
+put_variations(BinaryOutput *output, const Variation *variations)
+{
+    const Variation *variation;
+    unsigned long count = 0;
+
+    for (variation = variations; variation != NULL; variation = variation->next) {
+        count++;
+    }
+    put_number(count);
+    for (variation = variations; variation != NULL; variation = variation->next) {
+        put_comment_list(output, variation->prefix_comment);
+        put_move_list(output, variation->moves);
+        put_comment_list(output, variation->suffix_comment);
+    }
+}
+
+/* The number of a square, or -1 if col or rank is not known. */
+static int
+square_number(Col col, Rank rank)
+{
+    if (col >= 'a' && col <= 'h' && rank >= '1' && rank <= '8') {
+        return (col - 'a') + 8 * (rank - '1');
+    }
+    else {
+        return -1;
+    }
+}
+
+/* Which of the annotations of move are to be written. */
+static unsigned
+annotation_flags(const Move *move)
+{
+    unsigned flags = 0;
+
+    if (move->NAGs != NULL && GlobalState.keep_NAGs) {
+        flags |= NAGS_FLAG;
+    }
+    if (move->comment_list != NULL && GlobalState.keep_comments) {
+        flags |= COMMENTS_FLAG;
+    }
+    if (move->Variants != NULL && GlobalState.keep_variations) {
+        flags |= VARIATIONS_FLAG;
+    }
+    if (move->terminating_result != NULL) {
+        flags |= RESULT_FLAG;
+    }
+    return flags;
+}
+
+/* Set *word to the encoding of move and return TRUE, unless the move
+ * is not recognisable except from its text.
+ */
+static Boolean
+encode_move(const Move *move, unsigned *word)
+{
+    Boolean known = FALSE;
+
+    switch (move->class) {
+        case PAWN_MOVE:
+        case PAWN_MOVE_WITH_PROMOTION:
+        case ENPASSANT_PAWN_MOVE:
+        case PIECE_MOVE:
+        {
+            int from = square_number(move->from_col, move->from_rank);
+            int to = square_number(move->to_col, move->to_rank);
+
+            if (from >= 0 && to >= 0 && from != to) {
+                *word = from | (to << 6);
+                known = TRUE;
+                if (move->class == PAWN_MOVE_WITH_PROMOTION &&
+                        move->promoted_piece > PAWN &&
+                        move->promoted_piece <= KING) {
+                    *word |= (move->promoted_piece - PAWN) << 12;
+                }
+            }
+        }
+            break;
+        case KINGSIDE_CASTLE:
+            *word = KINGSIDE_CASTLE_CODE | (KINGSIDE_CASTLE_CODE << 6);
+            known = TRUE;
+            break;
+        case QUEENSIDE_CASTLE:
+            *word = QUEENSIDE_CASTLE_CODE | (QUEENSIDE_CASTLE_CODE << 6);
+            known = TRUE;
+            break;
+        case NULL_MOVE:
+            *word = NULL_MOVE_CODE | (NULL_MOVE_CODE << 6);
+            known = TRUE;
+            break;
+        default:
+            /* Only the text of the move is known. */
+            break;
+    }
+    return known;
+}
+
+static void
+put_move(BinaryOutput *output, const Move *move)
+{
+    unsigned flags = annotation_flags(move);
+    unsigned word = 0;
+    /* Whether the move is written as its text. */
+    Boolean as_text = output->move_text || !encode_move(move, &word);
+
+    if (as_text) {
+        word = TEXT_MOVE | (TEXT_MOVE << 6);
+    }
+    if (flags != 0) {
+        word |= ANNOTATED_MOVE;
+    }
+    put_byte(word & 0xff);
+    put_byte(word >> 8);
+    if (as_text) {
+        put_string(output, (const char *) move->move, FALSE);
+    }
+    if (flags != 0) {
+        put_byte(flags);
+        if (flags & NAGS_FLAG) {
+            put_NAG_list(output, move->NAGs);
+        }
+        if (flags & COMMENTS_FLAG) {
+            put_comment_list(output, move->comment_list);
+        }
+        if (flags & VARIATIONS_FLAG) {
+            put_variations(output, move->Variants);
+        }
+        if (flags & RESULT_FLAG) {
+            put_string(output, move->terminating_result, TRUE);
+        }
+    }
+}
+
+static void
+put_move_list(BinaryOutput *output, const Move *moves)
+{
+    const Move *move;
+    unsigned long count = 0;
+
+    for (move = moves; move != NULL; move = move->next) {
+        count++;
+    }
+    put_number(count);
+    for (move = moves; move != NULL; move = move->next) {
+        put_move(output, move);
+    }
+}
+
+/* Return the dictionary of outputfile, starting it and the file's
+ * binary_magic if this is the first game written to it.
+ * move_text is whether every move is to be written as its text.
+ */
+static BinaryOutput *
+binary_output_for(FILE *outputfile, Boolean move_text)
+{
+    BinaryOutput *output = binary_outputs;
+
+    while (output != NULL && output->fp != outputfile) {
+        output = output->next;
+    }
+    if (output == NULL) {
+        const char *magic;
+
+        output = (BinaryOutput *) malloc_or_die(sizeof(*output));
+        output->fp = outputfile;
+        output->entries = NULL;
+        output->size = 0;
+        output->num_strings = 0;
+        output->move_text = move_text;
+        grow_dictionary(output);
+        output->next = binary_outputs;
+        binary_outputs = output;
+        for (magic = binary_magic; *magic != '\0'; magic++) {
+            put_byte((unsigned char) *magic);
+        }
+    }
+    return output;
+}
+
+/* Write the tags, prefix comment and moves of game to output,
+ * and then the whole of the record to the file.
+ * Every tag that is not suppressed is written, regardless of the
+ * tag roster options, which apply when the game is read back.
+ */
+static void
+put_game(BinaryOutput *output, const Game *game)
+{
+    unsigned long num_tags = 0;
+    int tag;
+
+    for (tag = 0; tag < game->tags_length; tag++) {
+        if (game->tags[tag] != NULL && !is_suppressed_tag(tag)) {
+            num_tags++;
+        }
+    }
+    put_number(num_tags);
+    for (tag = 0; tag < game->tags_length; tag++) {
+        if (game->tags[tag] != NULL && !is_suppressed_tag(tag)) {
+            put_string(output, tag_header_string(tag), TRUE);
+            put_string(output, game->tags[tag], TRUE);
+        }
+    }
+    put_comment_list(output, game->prefix_comment);
+    put_move_list(output, game->moves);
+    (void) fwrite((const void *) game_bytes.bytes, 1, game_bytes.length,
+            output->fp);
+    PROFILE_COUNT(PROFILE_BYTES_WRITTEN, game_bytes.length);
+    game_bytes.length = 0;
+}
+
+/* Write game to outputfile in the binary form. */
+void
+output_binary_game(Game *game, FILE *outputfile)
+{
+    BinaryOutput *output = binary_output_for(outputfile, FALSE);
+
+    put_byte(GAME_RECORD);
+    put_game(output, game);
+}
+
+/* Write game, which has not yet been checked, to the job of --batch
+ * reading from outputfile.
+ */
+void
+output_batch_game(const Game *game, FILE *outputfile)
+{
+    BinaryOutput *output = binary_output_for(outputfile, TRUE);
+
+    put_byte(SOURCE_RECORD);
+    put_number(current_file_number());
+    put_number(game->start_line);
+    put_number(game->end_line);
+    put_game(output, game);
+}
+
+/* outputfile is about to be closed, so forget its dictionary. */
+void
+close_binary_output(FILE *outputfile)
+{
+    BinaryOutput **link = &binary_outputs;
+
+    while (*link != NULL && (*link)->fp != outputfile) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        BinaryOutput *output = *link;
+        unsigned long i;
+
+        for (i = 0; i < output->size; i++) {
+            if (output->entries[i].string != NULL) {
+                (void) free((void *) output->entries[i].string);
+            }
+        }
+        (void) free((void *) output->entries);
+        *link = output->next;
+        (void) free((void *) output);
+    }
+}
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+/* The file being read and its dictionary. */
+static struct {
+    FILE *fp;
+    const char *filename;
+    unsigned char buffer[INPUT_BUFFER_SIZE];
+    size_t length, next;
+    char **strings;
+    unsigned long num_strings, max_strings;
+    /* Whether the input is the games passed to a job of --batch. */
+    Boolean from_batch;
+} input;
+
+static Move *get_move_list(void);
+
+/* Stop on input that is not in the binary form. */
+static void
+corrupt_binary_input(void)
+{
+    fprintf(GlobalState.logfile,
+            "The binary game file %s is corrupt or truncated.\n",
+            input.filename);
+    exit(1);
+}
+
+/* Return the next byte of the input, or EOF at the end of it. */
+static int
+get_byte(void)
+{
+    if (input.next == input.length) {
+        input.length = fread((void *) input.buffer, 1, INPUT_BUFFER_SIZE,
+                input.fp);
+        input.next = 0;
+        if (input.length == 0) {
+            return EOF;
+        }
+    }
+    return input.buffer[input.next++];
+}
+
+/* Return the next byte of the input, which should not be at its end. */
+static unsigned
+need_byte(void)
+{
+    int byte = get_byte();
+
+    if (byte == EOF) {
+        corrupt_binary_input();
+    }
+    return (unsigned) byte;
+}
+
+static unsigned long
+get_number(void)
+{
+    unsigned long n = 0;
+    unsigned shift = 0;
+    unsigned byte;
+
+    do {
+        if (shift > 8 * sizeof(n) - 7) {
+            corrupt_binary_input();
+        }
+        byte = need_byte();
+        n |= (unsigned long) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return n;
+}
+
+static void
+reset_dictionary(void)
+{
+    unsigned long i;
+
+    for (i = 0; i < input.num_strings; i++) {
+        (void) free((void *) input.strings[i]);
+    }
+    input.num_strings = 0;
+}
+
+/* Return a copy of the next string of the input. */
+static char *
+get_string(void)
+{
+    unsigned long code = get_number();
+    char *str;
+
+    if (code == NEW_STRING || code == LITERAL_STRING) {
+        unsigned long length = get_number();
+        unsigned long i;
+
+        if (length > MAX_BINARY_STRING_LENGTH) {
+            corrupt_binary_input();
+        }
+        str = (char *) malloc_or_die(length + 1);
+        for (i = 0; i < length; i++) {
+            str[i] = (char) need_byte();
+        }
+        str[length] = '\0';
+        if (code == NEW_STRING) {
+            if (input.num_strings == input.max_strings) {
+                input.max_strings = input.max_strings == 0 ?
+                        INITIAL_DICTIONARY_SIZE : 2 * input.max_strings;
+                input.strings = (char **) realloc_or_die((void *) input.strings,
+                        input.max_strings * sizeof(*input.strings));
+            }
+            input.strings[input.num_strings++] = copy_string(str);
+        }
+    }
+    else if (code - FIRST_STRING_ID < input.num_strings) {
+        str = copy_string(input.strings[code - FIRST_STRING_ID]);
+    }
+    else {
+        corrupt_binary_input();
+        str = NULL;
+    }
+    return str;
+}
+
+static StringList *
+get_string_list(void)
+{
+    StringList *list = NULL;
+    unsigned long count = get_number();
+
+    while (count > 0) {
+        list = save_string_list_item(list, get_string());
+        count--;
+    }
+    return list;
+}
+
+static CommentList *
+get_comment_list(void)
+{
+    CommentList *comments = NULL, *tail = NULL;
+    unsigned long count = get_number();
+
+    while (count > 0) {
+        CommentList *comment = (CommentList *) arena_malloc(sizeof(*comment));
+
+        comment->comment = get_string_list();
+        comment->next = NULL;
+        if (tail == NULL) {
+            comments = comment;
+        }
+        else {
+            tail->next = comment;
+        }
+        tail = comment;
+        count--;
+    }
+    return comments;
+}
+
+static Nag *
+get_NAG_list(void)
+{
+    Nag *NAGs = NULL, *tail = NULL;
+    unsigned long count = get_number();
+
+    while (count > 0) {
+        Nag *nag = (Nag *) arena_malloc(sizeof(*nag));
+
+        nag->text = get_string_list();
+        nag->comments = get_comment_list();
+        nag->next = NULL;
+        if (tail == NULL) {
+            NAGs = nag;
+        }
+        else {
+            tail->next = nag;
+        }
+        tail = nag;
+        count--;
+    }
+    return NAGs;
+}
+
+static Variation *
+get_variations(void)
+{
+    Variation *variations = NULL, *tail = NULL;
+    unsigned long count = get_number();
+
+    while (count > 0) {
+        Variation *variation = (Variation *) arena_malloc(sizeof(*variation));
+
+        variation->prefix_comment = get_comment_list();
+        variation->moves = get_move_list();
+        variation->suffix_comment = get_comment_list();
+        variation->next = NULL;
+        if (tail == NULL) {
+            variations = variation;
+        }
+        else {
+            tail->next = variation;
+        }
+        tail = variation;
+        count--;
+    }
+    return variations;
+}
+
+/* Build the move held in word.
+ * The squares of an ordinary move are already known, so it is given
+ * the class and text of a long-algebraic move, which leaves only the
+ * piece on its from square to be found when it is applied.
+ */
+static Move *
+get_move(unsigned word)
+{
+    unsigned from = word & 0x3f;
+    unsigned to = (word >> 6) & 0x3f;
+    Move *move;
+
+    if (from != to) {
+        unsigned promotion = (word >> 12) & 0x7;
+        unsigned char *text;
+
+        if (promotion > KING - PAWN) {
+            corrupt_binary_input();
+        }
+        move = new_move_structure();
+        move->from_col = 'a' + from % 8;
+        move->from_rank = '1' + from / 8;
+        move->to_col = 'a' + to % 8;
+        move->to_rank = '1' + to / 8;
+        text = move->move;
+        *text++ = move->from_col;
+        *text++ = move->from_rank;
+        *text++ = move->to_col;
+        *text++ = move->to_rank;
+        if (promotion != 0) {
+            move->class = PAWN_MOVE_WITH_PROMOTION;
+            move->piece_to_move = PAWN;
+            *text++ = promotion_letters[promotion];
+        }
+        else {
+            move->class = PAWN_MOVE;
+        }
+        *text = '\0';
+    }
+    else if (to == NULL_MOVE_CODE) {
+        move = decode_move((const unsigned char *) NULL_MOVE_STRING);
+    }
+    else if (to == KINGSIDE_CASTLE_CODE) {
+        move = decode_move((const unsigned char *) "O-O");
+    }
+    else if (to == QUEENSIDE_CASTLE_CODE) {
+        move = decode_move((const unsigned char *) "O-O-O");
+    }
+    else if (to == TEXT_MOVE) {
+        char *text = get_string();
+
+        if (*text == '\0' || strlen(text) > MAX_MOVE_LEN) {
+            corrupt_binary_input();
+        }
+        move = decode_move((const unsigned char *) text);
+        (void) free((void *) text);
+    }
+    else {
+        corrupt_binary_input();
+        move = NULL;
+    }
+    return move;
+}
+
+static Move *
+get_move_list(void)
+{
+    Move *moves = NULL, *tail = NULL;
+    unsigned long count = get_number();
+
+    while (count > 0) {
+        unsigned word = need_byte();
+        Move *move;
+
+        word |= need_byte() << 8;
+        move = get_move(word);
+        if (word & ANNOTATED_MOVE) {
+            unsigned flags = need_byte();
+
+            if (flags & NAGS_FLAG) {
+                move->NAGs = get_NAG_list();
+            }
+            if (flags & COMMENTS_FLAG) {
+                move->comment_list = get_comment_list();
+            }
+            if (flags & VARIATIONS_FLAG) {
+                move->Variants = get_variations();
+            }
+            if (flags & RESULT_FLAG) {
+                move->terminating_result = get_string();
+            }
+        }
+        move->prev = tail;
+        if (tail == NULL) {
+            moves = move;
+        }
+        else {
+            tail->next = move;
+        }
+        tail = move;
+        count--;
+    }
+    return moves;
+}
+
+/* Read the next game and deal with it as if it had been parsed
+ * from the given lines.
+ */
+static void
+read_binary_game(unsigned long start_line, unsigned long end_line)
+{
+    unsigned long num_tags;
+    Move *moves;
+    ProfileMark mark;
+
+    PROFILE_BEGIN(mark);
+    for (num_tags = get_number(); num_tags > 0; num_tags--) {
+        char *tag_string = get_string();
+        TagName tag = lookup_tag(tag_string);
+
+        (void) free((void *) tag_string);
+        set_game_header_tag(tag, get_string());
+    }
+    set_game_header_prefix_comment(get_comment_list());
+    moves = get_move_list();
+    PROFILE_END(PROFILE_PARSE, mark);
+    /* Only the moves of a SOURCE_RECORD keep their original text. */
+    set_game_move_text_SAN(input.from_batch);
+    deal_with_game(moves, start_line, end_line);
+    set_game_move_text_SAN(TRUE);
+}
+
+/* Read a SOURCE_RECORD, of a game from one of the input files. */
+static void
+read_source_game(void)
+{
+    unsigned long file_number = get_number();
+    unsigned long start_line, end_line;
+
+    if (!input.from_batch || input_file_name(file_number) == NULL) {
+        corrupt_binary_input();
+    }
+    if (file_number != current_file_number()) {
+        select_input_file(file_number);
+    }
+    start_line = get_number();
+    end_line = get_number();
+    read_binary_game(start_line, end_line);
+}
+
+/* Read the records of the input until its end or processing is finished. */
+static void
+read_binary_records(void)
+{
+    int record;
+
+    while (!finished_processing() && (record = get_byte()) != EOF) {
+        if (record == GAME_RECORD) {
+            read_binary_game(0, 0);
+        }
+        else if (record == SOURCE_RECORD) {
+            read_source_game();
+        }
+        else if (record == binary_magic[0]) {
+            /* The start of another file's games. */
+            size_t i;
+
+            for (i = 1; i < BINARY_MAGIC_LENGTH; i++) {
+                if (need_byte() != (unsigned char) binary_magic[i]) {
+                    corrupt_binary_input();
+                }
+            }
+            reset_dictionary();
+        }
+        else {
+            corrupt_binary_input();
+        }
+        /* Nothing from the game remains in the arena. */
+        reset_arena();
+    }
+}
+
+/* Open filename and read past its binary_magic.
+ * Return NULL if it is not a binary game file.
+ */
+static FILE *
+open_binary_input(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+
+    if (fp != NULL) {
+        char magic[BINARY_MAGIC_LENGTH];
+
+        fp = open_compressed_input(fp, filename);
+        if (fp != NULL &&
+                (fread((void *) magic, 1, BINARY_MAGIC_LENGTH, fp) !=
+                    BINARY_MAGIC_LENGTH ||
+                 memcmp(magic, binary_magic, BINARY_MAGIC_LENGTH) != 0)) {
+            (void) fclose(fp);
+            fp = NULL;
+        }
+    }
+    return fp;
+}
+
+/* Read the games of the input file numbered file_number. */
+static void
+read_binary_file(unsigned file_number)
+{
+    input.filename = input_file_name(file_number);
+    input.fp = open_binary_input(input.filename);
+    if (input.fp == NULL) {
+        fprintf(GlobalState.logfile, "Unable to open the binary game file: %s\n",
+                input.filename);
+        exit(1);
+    }
+    input.length = input.next = 0;
+    reset_dictionary();
+    input.from_batch = FALSE;
+    select_input_file(file_number);
+    if (GlobalState.verbosity > 1) {
+        fprintf(GlobalState.logfile, "Processing %s\n", input.filename);
+    }
+    read_binary_records();
+    (void) fclose(input.fp);
+    input.fp = NULL;
+}
+
+/* Return whether the input files are in the binary form, in which
+ * case they are read by process_binary_input rather than opened by
+ * open_first_file. This is decided from their first bytes the first
+ * time it is called.
+ */
+Boolean
+binary_input(void)
+{
+    /* -1 until it has been decided. */
+    static int is_binary = -1;
+    unsigned file_number;
+    const char *filename;
+    /* A file that is not in the binary form. */
+    const char *pgn_file = NULL;
+    unsigned num_binary_files = 0;
+
+    if (is_binary >= 0) {
+        return is_binary != 0;
+    }
+    /* Standard input is always taken to be PGN. */
+    for (file_number = 0; (filename = input_file_name(file_number)) != NULL;
+            file_number++) {
+        FILE *fp = open_binary_input(filename);
+
+        if (fp != NULL) {
+            (void) fclose(fp);
+            num_binary_files++;
+        }
+        else if (pgn_file == NULL) {
+            pgn_file = filename;
+        }
+    }
+    if (num_binary_files > 0 && pgn_file != NULL) {
+        fprintf(GlobalState.logfile,
+                "%s is not a binary game file: binary and PGN input cannot be mixed.\n",
+                pgn_file);
+        exit(1);
+    }
+    is_binary = num_binary_files > 0;
+    return is_binary != 0;
+}
+
+/* Process all of the input if it is in the binary form.
+ * Return FALSE, having done nothing, if it is not, in which case
+ * it must be processed by yyparse as normal.
+ */
+Boolean
+process_binary_input(void)
+{
+    unsigned file_number;
+    int arena_was_used;
+
+    if (!binary_input()) {
+        return FALSE;
+    }
+    arena_was_used = use_arena(1);
+    for (file_number = 0; !finished_processing() &&
+            input_file_name(file_number) != NULL; file_number++) {
+        read_binary_file(file_number);
+    }
+    (void) use_arena(arena_was_used);
+    return TRUE;
+}
+
+/* Read the games passed to a job of --batch, from fp, which is
+ * named name in any report of corrupt input.
+ */
+void
+read_batch_games(FILE *fp, const char *name)
+{
+    int arena_was_used = use_arena(1);
+
+    input.filename = name;
+    input.fp = fp;
+    input.length = input.next = 0;
+    input.from_batch = TRUE;
+    reset_dictionary();
+    read_binary_records();
+    input.fp = NULL;
+    (void) use_arena(arena_was_used);
+}
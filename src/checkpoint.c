@@ -0,0 +1,559 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for --checkpoint file and --resume.
+ * Every checkpoint_interval games, the point in the input just after
+ * the result of the last game is recorded in the checkpoint file,
+ * along with the game counters and the lengths of the output files.
+ * The games first met since the previous checkpoint are appended
+ * to a journal of the duplicate table alongside it, so a checkpoint
+ * costs little however many games have been seen.
+ * --resume truncates the output files to their recorded lengths,
+ * rebuilds the duplicate table from the journal and carries on
+ * lexing from the recorded point.
+ * Everything is written to disk before the checkpoint is renamed
+ * into place, so the checkpoint always describes complete output.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define CHECKPOINTS 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if CHECKPOINTS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "grammar.h"
+#include "hashing.h"
+#include "output.h"
+#include "compress.h"
+#include "checkpoint.h"
+
+#if CHECKPOINTS
+
+#define CHECKPOINT_VERSION 1
+/* The longest line of a checkpoint. */
+#define CHECKPOINT_LINE_LENGTH (FILENAME_MAX + 32)
+/* A length for the names of -# output files. */
+#define FILENAME_LENGTH (250)
+
+static char *name_with_suffix(const char *name, const char *suffix);
+static void check_output_file(FILE *fp);
+static Boolean sync_file(FILE *fp);
+static long output_offset(FILE *fp);
+static void write_checkpoint(unsigned file_number, size_t offset,
+                             unsigned long lines);
+static void invalid_checkpoint(void);
+static char *checkpoint_value(FILE *fp, const char *key);
+static unsigned long checkpoint_number(FILE *fp, const char *key);
+static long checkpoint_offset(FILE *fp, const char *key);
+static void restore_output_file(FILE *fp, long offset);
+static game_number *remaining_game_numbers(game_number *range);
+static long source_file_number(const char *filename);
+
+/* The journal of the duplicate table, alongside the checkpoint. */
+static char *journal_name = NULL;
+static FILE *journal = NULL;
+/* The number of entries in the journal at the last checkpoint. */
+static unsigned long journal_length = 0;
+/* The value of num_games_processed at the last checkpoint. */
+static unsigned long games_at_checkpoint = 0;
+
+/* Check that the run can be resumed from its checkpoints. */
+void
+check_checkpoint_options(void)
+{
+    const char *clash = NULL;
+    unsigned file_number;
+
+    if (GlobalState.num_threads > 1) {
+        clash = "--threads";
+    }
+    else if (GlobalState.position_index_file != NULL) {
+        clash = "--posindex";
+    }
+    else if (GlobalState.ECO_level > DONT_DIVIDE) {
+        clash = "-E";
+    }
+    else if (GlobalState.output_compression != NO_COMPRESSION) {
+        clash = "--compress";
+    }
+    else if (GlobalState.delete_same_setup) {
+        clash = "--deletesamesetup";
+    }
+    if (clash != NULL) {
+        fprintf(GlobalState.logfile, "--checkpoint cannot be used with %s.\n",
+                clash);
+        exit(1);
+    }
+    if (input_file_name(0) == NULL) {
+        fprintf(GlobalState.logfile,
+                "--checkpoint cannot be used with standard input.\n");
+        exit(1);
+    }
+    for (file_number = 0; input_file_name(file_number) != NULL; file_number++) {
+        if (compressed_input_file(input_file_name(file_number))) {
+            fprintf(GlobalState.logfile,
+                    "--checkpoint cannot be used with the compressed file %s.\n",
+                    input_file_name(file_number));
+            exit(1);
+        }
+    }
+    if (GlobalState.outputfile == stdout && GlobalState.games_per_file == 0 &&
+            !GlobalState.check_only) {
+        fprintf(GlobalState.logfile,
+                "--checkpoint requires the output to be written to a file.\n");
+        exit(1);
+    }
+    if (GlobalState.outputfile != stdout) {
+        check_output_file(GlobalState.outputfile);
+    }
+    check_output_file(GlobalState.duplicate_file);
+    check_output_file(GlobalState.non_matching_file);
+    journal_name = name_with_suffix(GlobalState.checkpoint_file, ".dup");
+}
+
+/* Take a checkpoint if checkpoint_interval games have been
+ * processed since the last one.
+ * This is called between games, once the result of a game has
+ * been read and before anything of the next.
+ */
+void
+checkpoint_if_due(void)
+{
+    unsigned file_number;
+    size_t offset;
+    unsigned long lines;
+
+    if (GlobalState.num_games_processed - games_at_checkpoint >=
+                GlobalState.checkpoint_interval &&
+            input_resume_point(&file_number, &offset, &lines)) {
+        write_checkpoint(file_number, offset, lines);
+        games_at_checkpoint = GlobalState.num_games_processed;
+    }
+}
+
+/* The run is complete, so the checkpoint is no longer needed. */
+void
+finish_checkpoints(void)
+{
+    if (journal != NULL) {
+        (void) fclose(journal);
+        journal = NULL;
+    }
+    (void) remove(GlobalState.checkpoint_file);
+    (void) remove(journal_name);
+}
+
+/* Carry on from the checkpoint in place of opening the first input file. */
+void
+resume_from_checkpoint(void)
+{
+    FILE *fp = fopen(GlobalState.checkpoint_file, "r");
+    unsigned num_files, file_number, tag;
+    unsigned long lines, num_tags;
+    size_t offset;
+    long output, duplicates, non_matching, duplicates_source;
+    int version;
+
+    if (fp == NULL) {
+        fprintf(GlobalState.logfile, "Unable to read the checkpoint %s\n",
+                GlobalState.checkpoint_file);
+        exit(1);
+    }
+    if (sscanf(checkpoint_value(fp, "pgn-extract"), "checkpoint %d", &version) != 1 ||
+            version != CHECKPOINT_VERSION) {
+        invalid_checkpoint();
+    }
+    /* The input files must be the same. */
+    num_files = (unsigned) checkpoint_number(fp, "files");
+    for (file_number = 0; file_number < num_files; file_number++) {
+        const char *name = input_file_name(file_number);
+        if (name == NULL || strcmp(checkpoint_value(fp, "input"), name) != 0) {
+            fprintf(GlobalState.logfile,
+                    "The checkpoint %s was taken with different input files.\n",
+                    GlobalState.checkpoint_file);
+            exit(1);
+        }
+    }
+    if (input_file_name(num_files) != NULL) {
+        fprintf(GlobalState.logfile,
+                "The checkpoint %s was taken with different input files.\n",
+                GlobalState.checkpoint_file);
+        exit(1);
+    }
+    file_number = (unsigned) checkpoint_number(fp, "file");
+    offset = (size_t) checkpoint_number(fp, "offset");
+    lines = checkpoint_number(fp, "lines");
+    GlobalState.num_games_processed = checkpoint_number(fp, "processed");
+    GlobalState.num_games_matched = checkpoint_number(fp, "matched");
+    GlobalState.next_file_number = (unsigned) checkpoint_number(fp, "nextfile");
+    output = checkpoint_offset(fp, "output");
+    duplicates = checkpoint_offset(fp, "duplicates");
+    non_matching = checkpoint_offset(fp, "nonmatching");
+    /* The file, if any, named in the duplicate file before its last game. */
+    duplicates_source = checkpoint_offset(fp, "duplicatesfrom");
+    if (duplicates_source >= (long) num_files) {
+        invalid_checkpoint();
+    }
+    else if (duplicates_source >= 0) {
+        set_duplicates_source_file(input_file_name((unsigned) duplicates_source));
+    }
+    journal_length = checkpoint_number(fp, "journal");
+    /* Tags met in the input are numbered in the order they were met,
+     * which must be kept for unknown tags to be output in the same order.
+     */
+    num_tags = checkpoint_number(fp, "tags");
+    for (tag = 0; tag < num_tags; tag++) {
+        if (lookup_tag(checkpoint_value(fp, "tag")) !=
+                (TagName) (ORIGINAL_NUMBER_OF_TAGS + tag)) {
+            invalid_checkpoint();
+        }
+    }
+    (void) fclose(fp);
+
+    /* Rebuild the duplicate table and discard any later journal entries. */
+    journal = fopen(journal_name, "r+b");
+    if (journal != NULL) {
+        if (!replay_duplicate_journal(journal, journal_length) ||
+                ftruncate(fileno(journal), (off_t) ftell(journal)) != 0 ||
+                fseek(journal, 0L, SEEK_END) != 0) {
+            invalid_checkpoint();
+        }
+    }
+    else if (journal_length > 0) {
+        invalid_checkpoint();
+    }
+
+    /* Discard the output written since the checkpoint. */
+    if (GlobalState.games_per_file > 0) {
+        if (output >= 0) {
+            /* Carry on with the file of the last game matched. */
+            char filename[FILENAME_LENGTH];
+
+            sprintf(filename, "%u%s%s",
+                    GlobalState.next_file_number - 1,
+                    output_file_suffix(GlobalState.output_format),
+                    compression_suffix(GlobalState.output_compression));
+            GlobalState.outputfile = must_open_output_file(filename, "a");
+        }
+    }
+    else if ((output >= 0) != (GlobalState.outputfile != stdout)) {
+        invalid_checkpoint();
+    }
+    if (output >= 0) {
+        restore_output_file(GlobalState.outputfile, output);
+    }
+    if ((duplicates >= 0) != (GlobalState.duplicate_file != NULL) ||
+            (non_matching >= 0) != (GlobalState.non_matching_file != NULL)) {
+        invalid_checkpoint();
+    }
+    if (duplicates >= 0) {
+        restore_output_file(GlobalState.duplicate_file, duplicates);
+    }
+    if (non_matching >= 0) {
+        restore_output_file(GlobalState.non_matching_file, non_matching);
+    }
+
+    /* Move past the selected game numbers already dealt with. */
+    GlobalState.next_game_number_to_output =
+            remaining_game_numbers(GlobalState.next_game_number_to_output);
+    GlobalState.next_game_number_to_skip =
+            remaining_game_numbers(GlobalState.next_game_number_to_skip);
+
+    if (!resume_input(file_number, offset, lines)) {
+        fprintf(GlobalState.logfile, "Unable to resume reading %s from the checkpoint %s\n",
+                input_file_name(file_number) != NULL ?
+                    input_file_name(file_number) : "the input",
+                GlobalState.checkpoint_file);
+        exit(1);
+    }
+    games_at_checkpoint = GlobalState.num_games_processed;
+    if (GlobalState.verbosity > 1) {
+        fprintf(GlobalState.logfile, "Resuming %s at line %lu after %lu games.\n",
+                GlobalState.current_input_file, lines + 1,
+                GlobalState.num_games_processed);
+    }
+}
+
+/* Return a copy of name followed by suffix. */
+static char *
+name_with_suffix(const char *name, const char *suffix)
+{
+    char *result = (char *) malloc_or_die(strlen(name) + strlen(suffix) + 1);
+    strcpy(result, name);
+    strcat(result, suffix);
+    return result;
+}
+
+/* Exit unless fp is NULL or a regular file, which can be truncated. */
+static void
+check_output_file(FILE *fp)
+{
+    struct stat details;
+
+    if (fp != NULL &&
+            (fileno(fp) < 0 || fstat(fileno(fp), &details) != 0 ||
+             !S_ISREG(details.st_mode))) {
+        fprintf(GlobalState.logfile,
+                "--checkpoint requires the output files to be regular files.\n");
+        exit(1);
+    }
+}
+
+/* Write out anything buffered for fp and wait for it to reach the disk.
+ * Return FALSE on error.
+ */
+static Boolean
+sync_file(FILE *fp)
+{
+    return fp == NULL || fp == stdout ||
+            (fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+}
+
+/* Return how much has been written to fp, or -1 if it is not in use. */
+static long
+output_offset(FILE *fp)
+{
+    if (fp == NULL || fp == stdout) {
+        return -1;
+    }
+    else {
+        return ftell(fp);
+    }
+}
+
+/* Write a checkpoint from which lexing will resume at offset in
+ * input file file_number, where lines is the number of lines before it.
+ * Failure is reported but is not fatal, as the run can carry on.
+ */
+static void
+write_checkpoint(unsigned file_number, size_t offset, unsigned long lines)
+{
+    char *temp_name = name_with_suffix(GlobalState.checkpoint_file, ".tmp");
+    unsigned file, num_files, tag;
+    Boolean ok = TRUE;
+    FILE *fp;
+
+    /* Everything the checkpoint describes must be on disk before it is. */
+    if (journal == NULL) {
+        journal = fopen(journal_name, "wb");
+    }
+    if (journal == NULL) {
+        ok = FALSE;
+    }
+    else {
+        journal_length += write_duplicate_journal(journal);
+        ok = !ferror(journal) && sync_file(journal);
+    }
+    ok = ok && sync_file(GlobalState.outputfile) &&
+            sync_file(GlobalState.duplicate_file) &&
+            sync_file(GlobalState.non_matching_file);
+
+    fp = ok ? fopen(temp_name, "w") : NULL;
+    if (fp != NULL) {
+        for (num_files = 0; input_file_name(num_files) != NULL; num_files++) {
+        }
+        fprintf(fp, "pgn-extract checkpoint %d\n", CHECKPOINT_VERSION);
+        fprintf(fp, "files %u\n", num_files);
+        for (file = 0; file < num_files; file++) {
+            fprintf(fp, "input %s\n", input_file_name(file));
+        }
+        fprintf(fp, "file %u\n", file_number);
+        fprintf(fp, "offset %lu\n", (unsigned long) offset);
+        fprintf(fp, "lines %lu\n", lines);
+        fprintf(fp, "processed %lu\n", GlobalState.num_games_processed);
+        fprintf(fp, "matched %lu\n", GlobalState.num_games_matched);
+        fprintf(fp, "nextfile %u\n", GlobalState.next_file_number);
+        fprintf(fp, "output %ld\n", output_offset(GlobalState.outputfile));
+        fprintf(fp, "duplicates %ld\n", output_offset(GlobalState.duplicate_file));
+        fprintf(fp, "nonmatching %ld\n", output_offset(GlobalState.non_matching_file));
+        fprintf(fp, "duplicatesfrom %ld\n", source_file_number(duplicates_source_file()));
+        fprintf(fp, "journal %lu\n", journal_length);
+        fprintf(fp, "tags %u\n", number_of_tags() - ORIGINAL_NUMBER_OF_TAGS);
+        for (tag = ORIGINAL_NUMBER_OF_TAGS; tag < number_of_tags(); tag++) {
+            fprintf(fp, "tag %s\n", tag_header_string(tag));
+        }
+        ok = !ferror(fp) && sync_file(fp);
+        if (fclose(fp) != 0) {
+            ok = FALSE;
+        }
+        if (ok && rename(temp_name, GlobalState.checkpoint_file) != 0) {
+            ok = FALSE;
+        }
+    }
+    else {
+        ok = FALSE;
+    }
+    if (!ok) {
+        fprintf(GlobalState.logfile, "Unable to write the checkpoint %s\n",
+                GlobalState.checkpoint_file);
+        (void) remove(temp_name);
+    }
+    (void) free((void *) temp_name);
+}
+
+static void
+invalid_checkpoint(void)
+{
+    fprintf(GlobalState.logfile, "The checkpoint %s does not match this run.\n",
+            GlobalState.checkpoint_file);
+    exit(1);
+}
+
+/* Read the next line of the checkpoint from fp, which must start
+ * with key, and return the rest of it.
+ */
+static char *
+checkpoint_value(FILE *fp, const char *key)
+{
+    static char line[CHECKPOINT_LINE_LENGTH];
+    size_t key_length = strlen(key);
+
+    if (fgets(line, sizeof (line), fp) == NULL ||
+            strncmp(line, key, key_length) != 0 || line[key_length] != ' ') {
+        invalid_checkpoint();
+    }
+    line[strcspn(line, "\n")] = '\0';
+    return line + key_length + 1;
+}
+
+/* Read the number on the next line of the checkpoint, which must
+ * start with key.
+ */
+static unsigned long
+checkpoint_number(FILE *fp, const char *key)
+{
+    const char *value = checkpoint_value(fp, key);
+    char *end;
+    unsigned long number = strtoul(value, &end, 10);
+
+    if (end == value || *end != '\0') {
+        invalid_checkpoint();
+    }
+    return number;
+}
+
+/* Read the length of an output file recorded by the checkpoint:
+ * -1 if the file was not in use.
+ */
+static long
+checkpoint_offset(FILE *fp, const char *key)
+{
+    const char *value = checkpoint_value(fp, key);
+    char *end;
+    long offset = strtol(value, &end, 10);
+
+    if (end == value || *end != '\0' || offset < -1) {
+        invalid_checkpoint();
+    }
+    return offset;
+}
+
+/* Cut fp, opened for appending, back to offset. */
+static void
+restore_output_file(FILE *fp, long offset)
+{
+    struct stat details;
+
+    if (fflush(fp) != 0 || fstat(fileno(fp), &details) != 0 ||
+            details.st_size < (off_t) offset) {
+        fprintf(GlobalState.logfile,
+                "An output file is shorter than when the checkpoint %s was taken.\n",
+                GlobalState.checkpoint_file);
+        exit(1);
+    }
+    if (ftruncate(fileno(fp), (off_t) offset) != 0 ||
+            fseek(fp, 0L, SEEK_END) != 0) {
+        fprintf(GlobalState.logfile,
+                "Unable to restore the output files to the checkpoint %s\n",
+                GlobalState.checkpoint_file);
+        exit(1);
+    }
+}
+
+/* Return the number of the input file with the given name,
+ * or -1 if there is none.
+ */
+static long
+source_file_number(const char *filename)
+{
+    unsigned file_number;
+
+    for (file_number = 0; filename != NULL && input_file_name(file_number) != NULL;
+            file_number++) {
+        if (input_file_name(file_number) == filename) {
+            return (long) file_number;
+        }
+    }
+    return -1;
+}
+
+/* Return the first of the ranges from range not yet passed by
+ * num_games_matched.
+ */
+static game_number *
+remaining_game_numbers(game_number *range)
+{
+    while (range != NULL && range->max <= GlobalState.num_games_matched) {
+        range = range->next;
+    }
+    return range;
+}
+
+#else
+
+void
+check_checkpoint_options(void)
+{
+    fprintf(GlobalState.logfile, "--checkpoint is not supported on this system.\n");
+    exit(1);
+}
+
+void
+checkpoint_if_due(void)
+{
+}
+
+void
+finish_checkpoints(void)
+{
+}
+
+void
+resume_from_checkpoint(void)
+{
+}
+
+#endif
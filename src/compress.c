@@ -0,0 +1,730 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for compressed files of games.
+ * An input file compressed by gzip, xz or zstd is recognised by its
+ * first few bytes and read through a stream that decompresses it,
+ * so that the lexical analyser treats it like any other file.
+ * An output file whose name ends in .gz, .xz or .zst is written
+ * through a stream that compresses it.
+ * Each is supported only if pgn-extract is built with the library
+ * for it, which is selected in the Makefile, and where stdio allows
+ * streams with user-defined read and write functions.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#define COOKIE_STREAMS 1
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+        defined(__OpenBSD__)
+#define FUNOPEN_STREAMS 1
+#endif
+#if COOKIE_STREAMS || FUNOPEN_STREAMS
+#define COMPRESSED_STREAMS 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if COMPRESSED_STREAMS
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_LZMA
+#include <lzma.h>
+#endif
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "compress.h"
+
+static const struct {
+    Compression compression;
+    /* The suffix of a file name. */
+    const char *suffix;
+    /* The name of the compression program. */
+    const char *name;
+    /* The first bytes of a compressed file. */
+    const char *magic;
+    size_t magic_length;
+} compressions[] = {
+    { GZIP_COMPRESSION, ".gz", "gzip", "\x1f\x8b", 2 },
+    { XZ_COMPRESSION, ".xz", "xz", "\xfd" "7zXZ\0", 6 },
+    { ZSTD_COMPRESSION, ".zst", "zstd", "\x28\xb5\x2f\xfd", 4 },
+};
+
+#define NUM_COMPRESSIONS (sizeof (compressions) / sizeof (compressions[0]))
+/* The longest of the magic numbers. */
+#define MAX_MAGIC_LENGTH 6
+
+/* The index in compressions of compression. */
+static unsigned
+compression_index(Compression compression)
+{
+    unsigned i = 0;
+    while (i < NUM_COMPRESSIONS && compressions[i].compression != compression) {
+        i++;
+    }
+    return i;
+}
+
+/* Whether files compressed with compression can be read and written. */
+Boolean
+compression_supported(Compression compression)
+{
+#if COMPRESSED_STREAMS
+    switch (compression) {
+        case NO_COMPRESSION:
+            return TRUE;
+#if HAVE_ZLIB
+        case GZIP_COMPRESSION:
+            return TRUE;
+#endif
+#if HAVE_LZMA
+        case XZ_COMPRESSION:
+            return TRUE;
+#endif
+#if HAVE_ZSTD
+        case ZSTD_COMPRESSION:
+            return TRUE;
+#endif
+        default:
+            return FALSE;
+    }
+#else
+    return compression == NO_COMPRESSION;
+#endif
+}
+
+/* The file name suffix for compression; empty for none. */
+const char *
+compression_suffix(Compression compression)
+{
+    unsigned i = compression_index(compression);
+    return i < NUM_COMPRESSIONS ? compressions[i].suffix : "";
+}
+
+/* The compression called name, which may be its program or its suffix,
+ * or NO_COMPRESSION if it is not known.
+ */
+Compression
+named_compression(const char *name)
+{
+    unsigned i;
+    for (i = 0; i < NUM_COMPRESSIONS; i++) {
+        if (strcmp(name, compressions[i].name) == 0 ||
+                strcmp(name, compressions[i].suffix + 1) == 0) {
+            return compressions[i].compression;
+        }
+    }
+    return NO_COMPRESSION;
+}
+
+/* The compression implied by the suffix of filename. */
+static Compression
+suffix_compression(const char *filename)
+{
+    size_t length = strlen(filename);
+    unsigned i;
+    for (i = 0; i < NUM_COMPRESSIONS; i++) {
+        size_t suffix_length = strlen(compressions[i].suffix);
+        if (length > suffix_length &&
+                strcmp(filename + length - suffix_length, compressions[i].suffix) == 0) {
+            return compressions[i].compression;
+        }
+    }
+    return NO_COMPRESSION;
+}
+
+/* The compression of fp, recognised from its first bytes.
+ * fp must be at its start, and is left there.
+ * A file that cannot be repositioned, such as a pipe, is not examined.
+ */
+static Compression
+input_compression(FILE *fp)
+{
+    Compression compression = NO_COMPRESSION;
+    unsigned char magic[MAX_MAGIC_LENGTH];
+    size_t length;
+    unsigned i;
+
+    if (ftell(fp) != 0) {
+        return NO_COMPRESSION;
+    }
+    length = fread(magic, sizeof (*magic), MAX_MAGIC_LENGTH, fp);
+    for (i = 0; i < NUM_COMPRESSIONS && compression == NO_COMPRESSION; i++) {
+        if (length >= compressions[i].magic_length &&
+                memcmp(magic, compressions[i].magic, compressions[i].magic_length) == 0) {
+            compression = compressions[i].compression;
+        }
+    }
+    if (fseek(fp, 0L, SEEK_SET) != 0) {
+        fprintf(GlobalState.logfile, "Unable to reposition an input file.\n");
+        exit(1);
+    }
+    return compression;
+}
+
+/* Whether filename is a compressed file of games. */
+Boolean
+compressed_input_file(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    Compression compression = NO_COMPRESSION;
+
+    if (fp != NULL) {
+        compression = input_compression(fp);
+        (void) fclose(fp);
+    }
+    return compression != NO_COMPRESSION;
+}
+
+#if COMPRESSED_STREAMS
+
+/* The size of the buffer of compressed data of a stream. */
+#define COMPRESSION_BUFFER_SIZE (64 * 1024)
+
+typedef struct CompressedStream {
+    Compression compression;
+    Boolean writing;
+    /* The compressed file. */
+    FILE *fp;
+    /* The stream through which the file is read or written. */
+    FILE *stream;
+    /* For error messages. */
+    char *filename;
+    /* A buffer of compressed data, and the extent of the data
+     * in it still to be decompressed.
+     */
+    unsigned char *buffer;
+    size_t buffer_start, buffer_end;
+    /* Whether all of fp has been read into buffer. */
+    Boolean end_of_input;
+    /* Whether the compressed data read so far ends a complete stream,
+     * or has failed to decompress.
+     */
+    Boolean end_of_stream, failed;
+#if HAVE_ZLIB
+    z_stream gzip;
+#endif
+#if HAVE_LZMA
+    lzma_stream xz;
+#endif
+#if HAVE_ZSTD
+    ZSTD_DStream *zstd_input;
+    ZSTD_CStream *zstd_output;
+#endif
+    /* The process that opened the stream. */
+    pid_t owner;
+    struct CompressedStream *next;
+} CompressedStream;
+
+/* The output streams still open, which must be closed on exit
+ * so that the ends of their compressed data are written.
+ */
+static CompressedStream *open_output_streams = NULL;
+
+/* Run the compressor or decompressor of the stream on the data at *in,
+ * of in_length, putting the result at *out, with room for out_length.
+ * Both pointers are advanced past the data consumed and produced.
+ * When writing, finish asks for the compressed data to be completed;
+ * when reading, it indicates that there is no more input.
+ * Return 1 when the compressed data is complete, 0 if it is not,
+ * and -1 on error.
+ */
+static int
+run_codec(CompressedStream *stream, const unsigned char **in, size_t in_length,
+        unsigned char **out, size_t out_length, Boolean finish)
+{
+    switch (stream->compression) {
+#if HAVE_ZLIB
+        case GZIP_COMPRESSION: {
+            z_stream *gzip = &stream->gzip;
+            int result;
+
+            gzip->next_in = (Bytef *) *in;
+            gzip->avail_in = (uInt) in_length;
+            gzip->next_out = (Bytef *) *out;
+            gzip->avail_out = (uInt) out_length;
+            if (stream->writing) {
+                result = deflate(gzip, finish ? Z_FINISH : Z_NO_FLUSH);
+            }
+            else {
+                result = inflate(gzip, Z_NO_FLUSH);
+            }
+            *in = (const unsigned char *) gzip->next_in;
+            *out = (unsigned char *) gzip->next_out;
+            if (result == Z_STREAM_END) {
+                if (!stream->writing) {
+                    /* Another member may follow. */
+                    (void) inflateReset(gzip);
+                }
+                return 1;
+            }
+            return result == Z_OK || result == Z_BUF_ERROR ? 0 : -1;
+        }
+#endif
+#if HAVE_LZMA
+        case XZ_COMPRESSION: {
+            lzma_stream *xz = &stream->xz;
+            lzma_ret result;
+
+            xz->next_in = *in;
+            xz->avail_in = in_length;
+            xz->next_out = *out;
+            xz->avail_out = out_length;
+            result = lzma_code(xz, finish ? LZMA_FINISH : LZMA_RUN);
+            *in = xz->next_in;
+            *out = xz->next_out;
+            if (result == LZMA_STREAM_END) {
+                return 1;
+            }
+            return result == LZMA_OK || result == LZMA_BUF_ERROR ? 0 : -1;
+        }
+#endif
+#if HAVE_ZSTD
+        case ZSTD_COMPRESSION: {
+            ZSTD_inBuffer input;
+            ZSTD_outBuffer output;
+            size_t result;
+
+            input.src = *in;
+            input.size = in_length;
+            input.pos = 0;
+            output.dst = *out;
+            output.size = out_length;
+            output.pos = 0;
+            if (stream->writing) {
+                result = ZSTD_compressStream2(stream->zstd_output, &output, &input,
+                        finish ? ZSTD_e_end : ZSTD_e_continue);
+            }
+            else {
+                result = ZSTD_decompressStream(stream->zstd_input, &output, &input);
+            }
+            *in += input.pos;
+            *out += output.pos;
+            if (ZSTD_isError(result)) {
+                return -1;
+            }
+            /* Zero means that a frame has been completed and flushed. */
+            return result == 0 ? 1 : 0;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+/* Read up to size bytes of decompressed data into data.
+ * Return the number read, which is 0 at the end of the file.
+ */
+static ssize_t
+read_compressed(void *cookie, char *data, size_t size)
+{
+    CompressedStream *stream = (CompressedStream *) cookie;
+    unsigned char *out = (unsigned char *) data;
+
+    if (size > COMPRESSION_BUFFER_SIZE) {
+        size = COMPRESSION_BUFFER_SIZE;
+    }
+    while (out == (unsigned char *) data && !stream->failed) {
+        const unsigned char *in;
+        int result;
+
+        if (stream->buffer_start == stream->buffer_end) {
+            if (stream->end_of_input) {
+                break;
+            }
+            stream->buffer_start = 0;
+            stream->buffer_end = fread(stream->buffer, sizeof (*stream->buffer),
+                    COMPRESSION_BUFFER_SIZE, stream->fp);
+            stream->end_of_input = stream->buffer_end == 0;
+        }
+        in = stream->buffer + stream->buffer_start;
+        result = run_codec(stream, &in, stream->buffer_end - stream->buffer_start,
+                &out, size, stream->end_of_input);
+        if (in != stream->buffer + stream->buffer_start) {
+            stream->end_of_stream = FALSE;
+        }
+        stream->buffer_start = in - stream->buffer;
+        if (result < 0) {
+            stream->failed = TRUE;
+        }
+        else if (result > 0) {
+            stream->end_of_stream = TRUE;
+        }
+        else if (stream->end_of_input && out == (unsigned char *) data) {
+            /* No progress can be made. */
+            break;
+        }
+    }
+    if (!stream->failed && stream->end_of_input && out == (unsigned char *) data &&
+            !stream->end_of_stream) {
+        stream->failed = TRUE;
+    }
+    if (stream->failed && out == (unsigned char *) data) {
+        fprintf(GlobalState.logfile, "Unable to decompress all of %s.\n",
+                stream->filename);
+        stream->end_of_stream = TRUE;
+        stream->end_of_input = TRUE;
+        stream->buffer_start = stream->buffer_end;
+        stream->failed = FALSE;
+    }
+    return out - (unsigned char *) data;
+}
+
+/* Compress the size bytes of data. */
+static ssize_t
+write_compressed(void *cookie, const char *data, size_t size)
+{
+    CompressedStream *stream = (CompressedStream *) cookie;
+    const unsigned char *in = (const unsigned char *) data;
+    const unsigned char *end = in + size;
+
+    while (in < end) {
+        size_t in_length = (size_t) (end - in) < COMPRESSION_BUFFER_SIZE ?
+                (size_t) (end - in) : COMPRESSION_BUFFER_SIZE;
+        unsigned char *out = stream->buffer;
+
+        if (run_codec(stream, &in, in_length, &out,
+                    COMPRESSION_BUFFER_SIZE, FALSE) < 0 ||
+                fwrite(stream->buffer, sizeof (*stream->buffer),
+                    out - stream->buffer, stream->fp) != (size_t) (out - stream->buffer)) {
+            return -1;
+        }
+    }
+    return size;
+}
+
+/* Complete the compressed data of a stream being written. */
+static Boolean
+finish_compressed(CompressedStream *stream)
+{
+    int result;
+
+    do {
+        const unsigned char *in = stream->buffer;
+        unsigned char *out = stream->buffer;
+
+        result = run_codec(stream, &in, 0, &out, COMPRESSION_BUFFER_SIZE, TRUE);
+        if (result < 0 ||
+                fwrite(stream->buffer, sizeof (*stream->buffer),
+                    out - stream->buffer, stream->fp) != (size_t) (out - stream->buffer)) {
+            return FALSE;
+        }
+    } while (result == 0);
+    return TRUE;
+}
+
+/* Release the codec of a stream. */
+static void
+end_codec(CompressedStream *stream)
+{
+    switch (stream->compression) {
+#if HAVE_ZLIB
+        case GZIP_COMPRESSION:
+            if (stream->writing) {
+                (void) deflateEnd(&stream->gzip);
+            }
+            else {
+                (void) inflateEnd(&stream->gzip);
+            }
+            break;
+#endif
+#if HAVE_LZMA
+        case XZ_COMPRESSION:
+            lzma_end(&stream->xz);
+            break;
+#endif
+#if HAVE_ZSTD
+        case ZSTD_COMPRESSION:
+            if (stream->writing) {
+                (void) ZSTD_freeCStream(stream->zstd_output);
+            }
+            else {
+                (void) ZSTD_freeDStream(stream->zstd_input);
+            }
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+/* Close a stream, completing its data if it is being written. */
+static int
+close_compressed(void *cookie)
+{
+    CompressedStream *stream = (CompressedStream *) cookie;
+    Boolean ok = TRUE;
+
+    if (stream->writing) {
+        CompressedStream **link = &open_output_streams;
+
+        ok = finish_compressed(stream);
+        while (*link != NULL && *link != stream) {
+            link = &(*link)->next;
+        }
+        if (*link != NULL) {
+            *link = stream->next;
+        }
+        if (!ok) {
+            fprintf(GlobalState.logfile, "Unable to write all of %s.\n",
+                    stream->filename);
+        }
+    }
+    end_codec(stream);
+    if (fclose(stream->fp) != 0) {
+        ok = FALSE;
+    }
+    (void) free((void *) stream->buffer);
+    (void) free((void *) stream->filename);
+    (void) free((void *) stream);
+    return ok ? 0 : EOF;
+}
+
+/* Close any output streams left open at exit. */
+static void
+close_output_streams(void)
+{
+    pid_t process = getpid();
+    CompressedStream **link = &open_output_streams;
+
+    while (*link != NULL) {
+        if ((*link)->owner == process) {
+            /* Closing the stream removes it from the list. */
+            (void) fclose((*link)->stream);
+        }
+        else {
+            /* A copy inherited by a worker process (--threads). */
+            link = &(*link)->next;
+        }
+    }
+}
+
+#endif
+
+/* Arrange for the compressed output streams to be closed at exit.
+ * This is done when the first of them is opened, unless it has
+ * already been called so that another module's handler for exit
+ * runs before this one.
+ */
+void
+close_compressed_output_at_exit(void)
+{
+#if COMPRESSED_STREAMS
+    static Boolean registered = FALSE;
+
+    if (!registered) {
+        (void) atexit(close_output_streams);
+        registered = TRUE;
+    }
+#endif
+}
+
+#if COMPRESSED_STREAMS
+#if FUNOPEN_STREAMS
+static int
+funopen_read(void *cookie, char *data, int size)
+{
+    return (int) read_compressed(cookie, data, (size_t) size);
+}
+
+static int
+funopen_write(void *cookie, const char *data, int size)
+{
+    return (int) write_compressed(cookie, data, (size_t) size);
+}
+#endif
+
+/* Prepare the codec of a new stream.
+ * Return FALSE if that is not possible.
+ */
+static Boolean
+start_codec(CompressedStream *stream)
+{
+    switch (stream->compression) {
+#if HAVE_ZLIB
+        case GZIP_COMPRESSION:
+            memset(&stream->gzip, 0, sizeof (stream->gzip));
+            if (stream->writing) {
+                /* A gzip rather than a zlib header is written. */
+                return deflateInit2(&stream->gzip, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            }
+            else {
+                /* The header is recognised automatically. */
+                return inflateInit2(&stream->gzip, 15 + 32) == Z_OK;
+            }
+#endif
+#if HAVE_LZMA
+        case XZ_COMPRESSION: {
+            lzma_stream initial = LZMA_STREAM_INIT;
+
+            stream->xz = initial;
+            if (stream->writing) {
+                return lzma_easy_encoder(&stream->xz, LZMA_PRESET_DEFAULT,
+                        LZMA_CHECK_CRC64) == LZMA_OK;
+            }
+            else {
+                return lzma_stream_decoder(&stream->xz, UINT64_MAX,
+                        LZMA_CONCATENATED) == LZMA_OK;
+            }
+        }
+#endif
+#if HAVE_ZSTD
+        case ZSTD_COMPRESSION:
+            if (stream->writing) {
+                stream->zstd_output = ZSTD_createCStream();
+                if (stream->zstd_output != NULL && GlobalState.num_threads > 1) {
+                    /* This has no effect if the library lacks threads. */
+                    (void) ZSTD_CCtx_setParameter(stream->zstd_output,
+                            ZSTD_c_nbWorkers, (int) GlobalState.num_threads);
+                }
+                return stream->zstd_output != NULL;
+            }
+            else {
+                stream->zstd_input = ZSTD_createDStream();
+                return stream->zstd_input != NULL &&
+                        !ZSTD_isError(ZSTD_initDStream(stream->zstd_input));
+            }
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+/* Return a stream through which fp, compressed with compression,
+ * is read or written, or NULL if this is not possible.
+ */
+static FILE *
+open_stream(FILE *fp, Compression compression, Boolean writing,
+        const char *filename)
+{
+    CompressedStream *stream = (CompressedStream *) malloc_or_die(sizeof (*stream));
+
+    stream->compression = compression;
+    stream->writing = writing;
+    stream->fp = fp;
+    stream->stream = NULL;
+    stream->filename = copy_string(filename);
+    stream->buffer = (unsigned char *) malloc_or_die(COMPRESSION_BUFFER_SIZE);
+    stream->buffer_start = stream->buffer_end = 0;
+    stream->end_of_input = FALSE;
+    stream->end_of_stream = FALSE;
+    stream->failed = FALSE;
+    stream->owner = getpid();
+    stream->next = NULL;
+    if (start_codec(stream)) {
+#if COOKIE_STREAMS
+        cookie_io_functions_t functions;
+
+        functions.read = writing ? NULL : read_compressed;
+        functions.write = writing ? write_compressed : NULL;
+        functions.seek = NULL;
+        functions.close = close_compressed;
+        stream->stream = fopencookie(stream, writing ? "w" : "r", functions);
+#else
+        stream->stream = funopen(stream, writing ? NULL : funopen_read,
+                writing ? funopen_write : NULL, NULL, close_compressed);
+#endif
+        if (stream->stream == NULL) {
+            end_codec(stream);
+        }
+    }
+    if (stream->stream == NULL) {
+        (void) free((void *) stream->buffer);
+        (void) free((void *) stream->filename);
+        (void) free((void *) stream);
+        return NULL;
+    }
+    if (writing) {
+        close_compressed_output_at_exit();
+        stream->next = open_output_streams;
+        open_output_streams = stream;
+    }
+    return stream->stream;
+}
+#endif
+
+/* Return the stream from which the games of fp, which has been opened
+ * from filename, should be read.
+ * This is fp unless it is compressed.
+ * Return NULL, having closed fp, if it cannot be decompressed.
+ */
+FILE *
+open_compressed_input(FILE *fp, const char *filename)
+{
+    Compression compression = input_compression(fp);
+    FILE *stream = NULL;
+
+    if (compression == NO_COMPRESSION) {
+        return fp;
+    }
+#if COMPRESSED_STREAMS
+    if (compression_supported(compression)) {
+        stream = open_stream(fp, compression, FALSE, filename);
+    }
+#endif
+    if (stream == NULL) {
+        fprintf(GlobalState.logfile,
+                "%s is compressed with %s, which is not supported.\n",
+                filename, compressions[compression_index(compression)].name);
+        (void) fclose(fp);
+    }
+    return stream;
+}
+
+/* Return the stream to which games should be written for the
+ * output file fp, which has been opened from filename.
+ * This is fp unless the suffix of filename implies compression.
+ * Error and exit if the compression is not supported.
+ */
+FILE *
+open_compressed_output(FILE *fp, const char *filename)
+{
+    Compression compression = suffix_compression(filename);
+    FILE *stream = NULL;
+
+    if (compression == NO_COMPRESSION) {
+        return fp;
+    }
+#if COMPRESSED_STREAMS
+    if (compression_supported(compression)) {
+        stream = open_stream(fp, compression, TRUE, filename);
+    }
+#endif
+    if (stream == NULL) {
+        fprintf(GlobalState.logfile,
+                "Unable to write %s: %s compression is not supported.\n",
+                filename, compressions[compression_index(compression)].name);
+        exit(1);
+    }
+    return stream;
+}
@@ -0,0 +1,37 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+/* The longest suffix returned by compression_suffix. */
+#define MAX_COMPRESSION_SUFFIX 4
+
+Boolean compression_supported(Compression compression);
+const char *compression_suffix(Compression compression);
+Compression named_compression(const char *name);
+Boolean compressed_input_file(const char *filename);
+FILE *open_compressed_input(FILE *fp, const char *filename);
+FILE *open_compressed_output(FILE *fp, const char *filename);
+void close_compressed_output_at_exit(void);
+
+#endif	// COMPRESS_H
@@ -32,6 +32,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include "bool.h"
 #include "mymalloc.h"
 #include "defs.h"
@@ -132,17 +133,14 @@ is_check(char c)
 Move *
 new_move_structure(void)
 {
-    Move *move = (Move *) malloc_or_die(sizeof (Move));
+    Move *move = (Move *) arena_malloc(sizeof (Move));
 
     move->terminating_result = NULL;
     move->piece_to_move = EMPTY;
     move->captured_piece = EMPTY;
     move->promoted_piece = EMPTY;
     move->check_status = NOCHECK;
-    move->epd = NULL;
-    move->fen_suffix = NULL;
-    move->zobrist = ~0;
-    move->evaluation = 0;
+    move->annotation = NULL;
     move->NAGs = NULL;
     move->comment_list = NULL;
     move->Variants = NULL;
@@ -151,6 +149,99 @@ new_move_structure(void)
     return move;
 }
 
+/* Return the annotation details of move, allocating them
+ * if this is the first to be set.
+ */
+MoveAnnotation *
+annotate_move(Move *move)
+{
+    if (move->annotation == NULL) {
+        MoveAnnotation *annotation =
+                (MoveAnnotation *) arena_malloc(sizeof (*annotation));
+        annotation->epd = NULL;
+        annotation->fen_suffix = NULL;
+        annotation->zobrist = ~0;
+        annotation->evaluation = 0;
+        annotation->no_evaluation = FALSE;
+        move->annotation = annotation;
+    }
+    return move->annotation;
+}
+
+/* The details decoded from the text of a move, which depend only
+ * on that text and not on the position in which it is played.
+ */
+typedef struct {
+    unsigned char move[MAX_MOVE_LEN+1];
+    unsigned char class;
+    unsigned char piece_to_move;
+    Col from_col;
+    Rank from_rank;
+    Col to_col;
+    Rank to_rank;
+} DecodedMove;
+
+/* Most moves are drawn from a small vocabulary, such as e4, Nf3 and
+ * O-O, so the decoded details of recently seen moves are kept in a
+ * table indexed by a hash of their text, each new move replacing any
+ * other with the same index.
+ * Only moves that decode without error are kept, so that any errors
+ * are reported every time.
+ */
+#define DECODED_MOVE_TABLE_SIZE 4096
+static DecodedMove decoded_moves[DECODED_MOVE_TABLE_SIZE];
+
+static Move *decode_move_text(const unsigned char *move_string);
+
+/* Return the entry of decoded_moves for move_string. */
+static DecodedMove *
+decoded_move_entry(const unsigned char *move_string)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    const unsigned char *c;
+
+    for (c = move_string; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return &decoded_moves[hash % DECODED_MOVE_TABLE_SIZE];
+}
+
+/* Return a new Move for move_string, with the details that
+ * can be gleaned from its text.
+ */
+Move *
+decode_move(const unsigned char *move_string)
+{
+    DecodedMove *entry = decoded_move_entry(move_string);
+    Move *move_details;
+
+    if (entry->move[0] != '\0' &&
+            strcmp((const char *) entry->move, (const char *) move_string) == 0) {
+        move_details = new_move_structure();
+        strcpy((char *) move_details->move, (const char *) move_string);
+        move_details->class = entry->class;
+        move_details->piece_to_move = entry->piece_to_move;
+        move_details->from_col = entry->from_col;
+        move_details->from_rank = entry->from_rank;
+        move_details->to_col = entry->to_col;
+        move_details->to_rank = entry->to_rank;
+    }
+    else {
+        move_details = decode_move_text(move_string);
+        if (move_details->class != UNKNOWN_MOVE) {
+            strcpy((char *) entry->move, (const char *) move_string);
+            entry->class = move_details->class;
+            entry->piece_to_move = move_details->piece_to_move;
+            entry->from_col = move_details->from_col;
+            entry->from_rank = move_details->from_rank;
+            entry->to_col = move_details->to_col;
+            entry->to_rank = move_details->to_rank;
+        }
+    }
+    return move_details;
+}
+
 /* Work out whatever can be gleaned from move_string of
  * the starting and ending points of the given move.
  * The move may be any legal string.
@@ -158,8 +249,8 @@ new_move_structure(void)
  * illegal moves having already been filtered out by the process
  * of lexical analysis.
  */
-Move *
-decode_move(const unsigned char *move_string)
+static Move *
+decode_move_text(const unsigned char *move_string)
 { /* The four components of the co-ordinates when known. */
     Rank from_rank = 0, to_rank = 0;
     Col from_col = 0, to_col = 0;
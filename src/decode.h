@@ -23,6 +23,7 @@
 #define DECODE_H
 
 Move *new_move_structure(void);
+MoveAnnotation *annotate_move(Move *move);
 Piece is_piece(const unsigned char *move);
 Move *decode_move(const unsigned char *move_string);
 Move *decode_algebraic(Move *move_details, Board *board);
@@ -112,9 +112,9 @@ typedef struct {
      * that really needs updating to properly use the Zobrist hash.
      */
     HashCode weak_hash_value;
-    /* Provision for storing a Zobrist hash value. However,
-     * this is only set if GlobalState.add_hashcode_comments.
-     * At some point, it should supersede the weak_hash_value.
+    /* The piece placement component of the Zobrist hash value,
+     * maintained alongside weak_hash_value by make_move().
+     * generate_zobrist_hash_from_board() adds the remaining components.
      */
     uint64_t zobrist;
     /* The half-move clock since the last pawn move or capture. */
@@ -0,0 +1,610 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for duplicate detection split across several runs, for
+ * collections whose duplicate table is too large for one machine.
+ *     --dupscan prefix: each run checks its own share of the input
+ *         files and, instead of looking each game up, writes its hash
+ *         values to one of --dupshards files, prefix.0, prefix.1, ...,
+ *         chosen by the high bits of the value that it is stored under.
+ *     --dupmerge file: the shard files of the same number from every
+ *         run, given in the order of the runs as the input files,
+ *         are merged into a file of the games that they show to be
+ *         duplicates. Only the games of one shard are held in memory.
+ *     --dupresolve prefix: a run over all of the input files, in the
+ *         order of the runs, takes its duplicates from the merged
+ *         files prefix.0, prefix.1, ... rather than its own table.
+ * The merge decides each game in the same way as previous_occurance,
+ * in the order of the input, so the final run treats the same games
+ * as duplicates, with the same "First found in" files, as a single
+ * run would. The exception is that, with --fuzzydepth, a game that
+ * reaches the fuzzy depth is only compared with the games in its own
+ * shard, so a coincidence of both its final and cumulative hash values
+ * with those of a shorter game would no longer be found.
+ * The games are counted in the order in which they are checked, so
+ * every run must use the same selection criteria.
+ * Values are stored in native byte order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "hashing.h"
+#include "dupshard.h"
+
+#define SHARD_MAGIC "PGNDUPSH"
+#define MERGED_MAGIC "PGNDUPMG"
+#define SHARD_VERSION 1
+
+/* The header of both a shard file and a merged file.
+ * It is followed by num_files names, each as a uint32_t length and
+ * its characters, and then num_records ShardRecord or MergedRecord
+ * values.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    /* The duplicate settings of the run. */
+    uint32_t fuzzy;
+    uint32_t fuzzy_depth;
+    uint32_t num_shards;
+    uint32_t shard;
+    uint32_t num_files;
+    /* The number of games checked for duplicates by the run or runs. */
+    uint64_t num_games;
+    uint64_t num_records;
+} ShardHeader;
+
+/* A game checked by a --dupscan run. */
+typedef struct {
+    HashCode final_hash_value, cumulative_hash_value, fuzzy_hash_value;
+    /* The number of games checked before this one. */
+    uint64_t game;
+    uint32_t file_number;
+    /* Whether the game reached the fuzzy_match_depth. */
+    uint32_t reached_fuzzy_depth;
+} ShardRecord;
+
+/* A game found to be a duplicate by --dupmerge. */
+typedef struct {
+    /* The number of games checked, by all of the runs, before this one. */
+    uint64_t game;
+    /* The input file of the final run in which it was first found. */
+    uint32_t original_file;
+    uint32_t unused;
+} MergedRecord;
+
+/* A shard being written, by --dupscan, or read, by --dupresolve. */
+typedef struct {
+    FILE *fp;
+    char *filename;
+    ShardHeader header;
+    /* For --dupresolve, the next duplicate and whether there is one. */
+    MergedRecord next;
+    Boolean have_next;
+} Shard;
+
+static Shard *shards = NULL;
+/* The number of games checked for duplicates so far. */
+static uint64_t games_checked = 0;
+/* For --dupresolve, the number of games checked by the runs merged. */
+static uint64_t games_merged = 0;
+
+static void shard_file_error(const char *action, const char *filename);
+
+/* Return the name of shard number shard with the given prefix. */
+static char *
+shard_filename(const char *prefix, unsigned shard)
+{
+    char *filename = (char *) malloc_or_die(strlen(prefix) + 12);
+
+    sprintf(filename, "%s.%u", prefix, shard);
+    return filename;
+}
+
+/* Set header to the details of this run, with the given magic number. */
+static void
+init_shard_header(ShardHeader *header, const char *magic, unsigned shard,
+                  unsigned num_files)
+{
+    memset((void *) header, 0, sizeof (*header));
+    memcpy(header->magic, magic, sizeof (header->magic));
+    header->version = SHARD_VERSION;
+    header->fuzzy = GlobalState.fuzzy_match_duplicates ? 1 : 0;
+    header->fuzzy_depth = GlobalState.fuzzy_match_duplicates ?
+            (uint32_t) GlobalState.fuzzy_match_depth : 0;
+    header->num_shards = GlobalState.duplicate_shards;
+    header->shard = shard;
+    header->num_files = num_files;
+}
+
+/* Write header to the start of fp, followed by the names of the input
+ * files of this run if with_names.
+ * Return FALSE on error.
+ */
+static Boolean
+write_shard_header(FILE *fp, const ShardHeader *header, Boolean with_names)
+{
+    Boolean ok = fseek(fp, 0L, SEEK_SET) == 0 &&
+            fwrite((const void *) header, sizeof (*header), 1, fp) == 1;
+    unsigned file_number;
+
+    for (file_number = 0; ok && with_names && file_number < header->num_files;
+            file_number++) {
+        const char *name = input_file_name(file_number);
+        uint32_t length = (uint32_t) strlen(name);
+
+        ok = fwrite((const void *) &length, sizeof (length), 1, fp) == 1 &&
+                fwrite((const void *) name, 1, length, fp) == length;
+    }
+    return ok;
+}
+
+/* Read the header of filename from fp, which must have the given magic
+ * number, and its names of input files.
+ * Return the names, of which there are header->num_files.
+ */
+static char **
+read_shard_header(FILE *fp, const char *filename, const char *magic,
+                  ShardHeader *header)
+{
+    char **names;
+    uint32_t i;
+
+    if (fread((void *) header, sizeof (*header), 1, fp) != 1 ||
+            memcmp(header->magic, magic, sizeof (header->magic)) != 0 ||
+            header->version != SHARD_VERSION) {
+        fprintf(GlobalState.logfile, "%s is not a %s file.\n", filename,
+                strcmp(magic, SHARD_MAGIC) == 0 ? "--dupscan" : "--dupmerge");
+        exit(1);
+    }
+    names = (char **) malloc_or_die((header->num_files + 1) * sizeof (*names));
+    for (i = 0; i < header->num_files; i++) {
+        uint32_t length;
+
+        if (fread((void *) &length, sizeof (length), 1, fp) != 1) {
+            shard_file_error("read", filename);
+        }
+        names[i] = (char *) malloc_or_die(length + 1);
+        if (fread((void *) names[i], 1, length, fp) != length) {
+            shard_file_error("read", filename);
+        }
+        names[i][length] = '\0';
+    }
+    names[header->num_files] = NULL;
+    return names;
+}
+
+static void
+free_names(char **names)
+{
+    unsigned i;
+
+    for (i = 0; names[i] != NULL; i++) {
+        (void) free((void *) names[i]);
+    }
+    (void) free((void *) names);
+}
+
+/* Check that a shard's duplicate settings are those in use. */
+static void
+check_shard_settings(const ShardHeader *header, const char *filename)
+{
+    ShardHeader expected;
+
+    init_shard_header(&expected, SHARD_MAGIC, header->shard, 0);
+    if (header->fuzzy != expected.fuzzy ||
+            header->fuzzy_depth != expected.fuzzy_depth) {
+        fprintf(GlobalState.logfile,
+                "The --fuzzydepth of %s differs from that of this run.\n",
+                filename);
+        exit(1);
+    }
+}
+
+static void
+shard_file_error(const char *action, const char *filename)
+{
+    fprintf(GlobalState.logfile, "Unable to %s %s\n", action, filename);
+    exit(1);
+}
+
+/* Return the number of input files, which there must be. */
+static unsigned
+number_of_input_files(const char *option)
+{
+    unsigned num_files = 0;
+
+    while (input_file_name(num_files) != NULL) {
+        num_files++;
+    }
+    if (num_files == 0) {
+        fprintf(GlobalState.logfile,
+                "%s cannot be used with standard input.\n", option);
+        exit(1);
+    }
+    return num_files;
+}
+
+/* Open the shard files of --dupscan and write their headers. */
+static void
+open_scan_shards(void)
+{
+    unsigned num_files = number_of_input_files("--dupscan");
+    unsigned shard;
+
+    for (shard = 0; shard < GlobalState.duplicate_shards; shard++) {
+        Shard *s = &shards[shard];
+
+        s->filename = shard_filename(GlobalState.duplicate_scan_prefix, shard);
+        s->fp = fopen(s->filename, "wb");
+        init_shard_header(&s->header, SHARD_MAGIC, shard, num_files);
+        if (s->fp == NULL || !write_shard_header(s->fp, &s->header, TRUE)) {
+            shard_file_error("write", s->filename);
+        }
+    }
+}
+
+/* Read the next duplicate of shard s, if there is one. */
+static void
+read_next_duplicate(Shard *s)
+{
+    s->have_next = s->header.num_records > 0 &&
+            fread((void *) &s->next, sizeof (s->next), 1, s->fp) == 1;
+    if (s->header.num_records > 0 && !s->have_next) {
+        shard_file_error("read", s->filename);
+    }
+    else if (s->have_next) {
+        s->header.num_records--;
+        if (s->next.original_file >= s->header.num_files) {
+            fprintf(GlobalState.logfile, "%s is not a --dupmerge file.\n",
+                    s->filename);
+            exit(1);
+        }
+    }
+}
+
+/* Open the merged files of --dupresolve and check that they were
+ * made from runs over this run's input files.
+ */
+static void
+open_merged_shards(void)
+{
+    unsigned num_files = number_of_input_files("--dupresolve");
+    unsigned shard;
+
+    for (shard = 0; shard < GlobalState.duplicate_shards; shard++) {
+        Shard *s = &shards[shard];
+        char **names;
+        unsigned file_number;
+
+        s->filename = shard_filename(GlobalState.duplicate_resolve_prefix, shard);
+        s->fp = fopen(s->filename, "rb");
+        if (s->fp == NULL) {
+            shard_file_error("open", s->filename);
+        }
+        names = read_shard_header(s->fp, s->filename, MERGED_MAGIC, &s->header);
+        check_shard_settings(&s->header, s->filename);
+        if (s->header.num_shards != GlobalState.duplicate_shards ||
+                s->header.shard != shard) {
+            fprintf(GlobalState.logfile,
+                    "%s is not shard %u of %u.\n", s->filename, shard,
+                    GlobalState.duplicate_shards);
+            exit(1);
+        }
+        if (shard == 0) {
+            games_merged = s->header.num_games;
+        }
+        else if (s->header.num_games != games_merged) {
+            fprintf(GlobalState.logfile,
+                    "%s was not merged from the same runs as %s.\n",
+                    s->filename, shards[0].filename);
+            exit(1);
+        }
+        for (file_number = 0; file_number < num_files &&
+                names[file_number] != NULL &&
+                strcmp(names[file_number], input_file_name(file_number)) == 0;
+                file_number++) {
+        }
+        if (file_number < num_files || names[file_number] != NULL) {
+            fprintf(GlobalState.logfile,
+                    "The input files differ from those of the runs merged into %s.\n",
+                    s->filename);
+            exit(1);
+        }
+        free_names(names);
+        read_next_duplicate(s);
+    }
+}
+
+/* Check the settings of --dupscan, --dupmerge and --dupresolve, and
+ * open the files of --dupscan and --dupresolve.
+ */
+void
+check_duplicate_shard_options(void)
+{
+    const char *clash = NULL;
+    int modes = (GlobalState.duplicate_scan_prefix != NULL) +
+            (GlobalState.duplicate_merge_file != NULL) +
+            (GlobalState.duplicate_resolve_prefix != NULL);
+
+    if (modes > 1) {
+        fprintf(GlobalState.logfile,
+                "Only one of --dupscan, --dupmerge and --dupresolve may be used.\n");
+        exit(1);
+    }
+    if (GlobalState.duplicate_index_file != NULL) {
+        clash = "--dupindex";
+    }
+    else if (GlobalState.batch_file != NULL) {
+        clash = "--batch";
+    }
+    else if (GlobalState.checkpoint_file != NULL) {
+        clash = "--checkpoint";
+    }
+    else if (GlobalState.position_index_file != NULL) {
+        clash = "--posindex";
+    }
+    else if (GlobalState.num_threads > 1) {
+        clash = "--threads";
+    }
+    if (clash != NULL) {
+        fprintf(GlobalState.logfile,
+                "--dupscan, --dupmerge and --dupresolve cannot be used with %s.\n",
+                clash);
+        exit(1);
+    }
+    if (GlobalState.duplicate_merge_file == NULL) {
+        shards = (Shard *) malloc_or_die(GlobalState.duplicate_shards * sizeof (*shards));
+        memset((void *) shards, 0, GlobalState.duplicate_shards * sizeof (*shards));
+        if (GlobalState.duplicate_scan_prefix != NULL) {
+            open_scan_shards();
+            /* The games cannot be told apart until the final run. */
+            GlobalState.check_only = TRUE;
+        }
+        else {
+            open_merged_shards();
+        }
+    }
+}
+
+/* Write the hash values of a game being checked for duplicates
+ * to its shard, for --dupscan.
+ * fuzzy_hash_value is the value under which the game would be stored
+ * if reached_fuzzy_depth, and the shard is chosen by the value under
+ * which it would be stored.
+ */
+void
+record_shard_game(HashCode final_hash_value, HashCode cumulative_hash_value,
+                  HashCode fuzzy_hash_value, Boolean reached_fuzzy_depth,
+                  unsigned file_number)
+{
+    HashCode stored_value = reached_fuzzy_depth ? fuzzy_hash_value :
+            final_hash_value;
+    Shard *s = &shards[(stored_value >> 32) % GlobalState.duplicate_shards];
+    ShardRecord record;
+
+    memset((void *) &record, 0, sizeof (record));
+    record.final_hash_value = final_hash_value;
+    record.cumulative_hash_value = cumulative_hash_value;
+    record.fuzzy_hash_value = fuzzy_hash_value;
+    record.game = games_checked++;
+    record.file_number = file_number;
+    record.reached_fuzzy_depth = reached_fuzzy_depth;
+    if (fwrite((const void *) &record, sizeof (record), 1, s->fp) != 1) {
+        shard_file_error("write", s->filename);
+    }
+    s->header.num_records++;
+}
+
+/* Return the name of the file in which the next game checked for
+ * duplicates was first found, or NULL if it is not a duplicate,
+ * for --dupresolve.
+ */
+const char *
+resolved_occurance(void)
+{
+    const char *original_filename = NULL;
+    unsigned shard;
+
+    if (games_checked >= games_merged) {
+        fprintf(GlobalState.logfile,
+                "More games have been checked for duplicates than were by the runs merged into %s.\n",
+                shards[0].filename);
+        exit(1);
+    }
+    for (shard = 0; shard < GlobalState.duplicate_shards &&
+            original_filename == NULL; shard++) {
+        Shard *s = &shards[shard];
+
+        if (s->have_next && s->next.game == games_checked) {
+            original_filename = input_file_name(s->next.original_file);
+            read_next_duplicate(s);
+        }
+    }
+    games_checked++;
+    return original_filename;
+}
+
+/* Complete the files of --dupscan, or check that --dupresolve
+ * has used all of its duplicates.
+ */
+void
+finish_duplicate_shards(void)
+{
+    unsigned shard;
+
+    for (shard = 0; shard < GlobalState.duplicate_shards; shard++) {
+        Shard *s = &shards[shard];
+
+        if (GlobalState.duplicate_scan_prefix != NULL) {
+            s->header.num_games = games_checked;
+            if (!write_shard_header(s->fp, &s->header, FALSE) ||
+                    fclose(s->fp) != 0) {
+                shard_file_error("write", s->filename);
+            }
+        }
+        else {
+            (void) fclose(s->fp);
+        }
+        (void) free((void *) s->filename);
+    }
+    (void) free((void *) shards);
+    shards = NULL;
+    if (GlobalState.duplicate_resolve_prefix != NULL &&
+            games_checked != games_merged) {
+        fprintf(GlobalState.logfile,
+                "Fewer games have been checked for duplicates than were by the runs merged.\n");
+    }
+}
+
+/* Merge the shard files given as the input files into
+ * GlobalState.duplicate_merge_file, for --dupmerge, and exit.
+ * The files must come from the runs in the order in which their
+ * input files are given to the final run.
+ */
+void
+merge_duplicate_shards(void)
+{
+    const char *merge_file = GlobalState.duplicate_merge_file;
+    unsigned num_files = number_of_input_files("--dupmerge");
+    ShardHeader *headers = (ShardHeader *) malloc_or_die(num_files * sizeof (*headers));
+    char ***names = (char ***) malloc_or_die(num_files * sizeof (*names));
+    ShardHeader merged;
+    MergedRecord duplicate;
+    FILE *out;
+    unsigned file_number;
+    uint32_t total_files = 0;
+    uint64_t game_offset = 0;
+    uint32_t file_offset = 0;
+    Boolean ok;
+
+    /* Check that the shards belong together. */
+    for (file_number = 0; file_number < num_files; file_number++) {
+        const char *filename = input_file_name(file_number);
+        FILE *fp = fopen(filename, "rb");
+
+        if (fp == NULL) {
+            shard_file_error("open", filename);
+        }
+        names[file_number] = read_shard_header(fp, filename, SHARD_MAGIC,
+                                               &headers[file_number]);
+        (void) fclose(fp);
+        if (file_number > 0 &&
+                (headers[file_number].shard != headers[0].shard ||
+                 headers[file_number].num_shards != headers[0].num_shards ||
+                 headers[file_number].fuzzy != headers[0].fuzzy ||
+                 headers[file_number].fuzzy_depth != headers[0].fuzzy_depth)) {
+            fprintf(GlobalState.logfile,
+                    "%s is not the same shard, with the same settings, as %s.\n",
+                    filename, input_file_name(0));
+            exit(1);
+        }
+        total_files += headers[file_number].num_files;
+    }
+    /* Look games up with the settings of the runs. */
+    GlobalState.fuzzy_match_duplicates = headers[0].fuzzy != 0;
+    GlobalState.fuzzy_match_depth = headers[0].fuzzy_depth;
+    GlobalState.duplicate_shards = headers[0].num_shards;
+    init_duplicate_hash_table();
+
+    out = fopen(merge_file, "wb");
+    init_shard_header(&merged, MERGED_MAGIC, headers[0].shard, total_files);
+    ok = out != NULL && fwrite((const void *) &merged, sizeof (merged), 1, out) == 1;
+    for (file_number = 0; ok && file_number < num_files; file_number++) {
+        char **name;
+
+        for (name = names[file_number]; ok && *name != NULL; name++) {
+            uint32_t length = (uint32_t) strlen(*name);
+
+            ok = fwrite((const void *) &length, sizeof (length), 1, out) == 1 &&
+                    fwrite((const void *) *name, 1, length, out) == length;
+        }
+    }
+    if (!ok) {
+        shard_file_error("write", merge_file);
+    }
+
+    memset((void *) &duplicate, 0, sizeof (duplicate));
+    for (file_number = 0; file_number < num_files; file_number++) {
+        const char *filename = input_file_name(file_number);
+        FILE *fp = fopen(filename, "rb");
+        ShardHeader header;
+        ShardRecord record;
+        uint64_t i;
+
+        if (fp == NULL) {
+            shard_file_error("open", filename);
+        }
+        free_names(read_shard_header(fp, filename, SHARD_MAGIC, &header));
+        for (i = 0; i < header.num_records; i++) {
+            unsigned original_file;
+
+            if (fread((void *) &record, sizeof (record), 1, fp) != 1 ||
+                    record.file_number >= header.num_files ||
+                    record.game >= header.num_games) {
+                fprintf(GlobalState.logfile,
+                        "%s is incomplete or not a --dupscan file.\n", filename);
+                exit(1);
+            }
+            if (merge_occurance(record.final_hash_value,
+                                record.cumulative_hash_value,
+                                record.fuzzy_hash_value,
+                                record.reached_fuzzy_depth != 0,
+                                file_offset + record.file_number,
+                                &original_file)) {
+                duplicate.game = game_offset + record.game;
+                duplicate.original_file = original_file;
+                if (fwrite((const void *) &duplicate, sizeof (duplicate), 1, out) != 1) {
+                    shard_file_error("write", merge_file);
+                }
+                merged.num_records++;
+            }
+        }
+        (void) fclose(fp);
+        game_offset += header.num_games;
+        file_offset += header.num_files;
+        free_names(names[file_number]);
+    }
+    merged.num_games = game_offset;
+    if (!write_shard_header(out, &merged, FALSE) || fclose(out) != 0) {
+        shard_file_error("write", merge_file);
+    }
+    if (GlobalState.verbosity > 1) {
+        fprintf(GlobalState.logfile,
+                "%" PRIu64 " duplicate%s found in shard %" PRIu32 " of %" PRIu64 " games.\n",
+                merged.num_records, merged.num_records == 1 ? "" : "s",
+                merged.shard, merged.num_games);
+    }
+    clear_duplicate_hash_table();
+    (void) free((void *) headers);
+    (void) free((void *) names);
+    exit(0);
+}
@@ -0,0 +1,35 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+#ifndef DUPSHARD_H
+#define DUPSHARD_H
+
+void check_duplicate_shard_options(void);
+void finish_duplicate_shards(void);
+void merge_duplicate_shards(void);
+void record_shard_game(HashCode final_hash_value, HashCode cumulative_hash_value,
+                       HashCode fuzzy_hash_value, Boolean reached_fuzzy_depth,
+                       unsigned file_number);
+const char *resolved_occurance(void);
+
+#endif	// DUPSHARD_H
+
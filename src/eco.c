@@ -19,10 +19,26 @@
  *  https://www.cs.kent.ac.uk/people/staff/djb/
  */
 
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+/* An ECO index is memory mapped rather than read, and its
+ * currency is checked against the ECO file's size and modification time.
+ */
+#define MAPPED_INDEX 1
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
 #include "bool.h"
 #include "mymalloc.h"
 #include "defs.h"
@@ -33,6 +49,10 @@
 #include "lex.h"
 #include "eco.h"
 #include "apply.h"
+#include "profile.h"
+#include "compress.h"
+#include "asyncout.h"
+#include "binary.h"
 
 /* Place a limit on how distant a position may be from the ECO line
  * it purports to match. This is to try to stop collisions way past
@@ -46,12 +66,74 @@
  */
 static unsigned maximum_half_moves = ECO_HALF_MOVE_LIMIT;
 
+/* A pawn that leaves its starting square, or is captured there,
+ * can never return to it. So a game can only reach an ECO
+ * position that has no more pawns on their starting squares than
+ * the game's current position.
+ * An ECO horizon table is indexed by a mask of the pawns on their
+ * starting squares; WHITE's in the low 8 bits and BLACK's in the
+ * high 8. Each element holds the latest half move at which a match
+ * is possible against a line whose pawn mask is a subset of the index.
+ * Once a game has gone past the horizon of its current mask,
+ * it cannot match any further lines.
+ */
+#define ECO_HORIZONS (1 << (2 * BOARDSIZE))
+static uint16_t *eco_horizons;
+
 /* Define a table to hold hash values of the ECO positions.
  * This is used to enable duplicate detection.
  */
 #define ECO_TABLE_SIZE 4096
 static EcoLog **EcoTable;
 
+/* Once the ECO file has been read, EcoTable is compiled into an
+ * array of entries sorted on their required_hash_value, with the
+ * tag strings held in a single pool. This is the form searched
+ * by eco_matches, and the form saved and reloaded with --ecoindex.
+ */
+#define ECO_INDEX_MAGIC "PGNECOIX"
+#define ECO_INDEX_VERSION 2
+/* The string offset of an absent tag. */
+#define NO_ECO_STRING UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    /* The maximum_half_moves of the table. */
+    uint32_t maximum_half_moves;
+    uint64_t count;
+    /* The number of bytes in the string pool. */
+    uint64_t string_space;
+    /* The size and modification time of the ECO file
+     * from which the index was built.
+     */
+    int64_t source_size;
+    int64_t source_time;
+} EcoIndexHeader;
+
+typedef struct {
+    HashCode required_hash_value;
+    HashCode cumulative_hash_value;
+    uint32_t half_moves;
+    /* Order of entry into EcoTable, to keep lines with the same
+     * required_hash_value in the order of the ECO file.
+     */
+    uint32_t sequence;
+    /* Offsets in the string pool. */
+    uint32_t ECO_tag, Opening_tag, Variation_tag, Sub_Variation_tag;
+} EcoIndexEntry;
+
+static struct {
+    const EcoIndexEntry *entries;
+    size_t count;
+    const char *strings;
+    const uint16_t *horizons;
+    /* Where the table came from, for releasing it. */
+    void *contents;
+    size_t length;
+    Boolean mapped;
+} compiled_eco_table;
+
 #if INCLUDE_UNUSED_FUNCTIONS
 
 static void
@@ -138,6 +220,44 @@ void initEcoTable(void)
         for (i = 0; i < ECO_TABLE_SIZE; i++) {
             EcoTable[i] = NULL;
         }
+        eco_horizons = (uint16_t *) malloc_or_die(ECO_HORIZONS * sizeof (*eco_horizons));
+        for (i = 0; i < ECO_HORIZONS; i++) {
+            eco_horizons[i] = 0;
+        }
+    }
+}
+
+/* Return the mask of the pawns of board that are on their
+ * starting squares, as used to index the ECO horizon table.
+ */
+static unsigned
+home_pawns(const Board *board)
+{
+    unsigned mask = 0;
+    int c;
+
+    for (c = 0; c < BOARDSIZE; c++) {
+        if (board->board[RankConvert('2')][HEDGE + c] == W(PAWN)) {
+            mask |= 1u << c;
+        }
+        if (board->board[RankConvert('7')][HEDGE + c] == B(PAWN)) {
+            mask |= 1u << (BOARDSIZE + c);
+        }
+    }
+    return mask;
+}
+
+/* Return the latest half move at which a game that has reached
+ * board could still match an ECO line.
+ */
+unsigned
+eco_horizon(const Board *board)
+{
+    if (compiled_eco_table.horizons == NULL) {
+        return maximum_half_moves;
+    }
+    else {
+        return compiled_eco_table.horizons[home_pawns(board)];
     }
 }
 
@@ -209,6 +329,16 @@ save_eco_details(const Game *game_details, const Board *final_position, unsigned
         if (number_of_half_moves + ECO_HALF_MOVE_LIMIT > maximum_half_moves) {
             maximum_half_moves = number_of_half_moves + ECO_HALF_MOVE_LIMIT;
         }
+        {
+            unsigned mask = home_pawns(final_position);
+            unsigned horizon = number_of_half_moves + ECO_HALF_MOVE_LIMIT;
+            if (horizon > UINT16_MAX) {
+                horizon = UINT16_MAX;
+            }
+            if (horizon > eco_horizons[mask]) {
+                eco_horizons[mask] = (uint16_t) horizon;
+            }
+        }
         if (game_details->tags[ECO_TAG] != NULL) {
             if ((last_entry != NULL) && (last_entry->ECO_tag != NULL) &&
                     (strcmp(last_entry->ECO_tag, game_details->tags[ECO_TAG]) == 0)) {
@@ -257,46 +387,427 @@ save_eco_details(const Game *game_details, const Board *final_position, unsigned
     }
 }
 
-/* Look in EcoTable for current_hash_value.
+/* Space for building the string pool of the compiled table. */
+static char *pool;
+static size_t pool_used, pool_allocated;
+/* An open-addressed table of the offsets of strings in the pool,
+ * so that each distinct string is only stored once.
+ */
+static uint32_t *pool_index;
+static size_t pool_index_size;
+
+static uint32_t
+intern_eco_string(const char *str)
+{
+    size_t len, ix;
+    uint32_t hash = 5381;
+    const unsigned char *p;
+
+    if (str == NULL) {
+        return NO_ECO_STRING;
+    }
+    for (p = (const unsigned char *) str; *p != '\0'; p++) {
+        hash = hash * 33 + *p;
+    }
+    for (ix = hash & (pool_index_size - 1); pool_index[ix] != NO_ECO_STRING;
+            ix = (ix + 1) & (pool_index_size - 1)) {
+        if (strcmp(&pool[pool_index[ix]], str) == 0) {
+            return pool_index[ix];
+        }
+    }
+    len = strlen(str) + 1;
+    if (pool_used + len > pool_allocated) {
+        while (pool_used + len > pool_allocated) {
+            pool_allocated *= 2;
+        }
+        pool = (char *) realloc_or_die((void *) pool, pool_allocated);
+    }
+    memcpy(&pool[pool_used], str, len);
+    pool_index[ix] = (uint32_t) pool_used;
+    pool_used += len;
+    return pool_index[ix];
+}
+
+/* Order compiled entries on their required_hash_value and then
+ * their sequence.
+ */
+static int
+compare_eco_entries(const void *e1, const void *e2)
+{
+    const EcoIndexEntry *entry1 = (const EcoIndexEntry *) e1;
+    const EcoIndexEntry *entry2 = (const EcoIndexEntry *) e2;
+
+    if (entry1->required_hash_value != entry2->required_hash_value) {
+        return entry1->required_hash_value < entry2->required_hash_value ? -1 : 1;
+    }
+    else if (entry1->sequence != entry2->sequence) {
+        return entry1->sequence < entry2->sequence ? -1 : 1;
+    }
+    else {
+        return 0;
+    }
+}
+
+/* Compile the entries saved from the ECO file for use by eco_matches. */
+void
+compile_eco_table(void)
+{
+    size_t count = 0, next = 0, i;
+    unsigned ix, bit;
+    EcoIndexEntry *entries;
+
+    for (ix = 0; ix < ECO_TABLE_SIZE; ix++) {
+        const EcoLog *entry;
+        for (entry = EcoTable[ix]; entry != NULL; entry = entry->next) {
+            count++;
+        }
+    }
+    entries = (EcoIndexEntry *) malloc_or_die((count > 0 ? count : 1) * sizeof (*entries));
+    pool_allocated = 4096;
+    pool_used = 0;
+    pool = (char *) malloc_or_die(pool_allocated);
+    /* There are usually far fewer distinct strings than entries. */
+    for (pool_index_size = 1024; pool_index_size < 4 * count; pool_index_size *= 2) {
+    }
+    pool_index = (uint32_t *) malloc_or_die(pool_index_size * sizeof (*pool_index));
+    for (i = 0; i < pool_index_size; i++) {
+        pool_index[i] = NO_ECO_STRING;
+    }
+
+    for (ix = 0; ix < ECO_TABLE_SIZE; ix++) {
+        const EcoLog *entry;
+        size_t chain_length = 0, position = 0;
+
+        for (entry = EcoTable[ix]; entry != NULL; entry = entry->next) {
+            chain_length++;
+        }
+        /* Each chain has its most recent entry first. */
+        for (entry = EcoTable[ix]; entry != NULL; entry = entry->next) {
+            EcoIndexEntry *compiled = &entries[next++];
+            compiled->required_hash_value = entry->required_hash_value;
+            compiled->cumulative_hash_value = entry->cumulative_hash_value;
+            compiled->half_moves = entry->half_moves;
+            compiled->sequence = (uint32_t) (chain_length - position++);
+            compiled->ECO_tag = intern_eco_string(entry->ECO_tag);
+            compiled->Opening_tag = intern_eco_string(entry->Opening_tag);
+            compiled->Variation_tag = intern_eco_string(entry->Variation_tag);
+            compiled->Sub_Variation_tag = intern_eco_string(entry->Sub_Variation_tag);
+        }
+    }
+    qsort((void *) entries, count, sizeof (*entries), compare_eco_entries);
+    (void) free((void *) pool_index);
+    pool_index = NULL;
+
+    /* Let each pawn mask inherit the horizons of its subsets. */
+    for (bit = 1; bit < ECO_HORIZONS; bit <<= 1) {
+        for (ix = 0; ix < ECO_HORIZONS; ix++) {
+            if ((ix & bit) != 0 && eco_horizons[ix ^ bit] > eco_horizons[ix]) {
+                eco_horizons[ix] = eco_horizons[ix ^ bit];
+            }
+        }
+    }
+
+    compiled_eco_table.entries = entries;
+    compiled_eco_table.count = count;
+    compiled_eco_table.strings = pool;
+    compiled_eco_table.horizons = eco_horizons;
+    compiled_eco_table.contents = NULL;
+    compiled_eco_table.length = 0;
+    compiled_eco_table.mapped = FALSE;
+}
+
+/* Obtain the size and modification time of the ECO file.
+ * Return FALSE if it cannot be determined.
+ */
+static Boolean
+eco_file_details(const char *eco_file, int64_t *size, int64_t *time)
+{
+#if MAPPED_INDEX
+    struct stat details;
+    if (stat(eco_file, &details) == 0) {
+        *size = (int64_t) details.st_size;
+        *time = (int64_t) details.st_mtime;
+        return TRUE;
+    }
+#else
+    (void) eco_file;
+#endif
+    *size = 0;
+    *time = 0;
+    return FALSE;
+}
+
+/* Use the compiled ECO table in index_file if it exists and was
+ * built from the current state of eco_file. Return TRUE if so.
+ * If eco_file cannot be found, an existing index is used regardless.
+ */
+Boolean
+load_eco_index(const char *index_file, const char *eco_file)
+{
+    FILE *fp = fopen(index_file, "rb");
+    EcoIndexHeader header;
+    size_t length = 0;
+    void *contents = NULL;
+    Boolean mapped = FALSE;
+    int64_t source_size, source_time;
+    Boolean have_source;
+
+    if (fp == NULL) {
+        /* It will be built from the ECO file. */
+        return FALSE;
+    }
+    if (fseek(fp, 0L, SEEK_END) == 0) {
+        long end = ftell(fp);
+        if (end > 0) {
+            length = (size_t) end;
+        }
+    }
+    if (length < sizeof (header) || fseek(fp, 0L, SEEK_SET) != 0 ||
+            fread((void *) &header, sizeof (header), 1, fp) != 1 ||
+            memcmp(header.magic, ECO_INDEX_MAGIC, sizeof (header.magic)) != 0) {
+        fprintf(GlobalState.logfile, "%s is not an ECO index file.\n", index_file);
+        exit(1);
+    }
+    have_source = eco_file_details(eco_file, &source_size, &source_time);
+    if (header.version != ECO_INDEX_VERSION ||
+            header.count > (length - sizeof (header)) / sizeof (EcoIndexEntry) ||
+            sizeof (header) + header.count * sizeof (EcoIndexEntry) +
+                ECO_HORIZONS * sizeof (uint16_t) + header.string_space != length ||
+            (have_source &&
+                (source_size != header.source_size || source_time != header.source_time))) {
+        /* Out of date, so it will be rebuilt. */
+        (void) fclose(fp);
+        return FALSE;
+    }
+#if MAPPED_INDEX
+    contents = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (contents == MAP_FAILED) {
+        contents = NULL;
+    }
+    else {
+        mapped = TRUE;
+    }
+#endif
+    if (contents == NULL) {
+        contents = malloc_or_die(length);
+        if (fseek(fp, 0L, SEEK_SET) != 0 ||
+                fread(contents, 1, length, fp) != length) {
+            fprintf(GlobalState.logfile,
+                    "Unable to read the ECO index %s\n", index_file);
+            exit(1);
+        }
+    }
+    (void) fclose(fp);
+
+    compiled_eco_table.contents = contents;
+    compiled_eco_table.length = length;
+    compiled_eco_table.mapped = mapped;
+    compiled_eco_table.count = (size_t) header.count;
+    compiled_eco_table.entries =
+            (const EcoIndexEntry *) ((const char *) contents + sizeof (header));
+    compiled_eco_table.horizons = (const uint16_t *) ((const char *) contents +
+            sizeof (header) + compiled_eco_table.count * sizeof (EcoIndexEntry));
+    compiled_eco_table.strings = (const char *) (compiled_eco_table.horizons + ECO_HORIZONS);
+    maximum_half_moves = header.maximum_half_moves;
+    return TRUE;
+}
+
+/* Save the compiled ECO table to index_file. */
+void
+save_eco_index(const char *index_file, const char *eco_file)
+{
+    EcoIndexHeader header;
+    char *temp_name;
+    FILE *fp;
+    Boolean ok;
+
+    temp_name = (char *) malloc_or_die(strlen(index_file) + strlen(".tmp") + 1);
+    strcpy(temp_name, index_file);
+    strcat(temp_name, ".tmp");
+    fp = fopen(temp_name, "wb");
+    if (fp == NULL) {
+        fprintf(GlobalState.logfile,
+                "Unable to write the ECO index %s\n", temp_name);
+        (void) free((void *) temp_name);
+        return;
+    }
+    memset((void *) &header, 0, sizeof (header));
+    memcpy(header.magic, ECO_INDEX_MAGIC, sizeof (header.magic));
+    header.version = ECO_INDEX_VERSION;
+    header.maximum_half_moves = maximum_half_moves;
+    header.count = compiled_eco_table.count;
+    header.string_space = pool_used;
+    (void) eco_file_details(eco_file, &header.source_size, &header.source_time);
+
+    ok = fwrite((void *) &header, sizeof (header), 1, fp) == 1 &&
+            fwrite((const void *) compiled_eco_table.entries,
+                   sizeof (EcoIndexEntry), compiled_eco_table.count, fp) ==
+                compiled_eco_table.count &&
+            fwrite((const void *) compiled_eco_table.horizons,
+                   sizeof (uint16_t), ECO_HORIZONS, fp) == ECO_HORIZONS &&
+            fwrite((const void *) compiled_eco_table.strings, 1, pool_used, fp) == pool_used;
+    if (fclose(fp) != 0) {
+        ok = FALSE;
+    }
+    if (ok && rename(temp_name, index_file) != 0) {
+        /* Some systems will not rename over an existing file. */
+        (void) remove(index_file);
+        ok = rename(temp_name, index_file) == 0;
+    }
+    if (!ok) {
+        fprintf(GlobalState.logfile,
+                "Unable to write the ECO index %s\n", index_file);
+        (void) remove(temp_name);
+    }
+    (void) free((void *) temp_name);
+}
+
+/* Return the string at offset in the compiled table's pool. */
+static const char *
+eco_string(uint32_t offset)
+{
+    return offset == NO_ECO_STRING ? NULL : &compiled_eco_table.strings[offset];
+}
+
+/* Look in the compiled table for the current hash value of board.
  * Use cumulative_hash_value to refine the match.
  * An exact match is preferable to a partial match.
+ * The result refers to storage that is overwritten by the
+ * next successful call.
  */
 EcoLog *
 eco_matches(const Board *board, HashCode cumulative_hash_value,
             unsigned half_moves_played)
 {
+    static EcoLog match;
     HashCode current_hash_value = board->weak_hash_value;
-    EcoLog *possible = NULL;
+    const EcoIndexEntry *possible = NULL;
+    ProfileMark mark;
 
+    PROFILE_BEGIN(mark);
     /* Don't bother trying if we are too far on in the game.  */
     if (half_moves_played <= maximum_half_moves) {
-        /* Where to look. */
-        unsigned ix = current_hash_value % ECO_TABLE_SIZE;
-        EcoLog *entry;
+        const EcoIndexEntry *entries = compiled_eco_table.entries;
+        size_t low = 0, high = compiled_eco_table.count;
+        size_t ix;
+        unsigned long probes = 0;
 
-        for (entry = EcoTable[ix]; entry != NULL; entry = entry->next) {
-            if (entry->required_hash_value == current_hash_value) {
-                /* See if we have a full match. */
-                if (half_moves_played == entry->half_moves &&
-                        entry->cumulative_hash_value == cumulative_hash_value) {
-                    return entry;
-                }
-                else if ((half_moves_played - entry->half_moves) <=
-                        ECO_HALF_MOVE_LIMIT) {
-                    /* Retain this as a possible. */
-                    possible = entry;
-                }
-                else {
-                    /* Ignore it, as the lines are too distant. */
-                }
+        /* Find the first entry with the required hash value. */
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            probes++;
+            if (entries[mid].required_hash_value < current_hash_value) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+        for (ix = low; ix < compiled_eco_table.count &&
+                entries[ix].required_hash_value == current_hash_value; ix++) {
+            const EcoIndexEntry *entry = &entries[ix];
+            /* See if we have a full match. */
+            if (half_moves_played == entry->half_moves &&
+                    entry->cumulative_hash_value == cumulative_hash_value) {
+                possible = entry;
+                break;
+            }
+            else if (possible == NULL &&
+                    (half_moves_played - entry->half_moves) <= ECO_HALF_MOVE_LIMIT) {
+                /* Retain the earliest as a possible. */
+                possible = entry;
             }
+            else {
+                /* Ignore it, as the lines are too distant. */
+            }
+        }
+        PROFILE_PROBES(PROFILE_ECO_TABLE, probes + (ix - low));
+    }
+    PROFILE_END(PROFILE_ECO, mark);
+    if (possible == NULL) {
+        return NULL;
+    }
+    match.required_hash_value = possible->required_hash_value;
+    match.cumulative_hash_value = possible->cumulative_hash_value;
+    match.half_moves = possible->half_moves;
+    match.ECO_tag = eco_string(possible->ECO_tag);
+    match.Opening_tag = eco_string(possible->Opening_tag);
+    match.Variation_tag = eco_string(possible->Variation_tag);
+    match.Sub_Variation_tag = eco_string(possible->Sub_Variation_tag);
+    match.next = NULL;
+    return &match;
+}
+
+/* The ECO output files of -E are kept open between games, up to a limit
+ * set by the number of file descriptors available, and the least recently
+ * used is closed when another is needed.
+ * Each has its own output buffer.
+ */
+#define ECO_OUTPUT_BUFFER_SIZE (64 * 1024)
+/* The most files kept open, which is sufficient for every file of -E3. */
+#define MAX_ECO_OUTPUT_FILES 512
+/* The file descriptors to leave for other files. */
+#define RESERVED_FILE_DESCRIPTORS 32
+
+typedef struct {
+    char *filename;
+    FILE *fp;
+    char *buffer;
+    unsigned long last_used;
+} EcoOutputFile;
+
+static EcoOutputFile *eco_output_files = NULL;
+static unsigned num_eco_output_files = 0;
+static unsigned max_eco_output_files = 0;
+/* Incremented on each use of an ECO output file. */
+static unsigned long eco_output_clock = 0;
+
+/* How many ECO output files may be kept open at once. */
+static unsigned
+eco_output_file_limit(void)
+{
+    unsigned limit = MAX_ECO_OUTPUT_FILES;
+#if MAPPED_INDEX
+    struct rlimit files;
+
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY) {
+        if (files.rlim_cur <= RESERVED_FILE_DESCRIPTORS) {
+            limit = 1;
+        }
+        else if (files.rlim_cur - RESERVED_FILE_DESCRIPTORS < limit) {
+            limit = (unsigned) (files.rlim_cur - RESERVED_FILE_DESCRIPTORS);
         }
     }
-    return possible;
+#else
+    limit = FOPEN_MAX > RESERVED_FILE_DESCRIPTORS ?
+            FOPEN_MAX - RESERVED_FILE_DESCRIPTORS : 1;
+#endif
+    return limit;
+}
+
+/* Close the ECO output file least recently used, to make room for another. */
+static void
+evict_eco_output_file(void)
+{
+    unsigned oldest = 0;
+    unsigned i;
+
+    for (i = 1; i < num_eco_output_files; i++) {
+        if (eco_output_files[i].last_used < eco_output_files[oldest].last_used) {
+            oldest = i;
+        }
+    }
+    close_binary_output(eco_output_files[oldest].fp);
+    (void) fclose(eco_output_files[oldest].fp);
+    (void) free((void *) eco_output_files[oldest].buffer);
+    (void) free((void *) eco_output_files[oldest].filename);
+    num_eco_output_files--;
+    eco_output_files[oldest] = eco_output_files[num_eco_output_files];
 }
 
 /* Depending upon the ECO_level and the eco string of the
- * current game, open the correctly named ECO file.
+ * current game, return the correctly named ECO file.
+ * The file is left open for the next game to use it.
  */
 FILE *
 open_eco_output_file(EcoDivision ECO_level, const char *eco)
@@ -306,9 +817,11 @@ open_eco_output_file(EcoDivision ECO_level, const char *eco)
     static const char suffix[] = ".pgn";
 
     enum {
-        MAXNAME = MAX_ECO_LEVEL + sizeof (suffix) - 1
+        MAXNAME = MAX_ECO_LEVEL + sizeof (suffix) - 1 + MAX_COMPRESSION_SUFFIX
     };
     static char filename[MAXNAME + 1];
+    EcoOutputFile *entry;
+    unsigned i;
 
     if ((eco == NULL) || !isalpha((int) *eco)) {
         strcpy(filename, "noeco.pgn");
@@ -328,5 +841,33 @@ open_eco_output_file(EcoDivision ECO_level, const char *eco)
         filename[ECO_level] = '\0';
         strcat(filename, suffix);
     }
-    return must_open_file(filename, "a");
+    strcat(filename, compression_suffix(GlobalState.output_compression));
+
+    eco_output_clock++;
+    for (i = 0; i < num_eco_output_files; i++) {
+        if (strcmp(eco_output_files[i].filename, filename) == 0) {
+            eco_output_files[i].last_used = eco_output_clock;
+            return eco_output_files[i].fp;
+        }
+    }
+    if (eco_output_files == NULL) {
+        max_eco_output_files = eco_output_file_limit();
+        eco_output_files = (EcoOutputFile *) malloc_or_die(
+                max_eco_output_files * sizeof (*eco_output_files));
+    }
+    if (num_eco_output_files == max_eco_output_files) {
+        evict_eco_output_file();
+    }
+    entry = &eco_output_files[num_eco_output_files];
+    entry->fp = open_compressed_output(must_open_file(filename, "a"), filename);
+    entry->buffer = (char *) malloc_or_die(ECO_OUTPUT_BUFFER_SIZE);
+    if (setvbuf(entry->fp, entry->buffer, _IOFBF, ECO_OUTPUT_BUFFER_SIZE) != 0) {
+        (void) free((void *) entry->buffer);
+        entry->buffer = NULL;
+    }
+    entry->fp = async_output_file(entry->fp, filename, ECO_OUTPUT_BUFFER_SIZE);
+    entry->filename = copy_string(filename);
+    entry->last_used = eco_output_clock;
+    num_eco_output_files++;
+    return entry->fp;
 }
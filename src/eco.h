@@ -42,10 +42,14 @@ typedef struct EcoLog {
 
 EcoLog *eco_matches(const Board *board, HashCode cumulative_hash_value,
                     unsigned half_moves_played);
+unsigned eco_horizon(const Board *board);
 Boolean add_ECO(Game game_details);
 FILE *open_eco_output_file(EcoDivision ECO_level,const char *eco);
 void initEcoTable(void);
 void save_eco_details(const Game *game_details, const Board *final_position, unsigned number_of_moves);
+void compile_eco_table(void);
+Boolean load_eco_index(const char *index_file, const char *eco_file);
+void save_eco_index(const char *index_file, const char *eco_file);
 
 #endif	// ECO_H
 
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <ctype.h>
 #include "bool.h"
 #include "mymalloc.h"
@@ -45,6 +46,13 @@
 /* Keep a list of endings to be found. */
 static Material_details *endings_to_match = NULL;
 
+/* Material is summarised as a signature that packs the number of
+ * each piece, other than the king, into SIGNATURE_BITS bits.
+ * No position can have this signature.
+ */
+#define SIGNATURE_BITS 6
+#define NO_MATERIAL_SIGNATURE (~(uint64_t) 0)
+
 /* What kind of piece is the character, c, likely to represent?
  * NB: This is NOT the same as is_piece() in decode.c
  */
@@ -101,6 +109,7 @@ new_ending_details(Boolean both_colours)
         /* Only the KING is a requirement for each side. */
         details->num_pieces[c][KING] = 1;
         details->match_depth[c] = 0;
+        details->signature[c] = NO_MATERIAL_SIGNATURE;
         /* How many general minor pieces to match. */
         details->num_minor_pieces[c] = 0;
         details->minor_occurs[c] = EXACTLY;
@@ -359,6 +368,8 @@ reset_match_depths(Material_details *endings)
     for (; endings != NULL; endings = endings->next) {
         endings->match_depth[WHITE] = 0;
         endings->match_depth[BLACK] = 0;
+        endings->signature[WHITE] = NO_MATERIAL_SIGNATURE;
+        endings->signature[BLACK] = NO_MATERIAL_SIGNATURE;
     }
 }
 
@@ -472,29 +483,143 @@ piece_set_match(const Material_details *details_to_find,
     return match;
 }
 
+/* Add the bounds implied by a requirement for num_to_find pieces
+ * to those in min and max.
+ */
+static void
+add_piece_bounds(int num_to_find, Occurs occurs, int *min, int *max)
+{
+    switch (occurs) {
+        case EXACTLY:
+            *min += num_to_find;
+            if (*max != INT_MAX) {
+                *max += num_to_find;
+            }
+            break;
+        case NUM_OR_MORE:
+            *min += num_to_find;
+            *max = INT_MAX;
+            break;
+        case NUM_OR_LESS:
+            if (*max != INT_MAX) {
+                *max += num_to_find;
+            }
+            break;
+        default:
+            /* Relative to the opponent. */
+            *max = INT_MAX;
+            break;
+    }
+}
+
+/* Set the bounds on the number of pieces that each piece
+ * set of details can match.
+ */
+static void
+set_piece_bounds(Material_details *details)
+{
+    for (int c = 0; c < 2; c++) {
+        /* A requirement for general minor pieces replaces those
+         * for knights and bishops.
+         */
+        Boolean minor_requirement =
+            details->num_minor_pieces[c] > 0 || details->minor_occurs[c] != EXACTLY;
+        int min = 0, max = 0;
+        for (Piece piece = PAWN; piece < KING; piece++) {
+            if (!minor_requirement || (piece != KNIGHT && piece != BISHOP)) {
+                add_piece_bounds(details->num_pieces[c][piece],
+                                 details->occurs[c][piece], &min, &max);
+            }
+        }
+        if (minor_requirement) {
+            add_piece_bounds(details->num_minor_pieces[c],
+                             details->minor_occurs[c], &min, &max);
+        }
+        details->min_pieces[c] = min;
+        details->max_pieces[c] = max;
+    }
+}
+
+/* Pack the numbers of pieces, other than kings, into a signature. */
+static uint64_t
+material_signature(int num_pieces[2][NUM_PIECE_VALUES])
+{
+    uint64_t signature = 0;
+    for (int c = 0; c < 2; c++) {
+        for (Piece piece = PAWN; piece < KING; piece++) {
+            signature = (signature << SIGNATURE_BITS) | (uint64_t) num_pieces[c][piece];
+        }
+    }
+    return signature;
+}
+
+/* The number of pieces, other than the king, of the given colour. */
+static int
+total_pieces(int num_pieces[2][NUM_PIECE_VALUES], Colour colour)
+{
+    int total = 0;
+    for (Piece piece = PAWN; piece < KING; piece++) {
+        total += num_pieces[colour][piece];
+    }
+    return total;
+}
+
+/* Whether details_to_find could match the given totals of pieces,
+ * or any smaller totals, with its first piece set matched against
+ * game_colour.
+ */
+static Boolean
+material_reachable(const Material_details *details_to_find, const int totals[2],
+                   Colour game_colour)
+{
+    return totals[game_colour] >= details_to_find->min_pieces[WHITE] &&
+           totals[OPPOSITE_COLOUR(game_colour)] >= details_to_find->min_pieces[BLACK];
+}
+
 /* Look for a material match between current_details and
  * details_to_find. Only return TRUE if we have both a match
  * and match_depth >= move_depth in details_to_find.
+ * signature is the material_signature of num_pieces and totals
+ * the total_pieces of each colour. Material only changes on
+ * captures and promotions, so the outcome for the signature
+ * last tested is retained.
  * NB: If the game ends before the required depth is reached then a
  * potential match would be missed. This could be considered
  * as a bug.
  */
 static Boolean
 material_match(Material_details *details_to_find, int num_pieces[2][NUM_PIECE_VALUES],
-               Colour game_colour)
+               uint64_t signature, const int totals[2], Colour game_colour)
 {
     Boolean match = TRUE;
     Colour piece_set_colour = WHITE;
 
-    match = piece_set_match(details_to_find, num_pieces, game_colour,
-            piece_set_colour);
-    if (match) {
-        game_colour = OPPOSITE_COLOUR(game_colour);
-        piece_set_colour = OPPOSITE_COLOUR(piece_set_colour);
-        match = piece_set_match(details_to_find, num_pieces, game_colour,
-                piece_set_colour);
-        /* Reset colour to its original value. */
-        game_colour = OPPOSITE_COLOUR(game_colour);
+    if (details_to_find->signature[game_colour] == signature) {
+        match = details_to_find->signature_matches[game_colour];
+    }
+    else {
+        int white_total = totals[game_colour];
+        int black_total = totals[OPPOSITE_COLOUR(game_colour)];
+        if (white_total < details_to_find->min_pieces[WHITE] ||
+                white_total > details_to_find->max_pieces[WHITE] ||
+                black_total < details_to_find->min_pieces[BLACK] ||
+                black_total > details_to_find->max_pieces[BLACK]) {
+            match = FALSE;
+        }
+        else {
+            match = piece_set_match(details_to_find, num_pieces, game_colour,
+                    piece_set_colour);
+            if (match) {
+                game_colour = OPPOSITE_COLOUR(game_colour);
+                piece_set_colour = OPPOSITE_COLOUR(piece_set_colour);
+                match = piece_set_match(details_to_find, num_pieces, game_colour,
+                        piece_set_colour);
+                /* Reset colour to its original value. */
+                game_colour = OPPOSITE_COLOUR(game_colour);
+            }
+        }
+        details_to_find->signature[game_colour] = signature;
+        details_to_find->signature_matches[game_colour] = match;
     }
 
     if (match) {
@@ -562,6 +687,16 @@ look_for_material_match(Game *game_details)
     if(game_details->tags[FEN_TAG] != NULL) {
         extract_pieces_from_board(num_pieces, board);
     }
+    uint64_t signature = material_signature(num_pieces);
+    int totals[2] = {
+        total_pieces(num_pieces, WHITE), total_pieces(num_pieces, BLACK)
+    };
+    /* Whether the material has changed since the last position tried. */
+    Boolean material_changed = TRUE;
+    /* Whether the piece sets of any ending matched the current material.
+     * If not, nothing can change until the material does.
+     */
+    Boolean possible_match = TRUE;
     /* Ensure that all previous match indications are cleared. */
     reset_match_depths(endings_to_match);
 
@@ -573,39 +708,66 @@ look_for_material_match(Game *game_details)
     Boolean end_of_game = FALSE;
     Boolean white_matches = FALSE, black_matches = FALSE;
     while (game_ok && !matches && !end_of_game) {
-        for (Material_details *details_to_find = endings_to_match; !matches && (details_to_find != NULL);
-                details_to_find = details_to_find->next) {
-            /* Try before applying each move.
-             * Note, that we wish to try both ways around because we might
-             * have WT,BT WF,BT ... If we don't try BLACK on WHITE success
-             * then we might miss a match because a full match takes several
-             * separate individual match steps.
+        if (material_changed) {
+            /* The number of pieces never increases, so give up
+             * once there are too few for any of the endings.
              */
-            white_matches = material_match(details_to_find, num_pieces, WHITE);
-            if(details_to_find->both_colours) {
-                black_matches = material_match(details_to_find, num_pieces, BLACK);
+            Boolean reachable = FALSE;
+            for (Material_details *details_to_find = endings_to_match;
+                    !reachable && details_to_find != NULL;
+                    details_to_find = details_to_find->next) {
+                reachable = material_reachable(details_to_find, totals, WHITE) ||
+                    (details_to_find->both_colours &&
+                     material_reachable(details_to_find, totals, BLACK));
             }
-            else {
-                black_matches = FALSE;
+            if (!reachable) {
+                break;
             }
-            if (white_matches || black_matches) {
-                matches = TRUE;
-                /* See whether a matching comment is required. */
-                if (GlobalState.add_position_match_comments && !match_comment_added) {
-                    CommentList *match_comment = create_match_comment(board);
-                    if (move_for_comment != NULL) {
-                        append_comments_to_move(move_for_comment, match_comment);
-                    }
-                    else {
-                        if(game_details->prefix_comment == NULL) {
-                            game_details->prefix_comment = match_comment;
+            material_changed = FALSE;
+            possible_match = TRUE;
+        }
+        if (possible_match) {
+            possible_match = FALSE;
+            for (Material_details *details_to_find = endings_to_match; !matches && (details_to_find != NULL);
+                    details_to_find = details_to_find->next) {
+                /* Try before applying each move.
+                 * Note, that we wish to try both ways around because we might
+                 * have WT,BT WF,BT ... If we don't try BLACK on WHITE success
+                 * then we might miss a match because a full match takes several
+                 * separate individual match steps.
+                 */
+                white_matches = material_match(details_to_find, num_pieces,
+                                               signature, totals, WHITE);
+                if(details_to_find->both_colours) {
+                    black_matches = material_match(details_to_find, num_pieces,
+                                                   signature, totals, BLACK);
+                }
+                else {
+                    black_matches = FALSE;
+                }
+                if (details_to_find->signature_matches[WHITE] ||
+                        (details_to_find->both_colours && details_to_find->signature_matches[BLACK])) {
+                    possible_match = TRUE;
+                }
+                if (white_matches || black_matches) {
+                    matches = TRUE;
+                    /* See whether a matching comment is required. */
+                    if (GlobalState.add_position_match_comments && !match_comment_added) {
+                        CommentList *match_comment = create_match_comment(board);
+                        if (move_for_comment != NULL) {
+                            append_comments_to_move(move_for_comment, match_comment);
                         }
                         else {
-                            CommentList *comm = game_details->prefix_comment;
-                            while(comm->next != NULL) {
-                                comm = comm->next;
+                            if(game_details->prefix_comment == NULL) {
+                                game_details->prefix_comment = match_comment;
+                            }
+                            else {
+                                CommentList *comm = game_details->prefix_comment;
+                                while(comm->next != NULL) {
+                                    comm = comm->next;
+                                }
+                                comm->next = match_comment;
                             }
-                            comm->next = match_comment;
                         }
                     }
                 }
@@ -623,11 +785,17 @@ look_for_material_match(Game *game_details)
                 /* Remove any captured pieces. */
                 if (next_move->captured_piece != EMPTY) {
                     num_pieces[OPPOSITE_COLOUR(colour)][next_move->captured_piece]--;
+                    totals[OPPOSITE_COLOUR(colour)]--;
+                    material_changed = TRUE;
                 }
                 if (next_move->promoted_piece != EMPTY) {
                     num_pieces[colour][next_move->promoted_piece]++;
                     /* Remove the promoting pawn. */
                     num_pieces[colour][PAWN]--;
+                    material_changed = TRUE;
+                }
+                if (material_changed) {
+                    signature = material_signature(num_pieces);
                 }
 
                 move_for_comment = next_move;
@@ -688,11 +856,17 @@ constraint_material_match(Material_details *details_to_find, const Board *board)
 
     int num_pieces[2][NUM_PIECE_VALUES];
     extract_pieces_from_board(num_pieces, board);
-    Boolean white_matches = material_match(details_to_find, num_pieces, WHITE);
+    uint64_t signature = material_signature(num_pieces);
+    int totals[2] = {
+        total_pieces(num_pieces, WHITE), total_pieces(num_pieces, BLACK)
+    };
+    Boolean white_matches = material_match(details_to_find, num_pieces,
+                                           signature, totals, WHITE);
     Boolean black_matches;
 
     if(details_to_find->both_colours) {
-        black_matches = material_match(details_to_find, num_pieces, BLACK);
+        black_matches = material_match(details_to_find, num_pieces,
+                                       signature, totals, BLACK);
     }
     else {
         black_matches = FALSE;
@@ -719,6 +893,7 @@ process_material_description(const char *line, Boolean both_colours, Boolean pat
         details = new_ending_details(both_colours);
 
         if (decompose_line(line, details)) {
+            set_piece_bounds(details);
             if(!pattern_constraint) {
                 /* Add it on to the list. */
                 details->next = endings_to_match;
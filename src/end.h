@@ -53,6 +53,15 @@ typedef struct material_details {
      * success. A full match is only returned when match_depth == move_depth.
      */
     unsigned match_depth[2];
+    /* Bounds on the total number of pieces, other than the king,
+     * that each piece set can match.
+     */
+    int min_pieces[2], max_pieces[2];
+    /* The material signature last tested for each game colour,
+     * and whether the piece sets matched it.
+     */
+    uint64_t signature[2];
+    Boolean signature_matches[2];
     struct material_details *next;
 } Material_details;
 
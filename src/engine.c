@@ -0,0 +1,785 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+
+/* Support for --engine.
+ * The positions reached by the moves of a game are evaluated by a
+ * pool of external UCI engines, rather than by evaluate() in apply.c.
+ * As each move is rewritten for output, the position it reaches is
+ * looked up, by its Zobrist hash value, in a table of the evaluations
+ * already made. Those not found are queued, and once the game has been
+ * rewritten the queue is shared out between the engines, each being
+ * handed a new position as soon as it reports on its last, so that the
+ * engines search in parallel.
+ * The evaluations are also appended to the file of --evalcache, if
+ * given, from which they are loaded at the start of the next run, so
+ * positions common to many games, particularly in the openings, are
+ * only searched once.
+ * The engines are started when the first position is queued, so that
+ * each --threads worker has its own pool.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define ENGINE_PROCESSES 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if ENGINE_PROCESSES
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "apply.h"
+#include "zobrist.h"
+#include "engine.h"
+
+#if ENGINE_PROCESSES
+
+/* An evaluation, as held in the table and in the cache file. */
+typedef struct {
+    uint64_t hash;
+    /* In centipawns, from White's point of view. */
+    int32_t value;
+    /* The depth of the search, EMPTY_ENTRY for an unused entry of the
+     * table or PENDING_ENTRY while the position is being evaluated.
+     */
+    uint32_t depth;
+} Evaluation;
+
+#define EMPTY_ENTRY 0
+#define PENDING_ENTRY UINT32_MAX
+/* The depth of a position for which the engine reported no score.
+ * It is not saved in the cache file.
+ */
+#define UNSCORED_ENTRY (UINT32_MAX - 1)
+
+/* Mate in N is scored as MATE_VALUE - N centipawns. */
+#define MATE_VALUE 10000
+
+/* The number of seconds an engine may take to respond, to the
+ * handshake or with any line of a search, before it is taken to
+ * have failed.
+ */
+#define ENGINE_TIMEOUT 300
+
+/* The start of an --evalcache file. */
+static const char cache_magic[8] = { 'P', 'G', 'N', 'E', 'V', 'A', 'L', '1' };
+
+/* The table of evaluations, with open addressing. */
+static Evaluation *table = NULL;
+static size_t table_size = 0, table_used = 0;
+
+/* The positions to be handed to the engines. */
+typedef struct {
+    uint64_t hash;
+    char *fen;
+    Colour to_move;
+} Job;
+
+static Job *jobs = NULL;
+static size_t num_jobs = 0, job_space = 0;
+
+/* The moves waiting for the evaluation of their position. */
+typedef struct {
+    uint64_t hash;
+    MoveAnnotation *annotation;
+} Waiting;
+
+static Waiting *waiting = NULL;
+static size_t num_waiting = 0, waiting_space = 0;
+
+/* The --evalcache file, open for appending, or -1. */
+static int cache_fd = -1;
+/* The evaluations not yet appended to it. */
+static Evaluation *new_evaluations = NULL;
+static size_t num_new = 0, new_space = 0;
+
+typedef enum {
+    AWAITING_UCIOK, AWAITING_READYOK, IDLE, SEARCHING, STOPPED
+} EngineState;
+
+typedef struct {
+    pid_t pid;
+    int to_engine, from_engine;
+    EngineState state;
+    /* The job being searched and the latest score reported for it. */
+    size_t job;
+    Boolean scored;
+    int32_t score;
+    /* The start of a line not yet completely read. */
+    char *line;
+    size_t line_length, line_space;
+    /* When the engine was last sent a command or heard from. */
+    time_t last_heard;
+} Engine;
+
+static Engine *engines = NULL;
+static unsigned num_engines = 0;
+/* The process that started the engines, so that a forked
+ * process does not use them.
+ */
+static pid_t engine_owner;
+static Boolean table_loaded = FALSE;
+
+static void grow_table(void);
+static void add_evaluation(const Evaluation *evaluation);
+static Evaluation *find_evaluation(uint64_t hash);
+static void load_cache(void);
+static void forget_engines(void);
+static void start_engines(void);
+static void send_to_engine(Engine *engine, const char *text);
+static Boolean write_to_engine(Engine *engine, const char *text);
+static void engine_failed(Engine *engine, const char *reason);
+static void read_from_engine(Engine *engine);
+static void deal_with_engine_line(Engine *engine, char *line);
+static void note_score(Engine *engine, char *line);
+static void finish_job(Engine *engine);
+static void save_new_evaluations(void);
+
+/* Return the entry of the table for hash, which is empty
+ * if there is no evaluation of it.
+ */
+static Evaluation *
+find_evaluation(uint64_t hash)
+{
+    size_t index = (size_t) hash & (table_size - 1);
+
+    while (table[index].depth != EMPTY_ENTRY && table[index].hash != hash) {
+        index = (index + 1) & (table_size - 1);
+    }
+    return &table[index];
+}
+
+/* Double the size of the table. */
+static void
+grow_table(void)
+{
+    Evaluation *old_table = table;
+    size_t old_size = table_size, i;
+
+    table_size = table_size == 0 ? 1024 : 2 * table_size;
+    table = (Evaluation *) malloc_or_die(table_size * sizeof(*table));
+    for (i = 0; i < table_size; i++) {
+        table[i].depth = EMPTY_ENTRY;
+    }
+    for (i = 0; i < old_size; i++) {
+        if (old_table[i].depth != EMPTY_ENTRY) {
+            *find_evaluation(old_table[i].hash) = old_table[i];
+        }
+    }
+    (void) free((void *) old_table);
+}
+
+/* Add evaluation to the table, replacing any shallower one
+ * of the same position.
+ */
+static void
+add_evaluation(const Evaluation *evaluation)
+{
+    Evaluation *entry;
+
+    if (2 * (table_used + 1) > table_size) {
+        grow_table();
+    }
+    entry = find_evaluation(evaluation->hash);
+    if (entry->depth == EMPTY_ENTRY) {
+        table_used++;
+        *entry = *evaluation;
+    }
+    else if (entry->depth == PENDING_ENTRY || entry->depth < evaluation->depth) {
+        *entry = *evaluation;
+    }
+}
+
+/* Load the evaluations of the --evalcache file, if any, and
+ * open it for appending new ones.
+ * Those searched to less than the required depth are ignored.
+ */
+static void
+load_cache(void)
+{
+    const char *cache_file = GlobalState.evaluation_cache_file;
+    FILE *fp;
+    char magic[sizeof(cache_magic)];
+    Evaluation evaluation;
+    long records = 0;
+
+    table_loaded = TRUE;
+    grow_table();
+    if (cache_file == NULL) {
+        return;
+    }
+    fp = fopen(cache_file, "rb");
+    if (fp != NULL) {
+        if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+                memcmp(magic, cache_magic, sizeof(magic)) != 0) {
+            fprintf(GlobalState.logfile,
+                    "%s is not an evaluation cache file.\n", cache_file);
+            exit(1);
+        }
+        while (fread(&evaluation, sizeof(evaluation), 1, fp) == 1) {
+            if (evaluation.depth >= GlobalState.engine_depth &&
+                    evaluation.depth < UNSCORED_ENTRY) {
+                add_evaluation(&evaluation);
+            }
+            records++;
+        }
+        (void) fclose(fp);
+    }
+    cache_fd = open(cache_file, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (cache_fd < 0) {
+        perror(cache_file);
+        exit(1);
+    }
+    if (fp == NULL) {
+        if (write(cache_fd, cache_magic, sizeof(cache_magic)) !=
+                (ssize_t) sizeof(cache_magic)) {
+            perror(cache_file);
+            exit(1);
+        }
+    }
+    else {
+        /* Drop any record left incomplete by an earlier run, so
+         * that new ones are appended at the end of those complete.
+         */
+        off_t complete = (off_t) (sizeof(cache_magic) + records * sizeof(evaluation));
+        struct stat details;
+
+        if (fstat(cache_fd, &details) == 0 && details.st_size > complete) {
+            if (ftruncate(cache_fd, complete) != 0) {
+                perror(cache_file);
+                exit(1);
+            }
+        }
+    }
+}
+
+/* Queue the position of board for evaluation, on behalf of the
+ * move whose annotation is given, unless it has already been
+ * evaluated.
+ */
+void
+queue_engine_evaluation(const Board *board, MoveAnnotation *annotation)
+{
+    uint64_t hash = generate_zobrist_hash_from_board(board);
+    Evaluation *entry;
+
+    if (!table_loaded) {
+        load_cache();
+    }
+    entry = find_evaluation(hash);
+    if (entry->depth == UNSCORED_ENTRY) {
+        annotation->no_evaluation = TRUE;
+        return;
+    }
+    else if (entry->depth != EMPTY_ENTRY && entry->depth != PENDING_ENTRY) {
+        annotation->evaluation = entry->value / 100.0;
+        return;
+    }
+    if (entry->depth == EMPTY_ENTRY) {
+        Evaluation pending;
+
+        pending.hash = hash;
+        pending.value = 0;
+        pending.depth = PENDING_ENTRY;
+        add_evaluation(&pending);
+        if (num_jobs == job_space) {
+            job_space = job_space == 0 ? 256 : 2 * job_space;
+            jobs = (Job *) realloc_or_die((void *) jobs, job_space * sizeof(*jobs));
+        }
+        jobs[num_jobs].hash = hash;
+        jobs[num_jobs].fen = get_FEN_string(board);
+        jobs[num_jobs].to_move = board->to_move;
+        num_jobs++;
+    }
+    if (num_waiting == waiting_space) {
+        waiting_space = waiting_space == 0 ? 256 : 2 * waiting_space;
+        waiting = (Waiting *) realloc_or_die((void *) waiting,
+                                             waiting_space * sizeof(*waiting));
+    }
+    waiting[num_waiting].hash = hash;
+    waiting[num_waiting].annotation = annotation;
+    num_waiting++;
+}
+
+/* The number of jobs of the queue that have been finished. */
+static size_t jobs_finished = 0;
+
+/* Have the engines evaluate the queued positions and fill in the
+ * evaluations of the moves waiting for them.
+ */
+void
+complete_engine_evaluations(void)
+{
+    size_t i;
+
+    if (num_jobs > 0) {
+        struct pollfd *fds;
+        size_t next_job = 0;
+        unsigned e;
+
+        if (engines == NULL || engine_owner != getpid()) {
+            start_engines();
+        }
+        fds = (struct pollfd *) malloc_or_die(num_engines * sizeof(*fds));
+        jobs_finished = 0;
+        while (jobs_finished < num_jobs) {
+            for (e = 0; e < num_engines; e++) {
+                Engine *engine = &engines[e];
+
+                if (engine->state == IDLE && next_job < num_jobs) {
+                    const char *fen = jobs[next_job].fen;
+                    char *command = (char *) malloc_or_die(strlen(fen) + 50);
+
+                    sprintf(command, "position fen %s\ngo depth %u\n",
+                            fen, GlobalState.engine_depth);
+                    send_to_engine(engine, command);
+                    (void) free((void *) command);
+                    engine->state = SEARCHING;
+                    engine->job = next_job;
+                    engine->scored = FALSE;
+                    next_job++;
+                }
+                fds[e].fd = engine->from_engine;
+                fds[e].events = POLLIN;
+                fds[e].revents = 0;
+            }
+            /* Wake every second to check for engines that have hung. */
+            if (poll(fds, num_engines, 1000) < 0) {
+                if (errno != EINTR) {
+                    perror("poll");
+                    exit(1);
+                }
+            }
+            else {
+                time_t now = time(NULL);
+
+                for (e = 0; e < num_engines; e++) {
+                    if (fds[e].revents != 0) {
+                        read_from_engine(&engines[e]);
+                    }
+                    else if (engines[e].state != IDLE &&
+                            now - engines[e].last_heard > ENGINE_TIMEOUT) {
+                        engine_failed(&engines[e], "has stopped responding");
+                    }
+                }
+            }
+        }
+        (void) free((void *) fds);
+        for (i = 0; i < num_jobs; i++) {
+            (void) free((void *) jobs[i].fen);
+        }
+        num_jobs = 0;
+        save_new_evaluations();
+    }
+    for (i = 0; i < num_waiting; i++) {
+        const Evaluation *evaluation = find_evaluation(waiting[i].hash);
+
+        if (evaluation->depth == UNSCORED_ENTRY) {
+            waiting[i].annotation->no_evaluation = TRUE;
+        }
+        else {
+            waiting[i].annotation->evaluation = evaluation->value / 100.0;
+        }
+    }
+    num_waiting = 0;
+}
+
+/* Close the engines inherited from another process. */
+static void
+forget_engines(void)
+{
+    unsigned e;
+
+    for (e = 0; e < num_engines; e++) {
+        if (engines[e].state != STOPPED) {
+            (void) close(engines[e].to_engine);
+            (void) close(engines[e].from_engine);
+        }
+        (void) free((void *) engines[e].line);
+    }
+    (void) free((void *) engines);
+    engines = NULL;
+    num_engines = 0;
+}
+
+/* Start the pool of engines, each running GlobalState.engine_command. */
+static void
+start_engines(void)
+{
+    static Boolean stop_at_exit = FALSE;
+    unsigned e;
+
+    if (engines != NULL) {
+        forget_engines();
+    }
+    num_engines = GlobalState.num_engines;
+    engines = (Engine *) malloc_or_die(num_engines * sizeof(*engines));
+    engine_owner = getpid();
+    for (e = 0; e < num_engines; e++) {
+        Engine *engine = &engines[e];
+        int to_engine[2], from_engine[2];
+
+        if (pipe(to_engine) != 0 || pipe(from_engine) != 0) {
+            perror("pipe");
+            exit(1);
+        }
+        engine->pid = fork();
+        if (engine->pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+        else if (engine->pid == 0) {
+            (void) dup2(to_engine[0], 0);
+            (void) dup2(from_engine[1], 1);
+            (void) close(to_engine[0]);
+            (void) close(to_engine[1]);
+            (void) close(from_engine[0]);
+            (void) close(from_engine[1]);
+            execl("/bin/sh", "sh", "-c", GlobalState.engine_command, (char *) NULL);
+            _exit(127);
+        }
+        (void) close(to_engine[0]);
+        (void) close(from_engine[1]);
+        /* Keep them from the engines started later. */
+        (void) fcntl(to_engine[1], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(from_engine[0], F_SETFD, FD_CLOEXEC);
+        engine->to_engine = to_engine[1];
+        engine->from_engine = from_engine[0];
+        engine->state = AWAITING_UCIOK;
+        engine->line_space = 256;
+        engine->line = (char *) malloc_or_die(engine->line_space);
+        engine->line_length = 0;
+        send_to_engine(engine, "uci\n");
+    }
+    if (!stop_at_exit) {
+        atexit(stop_engines);
+        stop_at_exit = TRUE;
+    }
+}
+
+/* Send text to engine, treating any failure as that of the engine. */
+static void
+send_to_engine(Engine *engine, const char *text)
+{
+    if (!write_to_engine(engine, text)) {
+        engine_failed(engine, "stopped unexpectedly");
+    }
+    engine->last_heard = time(NULL);
+}
+
+/* Write text to engine.
+ * SIGPIPE is ignored for the duration, so that an engine that
+ * has exited results in EPIPE rather than the death of this process.
+ * Return whether it was all written.
+ */
+static Boolean
+write_to_engine(Engine *engine, const char *text)
+{
+    struct sigaction ignore, previous;
+    size_t length = strlen(text);
+    Boolean ok = TRUE;
+
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    ignore.sa_flags = 0;
+    (void) sigaction(SIGPIPE, &ignore, &previous);
+    while (ok && length > 0) {
+        ssize_t written = write(engine->to_engine, text, length);
+
+        if (written > 0) {
+            text += written;
+            length -= (size_t) written;
+        }
+        else if (written < 0 && errno != EINTR) {
+            ok = FALSE;
+        }
+    }
+    (void) sigaction(SIGPIPE, &previous, NULL);
+    return ok;
+}
+
+/* Report that engine has failed for reason, and exit. */
+static void
+engine_failed(Engine *engine, const char *reason)
+{
+    int status = 0;
+
+    (void) close(engine->to_engine);
+    (void) close(engine->from_engine);
+    engine->state = STOPPED;
+    (void) kill(engine->pid, SIGKILL);
+    fprintf(GlobalState.logfile, "--engine %s %s", GlobalState.engine_command,
+            reason);
+    if (waitpid(engine->pid, &status, 0) == engine->pid &&
+            WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        fprintf(GlobalState.logfile, " (exit status %d)",
+                WEXITSTATUS(status));
+    }
+    fprintf(GlobalState.logfile, ".\n");
+    exit(1);
+}
+
+/* Read what is available from engine and deal with each
+ * complete line.
+ */
+static void
+read_from_engine(Engine *engine)
+{
+    char buffer[4096];
+    ssize_t got = read(engine->from_engine, buffer, sizeof(buffer));
+    ssize_t i;
+
+    if (got < 0 && errno == EINTR) {
+        return;
+    }
+    if (got <= 0) {
+        engine_failed(engine, "stopped unexpectedly");
+    }
+    engine->last_heard = time(NULL);
+    for (i = 0; i < got; i++) {
+        if (buffer[i] == '\n') {
+            if (engine->line_length > 0 &&
+                    engine->line[engine->line_length - 1] == '\r') {
+                engine->line_length--;
+            }
+            engine->line[engine->line_length] = '\0';
+            deal_with_engine_line(engine, engine->line);
+            engine->line_length = 0;
+        }
+        else {
+            if (engine->line_length + 1 >= engine->line_space) {
+                engine->line_space *= 2;
+                engine->line = (char *) realloc_or_die((void *) engine->line,
+                                                       engine->line_space);
+            }
+            engine->line[engine->line_length] = buffer[i];
+            engine->line_length++;
+        }
+    }
+}
+
+/* Note the score given by an info line, unless it is only a bound
+ * or that of a line other than the first.
+ */
+static void
+note_score(Engine *engine, char *line)
+{
+    char *token = strtok(line, " \t");
+    Boolean found = FALSE, bound = FALSE;
+    long value = 0;
+
+    while (token != NULL) {
+        if (strcmp(token, "multipv") == 0) {
+            token = strtok(NULL, " \t");
+            if (token == NULL || strcmp(token, "1") != 0) {
+                return;
+            }
+        }
+        else if (strcmp(token, "score") == 0) {
+            const char *kind = strtok(NULL, " \t");
+            const char *amount = strtok(NULL, " \t");
+
+            if (kind == NULL || amount == NULL) {
+                return;
+            }
+            value = strtol(amount, NULL, 10);
+            if (strcmp(kind, "cp") == 0) {
+                found = TRUE;
+            }
+            else if (strcmp(kind, "mate") == 0) {
+                /* Mate 0 is where the side to move has been mated. */
+                value = value > 0 ? MATE_VALUE - value : -MATE_VALUE - value;
+                found = TRUE;
+            }
+        }
+        else if (strcmp(token, "lowerbound") == 0 ||
+                strcmp(token, "upperbound") == 0) {
+            bound = TRUE;
+        }
+        else if (strcmp(token, "pv") == 0 || strcmp(token, "string") == 0) {
+            /* The rest of the line is moves or text. */
+            break;
+        }
+        token = strtok(NULL, " \t");
+    }
+    if (found && !bound) {
+        engine->scored = TRUE;
+        engine->score = (int32_t) value;
+    }
+}
+
+static void
+deal_with_engine_line(Engine *engine, char *line)
+{
+    switch (engine->state) {
+        case AWAITING_UCIOK:
+            if (strcmp(line, "uciok") == 0) {
+                send_to_engine(engine, "isready\n");
+                engine->state = AWAITING_READYOK;
+            }
+            break;
+        case AWAITING_READYOK:
+            if (strcmp(line, "readyok") == 0) {
+                engine->state = IDLE;
+            }
+            break;
+        case SEARCHING:
+            if (strncmp(line, "info ", 5) == 0) {
+                note_score(engine, line);
+            }
+            else if (strncmp(line, "bestmove", 8) == 0 &&
+                    (line[8] == ' ' || line[8] == '\0')) {
+                finish_job(engine);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Record the evaluation of engine's job, from White's point of view. */
+static void
+finish_job(Engine *engine)
+{
+    const Job *job = &jobs[engine->job];
+    Evaluation evaluation;
+
+    evaluation.hash = job->hash;
+    if (!engine->scored) {
+        /* Note that there is no value, but do not cache it. */
+        evaluation.value = 0;
+        evaluation.depth = UNSCORED_ENTRY;
+        add_evaluation(&evaluation);
+        engine->state = IDLE;
+        jobs_finished++;
+        return;
+    }
+    evaluation.value = engine->score;
+    if (job->to_move == BLACK) {
+        evaluation.value = -evaluation.value;
+    }
+    evaluation.depth = GlobalState.engine_depth;
+    add_evaluation(&evaluation);
+    if (cache_fd >= 0) {
+        if (num_new == new_space) {
+            new_space = new_space == 0 ? 256 : 2 * new_space;
+            new_evaluations = (Evaluation *) realloc_or_die((void *) new_evaluations,
+                                                new_space * sizeof(*new_evaluations));
+        }
+        new_evaluations[num_new] = evaluation;
+        num_new++;
+    }
+    engine->state = IDLE;
+    jobs_finished++;
+}
+
+/* Append the new evaluations to the --evalcache file.
+ * They are written with a single write, if possible, so
+ * that those of concurrent runs are not interleaved.
+ */
+static void
+save_new_evaluations(void)
+{
+    const char *data = (const char *) new_evaluations;
+    size_t length = num_new * sizeof(*new_evaluations);
+
+    while (length > 0) {
+        ssize_t written = write(cache_fd, data, length);
+
+        if (written > 0) {
+            data += written;
+            length -= (size_t) written;
+        }
+        else if (written < 0 && errno != EINTR) {
+            perror(GlobalState.evaluation_cache_file);
+            exit(1);
+        }
+    }
+    num_new = 0;
+}
+
+/* Stop the engines and close the --evalcache file. */
+void
+stop_engines(void)
+{
+    unsigned e;
+
+    if (engines != NULL && engine_owner == getpid()) {
+        for (e = 0; e < num_engines; e++) {
+            Engine *engine = &engines[e];
+
+            if (engine->state != STOPPED) {
+                /* Any failure is of no consequence now. */
+                (void) write_to_engine(engine, "quit\n");
+                (void) close(engine->to_engine);
+                (void) close(engine->from_engine);
+                engine->state = STOPPED;
+            }
+            (void) waitpid(engine->pid, NULL, 0);
+        }
+        forget_engines();
+    }
+    if (cache_fd >= 0) {
+        save_new_evaluations();
+        (void) close(cache_fd);
+        cache_fd = -1;
+    }
+}
+
+#else
+
+void
+queue_engine_evaluation(const Board *board, MoveAnnotation *annotation)
+{
+    (void) board;
+    (void) annotation;
+    fprintf(GlobalState.logfile,
+            "--engine is not available on this platform.\n");
+    exit(1);
+}
+
+void
+complete_engine_evaluations(void)
+{
+}
+
+void
+stop_engines(void)
+{
+}
+
+#endif
@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include "bool.h"
@@ -70,18 +71,75 @@ typedef struct FENPatternMatch {
 
 static FENPatternMatch *pattern_tree = NULL;
 
-static Boolean matchhere(const char *regexp, const char *text);
-static Boolean matchstar(const char *regexp, const char *text);
-static Boolean matchccl(const char *regexp, const char *text);
-static Boolean matchnccl(const char *regexp, const char *text);
+/* The states of a square, in the order of their bits in a SquareClass. */
+static const char square_states[] = "_KQRNBPkqrnbp";
+#define NUM_SQUARE_STATES 13
+#define EMPTY_STATE 0
+#define ALL_SQUARE_STATES ((1 << NUM_SQUARE_STATES) - 1)
+
+/* The set of square states matched by a pattern character. */
+typedef uint16_t SquareClass;
+
+/* The most elements of a compiled rank: BOARDSIZE square classes
+ * either side of which there may be a single '*'.
+ */
+#define MAX_RANK_ELEMENTS (2 * BOARDSIZE + 1)
+
+/* A distinct rank pattern compiled for matching without backtracking.
+ * Bit e of a state set means that element e of the pattern is the
+ * next to be matched.
+ */
+typedef struct {
+    /* The single-square elements that accept each square state. */
+    uint32_t accepts[NUM_SQUARE_STATES];
+    /* The '*' elements. */
+    uint32_t stars;
+    /* The state set before the first square. */
+    uint32_t start;
+    /* The state of a complete match; 0 if the pattern cannot match. */
+    uint32_t final;
+    /* The leaves of the pattern tree that use this pattern. */
+    uint64_t *leaves;
+} CompiledRank;
+
+/* Cache of the leaves matched by a rank's contents. */
+#define RANK_CACHE_BITS 10
+#define RANK_CACHE_SIZE (1 << RANK_CACHE_BITS)
+/* No rank encodes to this as there are only 13 square states. */
+#define NO_RANK_KEY 0xffffffffu
+
+/* The distinct patterns for a single rank. */
+typedef struct {
+    CompiledRank *patterns;
+    unsigned num_patterns;
+    uint32_t *cache_keys;
+    uint64_t *cache_leaves;
+} RankMatcher;
+
+/* The pattern tree compiled to test a board against all
+ * of its patterns at once.
+ * Sets of leaves are bitmaps of words 64-bit words.
+ */
+typedef struct {
+    RankMatcher ranks[BOARDSIZE];
+    /* The leaves in the order in which the tree is searched. */
+    FENPatternMatch **leaves;
+    unsigned num_leaves;
+    unsigned words;
+    /* Working space for the leaves still matching a board. */
+    uint64_t *candidates;
+} CompiledPatterns;
+
+static CompiledPatterns *compiled_patterns = NULL;
+
 static Boolean matchone(char regchar, char textchar);
-static void convert_rank_to_text(const Board *board, Rank rank, char *text);
 static const char *reverse_fen_pattern(const char *pattern);
 static void pattern_tree_insert(char **ranks, const char *label, Material_details *constraint);
 static void insert_pattern(FENPatternMatch *node, FENPatternMatch *next);
-static const char *pattern_match_rank(const Board *board, 
-        FENPatternMatch *pattern, int patternIndex, 
-        char ranks[BOARDSIZE+1][BOARDSIZE+1]);
+static CompiledPatterns *compile_pattern_tree(FENPatternMatch *tree);
+static void free_compiled_patterns(void);
+static void compile_rank(const char *pattern, CompiledRank *compiled);
+static const uint64_t *rank_leaves(const CompiledPatterns *compiled, int r, const Piece *rankP);
 
 /*
  * Add a FENPattern to be matched. If add_reverse is TRUE then
@@ -295,6 +353,7 @@ pattern_tree_insert(char **ranks, const char *label, Material_details *constrain
             next->constraint = constraint;
         }
     }
+    free_compiled_patterns();
     if(pattern_tree == NULL) {
         pattern_tree = match;
     }
@@ -334,157 +393,365 @@ insert_pattern(FENPatternMatch *node, FENPatternMatch *next)
     }
 }
 
+/* Whether any FEN patterns have been added. */
+Boolean
+fen_patterns_in_use(void)
+{
+    return pattern_tree != NULL;
+}
+
 /*
  * Try to match the board against one of the FEN patterns.
  * Return NULL if no match, otherwise a possible label for the
  * match to be added to the game's tags. An empty string is
  * used for no label.
+ * The ranks of the board are matched against all of the
+ * patterns at once by the compiled form of the pattern tree.
  */
 const char *
 pattern_match_board(const Board *board)
 {
     const char *match_label = NULL;
     if(pattern_tree != NULL) {
-        /* Don't convert any ranks of the board until they
-         * are required.
+        if(compiled_patterns == NULL) {
+            compiled_patterns = compile_pattern_tree(pattern_tree);
+        }
+        const CompiledPatterns *compiled = compiled_patterns;
+        uint64_t *candidates = compiled->candidates;
+        Boolean possible = TRUE;
+        for(int r = 0; r < BOARDSIZE && possible; r++) {
+            const uint64_t *leaves =
+                rank_leaves(compiled, r, board->board[RankConvert(LASTRANK - r)]);
+            uint64_t any = 0;
+            for(unsigned w = 0; w < compiled->words; w++) {
+                candidates[w] = r == 0 ? leaves[w] : candidates[w] & leaves[w];
+                any |= candidates[w];
+            }
+            possible = any != 0;
+        }
+        /* Take the first surviving leaf, in tree order, whose
+         * material constraint (if any) is also satisfied.
          */
-        char ranks[BOARDSIZE+1][BOARDSIZE+1];
-        for(int i = 0; i < BOARDSIZE; i++) {
-            ranks[i][0] = '\0';
+        for(unsigned w = 0; possible && match_label == NULL && w < compiled->words; w++) {
+            uint64_t bits = candidates[w];
+            unsigned leaf = w * 64;
+            while(bits != 0 && match_label == NULL) {
+                if(bits & 1) {
+                    const FENPatternMatch *pattern = compiled->leaves[leaf];
+                    if(pattern->constraint == NULL ||
+                            constraint_material_match(pattern->constraint, board)) {
+                        match_label = pattern->optional_label;
+                    }
+                }
+                bits >>= 1;
+                leaf++;
+            }
         }
-        match_label = pattern_match_rank(board, pattern_tree, 0, ranks);
     }
     return match_label;
 }
 
+/* The rank of a pattern used by a given leaf of the pattern tree. */
+typedef struct {
+    const char *rank;
+    unsigned leaf;
+} LeafRank;
 
-/* Match ranks[patternIndex ...] against board.
- * return the corresponding match label if a match is found.
- * Return NULL if no match is found.
+/* Collect the leaves below node in the order in which a
+ * depth-first search of the tree visits them.
+ * path holds the ranks leading to node.
  */
-static const char *pattern_match_rank(const Board *board, FENPatternMatch *pattern, int patternIndex, char ranks[BOARDSIZE+1][BOARDSIZE+1])
+static void
+collect_leaves(FENPatternMatch *node, int depth, const char **path,
+               CompiledPatterns *compiled, const char ***leaf_ranks,
+               unsigned *allocated)
 {
-    const char *match_label = NULL;
-    if(ranks[patternIndex][0] == '\0') {
-        /* Convert the required rank.
-         * Convert the others when/if needed.
-         */
-        convert_rank_to_text(board, LASTRANK - patternIndex, ranks[patternIndex]);
+    for(; node != NULL; node = node->alternative_rank) {
+        path[depth] = node->rank;
+        if(depth == BOARDSIZE - 1) {
+            if(compiled->num_leaves == *allocated) {
+                *allocated = *allocated == 0 ? 64 : 2 * *allocated;
+                compiled->leaves = (FENPatternMatch **)
+                    realloc_or_die(compiled->leaves,
+                                   *allocated * sizeof(*compiled->leaves));
+                *leaf_ranks = (const char **)
+                    realloc_or_die(*leaf_ranks,
+                                   *allocated * BOARDSIZE * sizeof(**leaf_ranks));
+            }
+            compiled->leaves[compiled->num_leaves] = node;
+            memcpy(*leaf_ranks + compiled->num_leaves * BOARDSIZE, path,
+                   BOARDSIZE * sizeof(*path));
+            compiled->num_leaves++;
+        }
+        else {
+            collect_leaves(node->next_rank, depth + 1, path,
+                           compiled, leaf_ranks, allocated);
+        }
     }
-    while(match_label == NULL && pattern != NULL) {
-        if(matchhere(pattern->rank, ranks[patternIndex])) {
-            if(patternIndex == BOARDSIZE - 1) {
-                /* The board matches the pattern. */
-                if(pattern->constraint != NULL) {
-                    if(constraint_material_match(pattern->constraint, board)) {
-                        match_label = pattern->optional_label;
-                    }
-                }
-                else {
-                    match_label = pattern->optional_label;
-                }
+}
+
+static int
+compare_leaf_ranks(const void *p1, const void *p2)
+{
+    const LeafRank *r1 = (const LeafRank *) p1;
+    const LeafRank *r2 = (const LeafRank *) p2;
+    int order = strcmp(r1->rank, r2->rank);
+    if(order != 0) {
+        return order;
+    }
+    else {
+        return r1->leaf < r2->leaf ? -1 : r1->leaf > r2->leaf;
+    }
+}
+
+/*
+ * Compile the pattern tree rooted at tree.
+ * The tree only shares common prefixes of patterns, so each rank
+ * pattern is compiled just once for all the leaves that use it,
+ * wherever it occurs in the tree.
+ */
+static CompiledPatterns *
+compile_pattern_tree(FENPatternMatch *tree)
+{
+    CompiledPatterns *compiled = (CompiledPatterns *) malloc_or_die(sizeof(*compiled));
+    const char *path[BOARDSIZE];
+    const char **leaf_ranks = NULL;
+    unsigned allocated = 0;
+
+    compiled->leaves = NULL;
+    compiled->num_leaves = 0;
+    collect_leaves(tree, 0, path, compiled, &leaf_ranks, &allocated);
+    compiled->words = (compiled->num_leaves + 63) / 64;
+    compiled->candidates = (uint64_t *)
+        malloc_or_die(compiled->words * sizeof(*compiled->candidates));
+
+    LeafRank *sorted = (LeafRank *)
+        malloc_or_die(compiled->num_leaves * sizeof(*sorted));
+    for(int r = 0; r < BOARDSIZE; r++) {
+        RankMatcher *matcher = &compiled->ranks[r];
+        unsigned distinct = 0;
+
+        for(unsigned leaf = 0; leaf < compiled->num_leaves; leaf++) {
+            sorted[leaf].rank = leaf_ranks[leaf * BOARDSIZE + r];
+            sorted[leaf].leaf = leaf;
+        }
+        qsort(sorted, compiled->num_leaves, sizeof(*sorted), compare_leaf_ranks);
+        for(unsigned i = 0; i < compiled->num_leaves; i++) {
+            if(i == 0 || strcmp(sorted[i].rank, sorted[i - 1].rank) != 0) {
+                distinct++;
             }
-            else {
-                /* Try next rank.*/
-                match_label = pattern_match_rank(board, pattern->next_rank, patternIndex + 1, ranks);
+        }
+
+        matcher->num_patterns = distinct;
+        matcher->patterns = (CompiledRank *)
+            malloc_or_die(distinct * sizeof(*matcher->patterns));
+        uint64_t *leaf_sets = (uint64_t *)
+            malloc_or_die(distinct * compiled->words * sizeof(*leaf_sets));
+        memset(leaf_sets, 0, distinct * compiled->words * sizeof(*leaf_sets));
+        CompiledRank *pattern = NULL;
+        for(unsigned i = 0; i < compiled->num_leaves; i++) {
+            if(i == 0 || strcmp(sorted[i].rank, sorted[i - 1].rank) != 0) {
+                pattern = pattern == NULL ? matcher->patterns : pattern + 1;
+                compile_rank(sorted[i].rank, pattern);
+                pattern->leaves = leaf_sets;
+                leaf_sets += compiled->words;
             }
+            pattern->leaves[sorted[i].leaf / 64] |= (uint64_t) 1 << (sorted[i].leaf % 64);
         }
-        
-        if(match_label == NULL) {
-            pattern = pattern->alternative_rank;
+
+        matcher->cache_keys = (uint32_t *)
+            malloc_or_die(RANK_CACHE_SIZE * sizeof(*matcher->cache_keys));
+        for(unsigned slot = 0; slot < RANK_CACHE_SIZE; slot++) {
+            matcher->cache_keys[slot] = NO_RANK_KEY;
         }
+        matcher->cache_leaves = (uint64_t *)
+            malloc_or_die(RANK_CACHE_SIZE * compiled->words * sizeof(*matcher->cache_leaves));
     }
-    return match_label;
+    (void) free((void *) sorted);
+    (void) free((void *) leaf_ranks);
+    return compiled;
 }
 
-/**
- * matchhere: search for regexp at beginning of text
+/* Discard the compiled form of the patterns, e.g., because
+ * another pattern has been added.
  */
-static Boolean
-matchhere(const char *regexp, const char *text)
+static void
+free_compiled_patterns(void)
 {
-    if (regexp[0] == '\0' && text[0] == '\0') {
-        return TRUE;
+    if(compiled_patterns != NULL) {
+        for(int r = 0; r < BOARDSIZE; r++) {
+            RankMatcher *matcher = &compiled_patterns->ranks[r];
+            if(matcher->num_patterns > 0) {
+                /* The leaf sets were allocated as a single block. */
+                (void) free((void *) matcher->patterns[0].leaves);
+            }
+            (void) free((void *) matcher->patterns);
+            (void) free((void *) matcher->cache_keys);
+            (void) free((void *) matcher->cache_leaves);
+        }
+        (void) free((void *) compiled_patterns->leaves);
+        (void) free((void *) compiled_patterns->candidates);
+        (void) free((void *) compiled_patterns);
+        compiled_patterns = NULL;
     }
-    if (regexp[0] == ZERO_OR_MORE_OF_ANYTHING) {
-        return matchstar(regexp + 1, text);
+}
+
+/* Return the square-class bitmask of the single pattern character
+ * regchar.
+ */
+static SquareClass
+square_class(char regchar)
+{
+    SquareClass class = 0;
+    for(int s = 0; s < NUM_SQUARE_STATES; s++) {
+        if(matchone(regchar, square_states[s])) {
+            class |= 1 << s;
+        }
     }
-    if (*text != '\0') {
-        switch (*regexp) {
-            case ANY_SQUARE_STATE:
-                return matchhere(regexp + 1, text + 1);
-                break;
-            case NON_EMPTY_SQUARE:
-            case ANY_WHITE_PIECE:
-            case ANY_BLACK_PIECE:
-            case NOT_A_PAWN:
-                if (matchone(*regexp, *text)) {
-                    return matchhere(regexp + 1, text + 1);
-                }
-                break;
-            case CCL_START:
-                /* Closure */
-                if (regexp[1] == NCCL) {
-                    return matchnccl(regexp + 2, text);
-                }
-                else {
-                    return matchccl(regexp + 1, text);
-                }
-                break;
-            case '1': case '2': case '3': case '4':
-            case '5': case '6': case '7': case '8':
-            {
-                /* The number of empty squares required. */
-                int empty = regexp[0] - '0';
-                Boolean matches = TRUE;
-                /* The number matched. */
-                int match_count = 0;
-                while (matches && match_count < empty) {
-                    if (text[match_count] == EMPTY_SQUARE) {
-                        match_count++;
-                    }
-                    else {
-                        matches = FALSE;
-                    }
-                }
-                if (matches) {
-                    return matchhere(regexp + 1, text + match_count);
-                }
+    return class;
+}
+
+/*
+ * Compile the single rank pattern into compiled.
+ * The pattern becomes a sequence of elements: either a square class
+ * that matches one square or a '*' that matches any number.
+ * A rank that is a sequence of elements is matched without backtracking
+ * by tracking the set of elements that could be next to be matched.
+ */
+static void
+compile_rank(const char *pattern, CompiledRank *compiled)
+{
+    /* The number of elements. */
+    unsigned length = 0;
+    /* The number of squares required by the elements. */
+    int squares = 0;
+    SquareClass classes[MAX_RANK_ELEMENTS];
+    uint32_t stars = 0;
+    Boolean possible = TRUE;
+    const char *p = pattern;
+
+    while(*p != '\0' && possible) {
+        if(*p == ZERO_OR_MORE_OF_ANYTHING) {
+            /* Consecutive stars are equivalent to a single one. */
+            if(length == 0 || (stars & ((uint32_t) 1 << (length - 1))) == 0) {
+                stars |= (uint32_t) 1 << length;
+                classes[length] = 0;
+                length++;
             }
-                break;
-            default:
-                if (*regexp == *text) {
-                    return matchhere(regexp + 1, text + 1);
+            p++;
+        }
+        else if(*p >= '1' && *p <= '8') {
+            int empty = *p - '0';
+            if(squares + empty > BOARDSIZE) {
+                possible = FALSE;
+            }
+            else {
+                for(int i = 0; i < empty; i++) {
+                    classes[length] = 1 << EMPTY_STATE;
+                    length++;
                 }
-                break;
+                squares += empty;
+            }
+            p++;
+        }
+        else if(squares == BOARDSIZE) {
+            possible = FALSE;
+        }
+        else if(*p == CCL_START) {
+            Boolean negated = p[1] == NCCL;
+            SquareClass class = 0;
+            p += negated ? 2 : 1;
+            while(*p != CCL_END && *p != '\0') {
+                class |= square_class(*p);
+                p++;
+            }
+            if(*p == CCL_END) {
+                classes[length] = negated ? (SquareClass) (~class & ALL_SQUARE_STATES) : class;
+                length++;
+                squares++;
+                p++;
+            }
+            else {
+                /* An unterminated closure never matches. */
+                possible = FALSE;
+            }
+        }
+        else {
+            classes[length] = square_class(*p);
+            length++;
+            squares++;
+            p++;
         }
     }
-    /* No match. */
-    return FALSE;
+
+    for(int s = 0; s < NUM_SQUARE_STATES; s++) {
+        compiled->accepts[s] = 0;
+        for(unsigned e = 0; e < length; e++) {
+            if(classes[e] & (1 << s)) {
+                compiled->accepts[s] |= (uint32_t) 1 << e;
+            }
+        }
+    }
+    compiled->stars = stars;
+    compiled->start = 1 | (1 & stars) << 1;
+    compiled->final = possible ? (uint32_t) 1 << length : 0;
 }
 
-/**
- * matchstar: leftmost longest search on a single rank.
- */
+/* Whether the squares of a rank match the compiled rank pattern. */
 static Boolean
-matchstar(const char *regexp, const char *text)
+rank_matches(const CompiledRank *pattern, const unsigned char *states)
 {
-    const char *t;
+    uint32_t next = pattern->start;
+    for(int col = 0; col < BOARDSIZE && next != 0; col++) {
+        next = (next & pattern->accepts[states[col]]) << 1 | (next & pattern->stars);
+        /* A star may also match nothing. */
+        next |= (next & pattern->stars) << 1;
+    }
+    return (next & pattern->final) != 0;
+}
+
+/*
+ * Return the set of leaves whose pattern for rank r matches
+ * the given rank of the board.
+ */
+static const uint64_t *
+rank_leaves(const CompiledPatterns *compiled, int r, const Piece *rankP)
+{
+    const RankMatcher *matcher = &compiled->ranks[r];
+    unsigned char states[BOARDSIZE];
+    uint32_t key = 0;
+    for(Col col = FIRSTCOL; col <= LASTCOL; col++) {
+        int coloured_piece = rankP[ColConvert(col)];
+        unsigned char state;
+        if(coloured_piece != EMPTY) {
+            state = (unsigned char) (strchr(square_states,
+                        coloured_piece_to_SAN_letter(coloured_piece)) - square_states);
+        }
+        else {
+            state = EMPTY_STATE;
+        }
+        states[col - FIRSTCOL] = state;
+        key = key << 4 | state;
+    }
 
-    /* Find the end of this rank. */
-    for (t = text; *t != '\0'; t++) {
-        ;
+    unsigned slot = (unsigned) ((key * 2654435761u) >> (32 - RANK_CACHE_BITS));
+    uint64_t *leaves = matcher->cache_leaves + slot * compiled->words;
+    if(matcher->cache_keys[slot] != key) {
+        memset(leaves, 0, compiled->words * sizeof(*leaves));
+        for(unsigned k = 0; k < matcher->num_patterns; k++) {
+            const CompiledRank *pattern = &matcher->patterns[k];
+            if(rank_matches(pattern, states)) {
+                for(unsigned w = 0; w < compiled->words; w++) {
+                    leaves[w] |= pattern->leaves[w];
+                }
+            }
+        }
+        matcher->cache_keys[slot] = key;
     }
-    /* Try from the longest match to the shortest until success. */
-    do {
-        /* * matches zero or more */
-        if (matchhere(regexp, t)) {
-            return TRUE;
-        }
-    } while (t-- > text);
-    return FALSE;
+    return leaves;
 }
 
+
 /*
  * Return TRUE if regchar matches textchar, FALSE otherwise.
  */
@@ -540,45 +807,6 @@ matchone(char regchar, char textchar)
     }
 }
 
-/*
- * Match any of the character closure.
- */
-static Boolean
-matchccl(const char *regexp, const char *text)
-{
-    while (*regexp != CCL_END &&
-            !matchone(*regexp, *text) && *regexp != '\0') {
-        regexp++;
-    }
-    if (matchone(*regexp, *text)) {
-        do {
-            regexp++;
-        } while (*regexp != CCL_END && *regexp != '\0');
-        return matchhere(regexp + 1, text + 1);
-    }
-    else {
-        return FALSE;
-    }
-}
-
-/*
- * Match any of the characters not in the closure.
- */
-static Boolean
-matchnccl(const char *regexp, const char *text)
-{
-    while (*regexp != CCL_END &&
-            !matchone(*regexp, *text) && *regexp != '\0') {
-        regexp++;
-    }
-    if (*regexp == CCL_END) {
-        return matchhere(regexp + 1, text + 1);
-    }
-    else {
-        return FALSE;
-    }
-}
-
 #if 0
 /* Build a basic EPD string from the given board. */
 static char *
@@ -610,23 +838,3 @@ convert_board_to_text(const Board *board)
     return text;
 }
 #endif
-
-/* Build a basic EPD string from rank of the given board. */
-static void
-convert_rank_to_text(const Board *board, Rank rank, char *text)
-{
-    const Piece *rankP = board->board[RankConvert(rank)];
-    int ix = 0;
-    Col col;
-    for (col = FIRSTCOL; col <= LASTCOL; col++) {
-        int coloured_piece = rankP[ColConvert(col)];
-        if (coloured_piece != EMPTY) {
-            text[ix] = coloured_piece_to_SAN_letter(coloured_piece);
-        }
-        else {
-            text[ix] = EMPTY_SQUARE;
-        }
-        ix++;
-    }
-    text[ix] = '\0';
-}
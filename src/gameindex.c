@@ -0,0 +1,593 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+
+/* Support for --gameindex.
+ * The game index of an input file is kept alongside it, in a file
+ * whose name has the suffix .pgni, and records where each of its games
+ * ends, along with the number of lines before that point, so that
+ * games can be passed over without being read.
+ * If the index does not exist, or the input file has changed since it
+ * was built, then the file is processed as normal and its index is
+ * built along the way.
+ * Otherwise, the games before --firstgame are passed over by carrying
+ * on straight from the end of the last of them, unless they are still
+ * needed for duplicate detection or as non-matching games, and the
+ * chunks of --offsetchunks end exactly at the ends of games.
+ * The tags met for the first time in the file are also recorded, so
+ * that those of the games passed over are numbered in the same order
+ * as if the games had been read.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define GAME_INDEX 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if GAME_INDEX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "compress.h"
+#include "gameindex.h"
+
+#if GAME_INDEX
+
+#define GAME_INDEX_MAGIC "PGNGAMEI"
+#define GAME_INDEX_VERSION 1
+/* The recorded end of a game that is followed by more on its line. */
+#define UNKNOWN_OFFSET UINT64_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_tags;
+    /* The size and modification time of the indexed file. */
+    int64_t size;
+    int64_t time;
+    uint64_t num_games;
+    /* The number of bytes in the pool of tag names. */
+    uint64_t name_space;
+} GameIndexHeader;
+
+/* Where a game ends: the offset of the start of the line after it,
+ * and the number of lines before that.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t lines;
+} IndexedGame;
+
+/* A tag that is first met in the file. */
+typedef struct {
+    /* The number of games of the file before the one it is met in. */
+    uint64_t games_before;
+    /* Offset of the tag's name in the name pool. */
+    uint32_t name;
+    uint32_t unused;
+} IndexedTag;
+
+/* The index of one input file, either as it is built or as read. */
+static struct {
+    /* Whether this is the index of file_number. */
+    Boolean open;
+    unsigned file_number;
+    /* Whether the index is being built, rather than having been read. */
+    Boolean building;
+    /* Whether it was read from its file. */
+    Boolean loaded;
+    /* The number of games processed before the file was opened. */
+    unsigned long games_before_file;
+    IndexedGame *games;
+    size_t num_games, max_games;
+    IndexedTag *tags;
+    size_t num_tags, max_tags;
+    char *names;
+    size_t name_space, max_name_space;
+    /* Which tags have been met in the file, while building. */
+    Boolean *tags_met;
+    unsigned num_tags_met;
+    /* How many of the tags read have been registered. */
+    size_t tags_registered;
+    /* The contents of the index file, when read. */
+    void *contents;
+    size_t length;
+    Boolean mapped;
+} game_index;
+
+static void release_game_index(void);
+
+/* Return the name of the game index of input file file_number. */
+static char *
+game_index_name(unsigned file_number)
+{
+    const char *name = input_file_name(file_number);
+    char *index_name = (char *) malloc_or_die(strlen(name) +
+            strlen(GAME_INDEX_SUFFIX) + 1);
+
+    strcpy(index_name, name);
+    strcat(index_name, GAME_INDEX_SUFFIX);
+    return index_name;
+}
+
+/* Whether the input files are being read in order by a single process,
+ * and so can be indexed.
+ */
+static Boolean
+game_index_possible(void)
+{
+    return GlobalState.game_index && GlobalState.num_threads <= 1 &&
+            GlobalState.batch_file == NULL &&
+            GlobalState.position_index_file == NULL;
+}
+
+/* Whether the games before --firstgame can be passed over.
+ * They are not if they could still be needed for duplicate detection,
+ * be output as non-matching games, or be recorded by a checkpoint.
+ */
+static Boolean
+passing_over_possible(void)
+{
+    return GlobalState.non_matching_file == NULL &&
+            !GlobalState.suppress_duplicates &&
+            !GlobalState.suppress_originals &&
+            GlobalState.duplicate_file == NULL &&
+            GlobalState.duplicate_index_file == NULL &&
+            GlobalState.duplicate_scan_prefix == NULL &&
+            GlobalState.duplicate_resolve_prefix == NULL &&
+            !GlobalState.delete_same_setup &&
+            GlobalState.checkpoint_file == NULL;
+}
+
+/* Set size and time to those of input file file_number.
+ * Return FALSE if it is not a regular, uncompressed file.
+ */
+static Boolean
+indexable_file(unsigned file_number, int64_t *size, int64_t *time)
+{
+    const char *name = input_file_name(file_number);
+    struct stat file_details;
+
+    if (name == NULL || input_file_type(file_number) != NORMALFILE ||
+            stat(name, &file_details) != 0 || !S_ISREG(file_details.st_mode) ||
+            compressed_input_file(name)) {
+        return FALSE;
+    }
+    *size = (int64_t) file_details.st_size;
+    *time = (int64_t) file_details.st_mtime;
+    return TRUE;
+}
+
+/* Read the index of input file file_number, if it exists and was
+ * built from the current state of the file. Return TRUE if so.
+ */
+static Boolean
+load_game_index(unsigned file_number)
+{
+    char *index_file = game_index_name(file_number);
+    FILE *fp = fopen(index_file, "rb");
+    GameIndexHeader header;
+    size_t length = 0, expected;
+    void *contents;
+    Boolean mapped = TRUE;
+    int64_t size, time;
+
+    if (fp == NULL) {
+        (void) free((void *) index_file);
+        return FALSE;
+    }
+    if (fseek(fp, 0L, SEEK_END) == 0) {
+        long end = ftell(fp);
+        if (end > 0) {
+            length = (size_t) end;
+        }
+    }
+    if (length < sizeof (header) || fseek(fp, 0L, SEEK_SET) != 0 ||
+            fread((void *) &header, sizeof (header), 1, fp) != 1 ||
+            memcmp(header.magic, GAME_INDEX_MAGIC, sizeof (header.magic)) != 0) {
+        fprintf(GlobalState.logfile, "%s is not a game index file.\n", index_file);
+        exit(1);
+    }
+    expected = sizeof (header) + header.num_games * sizeof (IndexedGame) +
+            header.num_tags * sizeof (IndexedTag) + header.name_space;
+    if (header.version != GAME_INDEX_VERSION || expected != length ||
+            !indexable_file(file_number, &size, &time) ||
+            header.size != size || header.time != time) {
+        /* It will be rebuilt. */
+        (void) fclose(fp);
+        (void) free((void *) index_file);
+        return FALSE;
+    }
+    contents = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (contents == MAP_FAILED) {
+        mapped = FALSE;
+        contents = malloc_or_die(length);
+        if (fseek(fp, 0L, SEEK_SET) != 0 ||
+                fread(contents, 1, length, fp) != length) {
+            fprintf(GlobalState.logfile,
+                    "Unable to read the game index %s\n", index_file);
+            exit(1);
+        }
+    }
+    (void) fclose(fp);
+    (void) free((void *) index_file);
+
+    game_index.contents = contents;
+    game_index.length = length;
+    game_index.mapped = mapped;
+    game_index.num_games = (size_t) header.num_games;
+    game_index.games = (IndexedGame *) ((char *) contents + sizeof (header));
+    game_index.num_tags = header.num_tags;
+    game_index.tags = (IndexedTag *) (game_index.games + game_index.num_games);
+    game_index.name_space = (size_t) header.name_space;
+    game_index.names = (char *) (game_index.tags + game_index.num_tags);
+    if (game_index.name_space > 0 &&
+            game_index.names[game_index.name_space - 1] != '\0') {
+        /* The names would not be terminated. */
+        game_index.num_tags = 0;
+    }
+    return TRUE;
+}
+
+/* Write the index that has just been built. */
+static void
+save_game_index(void)
+{
+    char *index_file = game_index_name(game_index.file_number);
+    char *temp_name;
+    GameIndexHeader header;
+    FILE *fp;
+    Boolean ok;
+
+    memset((void *) &header, 0, sizeof (header));
+    memcpy(header.magic, GAME_INDEX_MAGIC, sizeof (header.magic));
+    header.version = GAME_INDEX_VERSION;
+    header.num_tags = (uint32_t) game_index.num_tags;
+    header.num_games = game_index.num_games;
+    header.name_space = game_index.name_space;
+    if (!indexable_file(game_index.file_number, &header.size, &header.time)) {
+        (void) free((void *) index_file);
+        return;
+    }
+
+    temp_name = (char *) malloc_or_die(strlen(index_file) + strlen(".tmp") + 1);
+    strcpy(temp_name, index_file);
+    strcat(temp_name, ".tmp");
+    fp = fopen(temp_name, "wb");
+    if (fp == NULL) {
+        fprintf(GlobalState.logfile,
+                "Unable to write the game index %s\n", temp_name);
+    }
+    else {
+        ok = fwrite((void *) &header, sizeof (header), 1, fp) == 1 &&
+                (game_index.num_games == 0 ||
+                 fwrite((void *) game_index.games, sizeof (*game_index.games),
+                        game_index.num_games, fp) == game_index.num_games) &&
+                (game_index.num_tags == 0 ||
+                 fwrite((void *) game_index.tags, sizeof (*game_index.tags),
+                        game_index.num_tags, fp) == game_index.num_tags) &&
+                (game_index.name_space == 0 ||
+                 fwrite((void *) game_index.names, 1, game_index.name_space, fp) ==
+                        game_index.name_space);
+        if (fclose(fp) != 0) {
+            ok = FALSE;
+        }
+        if (ok && rename(temp_name, index_file) != 0) {
+            /* Some systems will not rename over an existing file. */
+            (void) remove(index_file);
+            ok = rename(temp_name, index_file) == 0;
+        }
+        if (!ok) {
+            fprintf(GlobalState.logfile,
+                    "Unable to write the game index %s\n", index_file);
+            (void) remove(temp_name);
+        }
+    }
+    (void) free((void *) temp_name);
+    (void) free((void *) index_file);
+}
+
+/* Discard the current index. */
+static void
+release_game_index(void)
+{
+    if (game_index.contents != NULL) {
+        if (game_index.mapped) {
+            (void) munmap(game_index.contents, game_index.length);
+        }
+        else {
+            (void) free(game_index.contents);
+        }
+    }
+    else {
+        (void) free((void *) game_index.games);
+        (void) free((void *) game_index.tags);
+        (void) free((void *) game_index.names);
+    }
+    (void) free((void *) game_index.tags_met);
+    memset((void *) &game_index, 0, sizeof (game_index));
+}
+
+/* Make the index of input file file_number the current one, reading
+ * it if possible, for the use of indexed_game_start.
+ * Return FALSE if it cannot be read.
+ */
+static Boolean
+select_game_index(unsigned file_number)
+{
+    if (!game_index.open || game_index.file_number != file_number ||
+            game_index.building) {
+        release_game_index();
+        game_index.open = TRUE;
+        game_index.file_number = file_number;
+        game_index.loaded = load_game_index(file_number);
+    }
+    return game_index.loaded;
+}
+
+/* Record that the game just processed ends where the symbol last
+ * returned by the lexical analyser does.
+ * games is the number of the file's games processed so far.
+ */
+static void
+record_game_end(size_t games)
+{
+    size_t offset;
+    unsigned long lines;
+
+    if (games == 0) {
+        return;
+    }
+    if (games > game_index.max_games) {
+        game_index.max_games = game_index.max_games == 0 ?
+                1024 : 2 * game_index.max_games;
+        if (game_index.max_games < games) {
+            game_index.max_games = games;
+        }
+        game_index.games = (IndexedGame *) realloc_or_die(
+                (void *) game_index.games,
+                game_index.max_games * sizeof (*game_index.games));
+    }
+    /* The ends of any games processed without a break between them
+     * are not known.
+     */
+    while (game_index.num_games < games) {
+        game_index.games[game_index.num_games].offset = UNKNOWN_OFFSET;
+        game_index.games[game_index.num_games].lines = 0;
+        game_index.num_games++;
+    }
+    if (input_line_position(&offset, &lines)) {
+        game_index.games[games - 1].offset = offset;
+        game_index.games[games - 1].lines = lines;
+    }
+}
+
+/* Pass over as many as possible of the games before --firstgame
+ * that follow the games processed so far in the file.
+ */
+static void
+pass_over_indexed_games(size_t games)
+{
+    size_t wanted = GlobalState.first_game_number - 1 - game_index.games_before_file;
+    size_t end;
+
+    if (wanted > game_index.num_games) {
+        wanted = game_index.num_games;
+    }
+    end = wanted;
+    while (end > games && game_index.games[end - 1].offset == UNKNOWN_OFFSET) {
+        end--;
+    }
+    if (end > games && seek_input((size_t) game_index.games[end - 1].offset,
+                (unsigned long) game_index.games[end - 1].lines)) {
+        /* Register the tags of those games, in the order they are met. */
+        while (game_index.tags_registered < game_index.num_tags &&
+                game_index.tags[game_index.tags_registered].games_before < end) {
+            const IndexedTag *tag = &game_index.tags[game_index.tags_registered];
+
+            if (tag->name < game_index.name_space) {
+                (void) lookup_tag(&game_index.names[tag->name]);
+            }
+            game_index.tags_registered++;
+        }
+        GlobalState.num_games_processed += end - games;
+    }
+}
+#endif
+
+/* Input file file_number has just been opened to be read from the
+ * start: read its index or start to build one.
+ */
+void
+open_game_index(unsigned file_number)
+{
+#if GAME_INDEX
+    int64_t size, time;
+
+    release_game_index();
+    if (game_index_possible() && indexable_file(file_number, &size, &time)) {
+        game_index.open = TRUE;
+        game_index.file_number = file_number;
+        game_index.games_before_file = GlobalState.num_games_processed;
+        game_index.loaded = load_game_index(file_number);
+        game_index.building = !game_index.loaded;
+    }
+#else
+    (void) file_number;
+#endif
+}
+
+/* The whole of the current input file has been read, so save its
+ * index if it has been built.
+ */
+void
+close_game_index(void)
+{
+#if GAME_INDEX
+    if (game_index.open && game_index.building &&
+            current_file_number() == game_index.file_number) {
+        save_game_index();
+    }
+    release_game_index();
+#endif
+}
+
+/* Record tag, which has been met in the input file being indexed,
+ * if it is the first time in the file.
+ */
+void
+index_game_tag(TagName tag)
+{
+#if GAME_INDEX
+    if (game_index.building && tag >= ORIGINAL_NUMBER_OF_TAGS) {
+        if (tag >= game_index.num_tags_met) {
+            unsigned num_tags = number_of_tags();
+            unsigned t;
+
+            game_index.tags_met = (Boolean *) realloc_or_die(
+                    (void *) game_index.tags_met,
+                    num_tags * sizeof (*game_index.tags_met));
+            for (t = game_index.num_tags_met; t < num_tags; t++) {
+                game_index.tags_met[t] = FALSE;
+            }
+            game_index.num_tags_met = num_tags;
+        }
+        if (!game_index.tags_met[tag]) {
+            const char *name = tag_header_string(tag);
+            size_t length = strlen(name) + 1;
+            IndexedTag *indexed;
+
+            game_index.tags_met[tag] = TRUE;
+            if (game_index.num_tags == game_index.max_tags) {
+                game_index.max_tags = game_index.max_tags == 0 ?
+                        16 : 2 * game_index.max_tags;
+                game_index.tags = (IndexedTag *) realloc_or_die(
+                        (void *) game_index.tags,
+                        game_index.max_tags * sizeof (*game_index.tags));
+            }
+            while (game_index.name_space + length > game_index.max_name_space) {
+                game_index.max_name_space = game_index.max_name_space == 0 ?
+                        256 : 2 * game_index.max_name_space;
+                game_index.names = (char *) realloc_or_die(
+                        (void *) game_index.names, game_index.max_name_space);
+            }
+            indexed = &game_index.tags[game_index.num_tags++];
+            indexed->games_before = GlobalState.num_games_processed -
+                    game_index.games_before_file;
+            indexed->name = (uint32_t) game_index.name_space;
+            indexed->unused = 0;
+            memcpy(&game_index.names[game_index.name_space], name, length);
+            game_index.name_space += length;
+        }
+    }
+#else
+    (void) tag;
+#endif
+}
+
+/* Nothing of the next game has been read from the current input file:
+ * record where the last game ended, or pass over the games before
+ * --firstgame.
+ */
+void
+index_game_boundary(void)
+{
+#if GAME_INDEX
+    if (game_index.open && game_index_possible() &&
+            current_file_number() == game_index.file_number &&
+            GlobalState.current_file_type == NORMALFILE) {
+        size_t games = GlobalState.num_games_processed - game_index.games_before_file;
+
+        if (game_index.building) {
+            record_game_end(games);
+        }
+        else if (game_index.loaded &&
+                GlobalState.num_games_processed + 1 < GlobalState.first_game_number &&
+                passing_over_possible()) {
+            pass_over_indexed_games(games);
+        }
+    }
+#endif
+}
+
+/* Find the end of the first game of input file file_number that ends
+ * at or after from, according to its index, for --offsetchunks.
+ * Set offset to it and lines to the number of lines before it.
+ * Return FALSE if the file has no index or there is no such game.
+ */
+Boolean
+indexed_game_start(unsigned file_number, size_t from,
+        size_t *offset, unsigned long *lines)
+{
+#if GAME_INDEX
+    size_t low = 0, high, found;
+
+    if (!GlobalState.game_index || !select_game_index(file_number)) {
+        return FALSE;
+    }
+    high = found = game_index.num_games;
+    /* The known ends are in order of their offsets. */
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        size_t probe = mid;
+
+        while (probe < high && game_index.games[probe].offset == UNKNOWN_OFFSET) {
+            probe++;
+        }
+        if (probe == high) {
+            high = mid;
+        }
+        else if (game_index.games[probe].offset < from) {
+            low = probe + 1;
+        }
+        else {
+            found = probe;
+            high = mid;
+        }
+    }
+    if (found == game_index.num_games) {
+        return FALSE;
+    }
+    *offset = (size_t) game_index.games[found].offset;
+    *lines = (unsigned long) game_index.games[found].lines;
+    return TRUE;
+#else
+    (void) file_number;
+    (void) from;
+    (void) offset;
+    (void) lines;
+    return FALSE;
+#endif
+}
@@ -0,0 +1,38 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+
+#ifndef GAMEINDEX_H
+#define GAMEINDEX_H
+
+/* The suffix of the name of the game index of an input file. */
+#define GAME_INDEX_SUFFIX ".pgni"
+
+void open_game_index(unsigned file_number);
+void close_game_index(void);
+void index_game_tag(TagName tag);
+void index_game_boundary(void);
+Boolean indexed_game_start(unsigned file_number, size_t from,
+        size_t *offset, unsigned long *lines);
+
+#endif	// GAMEINDEX_H
+
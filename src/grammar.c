@@ -39,6 +39,15 @@
 #include "end.h"
 #include "grammar.h"
 #include "hashing.h"
+#include "posindex.h"
+#include "profile.h"
+#include "compress.h"
+#include "asyncout.h"
+#include "gameindex.h"
+#include "binary.h"
+#include "checkpoint.h"
+#include "engine.h"
+#include "statistics.h"
 
 static TokenType current_symbol = NO_TOKEN;
 
@@ -62,8 +71,26 @@ static struct {
     CommentList *prefix_comment;
 } GameHeader;
 
+/* If not NULL, the function to be given each game in place of
+ * dispose_of_game. See set_game_recorder.
+ */
+static GameRecorder game_recorder = NULL;
+/* If not NULL, the function to be given each game before it is
+ * checked. See set_game_forwarder.
+ */
+static GameForwarder game_forwarder = NULL;
+/* The input file of the last game written to the duplicate file.
+ * Its name is written before the first duplicate from each file.
+ */
+static const char *duplicates_source = NULL;
+/* Whether the move text of the games is in SAN, as it is when
+ * they are parsed. See set_game_move_text_SAN.
+ */
+static Boolean move_text_SAN = TRUE;
+
 static void parse_opt_game_list(SourceFileType file_type);
 static Boolean parse_game(Move **returned_move_list, unsigned long *start_line, unsigned long *end_line);
+static Boolean rejected_on_tags(void);
 Boolean parse_opt_tag_list(void);
 Boolean parse_tag(void);
 static Move *parse_move_list(void);
@@ -82,12 +109,15 @@ static CommentList *append_comment(CommentList *item, CommentList *list);
 static void check_result(char **Tags, const char *terminating_result);
 static Boolean chess960_setup(Board *board);
 static void deal_with_ECO_line(Move *move_list);
-static void deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line);
-static Boolean finished_processing(void);
 static void free_tags(void);
 static CommentList *merge_comment_lists(CommentList *prefix, CommentList *suffix);
-static void output_game(Game *game,FILE *outputfile);
-static void split_variants(Game *game, FILE *outputfile, unsigned depth);
+static Boolean check_main_line_text(Game *current_game);
+static void split_variants(Game *game, FILE *outputfile, unsigned depth,
+                           Move *prev, const Board *board);
+static Board *play_split_line(Game *game, Move *line, const Board *board,
+                              Board **branch_boards);
+static void write_game(Game *current_game, const FormattedGame *formatted,
+        FILE *outputfile);
 
 /* Initialise the game header structure to contain
  * space for the default number of tags.
@@ -127,6 +157,49 @@ increase_game_header_tags_length(unsigned new_length)
     GameHeader.header_tags_length = new_length;
 }
 
+/* Set the value of tag for a game that is not being read by
+ * the parser; see binary.c.
+ * value must have been malloc'd and is freed with the game.
+ */
+void
+set_game_header_tag(unsigned tag, char *value)
+{
+    if (GameHeader.Tags[tag] != NULL) {
+        free_tag_value(GameHeader.Tags[tag]);
+    }
+    GameHeader.Tags[tag] = value;
+}
+
+/* Set the prefix comment of a game that is not being read by
+ * the parser.
+ */
+void
+set_game_header_prefix_comment(CommentList *prefix_comment)
+{
+    GameHeader.prefix_comment = prefix_comment;
+}
+
+/* Set whether the move text of the games to be dealt with is in
+ * SAN, which textual variations (-v) are matched against.
+ */
+void
+set_game_move_text_SAN(Boolean in_SAN)
+{
+    move_text_SAN = in_SAN;
+}
+
+/* Check the textual variations against the main line of current_game,
+ * once its move text has been rewritten in SAN, if necessary.
+ */
+static Boolean
+check_main_line_text(Game *current_game)
+{
+    if (!move_text_SAN && textual_variations_wanted()) {
+        rewrite_main_line_SAN(current_game);
+    }
+    return check_textual_variations(current_game);
+}
+
 /* Try to open the given file. Error and exit on failure. */
 FILE *
 must_open_file(const char *filename, const char *mode)
@@ -142,28 +215,104 @@ must_open_file(const char *filename, const char *mode)
     return fp;
 }
 
+/* The size of the buffer given to a file to which games are written,
+ * so that output is written in large blocks.
+ */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+/* How many such files might be open at once. */
+#define MAX_OUTPUT_BUFFERS 8
+
+static struct {
+    FILE *fp;
+    char *buffer;
+} output_buffers[MAX_OUTPUT_BUFFERS];
+
+/* Give fp a large output buffer. This must be called before
+ * anything is written to it.
+ */
+void
+buffer_output_file(FILE *fp)
+{
+    int slot = 0;
+    while (slot < MAX_OUTPUT_BUFFERS && output_buffers[slot].fp != NULL) {
+        slot++;
+    }
+    if (slot < MAX_OUTPUT_BUFFERS) {
+        char *buffer = (char *) malloc_or_die(OUTPUT_BUFFER_SIZE);
+        if (setvbuf(fp, buffer, _IOFBF, OUTPUT_BUFFER_SIZE) == 0) {
+            output_buffers[slot].fp = fp;
+            output_buffers[slot].buffer = buffer;
+        }
+        else {
+            (void) free((void *) buffer);
+        }
+    }
+    else {
+        /* Leave it with the default buffering. */
+    }
+}
+
+/* Open the given file for writing games.
+ * Error and exit on failure.
+ */
+FILE *
+must_open_output_file(const char *filename, const char *mode)
+{
+    FILE *fp = open_compressed_output(must_open_file(filename, mode), filename);
+    FILE *stream = async_output_file(fp, filename, ASYNC_OUTPUT_BUFFER_SIZE);
+
+    if (stream == fp) {
+        buffer_output_file(fp);
+    }
+    return stream;
+}
+
+/* Close fp, which may have been opened with must_open_output_file. */
+void
+close_output_file(FILE *fp)
+{
+    close_binary_output(fp);
+    (void) fclose(fp);
+    for (int slot = 0; slot < MAX_OUTPUT_BUFFERS; slot++) {
+        if (output_buffers[slot].fp == fp) {
+            (void) free((void *) output_buffers[slot].buffer);
+            output_buffers[slot].fp = NULL;
+            output_buffers[slot].buffer = NULL;
+        }
+    }
+}
+
 /* Print out on outfp the current details and
  * terminate with a newline.
  */
 void
 report_details(FILE *outfp)
 {
-    if (GameHeader.Tags[WHITE_TAG] != NULL) {
-        fprintf(outfp, "%s - ", GameHeader.Tags[WHITE_TAG]);
+    report_tag_details(outfp, GameHeader.Tags);
+}
+
+/* Print out on outfp the details of a game with the given Tags and
+ * terminate with a newline.
+ */
+void
+report_tag_details(FILE *outfp, char **Tags)
+{
+    if (Tags[WHITE_TAG] != NULL) {
+        fprintf(outfp, "%s - ", Tags[WHITE_TAG]);
     }
-    if (GameHeader.Tags[BLACK_TAG] != NULL) {
-        fprintf(outfp, "%s ", GameHeader.Tags[BLACK_TAG]);
+    if (Tags[BLACK_TAG] != NULL) {
+        fprintf(outfp, "%s ", Tags[BLACK_TAG]);
     }
 
-    if (GameHeader.Tags[EVENT_TAG] != NULL) {
-        fprintf(outfp, "%s ", GameHeader.Tags[EVENT_TAG]);
+    if (Tags[EVENT_TAG] != NULL) {
+        fprintf(outfp, "%s ", Tags[EVENT_TAG]);
     }
-    if (GameHeader.Tags[SITE_TAG] != NULL) {
-        fprintf(outfp, "%s ", GameHeader.Tags[SITE_TAG]);
+    if (Tags[SITE_TAG] != NULL) {
+        fprintf(outfp, "%s ", Tags[SITE_TAG]);
     }
 
-    if (GameHeader.Tags[DATE_TAG] != NULL) {
-        fprintf(outfp, "%s ", GameHeader.Tags[DATE_TAG]);
+    if (Tags[DATE_TAG] != NULL) {
+        fprintf(outfp, "%s ", Tags[DATE_TAG]);
     }
     putc('\n', outfp);
     fflush(outfp);
@@ -182,7 +331,7 @@ check_result(char **Tags, const char *terminating_result)
     
     if(result_tag != NULL && strcmp(result_tag, "1/2") == 0) {
         /* Inappropriate short form. */
-        (void) free(result_tag);
+        free_tag_value(result_tag);
         result_tag = Tags[RESULT_TAG] = copy_string("1/2-1/2");
     }
 
@@ -221,12 +370,13 @@ select_output_file(StateInfo *GameState, const char *eco)
                     /* Terminate the output of the previous file. */
                     fputs("\n]\n", GlobalState.outputfile);
                 }
-                (void) fclose(GameState->outputfile);
+                close_output_file(GameState->outputfile);
             }
-            sprintf(filename, "%u%s",
+            sprintf(filename, "%u%s%s",
                     GameState->next_file_number,
-                    output_file_suffix(GameState->output_format));
-            GameState->outputfile = must_open_file(filename, "w");
+                    output_file_suffix(GameState->output_format),
+                    compression_suffix(GameState->output_compression));
+            GameState->outputfile = must_open_output_file(filename, "w");
             GameState->next_file_number++;
             if (GlobalState.json_format) {
                 fputs("[\n", GlobalState.outputfile);
@@ -235,16 +385,10 @@ select_output_file(StateInfo *GameState, const char *eco)
     }
     else {
         if (GameState->ECO_level > DONT_DIVIDE) {
-            /* Open a file of the appropriate name. */
-            if (GameState->outputfile != NULL) {
-                /* @@@ In practice, this might need refinement.
-                 * Repeated opening and closing may prove inefficient.
-                 */
-                (void) fclose(GameState->outputfile);
-                GameState->outputfile = open_eco_output_file(
-                        GameState->ECO_level,
-                        eco);
-            }
+            /* Select the file of the appropriate name. */
+            GameState->outputfile = open_eco_output_file(
+                    GameState->ECO_level,
+                    eco);
         }
         else if (GlobalState.json_format && GameState->num_games_matched == 1) {
             fputs("[\n", GlobalState.outputfile);
@@ -259,7 +403,8 @@ select_output_file(StateInfo *GameState, const char *eco)
  * Conditions for finishing processing, other than all the input
  * having been processed.
  */
-static Boolean finished_processing(void)
+Boolean
+finished_processing(void)
 {
     return (GlobalState.matching_game_numbers != NULL &&
             GlobalState.next_game_number_to_output == NULL) ||
@@ -282,6 +427,8 @@ parse_opt_game_list(SourceFileType file_type)
 {
     Move *move_list = NULL;
     unsigned long start_line, end_line;
+    /* The nodes of each game are allocated from the arena. */
+    int arena_was_used = use_arena(1);
 
     while (parse_game(&move_list, &start_line, &end_line) && !finished_processing()) {
         if (file_type == NORMALFILE) {
@@ -303,13 +450,71 @@ parse_opt_game_list(SourceFileType file_type)
             /* Unknown type. */
             free_tags();
             free_move_list(move_list);
+            free_comment_list(GameHeader.prefix_comment);
+            GameHeader.prefix_comment = NULL;
         }
         move_list = NULL;
         setup_for_new_game();
+        if (GlobalState.checkpoint_file != NULL && current_symbol == NO_TOKEN &&
+                (file_type == NORMALFILE || file_type == CHECKFILE)) {
+            /* Nothing of the next game has been read, so a resumed
+             * run can carry on from here.
+             */
+            checkpoint_if_due();
+        }
+        if (GlobalState.game_index && current_symbol == NO_TOKEN &&
+                file_type != ECOFILE) {
+            index_game_boundary();
+        }
+        /* Nothing from the game remains, so its nodes can be reclaimed
+         * unless, in malformed input, the lookahead symbol is a
+         * move, comment or tag string that lives in the arena.
+         * In that case, it is left until after the next game.
+         */
+        if (current_symbol != MOVE && current_symbol != COMMENT &&
+                current_symbol != STRING) {
+            reset_arena();
+        }
     }
     if(move_list != NULL) {
         free_move_list(move_list);
     }
+    (void) use_arena(arena_was_used);
+}
+
+/* Return TRUE if the game whose tags have just been parsed can
+ * be rejected on those tags alone, so that its moves need not be parsed.
+ * This is not possible if non-matching games are to be output or
+ * every game is being checked, nor when the moves could still change
+ * the tags: a FEN tag may result in SetUp and Variant tags being
+ * added, and the result may fill in a missing Result tag.
+ */
+static Boolean
+rejected_on_tags(void)
+{
+    char **tags = GameHeader.Tags;
+
+    if (GlobalState.non_matching_file != NULL || GlobalState.check_only ||
+            GlobalState.parsing_ECO_file || building_position_index()) {
+        return FALSE;
+    }
+    else if (current_symbol == TAG || current_symbol == EOF_TOKEN) {
+        /* There are no moves to skip. */
+        return FALSE;
+    }
+    else if (tags[FEN_TAG] != NULL) {
+        return FALSE;
+    }
+    else if (is_checked_tag(RESULT_TAG) &&
+            (tags[RESULT_TAG] == NULL || *tags[RESULT_TAG] == '\0' ||
+             strcmp(tags[RESULT_TAG], "?") == 0 ||
+             strcmp(tags[RESULT_TAG], "1/2") == 0)) {
+        return FALSE;
+    }
+    else {
+        return !check_setup_tag(tags) ||
+                !check_tag_details_not_ECO(tags, GameHeader.header_tags_length);
+    }
 }
 
 /* Parse a game and return a pointer to any valid list of moves
@@ -325,7 +530,9 @@ parse_game(Move **returned_move_list, unsigned long *start_line, unsigned long *
      * but there sometimes is.
      */
     CommentList *hanging_comment;
+    ProfileMark mark;
 
+    PROFILE_BEGIN(mark);
     /* Assume that we won't return anything. */
     *returned_move_list = NULL;
     /* Skip over any junk between games. */
@@ -353,6 +560,22 @@ parse_game(Move **returned_move_list, unsigned long *start_line, unsigned long *
         current_symbol = next_token();
     }
 
+    if (rejected_on_tags()) {
+        /* There is no need to parse the moves. */
+        if (current_symbol == MOVE) {
+            free_move_list(yylval.move_details);
+        }
+        discard_game_text();
+        current_symbol = next_token();
+        result = parse_result();
+        if (result != NULL) {
+            (void) free((void *) result);
+        }
+        *end_line = get_line_number();
+        PROFILE_END(PROFILE_PARSE, mark);
+        return current_symbol != EOF_TOKEN;
+    }
+
     /* @@@ Beware of comments and/or tags without moves. */
     move_list = parse_move_list();
 
@@ -387,7 +610,7 @@ parse_game(Move **returned_move_list, unsigned long *start_line, unsigned long *
     }
     else {
         /* @@@ Nothing to attach the comment to. */
-        (void) free((void *) hanging_comment);
+        free_comment_list(hanging_comment);
         hanging_comment = NULL;
         /*
          * Workaround for games with zero moves.
@@ -402,6 +625,7 @@ parse_game(Move **returned_move_list, unsigned long *start_line, unsigned long *
         }
         *returned_move_list = NULL;
     }
+    PROFILE_END(PROFILE_PARSE, mark);
     return current_symbol != EOF_TOKEN;
 }
 
@@ -497,7 +721,7 @@ parse_tag(void)
             char *tag_string = yylval.token_string;
 
             if (tag_index < GameHeader.header_tags_length) {
-                GameHeader.Tags[tag_index] = tag_string;
+                GameHeader.Tags[tag_index] = store_tag_value(tag_index, tag_string);
             }
             else {
                 print_error_context(GlobalState.logfile);
@@ -516,7 +740,7 @@ parse_tag(void)
     else if (current_symbol == STRING) {
         print_error_context(GlobalState.logfile);
         fprintf(GlobalState.logfile, "Missing tag for %s.\n", yylval.token_string);
-        (void) free((void *) yylval.token_string);
+        arena_free((void *) yylval.token_string);
         current_symbol = next_token();
     }
     else {
@@ -646,16 +870,23 @@ static void
 parse_opt_NAG_list(Move *move_details)
 {
     while (current_symbol == NAG) {
-        Nag *details = (Nag *) malloc_or_die(sizeof(*details));
+        Nag *details = (Nag *) arena_malloc(sizeof(*details));
         details->text = NULL;
         details->comments = NULL;
         details->next = NULL;
         do {
-            details->text = save_string_list_item(details->text, yylval.token_string);
+            /* There is no text if NAGs are not being kept. */
+            if (yylval.token_string != NULL) {
+                details->text = save_string_list_item(details->text, yylval.token_string);
+            }
             current_symbol = next_token();
         } while(current_symbol == NAG);
         details->comments = parse_opt_comment_list();
-        if(move_details->NAGs == NULL) {
+        if (details->text == NULL && details->comments == NULL) {
+            /* Nothing to keep. */
+            arena_free((void *) details);
+        }
+        else if(move_details->NAGs == NULL) {
             move_details->NAGs = details;
         }
         else {
@@ -698,12 +929,15 @@ parse_variant(void)
         Move *moves;
 
         RAV_level++;
-        variation = (Variation *) malloc_or_die(sizeof (Variation));
+        variation = (Variation *) arena_malloc(sizeof (Variation));
 
         current_symbol = next_token();
         prefix_comment = parse_opt_comment_list();
         moves = parse_move_list();
-        if (moves == NULL) {
+        if (moves == NULL && passing_over_variations()) {
+            /* The lexer has passed over the moves. */
+        }
+        else if (moves == NULL) {
             print_error_context(GlobalState.logfile);
             fprintf(GlobalState.logfile, "Missing move list in variation.\n");
         }
@@ -789,7 +1023,7 @@ free_tags(void)
 
     for (tag = 0; tag < GameHeader.header_tags_length; tag++) {
         if (GameHeader.Tags[tag] != NULL) {
-            free(GameHeader.Tags[tag]);
+            free_tag_value(GameHeader.Tags[tag]);
             GameHeader.Tags[tag] = NULL;
         }
     }
@@ -807,7 +1041,7 @@ free_string_list(StringList *list)
         if (next->str != NULL) {
             (void) free((void *) next->str);
         }
-        (void) free((void *) next);
+        arena_free((void *) next);
     }
 }
 
@@ -821,7 +1055,7 @@ free_comment_list(CommentList *comment_list)
             free_string_list(comment_list->comment);
         }
         comment_list = comment_list->next;
-        (void) free((void *) this_comment);
+        arena_free((void *) this_comment);
     }
 }
 
@@ -842,7 +1076,7 @@ free_variation(Variation *variation)
         if (next->moves != NULL) {
             (void) free_move_list(next->moves);
         }
-        (void) free((void *) next);
+        arena_free((void *) next);
     }
 }
 
@@ -852,7 +1086,7 @@ static void free_NAG_list(Nag *nag_list)
         Nag *nextNAG = nag_list->next;
         free_string_list(nag_list->text);
         free_comment_list(nag_list->comments);
-        (void) free((void *) nag_list);
+        arena_free((void *) nag_list);
         nag_list = nextNAG;
     }
 }
@@ -870,18 +1104,19 @@ free_move_list(Move *move_list)
         free_comment_list(nextMove->comment_list);
         free_variation(nextMove->Variants);
         
-        if (nextMove->epd != NULL) {
-            (void) free((void *) nextMove->epd);
-        }
-        if(nextMove->fen_suffix != NULL) {
-            (void) free((void *) nextMove->fen_suffix);
-            nextMove->fen_suffix = NULL;
+        if (nextMove->annotation != NULL) {
+            MoveAnnotation *annotation = nextMove->annotation;
+            /* fen_suffix shares the allocation of epd. */
+            if (annotation->epd != NULL) {
+                (void) free((void *) annotation->epd);
+            }
+            arena_free((void *) annotation);
         }
         if (nextMove->terminating_result != NULL) {
             (void) free((void *) nextMove->terminating_result);
         }
         
-        (void) free((void *) nextMove);
+        arena_free((void *) nextMove);
     }
 }
 
@@ -894,7 +1129,7 @@ save_string_list_item(StringList *list, const char *str)
     if (str != NULL && *str != '\0') {
         StringList *new_item;
 
-        new_item = (StringList *) malloc_or_die(sizeof (*new_item));
+        new_item = (StringList *) arena_malloc(sizeof (*new_item));
         new_item->str = str;
         new_item->next = NULL;
         if (list == NULL) {
@@ -1043,21 +1278,17 @@ static Boolean consistent_FEN_tags(Game *current_game)
     return consistent;
 }
 
-static void
+/* Check the game whose tags and prefix comment are held in GameHeader
+ * against the selection criteria, dispose of it and free it.
+ */
+void
 deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line)
 {
     Game current_game;
     /* We need a dummy argument for apply_move_list. */
     unsigned plycount;
-    /* Whether the game matches, as long as it is not in a CHECKFILE. */
-    Boolean game_matches = FALSE;
-    /* Whether to output the game. */
-    Boolean output_the_game = FALSE;
-
-    if (GlobalState.current_file_type != CHECKFILE) {
-        /* Update the count of how many games handled. */
-        GlobalState.num_games_processed++;
-    }
+    /* Whether the game satisfies the selection criteria. */
+    Boolean wanted;
 
     /* Fill in the information currently known. */
     current_game.tags = GameHeader.Tags;
@@ -1068,46 +1299,174 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
     current_game.moves_ok = FALSE;
     current_game.error_ply = 0;
     current_game.position_counts = NULL;
+    /* Only set by apply_move_list for a game reaching the fuzzy depth. */
+    current_game.fuzzy_duplicate_hash = 0;
     current_game.start_line = start_line;
     current_game.end_line = end_line;
 
-    /* Determine whether or not this game is wanted, on the
-     * basis of the various selection criteria available.
-     */
+    if (building_position_index()) {
+        index_game_positions(&current_game);
+    }
+
+    if (game_forwarder != NULL) {
+        /* The game is checked and disposed of elsewhere. */
+        (*game_forwarder)(&current_game);
+    }
+    else {
+        /* Determine whether or not this game is wanted, on the
+         * basis of the various selection criteria available.
+         */
 
-    /*
-     * apply_move_list checks out the moves.
-     * If it returns TRUE as a match, it will also fill in the
-     *     current_game.final_hash_value and
-     *     current_game.cumulative_hash_value
-     * fields of current_game so that these can be used in the
-     * previous_occurrence function.
-     *
-     * If there are any tag criteria, it will be easy to quickly
-     * eliminate most games without going through the lengthy
-     * process of game matching.
-     *
-     * If ECO adding is done, the order of checking may cause
-     * a conflict here since it won't be possible to reject a game
-     * based on its ECO code unless it already has one.
-     * Therefore, check for the ECO tag only after everything else has
-     * been checked.
+        /*
+         * apply_move_list checks out the moves.
+         * If it returns TRUE as a match, it will also fill in the
+         *     current_game.final_hash_value and
+         *     current_game.cumulative_hash_value
+         * fields of current_game so that these can be used in the
+         * previous_occurrence function.
+         *
+         * If there are any tag criteria, it will be easy to quickly
+         * eliminate most games without going through the lengthy
+         * process of game matching.
+         * Likewise, the textual variations and move bounds are decided
+         * by the move text alone, so they are checked before the moves
+         * are replayed. The replay itself stops once the positional
+         * search depth has been passed without a match.
+         * With -r, every game is replayed first, so that errors and
+         * inconsistent results are reported whatever its move text.
+         *
+         * If ECO adding is done, the order of checking may cause
+         * a conflict here since it won't be possible to reject a game
+         * based on its ECO code unless it already has one.
+         * Therefore, check for the ECO tag only after everything else has
+         * been checked.
+         */
+        wanted = consistent_FEN_tags(&current_game) &&
+            check_tag_details_not_ECO(current_game.tags, current_game.tags_length) &&
+            check_setup_tag(current_game.tags) &&
+            check_duplicate_setup(&current_game) &&
+            (GlobalState.check_only ||
+                (check_main_line_text(&current_game) &&
+                 check_move_bounds_before_replay(&current_game))) &&
+            apply_move_list(&current_game, &plycount, GlobalState.depth_of_positional_search) &&
+            check_move_bounds(plycount) &&
+            (!GlobalState.check_only || check_main_line_text(&current_game)) &&
+            check_for_material_match(&current_game) &&
+            check_for_only_checkmate(&current_game) &&
+            check_for_only_repetition(current_game.position_counts) &&
+            check_ECO_tag(current_game.tags);
+
+        if (game_recorder != NULL) {
+            /* The game is disposed of elsewhere. */
+            (*game_recorder)(&current_game, plycount, wanted);
+        }
+        else {
+            dispose_of_game(&current_game, plycount, wanted, NULL);
+        }
+    }
+
+    /* Game is finished with, so free everything. */
+    if (GameHeader.prefix_comment != NULL) {
+        free_comment_list(GameHeader.prefix_comment);
+    }
+    /* Ensure that the GameHeader's prefix comment is NULL for
+     * the next game.
      */
-    if (consistent_FEN_tags(&current_game) &&
-        check_tag_details_not_ECO(current_game.tags, current_game.tags_length) &&
-        check_setup_tag(current_game.tags) &&
-        check_duplicate_setup(&current_game) &&
-        apply_move_list(&current_game, &plycount, GlobalState.depth_of_positional_search) &&
-        check_move_bounds(plycount) &&
-        check_textual_variations(&current_game) &&
-        check_for_material_match(&current_game) &&
-        check_for_only_checkmate(&current_game) &&
-        check_for_only_repetition(current_game.position_counts) &&
-        check_ECO_tag(current_game.tags)) {
+    GameHeader.prefix_comment = NULL;
+
+    free_tags();
+    free_move_list(current_game.moves);
+    if (current_game.position_counts != NULL) {
+        free_position_counts(current_game.position_counts);
+        current_game.position_counts = NULL;
+    }
+}
+
+/* Record forwarder as the function to be given each game, as soon
+ * as it has been read, in place of checking and disposing of it.
+ */
+void
+set_game_forwarder(GameForwarder forwarder)
+{
+    game_forwarder = forwarder;
+}
+
+/* Return the input file of the last game written to the
+ * duplicate file, for --checkpoint.
+ */
+const char *
+duplicates_source_file(void)
+{
+    return duplicates_source;
+}
+
+/* Restore the input file of the last game written to the
+ * duplicate file, for --resume.
+ */
+void
+set_duplicates_source_file(const char *filename)
+{
+    duplicates_source = filename;
+}
+
+/* Record recorder as the function to be given each game, once
+ * it has been checked against the selection criteria, in place
+ * of dispose_of_game.
+ */
+void
+set_game_recorder(GameRecorder recorder)
+{
+    game_recorder = recorder;
+}
+
+/* Write current_game to outputfile.
+ * If formatted is not NULL then it holds the text of the game,
+ * already formatted for output, and the log output from doing so.
+ */
+static void
+write_game(Game *current_game, const FormattedGame *formatted,
+        FILE *outputfile)
+{
+    if (formatted != NULL) {
+        (void) fwrite((const void *) formatted->log, sizeof(char),
+                formatted->log_length, GlobalState.logfile);
+        (void) fwrite((const void *) formatted->text, sizeof(char),
+                formatted->text_length, outputfile);
+        PROFILE_COUNT(PROFILE_BYTES_WRITTEN, formatted->text_length);
+    }
+    else {
+        output_game(current_game, outputfile);
+    }
+}
+
+/* Decide whether current_game is to be output, once it has been
+ * checked against the selection criteria, and output it if so.
+ * If wanted is TRUE then it satisfied those criteria and it
+ * remains to check for duplicates and the matching game numbers.
+ * If formatted is not NULL then the game was checked and formatted
+ * for output elsewhere, and current_game holds only its hash values,
+ * moves_ok and the tags needed to report on it and select its
+ * output file.
+ */
+void
+dispose_of_game(Game *current_game, unsigned plycount, Boolean wanted,
+        const FormattedGame *formatted)
+{
+    /* Whether the game matches, as long as it is not in a CHECKFILE. */
+    Boolean game_matches = FALSE;
+    /* Whether to output the game. */
+    Boolean output_the_game = FALSE;
+
+    if (GlobalState.current_file_type != CHECKFILE) {
+        /* Update the count of how many games handled. */
+        GlobalState.num_games_processed++;
+    }
+
+    if (wanted) {
         /* If there is no original filename then the game is not a
          * duplicate.
          */
-        const char *original_filename = previous_occurance(current_game, plycount);
+        const char *original_filename = previous_occurance(*current_game, plycount);
 
         if ((original_filename == NULL) && GlobalState.suppress_originals) {
             /* Don't output first occurrences. */
@@ -1130,15 +1489,21 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
                         GlobalState.next_game_number_to_skip = GlobalState.next_game_number_to_skip->next;
                     }
                 }
-                else if (GlobalState.check_only) {
-                    /* We are only checking. */
-                    if (GlobalState.verbosity > 1) {
-                        /* Report progress on logfile. */
-                        report_details(GlobalState.logfile);
-                    }
-                }
                 else {
-                    output_the_game = TRUE;
+                    if (GlobalState.statistics_key != NULL && formatted == NULL) {
+                        /* With --threads, the workers tally the games. */
+                        tally_game_statistics(current_game);
+                    }
+                    if (GlobalState.check_only) {
+                        /* We are only checking. */
+                        if (GlobalState.verbosity > 1) {
+                            /* Report progress on logfile. */
+                            report_tag_details(GlobalState.logfile, current_game->tags);
+                        }
+                    }
+                    else {
+                        output_the_game = TRUE;
+                    }
                 }
             }
             else {
@@ -1147,15 +1512,13 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
             if(output_the_game) {
                 /* This game is to be kept and output. */
                 FILE *outputfile = select_output_file(&GlobalState,
-                        current_game.tags[ECO_TAG]);
+                        current_game->tags[ECO_TAG]);
 
                 /* See if we wish to separate out duplicates. */
                 if ((original_filename != NULL) &&
                         (GlobalState.duplicate_file != NULL)) {
-                    static const char *last_input_file = NULL;
-
                     outputfile = GlobalState.duplicate_file;
-                    if ((last_input_file != GlobalState.current_input_file) &&
+                    if ((duplicates_source != GlobalState.current_input_file) &&
                             (GlobalState.current_input_file != NULL)) {
                         if(GlobalState.keep_comments) {
                             /* Record which file this and succeeding
@@ -1167,7 +1530,7 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
                             print_str(outputfile, " }");
                             terminate_line(outputfile);
                         }
-                        last_input_file = GlobalState.current_input_file;
+                        duplicates_source = GlobalState.current_input_file;
                     }
                     if(GlobalState.keep_comments) {
                         print_str(outputfile, "{ First found in: ");
@@ -1177,10 +1540,10 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
                     }
                 }
                 /* Now output what we have. */
-                output_game(&current_game, outputfile);
+                write_game(current_game, formatted, outputfile);
                 if (GlobalState.verbosity > 1) {
                     /* Report progress on logfile. */
-                    report_details(GlobalState.logfile);
+                    report_tag_details(GlobalState.logfile, current_game->tags);
                 }
             }
         }
@@ -1188,14 +1551,14 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
     if (!game_matches && (GlobalState.non_matching_file != NULL) &&
             GlobalState.current_file_type != CHECKFILE) {
         /* The user wants to keep everything else. */
-        if (!current_game.moves_checked) {
+        if (formatted == NULL && !current_game->moves_checked) {
             /* Make sure that the move text is in a reasonable state.
              * Force checking of the whole game.
              */
-            (void) apply_move_list(&current_game, &plycount, 0);
+            (void) apply_move_list(current_game, &plycount, 0);
         }
-        if (current_game.moves_ok || GlobalState.keep_broken_games) {
-            output_game(&current_game, GlobalState.non_matching_file);
+        if (current_game->moves_ok || GlobalState.keep_broken_games) {
+            write_game(current_game, formatted, GlobalState.non_matching_file);
         }
     }
     if (game_matches && GlobalState.matching_game_numbers != NULL &&
@@ -1206,23 +1569,12 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
         }
     }
 
-    /* Game is finished with, so free everything. */
-    if (GameHeader.prefix_comment != NULL) {
-        free_comment_list(GameHeader.prefix_comment);
-    }
-    /* Ensure that the GameHeader's prefix comment is NULL for
-     * the next game.
-     */
-    GameHeader.prefix_comment = NULL;
-
-    free_tags();
-    free_move_list(current_game.moves);
-    if (current_game.position_counts != NULL) {
-        free_position_count_list(current_game.position_counts);
-        current_game.position_counts = NULL;
-    }
     if (GlobalState.verbosity != 0 && (GlobalState.num_games_processed % PROGRESS_RATE) == 0) {
-        fprintf(stderr, "Games: %lu\r", GlobalState.num_games_processed);
+        fprintf(stderr, "Games: %lu", GlobalState.num_games_processed);
+        if (PROFILING) {
+            profile_progress(stderr);
+        }
+        fputc('\r', stderr);
     }
 }
 
@@ -1231,11 +1583,25 @@ deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line
  * If GlobalState.split_variants then this will involve outputting 
  * each variation separately.
  */
-static void
+void
 output_game(Game *game, FILE *outputfile)
 {
     if(GlobalState.split_variants && GlobalState.keep_variations) {
-        split_variants(game, outputfile, 0);
+        /* Unless plies might be dropped from the start of each line,
+         * comments replaced or broken lines altered, each line need
+         * only be rewritten from where it leaves its parent.
+         */
+        if(GlobalState.drop_ply_number == 0 &&
+                GlobalState.drop_comment_pattern == NULL &&
+                GlobalState.FEN_comment_pattern == NULL &&
+                !GlobalState.keep_broken_games) {
+            Board *board = new_game_board(game->tags[FEN_TAG]);
+            split_variants(game, outputfile, 0, NULL, board);
+            free_board(board);
+        }
+        else {
+            split_variants(game, outputfile, 0, NULL, NULL);
+        }
     }
     else {
         format_game(game, outputfile);
@@ -1247,14 +1613,30 @@ output_game(Game *game, FILE *outputfile)
  * NB: This involves the removal of all variations from the game.
  * This is done recursively and depth (>=0) defines the current
  * level of recursion.
+ * The line at this level starts after prev, or at the start of the
+ * game if prev is NULL.
+ * If board is not NULL then it is the position before the start of the
+ * line and the moves before that have already been rewritten, so only
+ * the rest of the line need be rewritten.
  */
 static void
-split_variants(Game *game, FILE *outputfile, unsigned depth)
+split_variants(Game *game, FILE *outputfile, unsigned depth,
+               Move *prev, const Board *board)
 {
+    Move *line = prev != NULL ? prev->next : game->moves;
+    Boolean split_further = GlobalState.split_depth_limit == 0 ||
+           GlobalState.split_depth_limit > depth;
+    /* The positions before the moves of the line with variations. */
+    Board **branch_boards = NULL;
+    unsigned num_branches = 0;
+
     /* Gather all the suffix comments at this level. */
-    Move *move = game->moves;
+    Move *move = line;
     while(move != NULL) {
         Variation *variants = move->Variants;
+        if(variants != NULL) {
+            num_branches++;
+        }
         while (variants != NULL) {
             if(variants->suffix_comment != NULL) {
                 move->comment_list = append_comment(variants->suffix_comment, move->comment_list);
@@ -1266,17 +1648,54 @@ split_variants(Game *game, FILE *outputfile, unsigned depth)
     }
 
     /* Format the main line at this level. */
-    format_game(game, outputfile);
+    if(board != NULL) {
+        Board *final_board;
+        if(split_further && num_branches > 0) {
+            branch_boards = (Board **) malloc_or_die(num_branches * sizeof(*branch_boards));
+        }
+        final_board = play_split_line(game, line, board, branch_boards);
+        if(final_board == NULL) {
+            /* Rewrite this line, and those below it, in full. */
+            format_game(game, outputfile);
+            (void) free((void *) branch_boards);
+            branch_boards = NULL;
+        }
+        else {
+            if(depth > 0) {
+                format_rewritten_game(game, outputfile, final_board);
+            }
+            else if(!format_game(game, outputfile) && branch_boards != NULL) {
+                /* Rewriting the whole of the main line checks its
+                 * variations, so one of them is broken and each
+                 * line below must be rewritten in full to check
+                 * its own.
+                 */
+                unsigned b;
+                for(b = 0; b < num_branches; b++) {
+                    free_board(branch_boards[b]);
+                }
+                (void) free((void *) branch_boards);
+                branch_boards = NULL;
+            }
+            free_board(final_board);
+        }
+    }
+    else {
+        format_game(game, outputfile);
+    }
 
-    if(GlobalState.split_depth_limit == 0 ||
-           GlobalState.split_depth_limit > depth) {
+    if(split_further) {
+        /* The next of branch_boards. */
+        unsigned branch = 0;
         /* Now all the variations. */
         char *result_tag = game->tags[RESULT_TAG];
         game->tags[RESULT_TAG] = copy_string("*");
-        move = game->moves;
-        Move *prev = NULL;
+        move = line;
         while(move != NULL) {
             Variation *variants = move->Variants;
+            const Board *branch_board =
+                    branch_boards != NULL && variants != NULL ?
+                        branch_boards[branch] : NULL;
             while (variants != NULL) {
                 Variation *next_variant = variants->next;
                 Move *variant_moves = variants->moves;
@@ -1308,7 +1727,7 @@ split_variants(Game *game, FILE *outputfile, unsigned depth)
                                                                   game->prefix_comment);
                         }
                     }
-                    split_variants(game, outputfile, depth+1);
+                    split_variants(game, outputfile, depth+1, prev, branch_board);
                     if(prefix_comment != NULL) {
                         /* Remove the appended comments. */
                         CommentList *list;
@@ -1341,6 +1760,10 @@ split_variants(Game *game, FILE *outputfile, unsigned depth)
                 /* The variation can now be disposed of. */
                 free_variation(move->Variants);
                 move->Variants = NULL;
+                if(branch_boards != NULL) {
+                    free_board(branch_boards[branch]);
+                    branch++;
+                }
                 /* Restore the move replaced by its variants. */
                 if(prev != NULL) {
                     prev->next = move;
@@ -1353,9 +1776,46 @@ split_variants(Game *game, FILE *outputfile, unsigned depth)
             move = move->next;
         }
         /* Put everything back as it was. */
-        (void) free((void *) game->tags[RESULT_TAG]);
+        free_tag_value(game->tags[RESULT_TAG]);
         game->tags[RESULT_TAG] = result_tag;
+        (void) free((void *) branch_boards);
+    }
+}
+
+/* Play the moves of line from board, rewriting them for output,
+ * and return the final position, or NULL if a move could not be
+ * played.
+ * If branch_boards is not NULL then copies of the position before
+ * each move with variations are saved in it.
+ */
+static Board *
+play_split_line(Game *game, Move *line, const Board *board,
+                Board **branch_boards)
+{
+    Board *line_board = allocate_new_board();
+    unsigned num_saved = 0;
+    Move *move;
+
+    *line_board = *board;
+    for(move = line; move != NULL; move = move->next) {
+        if(move->Variants != NULL && branch_boards != NULL) {
+            Board *copy = allocate_new_board();
+            *copy = *line_board;
+            branch_boards[num_saved] = copy;
+            num_saved++;
+        }
+        if(!rewrite_line_move(game, line_board, move)) {
+            complete_engine_evaluations();
+            while(num_saved > 0) {
+                num_saved--;
+                free_board(branch_boards[num_saved]);
+            }
+            free_board(line_board);
+            return NULL;
+        }
     }
+    complete_engine_evaluations();
+    return line_board;
 }
 
 static void
@@ -1408,6 +1868,10 @@ int
 yyparse(SourceFileType file_type)
 {
     setup_for_new_game();
+    if (GlobalState.game_index && file_type != ECOFILE) {
+        /* Games before --firstgame might be passed over. */
+        index_game_boundary();
+    }
     current_symbol = skip_to_next_game(NO_TOKEN);
     parse_opt_game_list(file_type);
     if (current_symbol == EOF_TOKEN) {
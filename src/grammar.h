@@ -22,11 +22,44 @@
 #ifndef GRAMMAR_H
 #define GRAMMAR_H
 
+/* A function to be given each game once it has been checked against
+ * the selection criteria, in place of dispose_of_game.
+ */
+typedef void (*GameRecorder)(Game *game, unsigned plycount, Boolean wanted);
+
+/* A function to be given each game before it is checked against
+ * the selection criteria, in place of checking and disposing of it.
+ */
+typedef void (*GameForwarder)(Game *game);
+
+/* A game that has already been formatted for output, along with
+ * any log output produced while formatting it.
+ */
+typedef struct {
+    const char *text;
+    size_t text_length;
+    const char *log;
+    size_t log_length;
+} FormattedGame;
+
 int yyparse(SourceFileType file_type);
+void deal_with_game(Move *move_list, unsigned long start_line, unsigned long end_line);
+const char *duplicates_source_file(void);
+void dispose_of_game(Game *current_game, unsigned plycount, Boolean wanted,
+        const FormattedGame *formatted);
+Boolean finished_processing(void);
 void free_string_list(StringList *list);
 void init_game_header(void);
 void increase_game_header_tags_length(unsigned new_length);
+void output_game(Game *game, FILE *outputfile);
 void report_details(FILE *outfp);
+void report_tag_details(FILE *outfp, char **Tags);
+void set_game_header_prefix_comment(CommentList *prefix_comment);
+void set_game_header_tag(unsigned tag, char *value);
+void set_game_move_text_SAN(Boolean in_SAN);
+void set_duplicates_source_file(const char *filename);
+void set_game_forwarder(GameForwarder forwarder);
+void set_game_recorder(GameRecorder recorder);
 void append_comments_to_move(Move *move,CommentList *Comment);
 /* The following function is used for linking list items together. */
 StringList *save_string_list_item(StringList *list,const char *str);
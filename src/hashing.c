@@ -19,15 +19,20 @@
  *  https://www.cs.kent.ac.uk/people/staff/djb/
  */
 
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#if defined(__BORLANDC__) || defined(_MSC_VER)
-/* For unlink() */
-#include <io.h>
-#else
-/* For unlink() */
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+/* An existing duplicate index is memory mapped rather than read. */
+#define MAPPED_INDEX 1
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 #include "bool.h"
@@ -39,69 +44,93 @@
 #include "lex.h"
 #include "hashing.h"
 #include "zobrist.h"
-
-/* Routines, similar in nature to those in apply.c
- * to implement a duplicate hash-table lookup using
- * an external file, rather than malloc'd memory.
- * The only limit should be a file system limit.
- * NB: Using an external, virtual file seems obsolete now.
- *
- * This version should be slightly more accurate than
- * the alternative because the final_ and cumulative_
- * hash values are both stored, rather than the XOR
- * of them.
- */
-
-/*
- * The name of the file used.
- * This is overwritten each time, and removed on normal
- * program exit.
- */
-static char VIRTUAL_FILE[] = "virtual.tmp";
-
-/* Define the size of the hash table.
- */
-#define LOG_TABLE_SIZE 100003
+#include "profile.h"
+#include "dupshard.h"
 
 /* Define a table to hold hash values of the extracted games.
  * This is used to enable duplicate detection.
+ * Entries are held in a single open-addressed array, indexed by
+ * their final_hash_value and probed linearly, so that a lookup
+ * touches consecutive memory rather than following a chain of
+ * separately allocated nodes.
+ * The capacity is always a power of two and the table is doubled
+ * whenever it becomes more than LOG_TABLE_MAX_LOAD percent full.
  */
 typedef struct {
-    /* Record the file offset of the first and last entries
-     * for an index. (head == -1) => empty.
-     */
-    long head, tail;
-} LogHeaderEntry;
-
-/* If use_virtual_hash_table */
-static LogHeaderEntry *VirtualLogTable = NULL;
-
-/* Define a table to hold hash values of the extracted games.
- * This is used to enable duplicate detection when not using
- * the virtual hash table.
+    HashCode final_hash_value, cumulative_hash_value;
+    /* Record the file list index for the file this game was first found in. */
+    unsigned file_number;
+    /* Whether this slot holds an entry. */
+    Boolean in_use;
+} DuplicateEntry;
+
+#define LOG_TABLE_INITIAL_CAPACITY (1 << 16)
+#define LOG_TABLE_MAX_LOAD 70
+
+static DuplicateEntry *LogTable = NULL;
+/* The number of slots in LogTable. */
+static size_t log_table_capacity = 0;
+/* The number of slots in use. */
+static size_t log_table_entries = 0;
+
+/* The persistent duplicate index (--dupindex) is a file of
+ * the hash values of every game met in the runs that built it:
+ * a DuplicateIndexHeader, followed by count DuplicateIndexEntry
+ * values sorted by final_ and cumulative_hash_value, followed
+ * by the count fuzzy_hash_value fields sorted on their own.
+ * Values are stored in native byte order.
  */
-static HashLog **LogTable = NULL;
+#define DUPLICATE_INDEX_MAGIC "PGNDUPIX"
+#define DUPLICATE_INDEX_VERSION 1
 
-/* Define a type to hold hash values of interest.
- * This is used both to aid in duplicate detection
- * and in finding positional variations.
- */
-typedef struct VirtualHashLog {
-    /* Store the final position hash value and
-     * the cumulative hash value for a game.
-     */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    /* The --fuzzydepth used to build the index; 0 if not used. */
+    uint32_t fuzzy_depth;
+    uint64_t count;
+} DuplicateIndexHeader;
+
+typedef struct {
     HashCode final_hash_value, cumulative_hash_value;
-    /* Record the file list index for the file this game was first found in. */
-    int file_number;
-    /* Record the file offset of the next element
-     * in this list. -1 => end-of-list.
+    /* The position used for fuzzy matches; the end position
+     * unless the game reached the fuzzy depth.
      */
-    long next;
-} VirtualHashLog;
-
-static FILE *hash_file = NULL;
+    HashCode fuzzy_hash_value;
+} DuplicateIndexEntry;
+
+/* The index read at the start of the run. */
+static struct {
+    /* The whole file, if it was read. */
+    void *contents;
+    size_t length;
+    Boolean mapped;
+    const DuplicateIndexEntry *entries;
+    const HashCode *fuzzy_values;
+    size_t count;
+} duplicate_index = { NULL, 0, FALSE, NULL, NULL, 0 };
+
+/* Games first met in this run, to be merged into the index. */
+static DuplicateIndexEntry *new_index_entries = NULL;
+static size_t num_new_index_entries = 0;
+static size_t new_index_capacity = 0;
+
+/* For --checkpoint, the games first met in this run are also
+ * appended to a journal, from which --resume rebuilds LogTable
+ * and new_index_entries. The entries are held here until
+ * the next checkpoint writes them out.
+ * Values are stored in native byte order.
+ */
+typedef struct {
+    HashCode final_hash_value, cumulative_hash_value, fuzzy_hash_value;
+    uint32_t file_number;
+    /* Whether the game reached the fuzzy_match_depth. */
+    uint32_t reached_fuzzy_depth;
+} DuplicateJournalEntry;
 
-static const char *previous_virtual_occurance(Game game_details);
+static DuplicateJournalEntry *journal_entries = NULL;
+static size_t num_journal_entries = 0;
+static size_t journal_capacity = 0;
 
 /*
  * Check whether the position counts indicate a desired repetition.
@@ -111,11 +140,8 @@ static const char *previous_virtual_occurance(Game game_details);
 Boolean check_for_only_repetition(PositionCount *position_counts)
 {
     if (GlobalState.check_for_repetition > 0) {
-        PositionCount *entry = position_counts;
-        while (entry != NULL && entry->count < GlobalState.check_for_repetition) {
-            entry = entry->next;
-        }
-        return entry != NULL;
+        return position_counts != NULL &&
+                position_counts->max_count >= GlobalState.check_for_repetition;
     }
     else {
         return TRUE;
@@ -146,300 +172,622 @@ encode_castling_rights(const Board *board)
 }
 
 /*
- * Return TRUE if the position on board matches the entry details
+ * Set entry to the details of the position on board
  * for the purposes of position repetition matches:
  *     + Same board position (based on a hash value)
  *     + Same castling rights.
  *     + Same en passant status (i.e., no ep possible).
  *     + Same player to move.
  */
-static Boolean
-position_matches(PositionCount *entry, const Board *board)
+static void
+set_repeatable_position(RepeatablePosition *entry, const Board *board)
 {
-    if(board->weak_hash_value != entry->hash_value) {
-        return FALSE;
-    }
-    else if(board->to_move != entry->to_move) {
-        return FALSE;
-    }
-    else if(encode_castling_rights(board) != entry->castling_rights) {
-        return FALSE;
+    entry->hash_value = board->weak_hash_value;
+    entry->to_move = board->to_move;
+    entry->castling_rights = encode_castling_rights(board);
+    if(board->EnPassant) {
+        entry->ep_rank = board->ep_rank;
+        entry->ep_col = board->ep_col;
     }
     else {
-        if(board->EnPassant) {
-            return board->ep_rank == entry->ep_rank && board->ep_col == entry->ep_col;
-        }
-        else {
-            return entry->ep_rank == '\0';
-        }
+        entry->ep_rank = '\0';
+        entry->ep_col = '\0';
     }
 }
 
+static Boolean
+position_matches(const RepeatablePosition *entry, const RepeatablePosition *position)
+{
+    return entry->hash_value == position->hash_value &&
+            entry->to_move == position->to_move &&
+            entry->castling_rights == position->castling_rights &&
+            entry->ep_rank == position->ep_rank &&
+            entry->ep_col == position->ep_col;
+}
+
 /*
- * Add hash_value as a position in the current game.
+ * Add the position on board to those of the current game.
  * Return the number of times this position has occurred.
- * NB: The assumption is that position_counts is not NULL.
+ * A pawn move or capture resets the halfmove clock and no earlier
+ * position can recur, so only those since then are compared.
  */
 unsigned
 update_position_counts(PositionCount *position_counts, const Board *board)
 {
-    //fprintf(stderr, "U: %d,%d\n", board->ep_rank, board->ep_col);
-    PositionCount *entry = position_counts;
+    RepeatablePosition position;
+    unsigned count = 1;
+    unsigned i;
+
     if (position_counts == NULL) {
         /* Don't try to match in variations. */
         return 0;
     }
-    /* Try to find an existing entry. */
-    while (entry != NULL && !position_matches(entry, board)) {
-        entry = entry->next;
+    set_repeatable_position(&position, board);
+    if (board->halfmove_clock == 0) {
+        position_counts->num_positions = 0;
+    }
+    for (i = 0; i < position_counts->num_positions; i++) {
+        if (position_matches(&position_counts->positions[i], &position)) {
+            count++;
+        }
     }
-    if (entry == NULL) {
-        /* New position. */
-        entry = new_position_count_list(board);
-        /* Insert just after the head of the list. */
-        entry->next = position_counts->next;
-        position_counts->next = entry;
+    if (position_counts->num_positions == position_counts->max_positions) {
+        position_counts->max_positions *= 2;
+        position_counts->positions = (RepeatablePosition *)
+                realloc_or_die((void *) position_counts->positions,
+                    position_counts->max_positions * sizeof (RepeatablePosition));
     }
-    else {
-        /* Increment the count. */
-        entry->count++;
+    position_counts->positions[position_counts->num_positions] = position;
+    position_counts->num_positions++;
+    if (count > position_counts->max_count) {
+        position_counts->max_count = count;
     }
-    return entry->count;
+    return count;
 }
 
 /*
- * Free the list of position counts.
+ * The position counts of the current game.
+ * Only one game at a time has its positions counted, so the
+ * storage is retained for the next game rather than freed.
+ */
+static PositionCount game_position_counts;
+
+/*
+ * Finish with the position counts of the current game.
  */
 void
-free_position_count_list(PositionCount *position_counts)
+free_position_counts(PositionCount *position_counts)
 {
-    PositionCount *entry = position_counts;
-    while (entry != NULL) {
-        PositionCount *next = entry->next;
-        (void) free((void *) entry);
-        entry = next;
-    }
+    position_counts->num_positions = 0;
+    position_counts->max_count = 0;
 }
 
 /*
- * Create a new position count list.
- * This will have a single entry at its head.
+ * Start counting the positions of a game, from that on board.
  */
 PositionCount *
-new_position_count_list(const Board *board)
+new_position_counts(const Board *board)
 {
-    PositionCount *head = (PositionCount *) malloc_or_die(sizeof (*head));
-    head->hash_value = board->weak_hash_value;
-    head->to_move = board->to_move;
-    head->castling_rights = encode_castling_rights(board);
-    if(board->EnPassant) {
-        head->ep_rank = board->ep_rank;
-        head->ep_col = board->ep_col;
+    PositionCount *position_counts = &game_position_counts;
+    if (position_counts->positions == NULL) {
+        position_counts->max_positions = 128;
+        position_counts->positions = (RepeatablePosition *)
+                malloc_or_die(position_counts->max_positions * sizeof (RepeatablePosition));
+    }
+    set_repeatable_position(&position_counts->positions[0], board);
+    position_counts->num_positions = 1;
+    position_counts->max_count = 1;
+    return position_counts;
+}
+
+/* The --fuzzydepth in effect for this run, as recorded in an index. */
+static uint32_t
+index_fuzzy_depth(void)
+{
+    return GlobalState.fuzzy_match_duplicates ?
+            (uint32_t) GlobalState.fuzzy_match_depth : 0;
+}
+
+/* Read the duplicate index in filename, if it exists. */
+static void
+load_duplicate_index(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    DuplicateIndexHeader header;
+    size_t length = 0;
+    void *contents = NULL;
+    Boolean mapped = FALSE;
+
+    if (fp == NULL) {
+        /* It will be created at the end of the run. */
+        return;
+    }
+    if (fseek(fp, 0L, SEEK_END) == 0) {
+        long end = ftell(fp);
+        if (end > 0) {
+            length = (size_t) end;
+        }
+    }
+    if (length >= sizeof (header)) {
+#if MAPPED_INDEX
+        contents = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (contents == MAP_FAILED) {
+            contents = NULL;
+        }
+        else {
+            mapped = TRUE;
+        }
+#endif
+        if (contents == NULL) {
+            contents = malloc_or_die(length);
+            if (fseek(fp, 0L, SEEK_SET) != 0 ||
+                    fread(contents, 1, length, fp) != length) {
+                fprintf(GlobalState.logfile,
+                        "Unable to read the duplicate index %s\n", filename);
+                exit(1);
+            }
+        }
+    }
+    (void) fclose(fp);
+
+    if (contents == NULL) {
+        /* Too short to hold a header. */
     }
     else {
-        head->ep_rank = '\0';
-        head->ep_col = '\0';
+        /* Check that the details are consistent with the file's length. */
+        size_t per_entry = sizeof (DuplicateIndexEntry) + sizeof (HashCode);
+        size_t available = length - sizeof (header);
+        memcpy((void *) &header, contents, sizeof (header));
+        if (memcmp(header.magic, DUPLICATE_INDEX_MAGIC, sizeof (header.magic)) == 0 &&
+                header.version == DUPLICATE_INDEX_VERSION &&
+                header.count <= available / per_entry &&
+                header.count * per_entry == available) {
+            const char *base = (const char *) contents;
+            if (header.fuzzy_depth != index_fuzzy_depth()) {
+                if (header.fuzzy_depth == 0) {
+                    fprintf(GlobalState.logfile,
+                            "The duplicate index %s was built without --fuzzydepth.\n",
+                            filename);
+                }
+                else {
+                    fprintf(GlobalState.logfile,
+                            "The duplicate index %s was built with --fuzzydepth %lu.\n",
+                            filename, (unsigned long) header.fuzzy_depth);
+                }
+                exit(1);
+            }
+            duplicate_index.contents = contents;
+            duplicate_index.length = length;
+            duplicate_index.mapped = mapped;
+            duplicate_index.count = (size_t) header.count;
+            duplicate_index.entries =
+                    (const DuplicateIndexEntry *) (base + sizeof (header));
+            duplicate_index.fuzzy_values = (const HashCode *)
+                    (base + sizeof (header) +
+                     duplicate_index.count * sizeof (DuplicateIndexEntry));
+            return;
+        }
     }
-    head->count = 1;
-    head->next = NULL;
-    return head;
+    fprintf(GlobalState.logfile,
+            "%s is not a duplicate index file.\n", filename);
+    exit(1);
 }
 
-/*
- * Return an identical copy of the given list.
- */
-PositionCount *copy_position_count_list(PositionCount *original)
+/* Release the index read at the start of the run. */
+static void
+release_duplicate_index(void)
 {
-    PositionCount *copy = NULL;
-    PositionCount *tail = NULL;
-    while (original != NULL) {
-        PositionCount *entry = (PositionCount *) malloc_or_die(sizeof (*entry));
-        entry->hash_value = original->hash_value;
-        entry->to_move = original->to_move;
-        entry->castling_rights = original->castling_rights;
-        entry->count = original->count;
-        entry->next = NULL;
-
-        if (copy == NULL) {
-            copy = entry;
+    if (duplicate_index.contents != NULL) {
+#if MAPPED_INDEX
+        if (duplicate_index.mapped) {
+            (void) munmap(duplicate_index.contents, duplicate_index.length);
         }
-        else {
-            tail->next = entry;
+        else
+#endif
+        {
+            (void) free(duplicate_index.contents);
         }
-        tail = entry;
-        original = original->next;
     }
-    return copy;
+    duplicate_index.contents = NULL;
+    duplicate_index.length = 0;
+    duplicate_index.mapped = FALSE;
+    duplicate_index.entries = NULL;
+    duplicate_index.fuzzy_values = NULL;
+    duplicate_index.count = 0;
+}
+
+/* Order index entries on their final_ and then cumulative_hash_value. */
+static int
+compare_index_entries(const void *e1, const void *e2)
+{
+    const DuplicateIndexEntry *entry1 = (const DuplicateIndexEntry *) e1;
+    const DuplicateIndexEntry *entry2 = (const DuplicateIndexEntry *) e2;
+    if (entry1->final_hash_value != entry2->final_hash_value) {
+        return entry1->final_hash_value < entry2->final_hash_value ? -1 : 1;
+    }
+    else if (entry1->cumulative_hash_value != entry2->cumulative_hash_value) {
+        return entry1->cumulative_hash_value < entry2->cumulative_hash_value ? -1 : 1;
+    }
+    else {
+        return 0;
+    }
+}
+
+/* Order hash values. */
+static int
+compare_hash_codes(const void *h1, const void *h2)
+{
+    HashCode hash1 = *(const HashCode *) h1;
+    HashCode hash2 = *(const HashCode *) h2;
+    return hash1 < hash2 ? -1 : (hash1 > hash2 ? 1 : 0);
 }
 
-/* Determine which table to initialise, depending
- * on whether use_virtual_hash_table is set or not.
+/* Whether the index read at the start of the run contains
+ * final_hash_value and cumulative_hash_value as a pair.
  */
-void
-init_duplicate_hash_table(void)
+static Boolean
+in_duplicate_index(HashCode final_hash_value, HashCode cumulative_hash_value)
 {
-    int i;
+    DuplicateIndexEntry key;
+    key.final_hash_value = final_hash_value;
+    key.cumulative_hash_value = cumulative_hash_value;
+    key.fuzzy_hash_value = 0;
+    return duplicate_index.count > 0 &&
+            bsearch((const void *) &key, (const void *) duplicate_index.entries,
+                    duplicate_index.count, sizeof (key),
+                    compare_index_entries) != NULL;
+}
 
-    if (GlobalState.use_virtual_hash_table) {
-        VirtualLogTable = (LogHeaderEntry *)
-                malloc_or_die(LOG_TABLE_SIZE * sizeof (*VirtualLogTable));
-        for (i = 0; i < LOG_TABLE_SIZE; i++) {
-            VirtualLogTable[i].head = VirtualLogTable[i].tail = -1;
+/* Whether the index read at the start of the run contains
+ * fuzzy_hash_value as a fuzzy match position.
+ */
+static Boolean
+in_duplicate_index_fuzzy(HashCode fuzzy_hash_value)
+{
+    return duplicate_index.count > 0 &&
+            bsearch((const void *) &fuzzy_hash_value,
+                    (const void *) duplicate_index.fuzzy_values,
+                    duplicate_index.count, sizeof (fuzzy_hash_value),
+                    compare_hash_codes) != NULL;
+}
+
+/* Remember the details of a game first met in this run. */
+static void
+add_new_index_entry(HashCode final_hash_value, HashCode cumulative_hash_value,
+                    HashCode fuzzy_hash_value)
+{
+    DuplicateIndexEntry *entry;
+    if (num_new_index_entries == new_index_capacity) {
+        new_index_capacity = new_index_capacity == 0 ? 1024 : 2 * new_index_capacity;
+        new_index_entries = (DuplicateIndexEntry *)
+                realloc_or_die((void *) new_index_entries,
+                               new_index_capacity * sizeof (*new_index_entries));
+    }
+    entry = &new_index_entries[num_new_index_entries++];
+    entry->final_hash_value = final_hash_value;
+    entry->cumulative_hash_value = cumulative_hash_value;
+    entry->fuzzy_hash_value = fuzzy_hash_value;
+}
+
+/* Merge the entries from this run into the index and write it
+ * to filename. The new index is written alongside the old one
+ * and then renamed over it, so the old one survives a failure.
+ */
+static void
+save_duplicate_index(const char *filename)
+{
+    size_t old_count = duplicate_index.count;
+    size_t new_count = num_new_index_entries;
+    size_t total = old_count + new_count;
+    HashCode *new_fuzzy_values;
+    DuplicateIndexHeader header;
+    char *temp_name;
+    FILE *fp;
+    Boolean ok;
+    size_t i, j;
+
+    if (new_count == 0 && duplicate_index.contents != NULL) {
+        /* Nothing has changed. */
+        return;
+    }
+    qsort((void *) new_index_entries, new_count, sizeof (*new_index_entries),
+          compare_index_entries);
+    new_fuzzy_values = (HashCode *)
+            malloc_or_die((new_count > 0 ? new_count : 1) * sizeof (*new_fuzzy_values));
+    for (i = 0; i < new_count; i++) {
+        new_fuzzy_values[i] = new_index_entries[i].fuzzy_hash_value;
+    }
+    qsort((void *) new_fuzzy_values, new_count, sizeof (*new_fuzzy_values),
+          compare_hash_codes);
+
+    temp_name = (char *) malloc_or_die(strlen(filename) + strlen(".tmp") + 1);
+    strcpy(temp_name, filename);
+    strcat(temp_name, ".tmp");
+    fp = fopen(temp_name, "wb");
+    if (fp == NULL) {
+        fprintf(GlobalState.logfile,
+                "Unable to write the duplicate index %s\n", temp_name);
+        (void) free((void *) new_fuzzy_values);
+        (void) free((void *) temp_name);
+        return;
+    }
+
+    memset((void *) &header, 0, sizeof (header));
+    memcpy(header.magic, DUPLICATE_INDEX_MAGIC, sizeof (header.magic));
+    header.version = DUPLICATE_INDEX_VERSION;
+    header.fuzzy_depth = index_fuzzy_depth();
+    header.count = total;
+    ok = fwrite((void *) &header, sizeof (header), 1, fp) == 1;
+
+    /* Merge the two sorted sets of entries. */
+    i = j = 0;
+    while (ok && (i < old_count || j < new_count)) {
+        const DuplicateIndexEntry *next;
+        if (j == new_count ||
+                (i < old_count &&
+                 compare_index_entries(&duplicate_index.entries[i],
+                                       &new_index_entries[j]) <= 0)) {
+            next = &duplicate_index.entries[i++];
         }
-        hash_file = fopen(VIRTUAL_FILE, "w+b");
-        if (hash_file == NULL) {
-            fprintf(GlobalState.logfile, "Unable to open %s\n",
-                    VIRTUAL_FILE);
+        else {
+            next = &new_index_entries[j++];
         }
-    }
-    else {
-        LogTable = (HashLog**) malloc_or_die(LOG_TABLE_SIZE * sizeof (*LogTable));
-        for (i = 0; i < LOG_TABLE_SIZE; i++) {
-            LogTable[i] = NULL;
+        ok = fwrite((const void *) next, sizeof (*next), 1, fp) == 1;
+    }
+    /* Merge the two sorted sets of fuzzy values. */
+    i = j = 0;
+    while (ok && (i < old_count || j < new_count)) {
+        const HashCode *next;
+        if (j == new_count ||
+                (i < old_count && duplicate_index.fuzzy_values[i] <= new_fuzzy_values[j])) {
+            next = &duplicate_index.fuzzy_values[i++];
+        }
+        else {
+            next = &new_fuzzy_values[j++];
         }
+        ok = fwrite((const void *) next, sizeof (*next), 1, fp) == 1;
+    }
+    if (fclose(fp) != 0) {
+        ok = FALSE;
+    }
+    /* The old index is no longer needed. */
+    release_duplicate_index();
+    if (ok && rename(temp_name, filename) != 0) {
+        /* Some systems will not rename over an existing file. */
+        (void) remove(filename);
+        ok = rename(temp_name, filename) == 0;
+    }
+    if (!ok) {
+        fprintf(GlobalState.logfile,
+                "Unable to write the duplicate index %s\n", filename);
+        (void) remove(temp_name);
+    }
+    (void) free((void *) new_fuzzy_values);
+    (void) free((void *) temp_name);
+}
+
+/* Initialise the table used for duplicate detection, and
+ * read any index from an earlier run.
+ */
+void
+init_duplicate_hash_table(void)
+{
+    log_table_capacity = LOG_TABLE_INITIAL_CAPACITY;
+    log_table_entries = 0;
+    LogTable = (DuplicateEntry *)
+            malloc_or_die(log_table_capacity * sizeof (*LogTable));
+    memset(LogTable, 0, log_table_capacity * sizeof (*LogTable));
+    if (GlobalState.duplicate_index_file != NULL) {
+        load_duplicate_index(GlobalState.duplicate_index_file);
     }
 }
 
-/* Close and remove the temporary file if in use. */
+/* Write out the index, if in use, and free the table. */
 void
 clear_duplicate_hash_table(void)
 {
-    if (GlobalState.use_virtual_hash_table) {
-        if (hash_file != NULL) {
-            (void) fclose(hash_file);
-            unlink(VIRTUAL_FILE);
-            hash_file = NULL;
+    if (GlobalState.duplicate_index_file != NULL) {
+        save_duplicate_index(GlobalState.duplicate_index_file);
+        release_duplicate_index();
+        if (new_index_entries != NULL) {
+            (void) free((void *) new_index_entries);
+            new_index_entries = NULL;
         }
+        num_new_index_entries = new_index_capacity = 0;
     }
+    if (journal_entries != NULL) {
+        (void) free((void *) journal_entries);
+        journal_entries = NULL;
+    }
+    num_journal_entries = journal_capacity = 0;
+    if (LogTable != NULL) {
+        (void) free((void *) LogTable);
+        LogTable = NULL;
+    }
+    log_table_capacity = log_table_entries = 0;
 }
 
-/* Retrieve a duplicate table entry from the hash file. */
-static int
-retrieve_virtual_entry(long ix, VirtualHashLog *entry)
+/* Return the slot of LogTable at which to start probing for hash. */
+static size_t
+log_table_start(HashCode hash)
 {
-    if (hash_file == NULL) {
-        return 0;
-    }
-    else if (fseek(hash_file, ix, SEEK_SET) != 0) {
-        fprintf(GlobalState.logfile,
-                "Fseek error to %ld in retrieve_virtual_entry\n", ix);
-        return 0;
+    /* Fold the high bits in so that the mask does not just select
+     * the low bits of the hash value.
+     */
+    return (size_t) ((hash * 0x9E3779B97F4A7C15ULL) >> 32) &
+                (log_table_capacity - 1);
+}
+
+/* Hint that the slot at which a probe will start should be fetched. */
+static void
+prefetch_log_table_slot(HashCode hash)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(&LogTable[log_table_start(hash)]);
+#else
+    (void) hash;
+#endif
+}
+
+/* Find an entry in LogTable whose final_hash_value is final_hash_value.
+ * If exact is TRUE then cumulative_hash_value must match as well.
+ * Return NULL if there is no such entry.
+ */
+static const DuplicateEntry *
+find_log_table_entry(HashCode final_hash_value, HashCode cumulative_hash_value,
+                     Boolean exact)
+{
+    size_t mask = log_table_capacity - 1;
+    size_t ix = log_table_start(final_hash_value);
+    unsigned long probes = 1;
+
+    while (LogTable[ix].in_use) {
+        const DuplicateEntry *entry = &LogTable[ix];
+        if (entry->final_hash_value == final_hash_value &&
+                (!exact || entry->cumulative_hash_value == cumulative_hash_value)) {
+            PROFILE_PROBES(PROFILE_LOG_TABLE, probes);
+            return entry;
+        }
+        ix = (ix + 1) & mask;
+        probes++;
     }
-    else if (fread((void *) entry, sizeof (*entry), 1, hash_file) != 1) {
-        fprintf(GlobalState.logfile,
-                "Fread error from %ld in retrieve_virtual_entry\n", ix);
-        return 0;
+    PROFILE_PROBES(PROFILE_LOG_TABLE, probes);
+    return NULL;
+}
+
+/* Place entry in the first free slot of its probe sequence.
+ * The table must have at least one free slot.
+ */
+static void
+place_log_table_entry(const DuplicateEntry *entry)
+{
+    size_t mask = log_table_capacity - 1;
+    size_t ix = log_table_start(entry->final_hash_value);
+
+    while (LogTable[ix].in_use) {
+        ix = (ix + 1) & mask;
     }
-    else {
-        return 1;
+    LogTable[ix] = *entry;
+}
+
+/* Double the capacity of LogTable and re-insert its entries. */
+static void
+grow_log_table(void)
+{
+    DuplicateEntry *old_table = LogTable;
+    size_t old_capacity = log_table_capacity;
+    size_t i;
+
+    log_table_capacity *= 2;
+    LogTable = (DuplicateEntry *)
+            malloc_or_die(log_table_capacity * sizeof (*LogTable));
+    memset(LogTable, 0, log_table_capacity * sizeof (*LogTable));
+    for (i = 0; i < old_capacity; i++) {
+        if (old_table[i].in_use) {
+            place_log_table_entry(&old_table[i]);
+        }
     }
+    (void) free((void *) old_table);
 }
 
-/* Write a duplicate table entry to the hash file. */
-static int
-write_virtual_entry(long where, const VirtualHashLog *entry)
+/* Add a new entry to LogTable. */
+static void
+add_log_table_entry(HashCode final_hash_value, HashCode cumulative_hash_value,
+                    unsigned file_number)
 {
-    if (fseek(hash_file, where, SEEK_SET) != 0) {
-        fprintf(GlobalState.logfile,
-                "Fseek error to %ld in write_virtual_entry\n", where);
-        return 0;
+    DuplicateEntry entry;
+
+    if ((log_table_entries + 1) * 100 > log_table_capacity * LOG_TABLE_MAX_LOAD) {
+        grow_log_table();
     }
-    else if (fwrite((void *) entry, sizeof (*entry), 1, hash_file) != 1) {
-        fprintf(GlobalState.logfile,
-                "Fwrite error from %ld in write_virtual_entry\n", where);
-        fflush(hash_file);
-        return 0;
+    entry.final_hash_value = final_hash_value;
+    entry.cumulative_hash_value = cumulative_hash_value;
+    entry.file_number = file_number;
+    entry.in_use = TRUE;
+    place_log_table_entry(&entry);
+    log_table_entries++;
+}
+
+/* Record a game met for the first time. */
+static void
+add_first_occurance(HashCode final_hash_value, HashCode cumulative_hash_value,
+                    HashCode fuzzy_hash_value, Boolean reached_fuzzy_depth,
+                    unsigned file_number)
+{
+    if (reached_fuzzy_depth) {
+        /* Store just the hash value from the fuzzy depth. */
+        add_log_table_entry(fuzzy_hash_value, 0, file_number);
     }
     else {
-        /* Written ok. */
-        return 1;
+        /* Store the two hash values. */
+        add_log_table_entry(final_hash_value, cumulative_hash_value,
+                            file_number);
+    }
+    if (GlobalState.duplicate_index_file != NULL) {
+        add_new_index_entry(final_hash_value, cumulative_hash_value,
+                            fuzzy_hash_value);
     }
 }
 
-/* Return the name of the original file if it looks like we
- * have met the moves in game_details before, otherwise return
- * NULL.  A match is assumed to be so if both
- * the final_ and cumulative_ hash values in game_details
- * are already present in VirtualLogTable.
+/* Hold the details of a game met for the first time until
+ * the next write_duplicate_journal.
  */
-static const char *
-previous_virtual_occurance(Game game_details)
+static void
+add_journal_entry(HashCode final_hash_value, HashCode cumulative_hash_value,
+                  HashCode fuzzy_hash_value, Boolean reached_fuzzy_depth,
+                  unsigned file_number)
 {
-    unsigned ix = game_details.final_hash_value % LOG_TABLE_SIZE;
-    VirtualHashLog entry;
-    Boolean duplicate = FALSE;
-    const char *original_filename = NULL;
+    DuplicateJournalEntry *entry;
+    if (num_journal_entries == journal_capacity) {
+        journal_capacity = journal_capacity == 0 ? 1024 : 2 * journal_capacity;
+        journal_entries = (DuplicateJournalEntry *)
+                realloc_or_die((void *) journal_entries,
+                               journal_capacity * sizeof (*journal_entries));
+    }
+    entry = &journal_entries[num_journal_entries++];
+    entry->final_hash_value = final_hash_value;
+    entry->cumulative_hash_value = cumulative_hash_value;
+    entry->fuzzy_hash_value = fuzzy_hash_value;
+    entry->file_number = file_number;
+    entry->reached_fuzzy_depth = reached_fuzzy_depth;
+}
 
+/* Append to fp the games first met since the last call, for
+ * --checkpoint, and return how many there were.
+ * Errors are left for the caller to find with ferror.
+ */
+unsigned long
+write_duplicate_journal(FILE *fp)
+{
+    unsigned long written = num_journal_entries;
+    if (num_journal_entries > 0) {
+        (void) fwrite((const void *) journal_entries, sizeof (*journal_entries),
+                      num_journal_entries, fp);
+        num_journal_entries = 0;
+    }
+    return written;
+}
 
-    /* Are we keeping this information? */
-    if (GlobalState.suppress_duplicates || GlobalState.suppress_originals ||
-            GlobalState.duplicate_file != NULL) {
-        if (VirtualLogTable[ix].head < 0l) {
-            /* First occurrence. */
-        }
-        else {
-            int keep_going =
-                    retrieve_virtual_entry(VirtualLogTable[ix].head, &entry);
-
-            while (keep_going && !duplicate) {
-                if ((entry.final_hash_value == game_details.final_hash_value) &&
-                        (entry.cumulative_hash_value == game_details.cumulative_hash_value)) {
-                    /* We have a match.
-                     * Determine where it first occured.
-                     */
-                    original_filename = input_file_name(entry.file_number);
-                    duplicate = TRUE;
-                }
-                else if (entry.next >= 0l) {
-                    keep_going = retrieve_virtual_entry(entry.next, &entry);
-                }
-                else {
-                    keep_going = 0;
-                }
-            }
-        }
+/* Read count entries of the journal from fp, for --resume, and
+ * add them to the table.
+ * Return FALSE if the journal is too short.
+ */
+Boolean
+replay_duplicate_journal(FILE *fp, unsigned long count)
+{
+    DuplicateJournalEntry entry;
+    unsigned long i;
 
-        if (!duplicate) {
-            /* Write an entry for it. */
-            /* Where to write the next VirtualHashLog entry. */
-            static long next_free_entry = 0l;
-
-            /* Avoid valgrind error when writing unset bytes that
-             * are part of the structure padding.
-             */
-            memset((void *) &entry, 0, sizeof(entry));
-            /* Store the XOR of the two hash values. */
-            entry.final_hash_value = game_details.final_hash_value;
-            entry.cumulative_hash_value = game_details.cumulative_hash_value;
-            entry.file_number = current_file_number();
-            entry.next = -1l;
-
-            /* Write out these details. */
-            if (write_virtual_entry(next_free_entry, &entry)) {
-                long where_written = next_free_entry;
-                /* Move on ready for next time. */
-                next_free_entry += sizeof (entry);
-
-                /* Now update the index table. */
-                if (VirtualLogTable[ix].head < 0l) {
-                    /* First occurrence. */
-                    VirtualLogTable[ix].head =
-                            VirtualLogTable[ix].tail = where_written;
-                }
-                else {
-                    VirtualHashLog tail;
-
-                    if (retrieve_virtual_entry(VirtualLogTable[ix].tail, &tail)) {
-                        tail.next = where_written;
-                        (void) write_virtual_entry(VirtualLogTable[ix].tail, &tail);
-                        /* Store the new tail address. */
-                        VirtualLogTable[ix].tail = where_written;
-                    }
-                }
-            }
+    for (i = 0; i < count; i++) {
+        if (fread((void *) &entry, sizeof (entry), 1, fp) != 1) {
+            return FALSE;
         }
+        add_first_occurance(entry.final_hash_value, entry.cumulative_hash_value,
+                            entry.fuzzy_hash_value,
+                            entry.reached_fuzzy_depth != 0,
+                            entry.file_number);
     }
-    return original_filename;
+    return TRUE;
 }
 
 /* Return the name of the original file if it looks like we
@@ -447,7 +795,9 @@ previous_virtual_occurance(Game game_details)
  * NULL.
  * For non-fuzzy comparison, a match is assumed to be so if both
  * final_ and cumulative_ hash values are already present 
- * as a pair in LogTable.
+ * as a pair in LogTable, or the game is in the duplicate index
+ * from an earlier run, in which case the name of the index is
+ * returned.
  * Fuzzy matches depend on the match depth and do not use the
  * cumulative hash value.
  */
@@ -455,96 +805,115 @@ const char *
 previous_occurance(Game game_details, unsigned plycount)
 {
     const char *original_filename = NULL;
-    if (GlobalState.use_virtual_hash_table) {
-        original_filename = previous_virtual_occurance(game_details);
-    }
-    else {
-        /* Are we keeping this information? */
-        if (GlobalState.suppress_duplicates ||
-                GlobalState.suppress_originals ||
-                GlobalState.fuzzy_match_duplicates ||
-                GlobalState.duplicate_file != NULL) {
-            Boolean duplicate = FALSE;
-            // Entry index.
-            unsigned ix;
-            HashLog *entry;
-
-            ix = game_details.final_hash_value % LOG_TABLE_SIZE;
-            entry = LogTable[ix];
+    ProfileMark mark;
+
+    PROFILE_BEGIN(mark);
+    /* Are we keeping this information? */
+    if (GlobalState.suppress_duplicates ||
+            GlobalState.suppress_originals ||
+            GlobalState.fuzzy_match_duplicates ||
+            GlobalState.duplicate_file != NULL ||
+            GlobalState.duplicate_index_file != NULL) {
+        const DuplicateEntry *entry;
+        /* Whether the game reached the fuzzy_match_depth. */
+        Boolean reached_fuzzy_depth = GlobalState.fuzzy_match_duplicates &&
+                GlobalState.fuzzy_match_depth > 0 &&
+                plycount >= GlobalState.fuzzy_match_depth;
+        /* The position to be compared for a fuzzy match:
+         * at the fuzzy_match_depth or the end of the game.
+         */
+        HashCode fuzzy_hash_value = reached_fuzzy_depth ?
+                game_details.fuzzy_duplicate_hash :
+                game_details.final_hash_value;
+
+        if (GlobalState.duplicate_scan_prefix != NULL) {
+            /* Leave the look up to --dupmerge. */
+            record_shard_game(game_details.final_hash_value,
+                              game_details.cumulative_hash_value,
+                              fuzzy_hash_value, reached_fuzzy_depth,
+                              current_file_number());
+        }
+        else if (GlobalState.duplicate_resolve_prefix != NULL) {
+            /* Already decided by --dupmerge. */
+            original_filename = resolved_occurance();
+        }
+        else {
+            if (GlobalState.fuzzy_match_duplicates) {
+                /* Overlap fetching the fuzzy probe with the exact one. */
+                prefetch_log_table_slot(fuzzy_hash_value);
+            }
             /* Check for non-fuzzy matches first. */
-            while (entry != NULL && !duplicate) {
-                if (entry->final_hash_value == game_details.final_hash_value &&
-                        entry->cumulative_hash_value == game_details.cumulative_hash_value) {
-                    /* An exact match. */
-                    duplicate = TRUE;
-                    /* Determine where it first occurred. */
-                    original_filename = input_file_name(entry->file_number);
-                }
-                else {
-                    entry = entry->next;
-                }
+            entry = find_log_table_entry(game_details.final_hash_value,
+                                         game_details.cumulative_hash_value,
+                                         TRUE);
+            if (entry == NULL && GlobalState.fuzzy_match_duplicates) {
+                entry = find_log_table_entry(fuzzy_hash_value, 0, FALSE);
             }
-            if (!duplicate && GlobalState.fuzzy_match_duplicates) {
-                ix = game_details.fuzzy_duplicate_hash % LOG_TABLE_SIZE;
-                entry = LogTable[ix];
-                while (entry != NULL && !duplicate) {
-                    if (GlobalState.fuzzy_match_depth == 0 &&
-                            entry->final_hash_value == game_details.final_hash_value) {
-                        /* Accept positional match at the end of the game. */
-                        duplicate = TRUE;
-                    }
-                    else {
-                        /* Need to check at the fuzzy_match_depth. */
-                        if (entry->final_hash_value == game_details.fuzzy_duplicate_hash) {
-                            duplicate = TRUE;
-                        }
-                    }
-                    if (duplicate) {
-                        /* We have a match.
-                         * Determine where it first occurred.
-                         */
-                        original_filename = input_file_name(entry->file_number);
-                    }
-                    else {
-                        entry = entry->next;
-                    }
+
+            if (entry != NULL) {
+                /* Determine where it first occurred. */
+                original_filename = input_file_name(entry->file_number);
+                /* Without a filename, suppressing duplicates on stdin does not work. */
+                if (original_filename == NULL) {
+                    original_filename = "_stdin_";
                 }
             }
-
-            if (!duplicate) {
+            else if (in_duplicate_index(game_details.final_hash_value,
+                                        game_details.cumulative_hash_value) ||
+                    (GlobalState.fuzzy_match_duplicates &&
+                     in_duplicate_index_fuzzy(fuzzy_hash_value))) {
+                /* Met in an earlier run. */
+                original_filename = GlobalState.duplicate_index_file;
+            }
+            else {
                 /* First occurrence, so add it to the log. */
-                entry = (HashLog *) malloc_or_die(sizeof (*entry));
-
-                if (!GlobalState.fuzzy_match_duplicates) {
-                    /* Store the two hash values. */
-                    entry->final_hash_value = game_details.final_hash_value;
-                    entry->cumulative_hash_value = game_details.cumulative_hash_value;
-                }
-                else if (GlobalState.fuzzy_match_depth > 0 &&
-                        plycount >= GlobalState.fuzzy_match_depth) {
-                    /* Store just the hash value from the fuzzy depth. */
-                    entry->final_hash_value = game_details.fuzzy_duplicate_hash;
-                    entry->cumulative_hash_value = 0;
-                }
-                else {
-                    /* Store the two hash values. */
-                    entry->final_hash_value = game_details.final_hash_value;
-                    entry->cumulative_hash_value = game_details.cumulative_hash_value;
+                add_first_occurance(game_details.final_hash_value,
+                                    game_details.cumulative_hash_value,
+                                    fuzzy_hash_value, reached_fuzzy_depth,
+                                    current_file_number());
+                if (GlobalState.checkpoint_file != NULL) {
+                    add_journal_entry(game_details.final_hash_value,
+                                      game_details.cumulative_hash_value,
+                                      fuzzy_hash_value, reached_fuzzy_depth,
+                                      current_file_number());
                 }
-                entry->file_number = current_file_number();
-                /* Link it into the head at this index. */
-                entry->next = LogTable[ix];
-                LogTable[ix] = entry;
-            }
-            /* Without a filename, suppressing duplicates on stdin does not work. */
-            if(duplicate && original_filename == NULL) {
-                original_filename = "_stdin_";
             }
         }
     }
+    PROFILE_END(PROFILE_DUPLICATES, mark);
     return original_filename;
 }
 
+/* Look up a game recorded by --dupscan in the same way as
+ * previous_occurance, for --dupmerge.
+ * Return TRUE if it is a duplicate, with *original_file set to
+ * the number of the file in which it was first found.
+ * Otherwise add it to the table with file_number.
+ */
+Boolean
+merge_occurance(HashCode final_hash_value, HashCode cumulative_hash_value,
+                HashCode fuzzy_hash_value, Boolean reached_fuzzy_depth,
+                unsigned file_number, unsigned *original_file)
+{
+    const DuplicateEntry *entry = find_log_table_entry(final_hash_value,
+                                                       cumulative_hash_value,
+                                                       TRUE);
+
+    if (entry == NULL && GlobalState.fuzzy_match_duplicates) {
+        entry = find_log_table_entry(fuzzy_hash_value, 0, FALSE);
+    }
+    if (entry != NULL) {
+        *original_file = entry->file_number;
+        return TRUE;
+    }
+    else {
+        add_first_occurance(final_hash_value, cumulative_hash_value,
+                            fuzzy_hash_value, reached_fuzzy_depth,
+                            file_number);
+        return FALSE;
+    }
+}
+
 /* Define a table to hold the zobrist/polyglot hash codes of starting positions.
  * Size should be a prime number for collision avoidance.
  */
@@ -38,29 +38,44 @@ typedef struct HashLog {
 } HashLog;
 
 /*
- * A structure for counting the number of times a position arises
- * in a game.
+ * The details of a position that matter for repetitions.
  */
-typedef struct PositionCount {
+typedef struct {
     HashCode hash_value;
     Colour to_move;
     unsigned short castling_rights;
     Rank ep_rank;
     Col ep_col;
-    unsigned count;
-    struct PositionCount *next;
+} RepeatablePosition;
+
+/*
+ * A structure for counting the number of times a position arises
+ * in a game.
+ * Only the positions since the most recent irreversible move are kept,
+ * as no earlier position can be repeated.
+ */
+typedef struct PositionCount {
+    RepeatablePosition *positions;
+    unsigned num_positions;
+    unsigned max_positions;
+    /* The greatest number of times any position has occurred. */
+    unsigned max_count;
 } PositionCount;
 
 
 Boolean check_duplicate_setup(const Game *game_details);
 Boolean check_for_only_repetition(PositionCount *position_counts);
 void clear_duplicate_hash_table(void);
-PositionCount *copy_position_count_list(PositionCount *original);
-void free_position_count_list(PositionCount *position_counts);
+void free_position_counts(PositionCount *position_counts);
 void init_duplicate_hash_table(void);
-PositionCount *new_position_count_list(const Board *board);
+Boolean merge_occurance(HashCode final_hash_value, HashCode cumulative_hash_value,
+                HashCode fuzzy_hash_value, Boolean reached_fuzzy_depth,
+                unsigned file_number, unsigned *original_file);
+PositionCount *new_position_counts(const Board *board);
 const char *previous_occurance(Game game_details, unsigned plycount);
+Boolean replay_duplicate_journal(FILE *fp, unsigned long count);
 unsigned update_position_counts(PositionCount *position_counts, const Board *board);
+unsigned long write_duplicate_journal(FILE *fp);
 
 #endif	// HASHING_H
 
@@ -19,6 +19,10 @@
  *  https://www.cs.kent.ac.uk/people/staff/djb/
  */
 
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +35,15 @@
 #else
 #include <unistd.h>
 #endif
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+/* Regular input files are memory mapped rather than read through
+ * the input buffer.
+ */
+#define MAPPED_INPUT 1
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 #include "bool.h"
 #include "mymalloc.h"
 #include "defs.h"
@@ -45,19 +58,26 @@
 #include "grammar.h"
 #include "apply.h"
 #include "output.h"
+#include "profile.h"
+#include "compress.h"
+#include "gameindex.h"
 
 /* Prototypes for the functions in this file. */
 static Boolean extract_yytext(const unsigned char *symbol_start,
         const unsigned char *linep);
-static int identify_tag(const char *tag_string);
+static int identify_tag(const char *name, size_t len);
 static TagName make_new_tag(const char *tag);
 static Boolean open_input(const char *infile);
 static Boolean open_input_file(int file_number);
+static char *next_mapped_line(void);
+static void map_input(FILE *fp);
+static void unmap_input(void);
 /* When a move is saved, what is known of its source and destination coordinates
  * should also be saved.
  */
 static void save_k_castle(void);
 static void save_move(const unsigned char *move);
+static void save_NAG(const char *str);
 static void save_q_castle(void);
 static void save_string(const char *result);
 static void terminate_input(void);
@@ -69,6 +89,23 @@ static unsigned RAV_level = 0;
 static unsigned char last_move[MAX_MOVE_LEN + 1];
 /* How many games we have extracted from this file. */
 static unsigned games_in_file = 0;
+/* Whether the input is being lexed in chunks for --threads,
+ * in which case the end of a chunk is the end of the input.
+ */
+static Boolean lexing_chunks = FALSE;
+/* Whether to discard the remaining text of the current game,
+ * without tokenising it, at the next call of get_next_symbol.
+ */
+static Boolean discarding_game_text = FALSE;
+/* Whether to abandon the rest of the current line at the next call
+ * of get_next_symbol, because the input has been moved on by seek_input.
+ */
+static Boolean abandoning_line = FALSE;
+/* Where the symbol last returned by get_next_symbol ends,
+ * for input_resume_point.
+ * This is NULL at the end of a file.
+ */
+static const unsigned char *last_symbol_end = NULL;
 
 /* Provide an input file pointer.
  * This is intialised in init_lex_tables.
@@ -98,9 +135,76 @@ static unsigned tag_list_length = 0;
  * The indices are the same as for TagList.
  */
 static Boolean *suppressed_tags;
+/* An open-addressing hash table of the indices of TagList, for
+ * identify_tag. Free slots hold -1. It is kept at most half full.
+ */
+static int *tag_table = NULL;
+static unsigned tag_table_size = 0;
+
+/* The values of the tags that tend to repeat from game to game
+ * are interned: a single copy of each distinct value is kept and
+ * shared by every game, rather than each game having its own.
+ * The number per tag is limited so that values that turn out
+ * to be unique to each game cannot fill the table.
+ */
+static const TagName interned_tags[] = {
+    BLACK_TITLE_TAG, DATE_TAG, ECO_TAG, EVENT_TAG, EVENT_DATE_TAG,
+    OPENING_TAG, RESULT_TAG, SITE_TAG, TERMINATION_TAG, TIME_CONTROL_TAG,
+    VARIANT_TAG, WHITE_TITLE_TAG,
+};
+#define NUM_INTERNED_TAGS (sizeof (interned_tags) / sizeof (interned_tags[0]))
+#define MAX_INTERNED_VALUES_PER_TAG 256
+#define MAX_INTERNED_LENGTH 128
+/* Large enough to remain less than half full. */
+#define INTERNED_TABLE_SIZE 8192
+static char *interned_values[INTERNED_TABLE_SIZE];
+/* The number of values interned for each tag, or -1 for tags
+ * whose values are not interned.
+ */
+static int interned_count[ORIGINAL_NUMBER_OF_TAGS];
 /* Nested comment depth: GlobalState.allow_nested_comments. */
 static unsigned comment_depth = 0;
 
+/* The FNV-1a hash of the len characters of name. */
+static unsigned long
+hash_name(const char *name, size_t len)
+{
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = ((hash ^ (unsigned char) name[i]) * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+/* Add TagList[tag_index] to tag_table, growing it if necessary. */
+static void
+add_to_tag_table(unsigned tag_index)
+{
+    unsigned slot;
+
+    if (2 * (tag_index + 1) > tag_table_size) {
+        /* Rebuild it at twice the size. */
+        unsigned i;
+
+        tag_table_size = tag_table_size == 0 ? 128 : 2 * tag_table_size;
+        tag_table = (int *) realloc_or_die((void *) tag_table,
+                tag_table_size * sizeof (*tag_table));
+        for (i = 0; i < tag_table_size; i++) {
+            tag_table[i] = -1;
+        }
+        for (i = 0; i < tag_index; i++) {
+            add_to_tag_table(i);
+        }
+    }
+    slot = hash_name(TagList[tag_index], strlen(TagList[tag_index])) & (tag_table_size - 1);
+    while (tag_table[slot] >= 0) {
+        slot = (slot + 1) & (tag_table_size - 1);
+    }
+    tag_table[slot] = tag_index;
+}
+
 /* Initialise the TagList. This should be stored in alphabetical order,
  * by virtue of the order in which the _TAG values are defined.
  */
@@ -164,6 +268,15 @@ init_list_of_known_tags(void)
     TagList[WHITE_TITLE_TAG] = "WhiteTitle";
     TagList[WHITE_TYPE_TAG] = "WhiteType";
     TagList[WHITE_USCF_TAG] = "WhiteUSCF";
+    for (i = 0; i < tag_list_length; i++) {
+        add_to_tag_table(i);
+    }
+    for (i = 0; i < ORIGINAL_NUMBER_OF_TAGS; i++) {
+        interned_count[i] = -1;
+    }
+    for (i = 0; i < NUM_INTERNED_TAGS; i++) {
+        interned_count[interned_tags[i]] = 0;
+    }
 }
 
 /* Extend TagList to accomodate a new tag string.
@@ -182,6 +295,7 @@ make_new_tag(const char *tag)
                                       tag_list_length * sizeof(*suppressed_tags));
     TagList[tag_index] = copy_string(tag);
     suppressed_tags[tag_index] = FALSE;
+    add_to_tag_table(tag_index);
     /* Ensure that the game header's tags array can accommodate
      * the new tag.
      */
@@ -189,6 +303,13 @@ make_new_tag(const char *tag)
     return tag_index;
 }
 
+/* Return the number of tag names known, including those met in the input. */
+unsigned
+number_of_tags(void)
+{
+    return tag_list_length;
+}
+
 const char *
 tag_header_string(TagName tag)
 {
@@ -217,15 +338,24 @@ is_suppressed_tag(TagName tag)
     }
 }
 
-/* Don't include the given tag on output. */
-void
-suppress_tag(const char *tag_string)
+/* Return the index of tag_string, adding it to the
+ * known tags if it is not one of them.
+ */
+TagName
+lookup_tag(const char *tag_string)
 {
-    int tag_item = identify_tag(tag_string);
+    int tag_item = identify_tag(tag_string, strlen(tag_string));
     if (tag_item < 0) {
         tag_item = make_new_tag(tag_string);
     }
-    suppressed_tags[tag_item] = TRUE;
+    return tag_item;
+}
+
+/* Don't include the given tag on output. */
+void
+suppress_tag(const char *tag_string)
+{
+    suppressed_tags[lookup_tag(tag_string)] = TRUE;
 }
 
 /* Initialise ChTab[], the classification of the initial characters
@@ -347,6 +477,7 @@ init_lex_tables(void)
  * NB: This token is only used for tags, which are notoriously
  * error prone, so there is some code attempting recovery
  * if requested.
+ * The string is allocated from the arena, when it is in use.
  */
 LinePair
 gather_string(char *line, unsigned char *linep)
@@ -358,6 +489,11 @@ gather_string(char *line, unsigned char *linep)
     Boolean end_of_string = FALSE;
 
     do {
+        /* Skip the ordinary characters in one go. */
+        size_t span = strcspn((const char *) linep, "\"\\");
+
+        linep += span;
+        len += span;
         ch = *linep++;
         len++;
         if (ch == '\\') {
@@ -413,7 +549,7 @@ gather_string(char *line, unsigned char *linep)
 		linep = lookahead;
 	    }
 	    /* Replace any previous closing double quotes with single quotes. */
-	    str = (char *) malloc_or_die(len + 1);
+	    str = (char *) arena_malloc(len + 1);
 	    unsigned char *p = linep - len - 1;
 	    int i = 0;
 	    while(p < linep - 1) {
@@ -434,7 +570,7 @@ gather_string(char *line, unsigned char *linep)
 	else {
             /* The last one doesn't belong in the string. */
             len--;
-	    str = (char *) malloc_or_die(len + 1);
+	    str = (char *) arena_malloc(len + 1);
 	    strncpy(str, (const char *) (linep - len - 1), len);
 	    str[len] = '\0';
 	}
@@ -443,7 +579,7 @@ gather_string(char *line, unsigned char *linep)
 	/* The last one doesn't belong in the string. */
 	len--;
 	/* Allocate space for the result. */
-	str = (char *) malloc_or_die(len + 1);
+	str = (char *) arena_malloc(len + 1);
 	strncpy(str, (const char *) (linep - len - 1), len);
 	str[len] = '\0';
     }
@@ -497,6 +633,11 @@ gather_comment(char *line, unsigned char *linep)
     /* The pointer to be returned. */
     CommentList *comment;
     
+    /* The characters, apart from the end of the line, at which
+     * to stop scanning the comment.
+     */
+    const char *delimiters = GlobalState.allow_nested_comments ? "{}" : "}";
+    
     /* GlobalState.allow_nested_comments. */
     comment_depth++;
 
@@ -504,6 +645,11 @@ gather_comment(char *line, unsigned char *linep)
         /* Restart a new segment. */
         len = 0;
         do {
+            /* Skip the characters that cannot affect the nesting. */
+            size_t span = strcspn((const char *) linep, delimiters);
+
+            linep += span;
+            len += span;
             ch = *linep++;
             len++;
             if(ch == '{') {
@@ -561,15 +707,21 @@ gather_comment(char *line, unsigned char *linep)
         report_details(GlobalState.logfile);
     }
 
-    /* Set up the structure to be returned. */
-    comment = (CommentList *) malloc_or_die(sizeof (*comment));
-    comment->comment = current_comment;
-    comment->next = NULL;
-    yylval.comment = comment;
+    if (GlobalState.keep_comments) {
+        /* Set up the structure to be returned. */
+        comment = (CommentList *) arena_malloc(sizeof (*comment));
+        comment->comment = current_comment;
+        comment->next = NULL;
+        yylval.comment = comment;
+        resulting_line.token = COMMENT;
+    }
+    else {
+        /* Nothing would look at an empty comment, so drop it here. */
+        resulting_line.token = NO_TOKEN;
+    }
 
     resulting_line.line = line;
     resulting_line.linep = linep;
-    resulting_line.token = COMMENT;
     return resulting_line;
 }
 
@@ -624,7 +776,7 @@ gather_single_line_comment(char *line, unsigned char *linep)
         current_comment = save_string_list_item(current_comment, comment_str);
 
         /* Set up the comment structure to be returned. */
-        comment = (CommentList *) malloc_or_die(sizeof (*comment));
+        comment = (CommentList *) arena_malloc(sizeof (*comment));
         comment->comment = current_comment;
         comment->next = NULL;
         yylval.comment = comment;
@@ -726,27 +878,81 @@ gather_possible_numeric(char *line, unsigned char *linep, char initial_digit)
     return resulting_line;
 }
 
-/* Look up tag_string in TagList[] and return its _TAG
- * value or -1 if it isn't there.
- * Although the strings are sorted initially, further
- * tags identified in the source files will be appended
- * without further sorting. So we cannot use a binary
- * search on the list.
+/* Look up the len characters of name in TagList[] and return
+ * its _TAG value or -1 if it isn't there.
  */
 static int
-identify_tag(const char *tag_string)
+identify_tag(const char *name, size_t len)
 {
-    unsigned tag_index;
+    unsigned slot = hash_name(name, len) & (tag_table_size - 1);
 
-    for (tag_index = 0; tag_index < tag_list_length; tag_index++) {
-        if (strcmp(tag_string, TagList[tag_index]) == 0) {
-            return tag_index;
+    while (tag_table[slot] >= 0) {
+        const char *tag = TagList[tag_table[slot]];
+
+        if (strncmp(tag, name, len) == 0 && tag[len] == '\0') {
+            return tag_table[slot];
         }
+        slot = (slot + 1) & (tag_table_size - 1);
     }
     /* Not found. */
     return -1;
 }
 
+/* Return the slot of interned_values holding the len characters
+ * of value, or the free slot where they belong.
+ */
+static unsigned
+interned_slot(const char *value, size_t len)
+{
+    unsigned slot = hash_name(value, len) & (INTERNED_TABLE_SIZE - 1);
+
+    while (interned_values[slot] != NULL && strcmp(interned_values[slot], value) != 0) {
+        slot = (slot + 1) & (INTERNED_TABLE_SIZE - 1);
+    }
+    return slot;
+}
+
+/* Return the value to be stored for tag in the game header.
+ * value was gathered by the lexer. If the values of tag are
+ * interned then value is released and the shared copy returned.
+ */
+char *
+store_tag_value(TagName tag, char *value)
+{
+    if (tag < ORIGINAL_NUMBER_OF_TAGS && interned_count[tag] >= 0) {
+        size_t len = strlen(value);
+
+        if (len <= MAX_INTERNED_LENGTH) {
+            unsigned slot = interned_slot(value, len);
+
+            if (interned_values[slot] == NULL &&
+                    interned_count[tag] < MAX_INTERNED_VALUES_PER_TAG) {
+                interned_values[slot] = copy_string(value);
+                interned_count[tag]++;
+            }
+            if (interned_values[slot] != NULL) {
+                arena_free((void *) value);
+                value = interned_values[slot];
+            }
+        }
+    }
+    return value;
+}
+
+/* Release the value of a tag, unless it is interned. */
+void
+free_tag_value(char *value)
+{
+    if (value != NULL) {
+        size_t len = strlen(value);
+
+        if (len > MAX_INTERNED_LENGTH ||
+                interned_values[interned_slot(value, len)] != value) {
+            arena_free((void *) value);
+        }
+    }
+}
+
 /* Starting from linep in line, gather up the tag name.
  * Skip over any preceding white space.
  */
@@ -779,21 +985,22 @@ gather_tag(char *line, unsigned char *linep)
         /* The last one wasn't part of the tag. */
         linep--;
         if (len > 0) {
-            int tag_item;
-            char *tag_string;
+            int tag_item = identify_tag((const char *) (linep - len), len);
 
-            /* Allocate space for the result. */
-            tag_string = (char *) malloc_or_die(len + 1);
-            strncpy((char *) tag_string, (const char *) (linep - len), len);
-            tag_string[len] = '\0';
-            tag_item = identify_tag(tag_string);
             if (tag_item < 0) {
+                char *tag_string = (char *) malloc_or_die(len + 1);
+
+                strncpy(tag_string, (const char *) (linep - len), len);
+                tag_string[len] = '\0';
                 tag_item = make_new_tag(tag_string);
+                (void) free((void *) tag_string);
             }
             if (tag_item >= 0 && ((unsigned) tag_item) < tag_list_length) {
+                if (GlobalState.game_index) {
+                    index_game_tag(tag_item);
+                }
                 yylval.tag_index = tag_item;
                 resulting_line.token = TAG;
-                (void) free((void *) tag_string);
             }
             else {
                 fprintf(GlobalState.logfile,
@@ -835,6 +1042,202 @@ extract_yytext(const unsigned char *symbol_start, const unsigned char *linep)
     return Ok;
 }
 
+/* Return TRUE if a terminating result starts at linep in line. */
+static Boolean
+result_starts_at(const char *line, const unsigned char *linep)
+{
+    if (linep != (const unsigned char *) line && isalnum(linep[-1])) {
+        /* Part of another symbol. */
+        return FALSE;
+    }
+    else if (*linep == '*') {
+        return TRUE;
+    }
+    else if (*linep == '0') {
+        return strncmp((const char *) linep, "0-1", 3) == 0;
+    }
+    else if (*linep == '1') {
+        return strncmp((const char *) linep, "1-0", 3) == 0 ||
+                strncmp((const char *) linep, "1/2", 3) == 0;
+    }
+    else {
+        return FALSE;
+    }
+}
+
+/* Starting from linep in line, pass over the text of a game,
+ * without tokenising it, up to its terminating result or the
+ * next tag, whichever comes first.
+ * This only has to follow comments and variations accurately enough
+ * to find the same end of the game as the parser would.
+ */
+static LinePair
+skip_game_text(char *line, unsigned char *linep)
+{
+    LinePair resulting_line;
+    /* The depth of comment nesting. */
+    unsigned depth = 0;
+    /* The depth of variation nesting. */
+    unsigned rav_depth = 0;
+    Boolean found = FALSE;
+
+    while (!found && line != NULL) {
+        if (depth == 0 && linep == (unsigned char *) line && *linep == '%') {
+            /* An escaped line. */
+            linep += strlen(line);
+        }
+        while (!found && *linep != '\0') {
+            unsigned char ch = *linep;
+            if (depth > 0) {
+                /* Only the braces matter within a comment. */
+                linep += strcspn((const char *) linep, "{}");
+                ch = *linep;
+                if (ch == '}') {
+                    depth--;
+                }
+                else if (ch == '{' && GlobalState.allow_nested_comments) {
+                    depth++;
+                }
+                if (ch != '\0') {
+                    linep++;
+                }
+            }
+            else if (ch == '[') {
+                found = TRUE;
+            }
+            else if (ch == '{') {
+                depth = 1;
+                linep++;
+            }
+            else if (ch == ';') {
+                /* The rest of the line is a comment. */
+                linep += strlen((const char *) linep);
+            }
+            else if (ch == '(') {
+                rav_depth++;
+                linep++;
+            }
+            else if (ch == ')') {
+                if (rav_depth > 0) {
+                    rav_depth--;
+                }
+                linep++;
+            }
+            else if (rav_depth == 0 && result_starts_at(line, linep)) {
+                found = TRUE;
+            }
+            else {
+                linep++;
+            }
+        }
+        if (!found) {
+            line = next_input_line(yyin);
+            linep = (unsigned char *) line;
+        }
+    }
+    resulting_line.line = line;
+    resulting_line.linep = linep;
+    resulting_line.token = NO_TOKEN;
+    return resulting_line;
+}
+
+/* Whether the text of variations is passed over, rather than
+ * tokenised, because nothing will look at their moves.
+ * Only the opening and closing brackets are returned, so that any
+ * comments following a variation stay with it.
+ */
+Boolean
+passing_over_variations(void)
+{
+    return !GlobalState.keep_variations &&
+            GlobalState.position_index_file == NULL;
+}
+
+/* Starting from linep in line, just inside the opening bracket of a
+ * variation, pass over its text, without tokenising it, up to its
+ * closing bracket, which is left to be tokenised.
+ * The start of a tag also ends the text, as the parser would treat
+ * the variation as missing its closing bracket.
+ */
+static LinePair
+skip_variation_text(char *line, unsigned char *linep)
+{
+    LinePair resulting_line;
+    /* The depth of comment nesting. */
+    unsigned depth = 0;
+    /* The depth of nested variations. */
+    unsigned rav_depth = 0;
+    Boolean found = FALSE;
+
+    while (!found && line != NULL) {
+        if (depth == 0 && linep == (unsigned char *) line && *linep == '%') {
+            /* An escaped line. */
+            linep += strlen(line);
+        }
+        while (!found && *linep != '\0') {
+            unsigned char ch = *linep;
+            if (depth > 0) {
+                /* Only the braces matter within a comment. */
+                linep += strcspn((const char *) linep, "{}");
+                ch = *linep;
+                if (ch == '}') {
+                    depth--;
+                }
+                else if (ch == '{' && GlobalState.allow_nested_comments) {
+                    depth++;
+                }
+                if (ch != '\0') {
+                    linep++;
+                }
+            }
+            else if (ch == '[') {
+                found = TRUE;
+            }
+            else if (ch == '{') {
+                depth = 1;
+                linep++;
+            }
+            else if (ch == ';') {
+                /* The rest of the line is a comment. */
+                linep += strlen((const char *) linep);
+            }
+            else if (ch == '(') {
+                rav_depth++;
+                linep++;
+            }
+            else if (ch == ')') {
+                if (rav_depth > 0) {
+                    rav_depth--;
+                    linep++;
+                }
+                else {
+                    found = TRUE;
+                }
+            }
+            else {
+                linep++;
+            }
+        }
+        if (!found) {
+            line = next_input_line(yyin);
+            linep = (unsigned char *) line;
+        }
+    }
+    resulting_line.line = line;
+    resulting_line.linep = linep;
+    resulting_line.token = NO_TOKEN;
+    return resulting_line;
+}
+
+/* Arrange for the remaining text of the current game to be
+ * passed over, rather than tokenised, by the next call of next_token.
+ */
+void
+discard_game_text(void)
+{
+    discarding_game_text = TRUE;
+}
+
 /* Identify the next symbol.
  * Don't take any action on EOF -- leave that to next_token.
  */
@@ -847,6 +1250,18 @@ get_next_symbol(void)
     TokenType token;
     LinePair resulting_line;
 
+    if (abandoning_line) {
+        line = NULL;
+        abandoning_line = FALSE;
+    }
+    if (discarding_game_text) {
+        if (line != NULL) {
+            resulting_line = skip_game_text(line, linep);
+            line = resulting_line.line;
+            linep = resulting_line.linep;
+        }
+        discarding_game_text = FALSE;
+    }
     do {
         /* Remember where in line the current symbol starts. */
         const unsigned char *symbol_start;
@@ -912,7 +1327,7 @@ get_next_symbol(void)
                         linep++;
                     }
                     if (extract_yytext(symbol_start, linep)) {
-                        save_string((const char *) yytext);
+                        save_NAG((const char *) yytext);
                     }
                     else {
                         token = NO_TOKEN;
@@ -929,13 +1344,13 @@ get_next_symbol(void)
                             case '!':
                                 switch (yytext[1]) {
                                     case '!':
-                                        save_string("$3");
+                                        save_NAG("$3");
                                         break;
                                     case '?':
-                                        save_string("$5");
+                                        save_NAG("$5");
                                         break;
                                     default:
-                                        save_string("$1");
+                                        save_NAG("$1");
                                         break;
                                 }
                                 token = NAG;
@@ -943,13 +1358,13 @@ get_next_symbol(void)
                             case '?':
                                 switch (yytext[1]) {
                                     case '!':
-                                        save_string("$6");
+                                        save_NAG("$6");
                                         break;
                                     case '?':
-                                        save_string("$4");
+                                        save_NAG("$4");
                                         break;
                                     default:
-                                        save_string("$2");
+                                        save_NAG("$2");
                                         break;
                                 }
                                 token = NAG;
@@ -1086,6 +1501,11 @@ get_next_symbol(void)
                     break;
                 case RAV_START:
                     RAV_level++;
+                    if (passing_over_variations()) {
+                        resulting_line = skip_variation_text(line, linep);
+                        line = resulting_line.line;
+                        linep = resulting_line.linep;
+                    }
                     break;
                 case RAV_END:
                     if (RAV_level > 0) {
@@ -1170,19 +1590,24 @@ get_next_symbol(void)
             }
         }
     } while (token == NO_TOKEN);
+    last_symbol_end = linep;
     return token;
 }
 
 TokenType
 next_token(void)
 {
-    TokenType token = get_next_symbol();
+    ProfileMark mark;
+    TokenType token;
 
+    PROFILE_BEGIN(mark);
+    token = get_next_symbol();
     /* Don't call yywrap if parsing the ECO file. */
     while ((token == EOF_TOKEN) && !GlobalState.parsing_ECO_file &&
             !yywrap()) {
         token = get_next_symbol();
     }
+    PROFILE_END(PROFILE_LEX, mark);
     return token;
 }
 
@@ -1219,7 +1644,7 @@ skip_to_next_game(TokenType token)
                 if ((yylval.comment != NULL) &&
                         (yylval.comment->comment != NULL)) {
                     free_string_list(yylval.comment->comment);
-                    free((void *) yylval.comment);
+                    arena_free((void *) yylval.comment);
                     yylval.comment = NULL;
                 }
             }
@@ -1343,6 +1768,128 @@ static void unget_char(int c, FILE *fpin)
     }
 }
 
+/* Regular files are memory mapped, where supported, so that lines
+ * can be handed to the lexical analyser directly from the mapping
+ * without the character-by-character copying of read_line().
+ * The mapping is private and writable so that each line can be
+ * terminated in place by overwriting its end-of-line character.
+ * Standard input and pipes continue to use the input buffer.
+ */
+static struct {
+    /* The FILE whose contents are mapped. */
+    FILE *fp;
+    /* Start of the mapping; NULL if nothing is mapped. */
+    char *base;
+    /* Length of the mapped file. */
+    size_t length;
+    /* Offset of the start of the next line. */
+    size_t offset;
+    /* Offset at which lines stop being returned.
+     * This is the length, except when lexing one chunk of
+     * the file for --threads.
+     */
+    size_t limit;
+    /* A copy of a final line that has no terminating newline,
+     * because there is no room in the mapping to terminate it.
+     */
+    char *last_line;
+} mapped_input = { NULL, NULL, 0, 0, 0, NULL };
+
+/* Map the contents of fp, if it is a non-empty regular file.
+ * If it cannot be mapped then fp will be read via read_line().
+ */
+static void
+map_input(FILE *fp)
+{
+#if MAPPED_INPUT
+    struct stat file_details;
+    int fd = fileno(fp);
+
+    unmap_input();
+    if (fd >= 0 && fstat(fd, &file_details) == 0 &&
+            S_ISREG(file_details.st_mode) && file_details.st_size > 0) {
+        void *base = mmap(NULL, (size_t) file_details.st_size,
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            (void) posix_madvise(base, (size_t) file_details.st_size,
+                                 POSIX_MADV_SEQUENTIAL);
+            mapped_input.fp = fp;
+            mapped_input.base = (char *) base;
+            mapped_input.length = (size_t) file_details.st_size;
+            mapped_input.offset = 0;
+            mapped_input.limit = mapped_input.length;
+        }
+    }
+#else
+    unmap_input();
+#endif
+}
+
+/* Release any current mapping. */
+static void
+unmap_input(void)
+{
+#if MAPPED_INPUT
+    if (mapped_input.base != NULL) {
+        (void) munmap((void *) mapped_input.base, mapped_input.length);
+    }
+#endif
+    if (mapped_input.last_line != NULL) {
+        (void) free((void *) mapped_input.last_line);
+    }
+    mapped_input.fp = NULL;
+    mapped_input.base = NULL;
+    mapped_input.length = 0;
+    mapped_input.offset = 0;
+    mapped_input.limit = 0;
+    mapped_input.last_line = NULL;
+}
+
+/* Return the next line from the mapped input, terminated in place,
+ * or NULL at the end of the mapping.
+ * Lines are terminated in the same way as read_line(): by
+ * \n, \r or \r\n.
+ */
+static char *
+next_mapped_line(void)
+{
+    if (mapped_input.offset >= mapped_input.limit) {
+        return NULL;
+    }
+    else {
+        char *line = mapped_input.base + mapped_input.offset;
+        size_t remaining = mapped_input.limit - mapped_input.offset;
+        char *end = (char *) memchr(line, '\n', remaining);
+        /* A \r on its own also terminates a line. */
+        char *cr = (char *) memchr(line, '\r',
+                                   end != NULL ? (size_t) (end - line) : remaining);
+
+        if (cr != NULL) {
+            if (cr + 1 < mapped_input.base + mapped_input.limit && cr[1] == '\n') {
+                /* Avoid double counting lines in dos-format files. */
+                end = cr + 1;
+            }
+            else {
+                end = cr;
+            }
+            *cr = '\0';
+        }
+        else if (end != NULL) {
+            *end = '\0';
+        }
+        else {
+            /* The final line has no terminator, so it must be copied. */
+            mapped_input.last_line = (char *) malloc_or_die(remaining + 1);
+            memcpy(mapped_input.last_line, line, remaining);
+            mapped_input.last_line[remaining] = '\0';
+            mapped_input.offset = mapped_input.limit;
+            return mapped_input.last_line;
+        }
+        mapped_input.offset = (end - mapped_input.base) + 1;
+        return line;
+    }
+}
+
 /* Read a single line of input. */
 #define INIT_LINE_LENGTH 100
 #define LINE_INCREMENT 100
@@ -1497,6 +2044,10 @@ open_input(const char *infile)
 {
     yyin = fopen(infile, "rb");
     if (yyin != NULL) {
+        yyin = open_compressed_input(yyin, infile);
+    }
+    if (yyin != NULL) {
+        map_input(yyin);
         GlobalState.current_input_file = infile;
         if (GlobalState.verbosity > 1) {
             fprintf(GlobalState.logfile, "Processing %s\n",
@@ -1548,6 +2099,9 @@ open_first_file(void)
         }
     }
     else if (open_input_file(0)) {
+        if (GlobalState.game_index) {
+            open_game_index(0);
+        }
     }
     else {
         fprintf(GlobalState.logfile,
@@ -1557,6 +2111,30 @@ open_first_file(void)
     return ok;
 }
 
+/* Use fp, which is not one of the input files, as the source of
+ * input, for the library interface. name identifies it in messages.
+ */
+void
+open_input_stream(FILE *fp, const char *name)
+{
+    terminate_input();
+    yyin = fp;
+    input_buffer_index = input_buffer_limit = 0;
+    map_input(yyin);
+    GlobalState.current_input_file = name;
+    GlobalState.current_file_type = NORMALFILE;
+    restart_lex_for_new_game();
+    games_in_file = 0;
+    reset_line_number();
+}
+
+/* Close the current source of input. */
+void
+close_input(void)
+{
+    terminate_input();
+}
+
 /* Return the name of the file corresponding to the given
  * file number.
  */
@@ -1571,6 +2149,15 @@ input_file_name(unsigned file_number)
     }
 }
 
+/* Return the type of the file corresponding to the given
+ * file number, which must exist.
+ */
+SourceFileType
+input_file_type(unsigned file_number)
+{
+    return list_of_files.file_type[file_number];
+}
+
 /* Give some error information. */
 void
 print_error_context(FILE *fp)
@@ -1593,6 +2180,21 @@ save_string(const char *str)
     yylval.token_string = token;
 }
 
+/* Save the text of a NAG, unless NAGs will not be kept,
+ * in which case they are only needed to hold the comments
+ * that follow them.
+ */
+static void
+save_NAG(const char *str)
+{
+    if (GlobalState.keep_NAGs) {
+        save_string(str);
+    }
+    else {
+        yylval.token_string = NULL;
+    }
+}
+
 /* Return the next line of input from fp. */
 char *
 next_input_line(FILE *fp)
@@ -1601,6 +2203,16 @@ next_input_line(FILE *fp)
 
     if (line != NULL) {
         (void) free((void *) line);
+        line = NULL;
+    }
+
+    if (fp != NULL && fp == mapped_input.fp) {
+        /* Lines from the mapping are not separately allocated. */
+        char *mapped_line = next_mapped_line();
+        if (mapped_line != NULL) {
+            line_number++;
+        }
+        return mapped_line;
     }
 
     line = read_line(fp);
@@ -1618,7 +2230,11 @@ yywrap(void)
     int time_to_exit;
 
     /* Beware of this being called in inappropriate circumstances. */
-    if (list_of_files.files == NULL) {
+    if (lexing_chunks) {
+        /* The end of the current chunk. */
+        time_to_exit = 1;
+    }
+    else if (list_of_files.files == NULL) {
         /* There are no files. */
         time_to_exit = 1;
     }
@@ -1627,6 +2243,9 @@ yywrap(void)
         time_to_exit = 1;
     }
     else {
+        if (GlobalState.game_index) {
+            close_game_index();
+        }
         /* Close the input files.  */
         terminate_input();
         /* See if there is another. */
@@ -1652,6 +2271,9 @@ yywrap(void)
             restart_lex_for_new_game();
             games_in_file = 0;
             reset_line_number();
+            if (GlobalState.game_index) {
+                open_game_index(current_file_num);
+            }
         }
     }
     return time_to_exit;
@@ -1675,8 +2297,565 @@ static void
 terminate_input(void)
 {
     if ((yyin != stdin) && (yyin != NULL)) {
+        if (yyin == mapped_input.fp) {
+            unmap_input();
+        }
         (void) fclose(yyin);
         yyin = NULL;
     }
 }
 
+
+/* Support for --threads.
+ * Each worker process walks the whole of every input file to find
+ * the boundaries between chunks of complete games, but lexes only
+ * the chunks allocated to it.  A chunk ends just before a tag line
+ * that follows a game's result, once it has reached a minimum size.
+ * Walking the file also registers tag names in the order in which
+ * they are first met, so that unknown tags are numbered, and so
+ * output, in the same order as they would be by a single process.
+ */
+typedef enum {
+    SCAN_TEXT, SCAN_TAG, SCAN_STRING, SCAN_COMMENT
+} ChunkScanState;
+
+static struct {
+    /* Offset of the start of the next chunk. */
+    size_t offset;
+    /* The number of lines before offset. */
+    unsigned long lines;
+    /* Offset and number of lines before the most recent chunk. */
+    size_t chunk_start;
+    unsigned long chunk_lines;
+    ChunkScanState state;
+    /* Depth of comment nesting, for GlobalState.allow_nested_comments. */
+    unsigned comment_depth;
+    /* Whether the last non-blank line was a tag line. */
+    Boolean after_tags;
+    /* Whether a result has been seen since the last tag line. */
+    Boolean after_result;
+} chunk_scan;
+
+/* Register the tag name starting at text, if there is one. */
+static void
+register_scanned_tag(const char *text, size_t len)
+{
+    size_t i = 0;
+    size_t start;
+
+    while (i < len && (text[i] == ' ' || text[i] == '\t')) {
+        i++;
+    }
+    start = i;
+    while (i < len && (isalpha((unsigned char) text[i]) ||
+            isdigit((unsigned char) text[i]) || text[i] == '_')) {
+        i++;
+    }
+    if (i > start && identify_tag(&text[start], i - start) < 0) {
+        char *tag_string = (char *) malloc_or_die(i - start + 1);
+
+        strncpy(tag_string, &text[start], i - start);
+        tag_string[i - start] = '\0';
+        (void) make_new_tag(tag_string);
+        (void) free((void *) tag_string);
+    }
+}
+
+/* Track the lexical state across the given line of len characters.
+ * This need only be accurate enough to recognise tag lines that
+ * are not inside a comment.
+ */
+static void
+scan_chunk_line(const char *line, size_t len)
+{
+    Boolean blank = TRUE;
+    Boolean tag_line = FALSE;
+    size_t i;
+
+    if (chunk_scan.state == SCAN_TEXT && len > 0 && line[0] == '%') {
+        /* An escaped line. */
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        char ch = line[i];
+
+        switch (chunk_scan.state) {
+            case SCAN_TEXT:
+                if (ch == '[') {
+                    if (blank) {
+                        tag_line = TRUE;
+                        chunk_scan.after_result = FALSE;
+                    }
+                    blank = FALSE;
+                    chunk_scan.state = SCAN_TAG;
+                    register_scanned_tag(&line[i + 1], len - i - 1);
+                }
+                else if (ch == '{') {
+                    blank = FALSE;
+                    chunk_scan.state = SCAN_COMMENT;
+                    chunk_scan.comment_depth = 1;
+                }
+                else if (ch == ';') {
+                    /* The rest of the line is a comment. */
+                    blank = FALSE;
+                    i = len;
+                }
+                else if (!isspace((unsigned char) ch)) {
+                    blank = FALSE;
+                    if (ch == '*') {
+                        chunk_scan.after_result = TRUE;
+                    }
+                    else if ((ch == '1' || ch == '0') && i + 2 < len &&
+                            (strncmp(&line[i], "1-0", 3) == 0 ||
+                             strncmp(&line[i], "0-1", 3) == 0 ||
+                             strncmp(&line[i], "1/2", 3) == 0)) {
+                        chunk_scan.after_result = TRUE;
+                        if (i + 6 < len && strncmp(&line[i], "1/2-1/2", 7) == 0) {
+                            i += 6;
+                        }
+                        else {
+                            i += 2;
+                        }
+                    }
+                    else {
+                        /* Move text following a result is not the
+                         * end of a game.
+                         */
+                        chunk_scan.after_result = FALSE;
+                    }
+                }
+                break;
+            case SCAN_TAG:
+                if (ch == '"') {
+                    chunk_scan.state = SCAN_STRING;
+                }
+                else if (ch == ']') {
+                    chunk_scan.state = SCAN_TEXT;
+                }
+                break;
+            case SCAN_STRING:
+                if (ch == '\\' && i + 1 < len) {
+                    i++;
+                }
+                else if (ch == '"') {
+                    chunk_scan.state = SCAN_TAG;
+                }
+                break;
+            case SCAN_COMMENT:
+                blank = FALSE;
+                if (ch == '}') {
+                    chunk_scan.comment_depth--;
+                    if (chunk_scan.comment_depth == 0) {
+                        chunk_scan.state = SCAN_TEXT;
+                    }
+                }
+                else if (ch == '{' && GlobalState.allow_nested_comments) {
+                    chunk_scan.comment_depth++;
+                }
+                break;
+        }
+    }
+    if (chunk_scan.state == SCAN_TAG || chunk_scan.state == SCAN_STRING) {
+        /* Tags do not extend over lines. */
+        chunk_scan.state = SCAN_TEXT;
+    }
+    if (!blank) {
+        chunk_scan.after_tags = tag_line;
+    }
+}
+
+/* Open the given input file to be read in chunks by next_input_chunk.
+ * Return FALSE if it cannot be opened and mapped.
+ */
+Boolean
+open_chunked_input(unsigned file_number)
+{
+    terminate_input();
+    lexing_chunks = TRUE;
+    current_file_num = file_number;
+    chunk_scan.offset = 0;
+    chunk_scan.lines = 0;
+    chunk_scan.chunk_start = 0;
+    chunk_scan.chunk_lines = 0;
+    chunk_scan.state = SCAN_TEXT;
+    chunk_scan.comment_depth = 0;
+    chunk_scan.after_tags = FALSE;
+    chunk_scan.after_result = FALSE;
+    if (!open_input_file(file_number)) {
+        return FALSE;
+    }
+    else if (mapped_input.fp == yyin) {
+        /* Nothing is lexed until a chunk is selected. */
+        mapped_input.limit = 0;
+        return TRUE;
+    }
+    else {
+        /* Only an empty file is not mapped. */
+        return getc(yyin) == EOF;
+    }
+}
+
+/* Find the next chunk of at least min_size characters in the input
+ * opened by open_chunked_input.
+ * If lex_it then the lexical analyser will read just the lines of
+ * that chunk, otherwise it is skipped.
+ * Return FALSE when the input is exhausted.
+ */
+Boolean
+next_input_chunk(size_t min_size, Boolean lex_it)
+{
+    const char *base = mapped_input.base;
+    const size_t length = mapped_input.length;
+    const size_t start = chunk_scan.offset;
+    const unsigned long first_line = chunk_scan.lines;
+    size_t pos = start;
+
+    if (yyin == NULL || mapped_input.fp != yyin || start >= length) {
+        return FALSE;
+    }
+    while (pos < length) {
+        const char *nl = (const char *) memchr(&base[pos], '\n', length - pos);
+        const char *cr = (const char *) memchr(&base[pos], '\r',
+                (nl != NULL ? (size_t) (nl - &base[pos]) : length - pos));
+        size_t end_of_line, next_line;
+
+        /* Lines are terminated as in next_mapped_line. */
+        if (cr != NULL) {
+            end_of_line = cr - base;
+            if (end_of_line + 1 < length && base[end_of_line + 1] == '\n') {
+                next_line = end_of_line + 2;
+            }
+            else {
+                next_line = end_of_line + 1;
+            }
+        }
+        else if (nl != NULL) {
+            end_of_line = nl - base;
+            next_line = end_of_line + 1;
+        }
+        else {
+            end_of_line = next_line = length;
+        }
+        if (pos - start >= min_size && chunk_scan.state == SCAN_TEXT &&
+                base[pos] == '[' && !chunk_scan.after_tags &&
+                chunk_scan.after_result) {
+            /* The start of the next game. */
+            break;
+        }
+        scan_chunk_line(&base[pos], end_of_line - pos);
+        chunk_scan.lines++;
+        pos = next_line;
+    }
+    chunk_scan.offset = pos;
+    chunk_scan.chunk_start = start;
+    chunk_scan.chunk_lines = first_line;
+    if (lex_it) {
+        (void) select_input_chunk(start, pos, first_line);
+    }
+    return TRUE;
+}
+
+/* Whether the line starting at offset line_start of the
+ * mapped input is empty.
+ */
+static Boolean
+empty_line_at(const char *base, size_t length, size_t line_start)
+{
+    return line_start < length &&
+        (base[line_start] == '\n' || base[line_start] == '\r');
+}
+
+/* Return the offset of the start of the line before the one
+ * starting at line_start, which must not be 0.
+ */
+static size_t
+previous_line_start(const char *base, size_t line_start)
+{
+    size_t pos = line_start - 1;
+    if (pos > 0 && base[pos] == '\n' && base[pos - 1] == '\r') {
+        pos--;
+    }
+    while (pos > 0 && base[pos - 1] != '\n' && base[pos - 1] != '\r') {
+        pos--;
+    }
+    return pos;
+}
+
+/* Find the first likely start of a game at or after from:
+ * the start of a line beginning with '[' that follows an
+ * empty line, which does not itself follow a tag line.
+ * Return length if there is none.
+ */
+static size_t
+find_offset_game_start(const char *base, size_t length, size_t from)
+{
+    size_t pos = from;
+    while (pos < length) {
+        const char *bracket = (const char *) memchr(&base[pos], '[', length - pos);
+        if (bracket == NULL) {
+            return length;
+        }
+        pos = bracket - base;
+        if (pos >= 2 && (base[pos - 1] == '\n' || base[pos - 1] == '\r')) {
+            size_t blank = previous_line_start(base, pos);
+            if (blank > 0 && empty_line_at(base, length, blank)) {
+                size_t before = previous_line_start(base, blank);
+                if (base[before] != '[') {
+                    return pos;
+                }
+            }
+        }
+        pos++;
+    }
+    return length;
+}
+
+/* Count the lines that end between start and end, terminated
+ * as in next_mapped_line.
+ */
+static unsigned long
+count_lines(const char *base, size_t start, size_t end)
+{
+    unsigned long lines = 0;
+    const char *p = &base[start];
+    const char *limit = &base[end];
+    while ((p = (const char *) memchr(p, '\n', limit - p)) != NULL) {
+        lines++;
+        p++;
+    }
+    /* A carriage return on its own also ends a line. */
+    p = &base[start];
+    while ((p = (const char *) memchr(p, '\r', limit - p)) != NULL) {
+        if (p + 1 == limit || p[1] != '\n') {
+            lines++;
+        }
+        p++;
+    }
+    return lines;
+}
+
+/* Register the tags of the lines between start and end that
+ * appear to be tag lines, without lexing them.
+ */
+static void
+register_chunk_tags(const char *base, size_t start, size_t end)
+{
+    size_t pos = start;
+    while (pos < end) {
+        const char *bracket = (const char *) memchr(&base[pos], '[', end - pos);
+        if (bracket == NULL) {
+            pos = end;
+        }
+        else {
+            size_t line_start = bracket - base;
+            while (line_start > start &&
+                    (base[line_start - 1] == ' ' || base[line_start - 1] == '\t')) {
+                line_start--;
+            }
+            pos = (bracket - base) + 1;
+            if (line_start == 0 || base[line_start - 1] == '\n' ||
+                    base[line_start - 1] == '\r') {
+                const char *eol = &base[pos];
+                while (eol < &base[end] && *eol != '\n' && *eol != '\r') {
+                    eol++;
+                }
+                register_scanned_tag(&base[pos], eol - &base[pos]);
+                pos = eol - base;
+            }
+        }
+    }
+}
+
+/* An alternative to next_input_chunk for very large files that
+ * does not track the lexical state of the whole input: the
+ * next chunk ends at the first likely start of a game that is at
+ * least min_size characters from its start, so that a chunk that is
+ * not lexed costs little more than counting its lines.
+ * This relies on the input not having empty lines before lines
+ * that start with '[' other than between games.
+ * Tags in chunks that are skipped are registered so that unknown
+ * tags are numbered in the order in which they are first met.
+ * Return FALSE when the input is exhausted.
+ */
+Boolean
+next_offset_chunk(size_t min_size, Boolean lex_it)
+{
+    const char *base = mapped_input.base;
+    const size_t length = mapped_input.length;
+    const size_t start = chunk_scan.offset;
+    const unsigned long first_line = chunk_scan.lines;
+    size_t end;
+    /* Whether the end was found from the game index. */
+    Boolean indexed = FALSE;
+    unsigned long end_lines = 0;
+
+    if (yyin == NULL || mapped_input.fp != yyin || start >= length) {
+        return FALSE;
+    }
+    if (min_size >= length - start) {
+        end = length;
+    }
+    else if (indexed_game_start(current_file_num, start + min_size, &end, &end_lines) &&
+            end <= length) {
+        /* The chunk ends exactly at the end of a game. */
+        indexed = TRUE;
+    }
+    else {
+        end = find_offset_game_start(base, length, start + min_size);
+    }
+    if (lex_it) {
+        (void) select_input_chunk(start, end, first_line);
+    }
+    else {
+        register_chunk_tags(base, start, end);
+    }
+    chunk_scan.offset = end;
+    chunk_scan.lines = indexed ? end_lines : first_line + count_lines(base, start, end);
+    chunk_scan.chunk_start = start;
+    chunk_scan.chunk_lines = first_line;
+    return TRUE;
+}
+
+/* Set start and end to the offsets of the chunk most recently
+ * found by next_input_chunk, and first_line to the number of
+ * lines before it.
+ */
+void
+last_input_chunk(size_t *start, size_t *end, unsigned long *first_line)
+{
+    *start = chunk_scan.chunk_start;
+    *end = chunk_scan.offset;
+    *first_line = chunk_scan.chunk_lines;
+}
+
+/* Arrange for the lexical analyser to read just the characters
+ * from start to end of the input opened by open_chunked_input,
+ * where first_line is the number of lines before start.
+ * Return FALSE if the input does not extend that far.
+ */
+Boolean
+select_input_chunk(size_t start, size_t end, unsigned long first_line)
+{
+    if (yyin == NULL || mapped_input.fp != yyin ||
+            start > end || end > mapped_input.length) {
+        return FALSE;
+    }
+    mapped_input.offset = start;
+    mapped_input.limit = end;
+    line_number = first_line;
+    restart_lex_for_new_game();
+    return TRUE;
+}
+
+/* Find where the symbol last returned by the lexical analyser
+ * ends, for --checkpoint: the number of the current input file,
+ * the offset in it from which lexing would carry on and the number
+ * of lines before that offset.
+ * Return FALSE if this is not known because the file is not mapped.
+ */
+Boolean
+input_resume_point(unsigned *file_number, size_t *offset, unsigned long *lines)
+{
+    const char *end = (const char *) last_symbol_end;
+
+    if (yyin == NULL || mapped_input.fp != yyin || lexing_chunks ||
+            end == NULL) {
+        return FALSE;
+    }
+    else if (*end == '\0') {
+        /* The rest of the line has been used, so carry on with the next. */
+        if (mapped_input.offset >= mapped_input.length) {
+            return FALSE;
+        }
+        *offset = mapped_input.offset;
+        *lines = line_number;
+    }
+    else if (end >= mapped_input.base &&
+            end < mapped_input.base + mapped_input.length) {
+        /* Carry on within the line, which will be counted again. */
+        *offset = end - mapped_input.base;
+        *lines = line_number - 1;
+    }
+    else {
+        return FALSE;
+    }
+    *file_number = current_file_num;
+    return TRUE;
+}
+
+/* Find where the symbol last returned by the lexical analyser ends,
+ * for --gameindex, if nothing but white space follows it on its line:
+ * the offset of the start of the next line, or of the end of the file,
+ * and the number of lines before that offset.
+ * Return FALSE if it is followed by more or the file is not mapped.
+ */
+Boolean
+input_line_position(size_t *offset, unsigned long *lines)
+{
+    const unsigned char *end = last_symbol_end;
+
+    if (yyin == NULL || mapped_input.fp != yyin || lexing_chunks ||
+            end == NULL) {
+        return FALSE;
+    }
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (*end != '\0') {
+        return FALSE;
+    }
+    *offset = mapped_input.offset;
+    *lines = line_number;
+    return TRUE;
+}
+
+/* Carry on lexing the current input file from offset, which must be
+ * the start of a line that has not yet been read, where lines is the
+ * number of lines before it, for --gameindex.
+ * Return FALSE if that is not possible.
+ */
+Boolean
+seek_input(size_t offset, unsigned long lines)
+{
+    if (yyin == NULL || mapped_input.fp != yyin || lexing_chunks ||
+            offset < mapped_input.offset || offset > mapped_input.limit) {
+        return FALSE;
+    }
+    mapped_input.offset = offset;
+    line_number = lines;
+    abandoning_line = TRUE;
+    restart_lex_for_new_game();
+    return TRUE;
+}
+
+/* Open input file file_number and arrange for the lexical analyser
+ * to start reading it at offset, where lines is the number of lines
+ * before offset, for --resume.
+ * Return FALSE if it cannot be opened and mapped, or is too short.
+ */
+Boolean
+resume_input(unsigned file_number, size_t offset, unsigned long lines)
+{
+    terminate_input();
+    if (input_file_name(file_number) == NULL ||
+            !open_input_file(file_number) ||
+            mapped_input.fp != yyin || offset >= mapped_input.length) {
+        return FALSE;
+    }
+    current_file_num = file_number;
+    mapped_input.offset = offset;
+    line_number = lines;
+    restart_lex_for_new_game();
+    return TRUE;
+}
+
+/* Make file_number the current input file for the purposes of
+ * duplicate detection and reporting, without opening it.
+ */
+void
+select_input_file(unsigned file_number)
+{
+    current_file_num = file_number;
+    GlobalState.current_input_file = list_of_files.files[file_number];
+    GlobalState.current_file_type = list_of_files.file_type[file_number];
+}
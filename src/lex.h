@@ -71,24 +71,43 @@ typedef struct {
 void add_filename_to_source_list(const char *filename,SourceFileType file_type);
 void add_filename_list_from_file(FILE *fp,SourceFileType file_type);
 unsigned current_file_number(void);
+void discard_game_text(void);
 void free_move_list(Move *move_list);
+void free_tag_value(char *value);
 LinePair gather_tag(char *line, unsigned char *linep);
 LinePair gather_string(char *line, unsigned char *linep);
+Boolean next_input_chunk(size_t min_size, Boolean lex_it);
+Boolean next_offset_chunk(size_t min_size, Boolean lex_it);
+void close_input(void);
 void init_lex_tables(void);
+Boolean input_line_position(size_t *offset, unsigned long *lines);
+Boolean input_resume_point(unsigned *file_number, size_t *offset, unsigned long *lines);
+void last_input_chunk(size_t *start, size_t *end, unsigned long *first_line);
 const char *input_file_name(unsigned file_number);
+SourceFileType input_file_type(unsigned file_number);
 unsigned long get_line_number(void);
 Boolean is_character_class(unsigned char ch, TokenType character_class);
 Boolean is_suppressed_tag(TagName tag);
+TagName lookup_tag(const char *tag_string);
 char *next_input_line(FILE *fp);
 TokenType next_token(void);
+unsigned number_of_tags(void);
+Boolean open_chunked_input(unsigned file_number);
 Boolean open_eco_file(const char *eco_file);
 Boolean open_first_file(void);
+void open_input_stream(FILE *fp, const char *name);
+Boolean passing_over_variations(void);
 void print_error_context(FILE *fp);
 char *read_line(FILE *fpin);
 void reset_line_number(void);
 void restart_lex_for_new_game(void);
+Boolean resume_input(unsigned file_number, size_t offset, unsigned long lines);
 void save_assessment(const char *assess);
+Boolean select_input_chunk(size_t start, size_t end, unsigned long first_line);
+Boolean seek_input(size_t offset, unsigned long lines);
+void select_input_file(unsigned file_number);
 TokenType skip_to_next_game(TokenType token);
+char *store_tag_value(TagName tag, char *value);
 void suppress_tag(const char *tag_string);
 const char *tag_header_string(TagName tag);
 void yyerror(const char *s);
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <regex.h>
 #include "bool.h"
 #include "mymalloc.h"
@@ -61,6 +62,11 @@ typedef struct {
      * list[num_used_elements] == (char **) NULL once the list is complete.
      */
     TagSelection *tag_strings;
+    /* The compiled form of the list used by check_list.
+     * This is built when the list is first used for matching
+     * and discarded if the list is subsequently extended.
+     */
+    struct tag_matcher *matcher;
 } StringArray;
 
 /* Functions to allow creation of string lists. */
@@ -75,7 +81,8 @@ static StringArray *TagLists;
 static int tag_list_length = 0;
 
 static char *soundex(const char *str);
-static Boolean check_list(int tag, const char *tag_string, const StringArray *list);
+static void free_tag_matcher(struct tag_matcher *matcher);
+static Boolean check_list(int tag, const char *tag_string, StringArray *list);
 static Boolean check_time_period(const char *tag_string, unsigned period, const StringArray *list);
 
 void init_tag_lists(void)
@@ -87,6 +94,7 @@ void init_tag_lists(void)
         TagLists[i].num_allocated_elements = 0;
         TagLists[i].num_used_elements = 0;
         TagLists[i].tag_strings = (TagSelection *) NULL;
+        TagLists[i].matcher = NULL;
     }
 }
 
@@ -112,6 +120,7 @@ extend_tag_list_length(int new_length)
             TagLists[i].num_allocated_elements = 0;
             TagLists[i].num_used_elements = 0;
             TagLists[i].tag_strings = (TagSelection *) NULL;
+            TagLists[i].matcher = NULL;
         }
         tag_list_length = new_length;
     }
@@ -127,6 +136,11 @@ add_to_taglist(const char *str, StringArray *list)
 {
     Boolean everything_ok = TRUE;
 
+    if (list->matcher != NULL) {
+        /* The compiled form will no longer be complete. */
+        free_tag_matcher(list->matcher);
+        list->matcher = NULL;
+    }
     if (list->num_allocated_elements == list->num_used_elements) {
         /* We need more space. */
         if (list->num_allocated_elements == 0) {
@@ -612,6 +626,288 @@ check_elo(const char *elo_string, StringArray *list)
     return wanted;
 }
 
+/* The compiled form of a StringArray used by check_list.
+ * Matching by check_list looks for any list string that is
+ * either a prefix of the tag value or, with tag_match_anywhere,
+ * a substring of it. The list strings are held in a trie
+ * so that a prefix match follows a single path from the root,
+ * and with tag_match_anywhere the trie is extended with failure
+ * links (Aho-Corasick) so that the tag value is scanned just once.
+ * Either way, the cost depends on the length of the tag value
+ * rather than on the number of strings in the list.
+ * Since soundexed lists store the soundex codes, the same
+ * structure serves for soundex matching.
+ */
+typedef struct {
+    /* The character labelling the edge into this node. */
+    unsigned char ch;
+    /* Whether a list string ends at this node. */
+    Boolean ends_string;
+    /* Whether a list string is a suffix of the path to this node.
+     * Only set when failure links are built.
+     */
+    Boolean ends_suffix;
+    /* Indices of the first child and next sibling; 0 for none,
+     * as the root (node 0) is never a child.
+     */
+    unsigned first_child, next_sibling;
+    /* The failure link for tag_match_anywhere. */
+    unsigned fail;
+} TrieNode;
+
+/* A selection with a relational or REGEX operator.
+ * These are kept apart from the strings in the trie as
+ * they require the tag value to be examined against each
+ * of them in turn.
+ */
+typedef struct {
+    const TagSelection *selection;
+    /* Whether list_value holds the numeric value of the selection. */
+    Boolean has_value;
+    double list_value;
+    /* Whether regex holds the compiled REGEX selection. */
+    Boolean has_regex;
+    regex_t regex;
+} OperatorSelection;
+
+typedef struct tag_matcher {
+    TrieNode *nodes;
+    unsigned num_nodes, num_allocated_nodes;
+    /* The children of the root, indexed directly. */
+    unsigned root_children[1 << CHAR_BIT];
+    /* Whether the failure links have been built. */
+    Boolean anywhere;
+    OperatorSelection *operator_selections;
+    unsigned num_operator_selections;
+    /* Whether any of operator_selections is a REGEX. */
+    Boolean has_regex;
+} TagMatcher;
+
+/* Return the child of node along ch, or 0 if there is none. */
+static unsigned
+trie_child(const TagMatcher *matcher, unsigned node, unsigned char ch)
+{
+    if (node == 0) {
+        return matcher->root_children[ch];
+    }
+    else {
+        unsigned child;
+        for (child = matcher->nodes[node].first_child; child != 0;
+                child = matcher->nodes[child].next_sibling) {
+            if (matcher->nodes[child].ch == ch) {
+                return child;
+            }
+        }
+        return 0;
+    }
+}
+
+/* Add a new child of node along ch and return its index. */
+static unsigned
+new_trie_child(TagMatcher *matcher, unsigned node, unsigned char ch)
+{
+    unsigned child;
+    TrieNode *new_node;
+
+    if (matcher->num_nodes == matcher->num_allocated_nodes) {
+        matcher->num_allocated_nodes *= 2;
+        matcher->nodes = (TrieNode *) realloc_or_die((void *) matcher->nodes,
+                matcher->num_allocated_nodes * sizeof (*matcher->nodes));
+    }
+    child = matcher->num_nodes++;
+    new_node = &matcher->nodes[child];
+    new_node->ch = ch;
+    new_node->ends_string = FALSE;
+    new_node->ends_suffix = FALSE;
+    new_node->first_child = 0;
+    new_node->fail = 0;
+    /* Keep the root's children on its sibling list, too,
+     * for the breadth-first construction of the failure links.
+     */
+    new_node->next_sibling = matcher->nodes[node].first_child;
+    matcher->nodes[node].first_child = child;
+    if (node == 0) {
+        matcher->root_children[ch] = child;
+    }
+    return child;
+}
+
+static void
+add_trie_string(TagMatcher *matcher, const char *str)
+{
+    unsigned node = 0;
+
+    for (; *str != '\0'; str++) {
+        unsigned char ch = (unsigned char) *str;
+        unsigned child = trie_child(matcher, node, ch);
+        if (child == 0) {
+            child = new_trie_child(matcher, node, ch);
+        }
+        node = child;
+    }
+    matcher->nodes[node].ends_string = TRUE;
+}
+
+/* Build the failure links for matching anywhere in a tag,
+ * visiting the nodes in breadth-first order.
+ */
+static void
+build_failure_links(TagMatcher *matcher)
+{
+    unsigned *queue = (unsigned *) malloc_or_die(matcher->num_nodes * sizeof (*queue));
+    unsigned head = 0, tail = 0;
+    unsigned child;
+
+    matcher->nodes[0].ends_suffix = matcher->nodes[0].ends_string;
+    for (child = matcher->nodes[0].first_child; child != 0;
+            child = matcher->nodes[child].next_sibling) {
+        matcher->nodes[child].fail = 0;
+        matcher->nodes[child].ends_suffix = matcher->nodes[child].ends_string ||
+                matcher->nodes[0].ends_suffix;
+        queue[tail++] = child;
+    }
+    while (head < tail) {
+        unsigned node = queue[head++];
+        for (child = matcher->nodes[node].first_child; child != 0;
+                child = matcher->nodes[child].next_sibling) {
+            unsigned char ch = matcher->nodes[child].ch;
+            unsigned fail = matcher->nodes[node].fail;
+            unsigned target;
+
+            while (fail != 0 && trie_child(matcher, fail, ch) == 0) {
+                fail = matcher->nodes[fail].fail;
+            }
+            target = trie_child(matcher, fail, ch);
+            matcher->nodes[child].fail = target;
+            matcher->nodes[child].ends_suffix = matcher->nodes[child].ends_string ||
+                    matcher->nodes[target].ends_suffix;
+            queue[tail++] = child;
+        }
+    }
+    (void) free((void *) queue);
+    matcher->anywhere = TRUE;
+}
+
+static TagMatcher *
+compile_tag_list(const StringArray *list)
+{
+    TagMatcher *matcher = (TagMatcher *) malloc_or_die(sizeof (*matcher));
+    unsigned list_index;
+    unsigned num_operators = 0;
+    int ch;
+
+    matcher->num_allocated_nodes = 64;
+    matcher->nodes = (TrieNode *) malloc_or_die(matcher->num_allocated_nodes *
+            sizeof (*matcher->nodes));
+    matcher->num_nodes = 1;
+    matcher->nodes[0].ch = '\0';
+    matcher->nodes[0].ends_string = FALSE;
+    matcher->nodes[0].ends_suffix = FALSE;
+    matcher->nodes[0].first_child = 0;
+    matcher->nodes[0].next_sibling = 0;
+    matcher->nodes[0].fail = 0;
+    for (ch = 0; ch < (1 << CHAR_BIT); ch++) {
+        matcher->root_children[ch] = 0;
+    }
+    matcher->anywhere = FALSE;
+    matcher->has_regex = FALSE;
+
+    for (list_index = 0; list_index < list->num_used_elements; list_index++) {
+        const TagSelection *selection = &list->tag_strings[list_index];
+        /* Selections with an operator are also candidates for a
+         * straight string match.
+         */
+        add_trie_string(matcher, selection->tag_string);
+        if (selection->operator != NONE) {
+            num_operators++;
+        }
+    }
+    if (GlobalState.tag_match_anywhere) {
+        build_failure_links(matcher);
+    }
+
+    matcher->num_operator_selections = 0;
+    matcher->operator_selections = num_operators == 0 ? (OperatorSelection *) NULL :
+            (OperatorSelection *) malloc_or_die(num_operators *
+                sizeof (*matcher->operator_selections));
+    for (list_index = 0; list_index < list->num_used_elements; list_index++) {
+        const TagSelection *selection = &list->tag_strings[list_index];
+        if (selection->operator != NONE) {
+            OperatorSelection *op =
+                    &matcher->operator_selections[matcher->num_operator_selections++];
+            op->selection = selection;
+            op->has_value = sscanf(selection->tag_string, "%lf", &op->list_value) == 1;
+            op->has_regex = FALSE;
+            if (selection->operator == REGEX) {
+                matcher->has_regex = TRUE;
+                op->has_regex = regcomp(&op->regex, selection->tag_string, 0) == 0;
+            }
+        }
+    }
+    return matcher;
+}
+
+static void
+free_tag_matcher(TagMatcher *matcher)
+{
+    unsigned i;
+
+    for (i = 0; i < matcher->num_operator_selections; i++) {
+        if (matcher->operator_selections[i].has_regex) {
+            regfree(&matcher->operator_selections[i].regex);
+        }
+    }
+    if (matcher->operator_selections != NULL) {
+        (void) free((void *) matcher->operator_selections);
+    }
+    (void) free((void *) matcher->nodes);
+    (void) free((void *) matcher);
+}
+
+/* Return TRUE if any of the strings in the matcher is a prefix of str. */
+static Boolean
+trie_prefix_match(const TagMatcher *matcher, const char *str)
+{
+    unsigned node = 0;
+
+    if (matcher->nodes[0].ends_string) {
+        return TRUE;
+    }
+    for (; *str != '\0'; str++) {
+        node = trie_child(matcher, node, (unsigned char) *str);
+        if (node == 0) {
+            return FALSE;
+        }
+        else if (matcher->nodes[node].ends_string) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Return TRUE if any of the strings in the matcher occurs in str. */
+static Boolean
+trie_substring_match(const TagMatcher *matcher, const char *str)
+{
+    unsigned node = 0;
+
+    if (matcher->nodes[0].ends_suffix) {
+        return TRUE;
+    }
+    for (; *str != '\0'; str++) {
+        unsigned char ch = (unsigned char) *str;
+        unsigned child;
+        while ((child = trie_child(matcher, node, ch)) == 0 && node != 0) {
+            node = matcher->nodes[node].fail;
+        }
+        node = child;
+        if (matcher->nodes[node].ends_suffix) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 /* Check for matches of tag_string in list->strings.
  * Return TRUE on match, FALSE on failure.
  * For non-numeric tags, ANY match is considered.
@@ -620,27 +916,41 @@ check_elo(const char *elo_string, StringArray *list)
  * For numeric tags with relational operators, ALL operators must match.
  */
 static Boolean
-check_list(int tag, const char *tag_string, const StringArray *list)
+check_list(int tag, const char *tag_string, StringArray *list)
 {
-    unsigned list_index;
-    Boolean wanted = FALSE;
+    Boolean wanted;
     const char *search_str;
     Boolean tag_string_is_numeric;
-    /* Whether to consider possible numeric range comparison
-     * in the case of numeric tag values, if there is no
-     * other match.
-     */
-    Boolean possible_range_check = FALSE;
-    /* Where there is a possible regex check. */
-    Boolean possible_regex_check = FALSE;
+    const TagMatcher *matcher;
     const char *t;
 
+    if (list->matcher == NULL) {
+        list->matcher = compile_tag_list(list);
+    }
+    else if (GlobalState.tag_match_anywhere && !list->matcher->anywhere) {
+        build_failure_links(list->matcher);
+    }
+    matcher = list->matcher;
+
     if (GlobalState.use_soundex && soundex_tag(tag)) {
         search_str = soundex(tag_string);
     }
     else {
         search_str = tag_string;
     }
+
+    if (GlobalState.tag_match_anywhere) {
+        /* Match anywhere in the tag. */
+        wanted = trie_substring_match(matcher, search_str);
+    }
+    else {
+        /* Match only at the beginning of the tag. */
+        wanted = trie_prefix_match(matcher, search_str);
+    }
+    if (wanted || matcher->num_operator_selections == 0) {
+        return wanted;
+    }
+
     /* Determine whether the search string is numeric or not.
      * If it is numeric then it could be used in a
      * relational match.
@@ -655,85 +965,44 @@ check_list(int tag, const char *tag_string, const StringArray *list)
     }
     tag_string_is_numeric = *t == '\0';
 
-    for (list_index = 0; (list_index < list->num_used_elements) && !wanted;
-            list_index++) {
-        const TagSelection *selection = &list->tag_strings[list_index];
-        const char *list_string = selection->tag_string;
+    if(tag_string_is_numeric) {
+        /* Check the relational operators.
+         * This requires ALL to match rather than ANY.
+         */
+        double tag_value;
+        Boolean have_tag_value = sscanf(search_str, "%lf", &tag_value) == 1;
+        unsigned i;
 
-        if (GlobalState.tag_match_anywhere) {
-            /* Match anywhere in the tag. */
-            if (strstr(search_str, list_string) != NULL) {
-                wanted = TRUE;
-            }
-        }
-        else {
-            /* Match only at the beginning of the tag. */
-            if (strncmp(search_str, list_string, strlen(list_string)) == 0) {
-                wanted = TRUE;
-            }
-        }
-        if(!wanted && selection->operator != NONE) {
-            if(tag_string_is_numeric) {
-                /* Defer to a later check. */
-                possible_range_check = TRUE;
-            }
-            if(selection->operator == REGEX) {
-                /* Defer to a later check. */
-                possible_regex_check = TRUE;
+        wanted = TRUE;
+        for (i = 0; (i < matcher->num_operator_selections) && wanted; i++) {
+            const OperatorSelection *op = &matcher->operator_selections[i];
+            switch(op->selection->operator) {
+                case EQUAL_TO:
+                case NOT_EQUAL_TO:
+                case LESS_THAN:
+                case GREATER_THAN:
+                case LESS_THAN_OR_EQUAL_TO:
+                case GREATER_THAN_OR_EQUAL_TO:
+                    if(have_tag_value && op->has_value) {
+                        wanted = relative_numeric_match(op->selection->operator,
+                                                        tag_value, op->list_value);
+                    }
+                    break;
+                case NONE:
+                    break;
+                default:
+                    fprintf(GlobalState.logfile, "Internal error: missing case in call to check_list.\n");
+                    break;
             }
         }
     }
-    if(! wanted) {
-        if(possible_range_check) {
-            /* Check the relational operators.
-             * This requires ALL to match rather than ANY.
-             * There will be at least one comparison, so this
-             * initial value of wanted will be discarded before
-             * the end of the method.
-             */
-            wanted = TRUE;
-            for (list_index = 0; (list_index < list->num_used_elements) && wanted;
-                    list_index++) {
-                const TagSelection *selection = &list->tag_strings[list_index];
-                switch(selection->operator) {
-                    case EQUAL_TO:
-                    case NOT_EQUAL_TO:
-                    case LESS_THAN:
-                    case GREATER_THAN:
-                    case LESS_THAN_OR_EQUAL_TO:
-                    case GREATER_THAN_OR_EQUAL_TO:
-                        {
-                            const char *list_string = selection->tag_string;
-                            double tag_value, list_value;
-                            if(sscanf(search_str, "%lf", &tag_value) == 1 &&
-                                    sscanf(list_string, "%lf", &list_value) == 1) {
-                                wanted = relative_numeric_match(selection->operator,
-                                                                tag_value, list_value);
-                            }
-                        }
-                        break;
-                    case NONE:
-                        break;
-                    default:
-                        fprintf(GlobalState.logfile, "Internal error: missing case in call to check_list.\n");
-                        break;
-                }
-            }
-        }
-        if(! wanted && possible_regex_check) {
-            for (list_index = 0; (list_index < list->num_used_elements) && ! wanted;
-                    list_index++) {
-                const TagSelection *selection = &list->tag_strings[list_index];
-                if(selection->operator == REGEX) {
-                    const char *list_string = selection->tag_string;
-                    regex_t regex;
-
-                    if(regcomp(&regex, list_string, 0)  == 0) {
-                        if(regexec(&regex, search_str, 0, NULL, 0) == 0) {
-                            wanted = TRUE;
-                        }
-                    }
-                    regfree(&regex);
+    if(! wanted && matcher->has_regex) {
+        unsigned i;
+        for (i = 0; (i < matcher->num_operator_selections) && ! wanted; i++) {
+            const OperatorSelection *op = &matcher->operator_selections[i];
+            if(op->has_regex) {
+                if(regexec(&op->regex, search_str, 0, NULL, 0) == 0) {
+                    wanted = TRUE;
                 }
             }
         }
@@ -851,6 +1120,14 @@ check_tag_details_not_ECO(char *Details[], int num_details)
     return wanted;
 }
 
+/* Return TRUE if there are selection criteria for the given tag. */
+Boolean
+is_checked_tag(int tag)
+{
+    return GlobalState.check_tags && tag < tag_list_length &&
+            TagLists[tag].num_used_elements != 0;
+}
+
 /* Check just the ECO tag from the game's tag details. */
 Boolean
 check_ECO_tag(char *Details[])
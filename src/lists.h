@@ -48,6 +48,7 @@ Boolean check_tag_details_not_ECO(char *Details[],int num_details);
 Boolean check_ECO_tag(char *Details[]);
 void init_tag_lists(void);
 Boolean check_setup_tag(char *Details[]);
+Boolean is_checked_tag(int tag);
 
 #endif	// LISTS_H
 
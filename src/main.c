@@ -19,6 +19,10 @@
  *  https://www.cs.kent.ac.uk/people/staff/djb/
  */
 
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +34,7 @@
 #include "tokens.h"
 #include "taglist.h"
 #include "lex.h"
+#include "eco.h"
 #include "moves.h"
 #include "map.h"
 #include "lists.h"
@@ -38,6 +43,22 @@
 #include "grammar.h"
 #include "hashing.h"
 #include "argsfile.h"
+#include "parallel.h"
+#include "posindex.h"
+#include "profile.h"
+#include "binary.h"
+#include "batch.h"
+#include "checkpoint.h"
+#include "dupshard.h"
+#include "asyncout.h"
+#include "engine.h"
+#include "statistics.h"
+#include "main.h"
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#include <unistd.h>
+#define BUFFER_REDIRECTED_STDOUT 1
+#endif
 
 /* The maximum length of an output line.  This is conservatively
  * slightly smaller than the PGN export standard of 80.
@@ -51,6 +72,12 @@
 #define DEFAULT_ECO_FILE "eco.pgn"
 #endif
 
+/* How many games are processed between checkpoints by default. */
+#define DEFAULT_CHECKPOINT_INTERVAL 10000
+
+/* How many shard files --dupscan writes by default. */
+#define DEFAULT_DUPLICATE_SHARDS 16
+
 /* This structure holds details of the program state
  * available to all parts of the program.
  * This goes against the grain of good structured programming
@@ -79,7 +106,6 @@ StateInfo GlobalState = {
     DONT_DIVIDE,        /* ECO_level (-E) */
     SAN,                /* output_format (-W) */
     MAX_LINE_LENGTH,    /* max_line_length (-w) */
-    FALSE,              /* use_virtual_hash_table (-Z) */
     FALSE,              /* check_move_bounds (-b) */
     FALSE,              /* match_only_checkmate (-M) */
     FALSE,              /* match_only_stalemate (--stalemate) */
@@ -129,6 +155,18 @@ StateInfo GlobalState = {
     FALSE,              /* delete_same_setup (--deletesamesetup) */
     FALSE,              /* lichess_comment_fix (--lichesscommentfix) */
     0,                  /* split_depth_limit */
+    0,                  /* num_threads (--threads) */
+    FALSE,              /* split_input_by_offset (--offsetchunks) */
+    NO_PROFILE,         /* profile_format (--profile) */
+    NO_COMPRESSION,     /* output_compression (--compress) */
+    FALSE,              /* async_output (--asyncoutput) */
+    (char *) NULL,      /* engine_command (--engine) */
+    1,                  /* num_engines (--engines) */
+    DEFAULT_ENGINE_DEPTH, /* engine_depth (--enginedepth) */
+    (char *) NULL,      /* evaluation_cache_file (--evalcache) */
+    (char *) NULL,      /* statistics_key (--stats) */
+    (char *) NULL,      /* statistics_file (--statsfile) */
+    FALSE,              /* statistics_json (--statsformat) */
     NORMALFILE,         /* current_file_type */
     SETUP_TAG_OK,       /* setup_status */
     EITHER_TO_MOVE,     /* whose_move */
@@ -138,8 +176,21 @@ StateInfo GlobalState = {
     (char *) NULL,      /* line_number_marker (--linenumbers) */
     (char *) NULL,      /* current_input_file */
     DEFAULT_ECO_FILE,   /* eco_file (-e) */
+    (char *) NULL,      /* eco_index_file (--ecoindex) */
     (FILE *) NULL,      /* outputfile (-o, -a). Default is stdout */
     (char *) NULL,      /* output_filename (-o, -a) */
+    (char *) NULL,      /* duplicate_index_file (--dupindex) */
+    (char *) NULL,      /* duplicate_scan_prefix (--dupscan) */
+    (char *) NULL,      /* duplicate_merge_file (--dupmerge) */
+    (char *) NULL,      /* duplicate_resolve_prefix (--dupresolve) */
+    DEFAULT_DUPLICATE_SHARDS, /* duplicate_shards (--dupshards) */
+    (char *) NULL,      /* position_index_file (--posindex) */
+    FALSE,              /* game_index (--gameindex) */
+    (char *) NULL,      /* batch_file (--batch) */
+    (char *) NULL,      /* batch_job */
+    (char *) NULL,      /* checkpoint_file (--checkpoint) */
+    DEFAULT_CHECKPOINT_INTERVAL, /* checkpoint_interval (--checkpointevery) */
+    FALSE,              /* resume (--resume) */
     (FILE *) NULL,      /* logfile (-l). Default is stderr */
     (FILE *) NULL,      /* duplicate_file (-d) */
     (FILE *) NULL,      /* non_matching_file (-n) */
@@ -154,15 +205,21 @@ static void
 init_default_global_state(void)
 {
     GlobalState.outputfile = stdout;
+#ifdef BUFFER_REDIRECTED_STDOUT
+    if (!isatty(fileno(stdout))) {
+        buffer_output_file(stdout);
+    }
+#endif
     GlobalState.logfile = stderr;
     set_output_line_length(MAX_LINE_LENGTH);
 }
 
-int
-main(int argc, char *argv[])
+/* Prepare the global state and the tables that do not depend
+ * on the program's arguments.
+ */
+void
+init_program(void)
 {
-    int argnum;
-
     /* Prepare global state. */
     init_default_global_state();
     /* Prepare the Game_Header. */
@@ -173,7 +230,14 @@ main(int argc, char *argv[])
     init_hashtab();
     /* Initialise the lexical analyser's tables. */
     init_lex_tables();
-    /* Allow for some arguments. */
+}
+
+/* Process the program's arguments, from argv[1] onwards. */
+void
+process_program_arguments(int argc, char *argv[])
+{
+    int argnum;
+
     for (argnum = 1; argnum < argc;) {
         const char *argument = argv[argnum];
         if (argument[0] == '-') {
@@ -270,7 +334,7 @@ main(int argc, char *argv[])
                             fprintf(GlobalState.logfile,
                                     "Usage: -%c filename\n",
                                     argument_letter);
-                            exit(1);
+                            argument_error();
                         }
                     }
                     else {
@@ -304,7 +368,7 @@ main(int argc, char *argv[])
                             fprintf(GlobalState.logfile,
                                     "Usage: -%c value\n",
                                     argument_letter);
-                            exit(1);
+                            argument_error();
                         }
                     }
                     else {
@@ -351,7 +415,7 @@ main(int argc, char *argv[])
                             fprintf(GlobalState.logfile,
                                     "Usage: -%cfilename or -%c filename\n",
                                     argument_letter, argument_letter);
-                            exit(1);
+                            argument_error();
                         }
                     }
                     else {
@@ -368,7 +432,7 @@ main(int argc, char *argv[])
                     fprintf(GlobalState.logfile,
                             "Unknown flag %s. Use -%c for usage details.\n",
                             argument, HELP_ARGUMENT);
-                    exit(1);
+                    argument_error();
                     break;
             }
         }
@@ -378,18 +442,27 @@ main(int argc, char *argv[])
             argnum++;
         }
     }
+}
 
+/* Complete the settings made by the program's arguments and
+ * prepare the tables that depend on them, ready for the games
+ * to be read.
+ */
+void
+prepare_to_read_games(void)
+{
     /* Make some adjustments to other settings if JSON output is required. */
     if (GlobalState.json_format) {
         if (GlobalState.output_format != EPD &&
                 GlobalState.output_format != CM &&
+                GlobalState.output_format != BIN &&
                 GlobalState.ECO_level == DONT_DIVIDE) {
             GlobalState.keep_comments = FALSE;
             GlobalState.keep_variations = FALSE;
             GlobalState.keep_results = FALSE;
         }
         else {
-            fprintf(GlobalState.logfile, "JSON output is not currently supported with -E, -Wepd or -Wcm\n");
+            fprintf(GlobalState.logfile, "JSON output is not currently supported with -E, -Wepd, -Wcm or -Wbin\n");
             GlobalState.json_format = FALSE;
         }
     }
@@ -399,44 +472,114 @@ main(int argc, char *argv[])
 
     if (GlobalState.add_ECO) {
         /* Read in a list of ECO lines in order to classify the games. */
-        if (open_eco_file(GlobalState.eco_file)) {
+        if (GlobalState.eco_index_file != NULL &&
+                load_eco_index(GlobalState.eco_index_file, GlobalState.eco_file)) {
+            /* The compiled form is up to date. */
+        }
+        else if (open_eco_file(GlobalState.eco_file)) {
             /* Indicate that the ECO file is currently being parsed. */
             GlobalState.parsing_ECO_file = TRUE;
             yyparse(ECOFILE);
             reset_line_number();
             GlobalState.parsing_ECO_file = FALSE;
+            compile_eco_table();
+            if (GlobalState.eco_index_file != NULL) {
+                save_eco_index(GlobalState.eco_index_file, GlobalState.eco_file);
+            }
         }
         else {
             fprintf(GlobalState.logfile, "Unable to open the ECO file %s.\n",
                     GlobalState.eco_file);
-            exit(1);
+            argument_error();
         }
     }
+}
 
-    /* Open up the first file as the source of input. */
-    if (!open_first_file()) {
-        exit(1);
-    }
-
-    yyparse(GlobalState.current_file_type);
-
-    /* @@@ I would prefer this to be somewhere else. */
+/* Terminate the output of the games matched when it is JSON. */
+void
+finish_json_output(void)
+{
     if (GlobalState.json_format &&
             !GlobalState.check_only &&
             GlobalState.num_games_matched > 0) {
         fputs("\n]\n", GlobalState.outputfile);
     }
+}
+
+#ifndef PGN_EXTRACT_LIBRARY
+int
+main(int argc, char *argv[])
+{
+    init_program();
+    process_program_arguments(argc, argv);
+
+    if (GlobalState.checkpoint_file != NULL && GlobalState.batch_file == NULL) {
+        check_checkpoint_options();
+    }
+
+    if (GlobalState.duplicate_scan_prefix != NULL ||
+            GlobalState.duplicate_merge_file != NULL ||
+            GlobalState.duplicate_resolve_prefix != NULL) {
+        check_duplicate_shard_options();
+        if (GlobalState.duplicate_merge_file != NULL) {
+            /* This does not return. */
+            merge_duplicate_shards();
+        }
+    }
+
+    if (GlobalState.async_output) {
+        start_async_output();
+    }
+
+    if (GlobalState.batch_file != NULL) {
+        /* Only the process of each job carries on from here. */
+        run_batch_jobs();
+    }
+
+    prepare_to_read_games();
+
+    /* Open up the first file as the source of input.
+     * Binary input files are opened as they are read.
+     */
+    if (GlobalState.resume) {
+        resume_from_checkpoint();
+    }
+    else if (!binary_input() && !open_first_file()) {
+        exit(1);
+    }
+
+    if (!process_batch_job() && !process_binary_input() && !process_in_parallel() &&
+            !process_with_position_index()) {
+        yyparse(GlobalState.current_file_type);
+    }
+
+    finish_json_output();
 
     /* Remove any temporary files. */
     clear_duplicate_hash_table();
+    if (GlobalState.checkpoint_file != NULL) {
+        finish_checkpoints();
+    }
+    if (GlobalState.duplicate_scan_prefix != NULL ||
+            GlobalState.duplicate_resolve_prefix != NULL) {
+        finish_duplicate_shards();
+    }
     if (GlobalState.verbosity > 1) {
         fprintf(GlobalState.logfile, "%lu game%s matched out of %lu.\n",
                 GlobalState.num_games_matched,
                 GlobalState.num_games_matched == 1 ? "" : "s",
                 GlobalState.num_games_processed);
     }
+    if (GlobalState.statistics_key != NULL) {
+        report_statistics();
+    }
+    if (PROFILING) {
+        report_profile(GlobalState.logfile,
+                GlobalState.batch_job != NULL ? GlobalState.batch_job : "main");
+    }
     if ((GlobalState.logfile != stderr) && (GlobalState.logfile != NULL)) {
         (void) fclose(GlobalState.logfile);
     }
     return 0;
 }
+#endif
@@ -33,6 +33,7 @@
 #include "map.h"
 #include "decode.h"
 #include "apply.h"
+#include "zobrist.h"
 
 /* Structures to hold the x,y displacements of the various
  * piece movements.
@@ -303,6 +304,7 @@ make_move(MoveClass class, Col from_col, Rank from_rank, Col to_col, Rank to_ran
                 /* This is an ep capture. Remove the intermediate pawn. */
                 board->board[RankConvert(to_rank) - 1][ColConvert(to_col)] = EMPTY;
                 board->weak_hash_value ^= hash_lookup(to_col, to_rank - 1, PAWN, BLACK);
+                board->zobrist ^= zobrist_piece_hash(to_col, to_rank - 1, PAWN, BLACK);
                 board->EnPassant = FALSE;
             }
             else {
@@ -320,6 +322,7 @@ make_move(MoveClass class, Col from_col, Rank from_rank, Col to_col, Rank to_ran
                 /* This is an ep capture. Remove the intermediate pawn. */
                 board->board[RankConvert(to_rank) + 1][ColConvert(to_col)] = EMPTY;
                 board->weak_hash_value ^= hash_lookup(to_col, to_rank + 1, PAWN, WHITE);
+                board->zobrist ^= zobrist_piece_hash(to_col, to_rank + 1, PAWN, WHITE);
                 board->EnPassant = FALSE;
             }
             else {
@@ -331,9 +334,11 @@ make_move(MoveClass class, Col from_col, Rank from_rank, Col to_col, Rank to_ran
     if (class == PAWN_MOVE_WITH_PROMOTION && piece != PAWN) {
         /* Remove the promoted pawn. */
         board->weak_hash_value ^= hash_lookup(from_col, from_rank, PAWN, colour);
+        board->zobrist ^= zobrist_piece_hash(from_col, from_rank, PAWN, colour);
     }
     else {
         board->weak_hash_value ^= hash_lookup(from_col, from_rank, piece, colour);
+        board->zobrist ^= zobrist_piece_hash(from_col, from_rank, piece, colour);
     }
     board->board[from_r][from_c] = EMPTY;
     if (board->board[to_r][to_c] != EMPTY) {
@@ -345,6 +350,7 @@ make_move(MoveClass class, Col from_col, Rank from_rank, Col to_col, Rank to_ran
         removed_piece = EXTRACT_PIECE(coloured_piece);
         removed_colour = EXTRACT_COLOUR(coloured_piece);
         board->weak_hash_value ^= hash_lookup(to_col, to_rank, removed_piece, removed_colour);
+        board->zobrist ^= zobrist_piece_hash(to_col, to_rank, removed_piece, removed_colour);
         /* See whether the removed piece is a Rook, as this could
          * affect castling rights.
          */
@@ -395,6 +401,7 @@ make_move(MoveClass class, Col from_col, Rank from_rank, Col to_col, Rank to_ran
     board->board[to_r][to_c] = MAKE_COLOURED_PIECE(colour, piece);
     /* Insert the moved piece into the hash value. */
     board->weak_hash_value ^= hash_lookup(to_col, to_rank, piece, colour);
+    board->zobrist ^= zobrist_piece_hash(to_col, to_rank, piece, colour);
     if(!board->EnPassant) {
         board->ep_rank = '\0';
         board->ep_col = '\0';
@@ -405,12 +412,14 @@ make_move(MoveClass class, Col from_col, Rank from_rank, Col to_col, Rank to_ran
         if (castling_rook_col != to_col) {
             /* It must be removed. */
             board->weak_hash_value ^= hash_lookup(castling_rook_col, from_rank, ROOK, colour);
+            board->zobrist ^= zobrist_piece_hash(castling_rook_col, from_rank, ROOK, colour);
             board->board[from_r][ColConvert(castling_rook_col)] = EMPTY;
         }
         int rook_offset = (class == KINGSIDE_CASTLE ? -1 : 1);
         /* Place the rook at its destination. */
         board->board[to_r][to_c + rook_offset] = MAKE_COLOURED_PIECE(colour, ROOK);
         board->weak_hash_value ^= hash_lookup(to_col + rook_offset, to_rank, ROOK, colour);
+        board->zobrist ^= zobrist_piece_hash(to_col + rook_offset, to_rank, ROOK, colour);
     }
 }
 
@@ -840,82 +849,22 @@ find_single_pawn_move(Col from_col, Rank from_rank, Col to_col, Rank to_rank,
     return found;
 }
 
-/* Find knight moves to the given square. */
-static Boolean
-find_single_knight_move(Col to_col, Rank to_rank, Colour colour, const Board *board)
-{
-    int to_r = RankConvert(to_rank);
-    int to_c = ColConvert(to_col);
-    unsigned ix;
-    Piece target_piece = MAKE_COLOURED_PIECE(colour, KNIGHT);
-    Boolean found = FALSE;
-
-    /* Pick up pairs of offsets from to_r,to_c to look for a Knight of
-     * the right colour.
-     */
-    for (ix = 0; ix < 2 * NUM_KNIGHT_MOVES && !found; ix += 2) {
-        int r = Knight_moves[ix] + to_r;
-        int c = Knight_moves[ix + 1] + to_c;
-
-        if (board->board[r][c] == target_piece) {
-            found = TRUE;
-        }
-    }
-    return found;
-}
-
-/* See if there is at least one bishop move to the given square. */
-static Boolean
-find_single_bishop_move(Col to_col, Rank to_rank, Colour colour, const Board *board)
-{
-    int to_r = RankConvert(to_rank);
-    int to_c = ColConvert(to_col);
-    Piece target_piece = MAKE_COLOURED_PIECE(colour, BISHOP);
-    Boolean found = FALSE;
-
-    /* Pick up pairs of offsets from to_r,to_c to look for a Bishop of
-     * the right colour.
-     */
-    for (unsigned ix = 0; ix < 2 * NUM_BISHOP_MOVES && !found; ix += 2) {
-        int r = to_r, c = to_c;
-
-        /* Work backwards from the destination to find a bishop of
-         * the right colour.
-         */
-        do {
-            r += Bishop_moves[ix];
-            c += Bishop_moves[ix + 1];
-        } while (board->board[r][c] == EMPTY);
-
-        if (board->board[r][c] == target_piece) {
-            found = TRUE;
-        }
-    }
-    return found;
-}
-
-/* Find rook moves to the given square. */
+/* Find King moves to the given square. */
 static Boolean
-find_single_rook_move(Col to_col, Rank to_rank, Colour colour, const Board *board)
+find_single_king_move(Col to_col, Rank to_rank, Colour colour, const Board *board)
 {
     int to_r = RankConvert(to_rank);
     int to_c = ColConvert(to_col);
-    Piece target_piece = MAKE_COLOURED_PIECE(colour, ROOK);
+    Piece target_piece = MAKE_COLOURED_PIECE(colour, KING);
+    /* Store once the single King is found. */
     Boolean found = FALSE;
 
-    /* Pick up pairs of offsets from to_r,to_c to look for a Rook of
+    /* Pick up pairs of offsets from to_r,to_c to look for a King of
      * the right colour.
      */
-    for (unsigned ix = 0; ix < 2 * NUM_ROOK_MOVES && !found; ix += 2) {
-        int r = to_r, c = to_c;
-
-        /* Work backwards from the destination to find a rook of
-         * the right colour.
-         */
-        do {
-            r += Rook_moves[ix];
-            c += Rook_moves[ix + 1];
-        } while (board->board[r][c] == EMPTY);
+    for (unsigned ix = 0; ix < 2 * NUM_KING_MOVES && !found; ix += 2) {
+        int r = King_moves[ix] + to_r;
+        int c = King_moves[ix + 1] + to_c;
 
         if (board->board[r][c] == target_piece) {
             found = TRUE;
@@ -924,58 +873,49 @@ find_single_rook_move(Col to_col, Rank to_rank, Colour colour, const Board *boar
     return found;
 }
 
-/* Find queen moves to the given square. */
+/* Return TRUE if there is a queen, rook or bishop of the given
+ * colour with a clear line to the given square, or a knight that
+ * attacks it.
+ * Each of the eight lines from the square is followed just
+ * once, rather than once for each type of line piece.
+ */
 static Boolean
-find_single_queen_move(Col to_col, Rank to_rank, Colour colour, const Board *board)
+attacked_by_piece(int to_r, int to_c, Colour colour, const Board *board)
 {
-    int to_r = RankConvert(to_rank);
-    int to_c = ColConvert(to_col);
-    Piece target_piece = MAKE_COLOURED_PIECE(colour, QUEEN);
-    Boolean found = FALSE;
+    Piece queen = MAKE_COLOURED_PIECE(colour, QUEEN);
+    Piece rook = MAKE_COLOURED_PIECE(colour, ROOK);
+    Piece bishop = MAKE_COLOURED_PIECE(colour, BISHOP);
+    Piece knight = MAKE_COLOURED_PIECE(colour, KNIGHT);
+    unsigned ix;
 
-    /* Pick up pairs of offsets from to_r,to_c to look for a Queen of
-     * the right colour.
-     */
-    for (unsigned ix = 0; ix < 2 * NUM_QUEEN_MOVES && !found; ix += 2) {
+    for (ix = 0; ix < 2 * NUM_QUEEN_MOVES; ix += 2) {
         int r = to_r, c = to_c;
+        Piece occupant;
 
-        /* Work backwards from the destination to find a queen of
-         * the right colour.
-         */
         do {
             r += Queen_moves[ix];
             c += Queen_moves[ix + 1];
-        } while (board->board[r][c] == EMPTY);
+        } while ((occupant = board->board[r][c]) == EMPTY);
 
-        if (board->board[r][c] == target_piece) {
-            found = TRUE;
+        if (occupant == queen) {
+            return TRUE;
+        }
+        else if (Queen_moves[ix] != 0 && Queen_moves[ix + 1] != 0) {
+            /* A diagonal line. */
+            if (occupant == bishop) {
+                return TRUE;
+            }
+        }
+        else if (occupant == rook) {
+            return TRUE;
         }
     }
-    return found;
-}
-
-/* Find King moves to the given square. */
-static Boolean
-find_single_king_move(Col to_col, Rank to_rank, Colour colour, const Board *board)
-{
-    int to_r = RankConvert(to_rank);
-    int to_c = ColConvert(to_col);
-    Piece target_piece = MAKE_COLOURED_PIECE(colour, KING);
-    /* Store once the single King is found. */
-    Boolean found = FALSE;
-
-    /* Pick up pairs of offsets from to_r,to_c to look for a King of
-     * the right colour.
-     */
-    for (unsigned ix = 0; ix < 2 * NUM_KING_MOVES && !found; ix += 2) {
-        int r = King_moves[ix] + to_r;
-        int c = King_moves[ix + 1] + to_c;
-
-        if (board->board[r][c] == target_piece) {
-            found = TRUE;
+    for (ix = 0; ix < 2 * NUM_KNIGHT_MOVES; ix += 2) {
+        if (board->board[to_r + Knight_moves[ix]][to_c + Knight_moves[ix + 1]] == knight) {
+            return TRUE;
         }
     }
-    return found;
+    return FALSE;
 }
 
 /* Return true if the king of the given colour is
@@ -1000,28 +940,11 @@ king_is_in_check(const Board *board, Colour king_colour)
         king_rank = board->BKingRank;
     }
     /* Try and find one move that leaves this king in check.
-     * There is probably an optimal order for these tests but 
-     * I don't know for sure what it is.
-     * Try the pieces with greatest mobility first.
-     * 
-     * @@@ NB: Since a single move would be enough, this could
-     * be made more efficient.
+     * The pieces with greatest mobility are tried first.
      */
-    if (find_single_queen_move(king_col, king_rank,
-            opponent_colour, board)) {
-        /* King is in check from a queen. */
-    }
-    else if (find_single_rook_move(king_col, king_rank,
-            opponent_colour, board)) {
-        /* King is in check from a rook. */
-    }
-    else if (find_single_bishop_move(king_col, king_rank,
-            opponent_colour, board)) {
-        /* King is in check from a bishop. */
-    }
-    else if (find_single_knight_move(king_col, king_rank,
+    if (attacked_by_piece(RankConvert(king_rank), ColConvert(king_col),
             opponent_colour, board)) {
-        /* King is in check from a knight. */
+        /* King is in check from a queen, rook, bishop or knight. */
     }
     else if ((king_col != LASTCOL) &&
             (find_single_pawn_move(king_col + 1, 0, king_col, king_rank,
@@ -1055,6 +978,11 @@ king_is_in_check(const Board *board, Colour king_colour)
  * opponent that could capture the king of the given colour.
  * Only one such move needs to be found to invalidate one of the
  * possible moves.
+ *
+ * Rather than using make_move on a fresh copy of the board for
+ * each move, just the squares affected by the move are updated
+ * on a single copy and then restored. Nothing else that
+ * make_move changes has a bearing on whether the king is in check.
  */
 MovePair *
 exclude_checks(Piece piece, Colour colour, MovePair *possibles, const Board *board)
@@ -1065,16 +993,59 @@ exclude_checks(Piece piece, Colour colour, MovePair *possibles, const Board *boa
     Board copy_board;
     MovePair *valid_move_list = NULL;
     MovePair *move;
+    Piece coloured_piece = MAKE_COLOURED_PIECE(colour, piece);
 
+    if (possibles == NULL) {
+        return NULL;
+    }
+    copy_board = *board;
     /* For each possible move, make the move and see if it leaves the king
      * in check.
      */
     for (move = possibles; move != NULL;) {
-        /* Take a copy of the board before playing this next move. */
-        copy_board = *board;
-        make_move(UNKNOWN_MOVE, move->from_col, move->from_rank,
-                move->to_col, move->to_rank, piece, colour, &copy_board);
-        if (king_is_in_check(&copy_board, colour) != NOCHECK) {
+        int from_r = RankConvert(move->from_rank);
+        int from_c = ColConvert(move->from_col);
+        int to_r = RankConvert(move->to_rank);
+        int to_c = ColConvert(move->to_col);
+        Piece captured = copy_board.board[to_r][to_c];
+        /* The square of a pawn taken en passant; 0 if none. */
+        int ep_r = 0;
+        Boolean in_check;
+
+        if (piece == PAWN && board->EnPassant &&
+                board->ep_rank == move->to_rank && board->ep_col == move->to_col) {
+            ep_r = to_r - COLOUR_OFFSET(colour);
+            copy_board.board[ep_r][to_c] = EMPTY;
+        }
+        copy_board.board[from_r][from_c] = EMPTY;
+        copy_board.board[to_r][to_c] = coloured_piece;
+        if (piece == KING) {
+            if (colour == WHITE) {
+                copy_board.WKingCol = move->to_col;
+                copy_board.WKingRank = move->to_rank;
+            }
+            else {
+                copy_board.BKingCol = move->to_col;
+                copy_board.BKingRank = move->to_rank;
+            }
+        }
+
+        in_check = king_is_in_check(&copy_board, colour) != NOCHECK;
+
+        /* Restore the board. */
+        copy_board.board[to_r][to_c] = captured;
+        copy_board.board[from_r][from_c] = board->board[from_r][from_c];
+        if (ep_r != 0) {
+            copy_board.board[ep_r][to_c] = board->board[ep_r][to_c];
+        }
+        if (piece == KING) {
+            copy_board.WKingCol = board->WKingCol;
+            copy_board.WKingRank = board->WKingRank;
+            copy_board.BKingCol = board->BKingCol;
+            copy_board.BKingRank = board->BKingRank;
+        }
+
+        if (in_check) {
             MovePair *illegal_move = move;
             move = move->next;
             /* Free the illegal move. */
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include "bool.h"
 #include "mymalloc.h"
 #include "lines.h"
@@ -110,6 +111,99 @@ static variation_list *games_to_keep = NULL;
 static Boolean textual_variation_match(const char *variation_move,
         const unsigned char *actual_move);
 
+/* The kinds of move in a variation. */
+typedef enum {
+    /* A move that must match that of the game. */
+    MATCHING_MOVE,
+    /* A move starting with ANY_MOVE. */
+    WILDCARD_MOVE,
+    /* A move starting with DISALLOWED_MOVE. */
+    EXCLUDED_MOVE
+} variation_move_kind;
+
+/* The variations are compiled, the first time a game is checked,
+ * so that all of them are tested in a single walk of its moves.
+ * For straight matches, they form a trie of their moves: those
+ * that start with the same N moves share the path to the node at
+ * depth N, and the nodes reached by the moves played so far are
+ * followed forward by each move of the game in turn.
+ */
+typedef struct variation_node {
+    /* Whether a variation ends here. */
+    Boolean complete;
+    struct variation_edge *edges;
+    unsigned num_edges;
+    unsigned max_edges;
+    /* The words of the MATCHING_MOVE edges, in order, so that those
+     * which could match a move of the game are found by a binary
+     * search; see follow_matching_edges.
+     */
+    struct move_word *words;
+    unsigned num_words;
+    unsigned max_words;
+    /* The indices of the other edges, which are tried for every move. */
+    unsigned *unindexed;
+    unsigned num_unindexed;
+    /* The move of the game on which the node was last reached. */
+    unsigned long reached;
+} variation_node;
+
+typedef struct variation_edge {
+    const char *move;
+    variation_move_kind kind;
+    variation_node *next;
+} variation_edge;
+
+/* A run of move characters in the move of an edge. */
+typedef struct move_word {
+    const char *text;
+    size_t length;
+    unsigned edge;
+} move_word;
+
+/* For permutation matches, a variation whose moves are all plain
+ * moves, without alternatives, or a bare ANY_MOVE, or a DISALLOWED_MOVE
+ * of a plain move, is compiled into the number of times each move must
+ * be played by each colour within its length, which does not depend on
+ * the order in which they are played.
+ * The others are still matched by permutation_match.
+ */
+typedef struct {
+    /* The index of the move in permutation_words. */
+    unsigned word;
+    /* 0 for White and 1 for Black. */
+    unsigned colour;
+    /* How many times it must be played, or 0 if it must not be. */
+    unsigned count;
+} move_requirement;
+
+typedef struct {
+    unsigned length;
+    /* A bit for each of the moves required of each colour, to rule
+     * out most variations without looking at their requirements.
+     */
+    uint64_t signature[2];
+    move_requirement *requirements;
+    unsigned num_requirements;
+} move_multiset;
+
+/* Whether games_to_keep has been compiled. */
+static Boolean variations_compiled = FALSE;
+/* The trie of the variations, for straight matches. */
+static variation_node *variation_trie = NULL;
+/* The compiled variations for permutation matches, shortest first,
+ * and those that could not be compiled.
+ */
+static move_multiset *multisets = NULL;
+static unsigned num_multisets = 0;
+static const variation_list **uncompiled_variations = NULL;
+static unsigned num_uncompiled = 0;
+/* The distinct moves of the multisets, with a hash table to find them. */
+static char **permutation_words = NULL;
+static unsigned num_permutation_words = 0;
+static unsigned *word_table = NULL;
+static unsigned word_table_size = 0;
+
 /*** Functions concerned with reading details of the variations
  *** of interest.
  ***/
@@ -253,6 +347,7 @@ add_textual_variation_from_line(char *line)
         if (next_variation != NULL) {
             next_variation->next = games_to_keep;
             games_to_keep = next_variation;
+            variations_compiled = FALSE;
         }
     }
 }
@@ -430,70 +525,6 @@ textual_variation_match(const char *variation_move, const unsigned char *actual_
  *** against the variations of interest.
  ***/
 
-/* Do the moves of the current game match the given variation?
- * Go for a straight 1-1 match in the ordering, without considering
- * permutations.
- * Return TRUE if so, FALSE otherwise.
- */
-static Boolean
-straight_match(Move *current_game_head, variation_list variation)
-{
-    variant_move *moves_of_the_variation;
-    /* Which is the next move that we wish to match. */
-    Move *next_move;
-    unsigned move_index = 0;
-    /* Assume that it matches. */
-    Boolean matches = TRUE;
-
-    /* Access the head of the current game. */
-    next_move = current_game_head;
-    /* Go for a straight move-by-move match in the order in which
-     * the variation is listed.
-     * Point at the head of the moves list.
-     */
-    moves_of_the_variation = variation.moves;
-    move_index = 0;
-    while (matches && (next_move != NULL) && (move_index < variation.length)) {
-        Boolean this_move_matches;
-
-        if (*(moves_of_the_variation[move_index].move) == ANY_MOVE) {
-            /* Still matching as we don't care what the actual move is. */
-        }
-        else {
-            this_move_matches =
-                    textual_variation_match(moves_of_the_variation[move_index].move,
-                    next_move->move);
-            if (this_move_matches) {
-                /* We found a match, check that it isn't disallowed. */
-                if (*moves_of_the_variation[move_index].move == DISALLOWED_MOVE) {
-                    /* This move is disallowed and implies failure. */
-                    matches = FALSE;
-                }
-            }
-            else {
-                if (*moves_of_the_variation[move_index].move != DISALLOWED_MOVE) {
-                    /* No match found for this move. */
-                    matches = FALSE;
-                }
-                else {
-                    /* This is ok, because we didn't want a match. */
-                }
-            }
-
-        }
-        /* If we are still matching, go on to the next move. */
-        if (matches) {
-            move_index++;
-            next_move = next_move->next;
-        }
-    }
-    /* The game could be shorter than the variation, so don't rely
-     * on the fact that matches is still true.
-     */
-    matches = (move_index == variation.length);
-    return matches;
-}
-
 /* Do the moves of the current game match the given variation?
  * Try all possible orderings for the moves, within the
  * constraint of proper WHITE/BLACK moves.
@@ -675,6 +706,612 @@ permutation_match(Move *current_game_head, variation_list variation)
     return matches;
 }
 
+/*** Functions concerned with compiling the variations of interest,
+ *** so that all of them are matched in a single walk of a game.
+ ***/
+
+static variation_move_kind
+variation_move_kind_of(const char *move)
+{
+    if (*move == ANY_MOVE) {
+        return WILDCARD_MOVE;
+    }
+    else if (*move == DISALLOWED_MOVE) {
+        return EXCLUDED_MOVE;
+    }
+    else {
+        return MATCHING_MOVE;
+    }
+}
+
+/* Return the number of move characters at the start of text. */
+static size_t
+move_word_length(const char *text)
+{
+    size_t length = 0;
+
+    while (move_char(text[length])) {
+        length++;
+    }
+    return length;
+}
+
+static variation_node *
+new_variation_node(void)
+{
+    variation_node *node = (variation_node *) malloc_or_die(sizeof (*node));
+
+    node->complete = FALSE;
+    node->edges = NULL;
+    node->num_edges = node->max_edges = 0;
+    node->words = NULL;
+    node->num_words = node->max_words = 0;
+    node->unindexed = NULL;
+    node->num_unindexed = 0;
+    node->reached = 0;
+    return node;
+}
+
+static void
+free_variation_node(variation_node *node)
+{
+    unsigned e;
+
+    for (e = 0; e < node->num_edges; e++) {
+        free_variation_node(node->edges[e].next);
+    }
+    (void) free((void *) node->edges);
+    (void) free((void *) node->words);
+    (void) free((void *) node->unindexed);
+    (void) free((void *) node);
+}
+
+/* Return the node that follows node by move, adding it if there
+ * is not one already.
+ */
+static variation_node *
+follow_variation_move(variation_node *node, const char *move)
+{
+    variation_move_kind kind = variation_move_kind_of(move);
+    variation_edge *edge;
+    unsigned e;
+
+    for (e = 0; e < node->num_edges; e++) {
+        if (node->edges[e].kind == kind && strcmp(node->edges[e].move, move) == 0) {
+            return node->edges[e].next;
+        }
+    }
+    if (node->num_edges == node->max_edges) {
+        node->max_edges = node->max_edges == 0 ? 4 : 2 * node->max_edges;
+        node->edges = (variation_edge *) realloc_or_die((void *) node->edges,
+                node->max_edges * sizeof (*node->edges));
+    }
+    edge = &node->edges[node->num_edges];
+    edge->move = move;
+    edge->kind = kind;
+    edge->next = new_variation_node();
+    if (kind == MATCHING_MOVE) {
+        /* Index the edge by each of the alternatives in its move. */
+        const char *text = move;
+
+        while (*text != '\0') {
+            size_t length = move_word_length(text);
+
+            if (length == 0) {
+                text++;
+            }
+            else {
+                if (node->num_words == node->max_words) {
+                    node->max_words = node->max_words == 0 ? 4 : 2 * node->max_words;
+                    node->words = (move_word *) realloc_or_die((void *) node->words,
+                            node->max_words * sizeof (*node->words));
+                }
+                node->words[node->num_words].text = text;
+                node->words[node->num_words].length = length;
+                node->words[node->num_words].edge = node->num_edges;
+                node->num_words++;
+                text += length;
+            }
+        }
+    }
+    else {
+        node->unindexed = (unsigned *) realloc_or_die((void *) node->unindexed,
+                (node->num_unindexed + 1) * sizeof (*node->unindexed));
+        node->unindexed[node->num_unindexed] = node->num_edges;
+        node->num_unindexed++;
+    }
+    node->num_edges++;
+    return edge->next;
+}
+
+static int
+compare_move_words(const char *text1, size_t length1,
+                   const char *text2, size_t length2)
+{
+    int comparison = memcmp(text1, text2, length1 < length2 ? length1 : length2);
+
+    if (comparison != 0) {
+        return comparison;
+    }
+    else {
+        return length1 < length2 ? -1 : length1 > length2 ? 1 : 0;
+    }
+}
+
+static int
+order_move_words(const void *p1, const void *p2)
+{
+    const move_word *word1 = (const move_word *) p1;
+    const move_word *word2 = (const move_word *) p2;
+
+    return compare_move_words(word1->text, word1->length,
+                              word2->text, word2->length);
+}
+
+/* Sort the words of node and of the nodes that follow it. */
+static void
+sort_variation_words(variation_node *node)
+{
+    unsigned e;
+
+    if (node->num_words > 1) {
+        qsort((void *) node->words, node->num_words, sizeof (*node->words),
+              order_move_words);
+    }
+    for (e = 0; e < node->num_edges; e++) {
+        sort_variation_words(node->edges[e].next);
+    }
+}
+
+/* Return the index in permutation_words of the length characters of
+ * text, adding them if add is TRUE, or -1 if they are not there.
+ */
+static long
+permutation_word(const char *text, size_t length, Boolean add)
+{
+    unsigned long hash = 5381;
+    size_t i;
+    unsigned slot;
+
+    for (i = 0; i < length; i++) {
+        hash = hash * 33 + (unsigned char) text[i];
+    }
+    if (add && 2 * (num_permutation_words + 1) > word_table_size) {
+        unsigned w;
+
+        word_table_size = word_table_size == 0 ? 256 : 2 * word_table_size;
+        (void) free((void *) word_table);
+        word_table = (unsigned *) malloc_or_die(word_table_size * sizeof (*word_table));
+        for (slot = 0; slot < word_table_size; slot++) {
+            word_table[slot] = UINT_MAX;
+        }
+        for (w = 0; w < num_permutation_words; w++) {
+            const char *word = permutation_words[w];
+            unsigned long word_hash = 5381;
+
+            for (i = 0; word[i] != '\0'; i++) {
+                word_hash = word_hash * 33 + (unsigned char) word[i];
+            }
+            slot = word_hash & (word_table_size - 1);
+            while (word_table[slot] != UINT_MAX) {
+                slot = (slot + 1) & (word_table_size - 1);
+            }
+            word_table[slot] = w;
+        }
+    }
+    if (word_table_size == 0) {
+        return -1;
+    }
+    slot = hash & (word_table_size - 1);
+    while (word_table[slot] != UINT_MAX) {
+        const char *word = permutation_words[word_table[slot]];
+
+        if (strncmp(word, text, length) == 0 && word[length] == '\0') {
+            return word_table[slot];
+        }
+        slot = (slot + 1) & (word_table_size - 1);
+    }
+    if (!add) {
+        return -1;
+    }
+    permutation_words = (char **) realloc_or_die((void *) permutation_words,
+            (num_permutation_words + 1) * sizeof (*permutation_words));
+    permutation_words[num_permutation_words] = (char *) malloc_or_die(length + 1);
+    memcpy(permutation_words[num_permutation_words], text, length);
+    permutation_words[num_permutation_words][length] = '\0';
+    word_table[slot] = num_permutation_words;
+    num_permutation_words++;
+    return word_table[slot];
+}
+
+/* Add to multiset the requirement that the given move be played by
+ * colour count more times, or not at all if count is 0.
+ */
+static void
+add_move_requirement(move_multiset *multiset, const char *text, size_t length,
+                     unsigned colour, unsigned count)
+{
+    unsigned word = (unsigned) permutation_word(text, length, TRUE);
+    unsigned r;
+
+    for (r = 0; r < multiset->num_requirements; r++) {
+        move_requirement *requirement = &multiset->requirements[r];
+
+        if (requirement->word == word && requirement->colour == colour &&
+                (requirement->count == 0) == (count == 0)) {
+            requirement->count += count;
+            return;
+        }
+    }
+    multiset->requirements = (move_requirement *) realloc_or_die(
+            (void *) multiset->requirements,
+            (multiset->num_requirements + 1) * sizeof (*multiset->requirements));
+    multiset->requirements[r].word = word;
+    multiset->requirements[r].colour = colour;
+    multiset->requirements[r].count = count;
+    multiset->num_requirements++;
+    if (count > 0) {
+        multiset->signature[colour] |= ((uint64_t) 1) << (word & 63);
+    }
+}
+
+/* Whether the moves of variation are all of the forms that can be
+ * compiled into a move_multiset.
+ * A plain move, of move characters only, matches a move of the game
+ * only when they are the same, a DISALLOWED_MOVE of a plain move
+ * matches only that move or itself, and a bare ANY_MOVE matches nothing
+ * but may stand in for anything.
+ */
+static Boolean
+compilable_permutation(const variation_list *variation)
+{
+    unsigned m;
+
+    for (m = 0; m < variation->length; m++) {
+        const char *move = variation->moves[m].move;
+
+        if (*move == ANY_MOVE) {
+            if (move[1] != '\0') {
+                return FALSE;
+            }
+        }
+        else {
+            if (*move == DISALLOWED_MOVE) {
+                move++;
+            }
+            if (move[move_word_length(move)] != '\0') {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+static void
+compile_permutation(const variation_list *variation, move_multiset *multiset)
+{
+    unsigned m;
+
+    multiset->length = variation->length;
+    multiset->signature[0] = multiset->signature[1] = 0;
+    multiset->requirements = NULL;
+    multiset->num_requirements = 0;
+    for (m = 0; m < variation->length; m++) {
+        const char *move = variation->moves[m].move;
+        unsigned colour = m & 0x01;
+
+        if (*move == ANY_MOVE) {
+            /* Only its place is needed. */
+        }
+        else if (*move == DISALLOWED_MOVE) {
+            if (move[1] != '\0') {
+                add_move_requirement(multiset, move + 1, strlen(move + 1), colour, 0);
+                add_move_requirement(multiset, move, strlen(move), colour, 0);
+            }
+        }
+        else {
+            add_move_requirement(multiset, move, strlen(move), colour, 1);
+        }
+    }
+}
+
+static int
+order_multisets(const void *p1, const void *p2)
+{
+    const move_multiset *multiset1 = (const move_multiset *) p1;
+    const move_multiset *multiset2 = (const move_multiset *) p2;
+
+    return multiset1->length < multiset2->length ? -1 :
+            multiset1->length > multiset2->length ? 1 : 0;
+}
+
+static void
+free_compiled_variations(void)
+{
+    unsigned i;
+
+    if (variation_trie != NULL) {
+        free_variation_node(variation_trie);
+        variation_trie = NULL;
+    }
+    for (i = 0; i < num_multisets; i++) {
+        (void) free((void *) multisets[i].requirements);
+    }
+    (void) free((void *) multisets);
+    multisets = NULL;
+    num_multisets = 0;
+    (void) free((void *) uncompiled_variations);
+    uncompiled_variations = NULL;
+    num_uncompiled = 0;
+    for (i = 0; i < num_permutation_words; i++) {
+        (void) free((void *) permutation_words[i]);
+    }
+    (void) free((void *) permutation_words);
+    permutation_words = NULL;
+    num_permutation_words = 0;
+    (void) free((void *) word_table);
+    word_table = NULL;
+    word_table_size = 0;
+}
+
+/* Compile games_to_keep for the kind of matching required. */
+static void
+compile_variations(void)
+{
+    const variation_list *variation;
+
+    free_compiled_variations();
+    if (GlobalState.match_permutations) {
+        unsigned num_variations = 0;
+
+        for (variation = games_to_keep; variation != NULL; variation = variation->next) {
+            num_variations++;
+        }
+        multisets = (move_multiset *) malloc_or_die(num_variations * sizeof (*multisets));
+        uncompiled_variations = (const variation_list **)
+                malloc_or_die(num_variations * sizeof (*uncompiled_variations));
+        for (variation = games_to_keep; variation != NULL; variation = variation->next) {
+            if (compilable_permutation(variation)) {
+                compile_permutation(variation, &multisets[num_multisets]);
+                num_multisets++;
+            }
+            else {
+                uncompiled_variations[num_uncompiled] = variation;
+                num_uncompiled++;
+            }
+        }
+        if (num_multisets > 1) {
+            qsort((void *) multisets, num_multisets, sizeof (*multisets), order_multisets);
+        }
+    }
+    else {
+        variation_trie = new_variation_node();
+        for (variation = games_to_keep; variation != NULL; variation = variation->next) {
+            variation_node *node = variation_trie;
+            unsigned m;
+
+            for (m = 0; m < variation->length; m++) {
+                node = follow_variation_move(node, variation->moves[m].move);
+            }
+            node->complete = TRUE;
+        }
+        sort_variation_words(variation_trie);
+    }
+    variations_compiled = TRUE;
+}
+
+/*** Functions concerned with matching the moves of the current game
+ *** against the compiled variations.
+ ***/
+
+/* The nodes of the trie reached by the moves of the game so far,
+ * and by the next move.
+ */
+static variation_node **reached_nodes = NULL, **next_nodes = NULL;
+static unsigned num_reached = 0, num_next = 0, max_reached = 0;
+/* The number of moves of games followed through the trie. */
+static unsigned long moves_followed = 0;
+
+/* Note that node has been reached by the next move.
+ * Return TRUE if a variation ends there.
+ */
+static Boolean
+reach_variation_node(variation_node *node)
+{
+    if (node->reached != moves_followed) {
+        node->reached = moves_followed;
+        if (num_next == max_reached) {
+            max_reached = max_reached == 0 ? 16 : 2 * max_reached;
+            reached_nodes = (variation_node **) realloc_or_die((void *) reached_nodes,
+                    max_reached * sizeof (*reached_nodes));
+            next_nodes = (variation_node **) realloc_or_die((void *) next_nodes,
+                    max_reached * sizeof (*next_nodes));
+        }
+        next_nodes[num_next] = node;
+        num_next++;
+    }
+    return node->complete;
+}
+
+/* Follow the edges of node that match actual_move.
+ * A MATCHING_MOVE can only match if the move characters at the start
+ * of actual_move form one of its words, as textual_variation_match
+ * requires a non-move character either side of the match, and it
+ * certainly matches if they are the whole of actual_move.
+ * Return TRUE if a variation ends at one of the nodes reached.
+ */
+static Boolean
+follow_matching_edges(const variation_node *node, const unsigned char *actual_move)
+{
+    const char *move_text = (const char *) actual_move;
+    size_t length = move_word_length(move_text);
+    Boolean complete = FALSE;
+    unsigned i;
+
+    if (length > 0) {
+        /* Find the first word the same as the start of the move. */
+        unsigned low = 0, high = node->num_words;
+
+        while (low < high) {
+            unsigned middle = low + (high - low) / 2;
+            const move_word *word = &node->words[middle];
+
+            if (compare_move_words(word->text, word->length, move_text, length) < 0) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        for (i = low; i < node->num_words &&
+                compare_move_words(node->words[i].text, node->words[i].length,
+                                   move_text, length) == 0; i++) {
+            const variation_edge *edge = &node->edges[node->words[i].edge];
+
+            if (move_text[length] == '\0' ||
+                    textual_variation_match(edge->move, actual_move)) {
+                complete |= reach_variation_node(edge->next);
+            }
+        }
+    }
+    else {
+        for (i = 0; i < node->num_edges; i++) {
+            const variation_edge *edge = &node->edges[i];
+
+            if (edge->kind == MATCHING_MOVE &&
+                    textual_variation_match(edge->move, actual_move)) {
+                complete |= reach_variation_node(edge->next);
+            }
+        }
+    }
+    for (i = 0; i < node->num_unindexed; i++) {
+        const variation_edge *edge = &node->edges[node->unindexed[i]];
+
+        if (edge->kind == WILDCARD_MOVE ||
+                !textual_variation_match(edge->move, actual_move)) {
+            complete |= reach_variation_node(edge->next);
+        }
+    }
+    return complete;
+}
+
+/* Do the moves of the current game match any of the variations?
+ * Go for a straight 1-1 match in the ordering, without considering
+ * permutations.
+ * An ANY_MOVE matches any move of the game, and a DISALLOWED_MOVE any
+ * move other than those it lists.
+ * Return TRUE if so, FALSE otherwise.
+ */
+static Boolean
+straight_match_trie(const Move *current_game_head)
+{
+    const Move *next_move;
+    Boolean matches = variation_trie->complete;
+
+    num_reached = 0;
+    num_next = 0;
+    moves_followed++;
+    (void) reach_variation_node(variation_trie);
+    for (next_move = current_game_head; !matches && next_move != NULL && num_next > 0;
+            next_move = next_move->next) {
+        variation_node **swap = reached_nodes;
+        unsigned n;
+
+        reached_nodes = next_nodes;
+        next_nodes = swap;
+        num_reached = num_next;
+        num_next = 0;
+        moves_followed++;
+        for (n = 0; n < num_reached && !matches; n++) {
+            matches = follow_matching_edges(reached_nodes[n], next_move->move);
+        }
+    }
+    return matches;
+}
+
+/* How often each of permutation_words has been played by each colour
+ * in the moves of the game so far.
+ */
+static unsigned *word_counts[2] = { NULL, NULL };
+static unsigned counted_words = 0;
+
+static Boolean
+multiset_matches(const move_multiset *multiset, const uint64_t played[2])
+{
+    unsigned r;
+
+    if ((multiset->signature[0] & ~played[0]) != 0 ||
+            (multiset->signature[1] & ~played[1]) != 0) {
+        return FALSE;
+    }
+    for (r = 0; r < multiset->num_requirements; r++) {
+        const move_requirement *requirement = &multiset->requirements[r];
+        unsigned count = word_counts[requirement->colour][requirement->word];
+
+        if (requirement->count == 0 ? count != 0 : count < requirement->count) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Do the moves of the current game match any of the compiled
+ * variations, in any order of the moves of each colour?
+ * This has the same result as permutation_match with each of them:
+ * the moves played by each colour within the length of a variation
+ * must include all of its plain moves of that colour, since the
+ * remainder are taken up by its ANY_MOVEs and DISALLOWED_MOVEs, and
+ * none of its DISALLOWED_MOVEs.
+ */
+static Boolean
+permutation_match_multisets(const Move *current_game_head)
+{
+    const Move *next_move = current_game_head;
+    uint64_t played[2] = { 0, 0 };
+    unsigned next_multiset = 0, ply = 0, colour;
+    Boolean matches = FALSE;
+
+    if (num_multisets == 0) {
+        return FALSE;
+    }
+    if (word_counts[0] == NULL || counted_words < num_permutation_words) {
+        for (colour = 0; colour < 2; colour++) {
+            (void) free((void *) word_counts[colour]);
+            word_counts[colour] = (unsigned *) malloc_or_die(
+                    (num_permutation_words + 1) * sizeof (*word_counts[colour]));
+        }
+        counted_words = num_permutation_words;
+    }
+    for (colour = 0; colour < 2; colour++) {
+        memset((void *) word_counts[colour], 0,
+               (num_permutation_words + 1) * sizeof (*word_counts[colour]));
+    }
+    while (!matches && next_multiset < num_multisets) {
+        if (multisets[next_multiset].length == ply) {
+            matches = multiset_matches(&multisets[next_multiset], played);
+            next_multiset++;
+        }
+        else if (next_move == NULL) {
+            /* The game is shorter than the rest. */
+            next_multiset = num_multisets;
+        }
+        else {
+            long word = permutation_word((const char *) next_move->move,
+                                         strlen((const char *) next_move->move),
+                                         FALSE);
+
+            colour = ply & 0x01;
+            if (word >= 0) {
+                word_counts[colour][word]++;
+                played[colour] |= ((uint64_t) 1) << (word & 63);
+            }
+            ply++;
+            next_move = next_move->next;
+        }
+    }
+    return matches;
+}
+
 /* Determine whether or not the current game is wanted.
  * It will be if we are either not looking for checkmate-only
  * games, or if we are and the games does end in checkmate.
@@ -746,18 +1383,22 @@ Boolean
 check_textual_variations(const Game *game_details)
 {
     Boolean wanted = FALSE;
-    variation_list *variation;
 
     if (games_to_keep != NULL) {
-        for (variation = games_to_keep; (variation != NULL) && !wanted;
-                variation = variation->next) {
-            if (GlobalState.match_permutations) {
-                wanted = permutation_match(game_details->moves, *variation);
-            }
-            else {
-                wanted = straight_match(game_details->moves, *variation);
+        if (!variations_compiled) {
+            compile_variations();
+        }
+        if (GlobalState.match_permutations) {
+            unsigned v;
+
+            wanted = permutation_match_multisets(game_details->moves);
+            for (v = 0; v < num_uncompiled && !wanted; v++) {
+                wanted = permutation_match(game_details->moves, *uncompiled_variations[v]);
             }
         }
+        else {
+            wanted = straight_match_trie(game_details->moves);
+        }
     }
     else {
         /* There are no variations, assume that selection is done
@@ -768,6 +1409,13 @@ check_textual_variations(const Game *game_details)
     return wanted;
 }
 
+/* Whether there are textual variations (-v) to be matched. */
+Boolean
+textual_variations_wanted(void)
+{
+    return games_to_keep != NULL;
+}
+
 /* Determine whether the number of ply in this game
  * is within the bounds of what we want.
  */
@@ -27,6 +27,7 @@ void add_positional_variation_from_line(char *line);
 void add_textual_variations_from_file(FILE *fpin);
 void add_textual_variation_from_line(char *line);
 Boolean check_textual_variations(const Game *game_details);
+Boolean textual_variations_wanted(void);
 Boolean check_move_bounds(unsigned plycount);
 void add_fen_positional_match(const char *fen_string);
 void add_fen_pattern_match(const char *fen_pattern, Boolean add_reverse, const char *label);
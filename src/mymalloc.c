@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "mymalloc.h"
 
 /* Allocate the required space or abort the program. */
@@ -50,3 +51,140 @@ realloc_or_die(void *space, size_t nbytes)
     }
     return result;
 }
+
+/* The nodes of the tree built for each game (Move, CommentList,
+ * StringList, Nag and Variation) are allocated from an arena
+ * while games are being parsed. The whole arena is reset once a
+ * game has been dealt with, rather than the nodes being returned
+ * one at a time, and its blocks are retained for the next game.
+ * Anything that must outlive a game, such as duplicate and ECO
+ * table entries, continues to use malloc_or_die.
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+    char *start, *end;
+} ArenaBlock;
+
+/* The strictest alignment of any of the nodes. */
+typedef union {
+    long double ld;
+    double d;
+    long l;
+    void *p;
+} ArenaAlignment;
+
+#define ARENA_ROUND(n) \
+    (((n) + sizeof (ArenaAlignment) - 1) / sizeof (ArenaAlignment) * sizeof (ArenaAlignment))
+#define ARENA_INITIAL_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (4 * 1024 * 1024)
+
+/* All the blocks, in the order they are used. */
+static ArenaBlock *arena_blocks = NULL;
+/* The block currently being allocated from, and its next free byte. */
+static ArenaBlock *current_block = NULL;
+static char *arena_next = NULL;
+/* Whether arena_malloc allocates from the arena. */
+static int arena_enabled = 0;
+
+/* Add a block of at least nbytes after current_block. */
+static ArenaBlock *
+new_arena_block(size_t nbytes)
+{
+    size_t size = ARENA_INITIAL_BLOCK_SIZE;
+    ArenaBlock *block;
+
+    if (current_block != NULL) {
+        size = (size_t) (current_block->end - current_block->start);
+        if (size < ARENA_MAX_BLOCK_SIZE) {
+            size *= 2;
+        }
+    }
+    if (size < nbytes) {
+        size = nbytes;
+    }
+    block = (ArenaBlock *) malloc_or_die(ARENA_ROUND(sizeof (*block)) + size);
+    block->start = (char *) block + ARENA_ROUND(sizeof (*block));
+    block->end = block->start + size;
+    if (current_block == NULL) {
+        block->next = arena_blocks;
+        arena_blocks = block;
+    }
+    else {
+        block->next = current_block->next;
+        current_block->next = block;
+    }
+    return block;
+}
+
+/* Allocate nbytes from the arena, if it is in use,
+ * otherwise from the heap.
+ */
+void *
+arena_malloc(size_t nbytes)
+{
+    void *result;
+
+    if (!arena_enabled) {
+        return malloc_or_die(nbytes);
+    }
+    nbytes = ARENA_ROUND(nbytes);
+    if (current_block == NULL || nbytes > (size_t) (current_block->end - arena_next)) {
+        ArenaBlock *next = current_block != NULL ? current_block->next : arena_blocks;
+
+        if (next == NULL || nbytes > (size_t) (next->end - next->start)) {
+            next = new_arena_block(nbytes);
+        }
+        current_block = next;
+        arena_next = next->start;
+    }
+    result = arena_next;
+    arena_next += nbytes;
+    return result;
+}
+
+/* Return whether space was allocated from the arena. */
+static int
+in_arena(const void *space)
+{
+    uintptr_t address = (uintptr_t) space;
+    const ArenaBlock *block;
+
+    for (block = arena_blocks; block != NULL; block = block->next) {
+        if ((uintptr_t) block->start <= address && address < (uintptr_t) block->end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Free space obtained from arena_malloc.
+ * Space in the arena is only reclaimed by reset_arena.
+ */
+void
+arena_free(void *space)
+{
+    if (space != NULL && !in_arena(space)) {
+        free(space);
+    }
+}
+
+/* Start or stop allocating from the arena.
+ * Return the previous setting.
+ */
+int
+use_arena(int enable)
+{
+    int previous = arena_enabled;
+    arena_enabled = enable;
+    return previous;
+}
+
+/* Reclaim everything allocated from the arena.
+ * The caller must ensure that none of it is still referenced.
+ */
+void
+reset_arena(void)
+{
+    current_block = NULL;
+    arena_next = NULL;
+}
@@ -25,6 +25,10 @@
 void *malloc_or_die(size_t nbytes);
 void *realloc_or_die(void *space,size_t nbytes);
 char *copy_string(const char *str);
+void *arena_malloc(size_t nbytes);
+void arena_free(void *space);
+int use_arena(int enable);
+void reset_arena(void);
 
 #endif	// MYMALLOC_H
 
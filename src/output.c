@@ -35,6 +35,8 @@
 #include "apply.h"
 #include "output.h"
 #include "mymalloc.h"
+#include "profile.h"
+#include "binary.h"
 
 
 /* Functions for outputting games in the required format. */
@@ -54,6 +56,8 @@
 
 /* How much text we have output on the current line. */
 static size_t line_length = 0;
+/* The annotation details of a move for which none have been set. */
+static const MoveAnnotation no_annotation = { NULL, NULL, ~(uint64_t) 0, 0, FALSE };
 /* The buffer in which each output line of a game is built. */
 static char *output_line = NULL;
 
@@ -90,6 +94,8 @@ static void start_comment(FILE *outputfile);
 static void end_comment(FILE *outputfile);
 static void print_as_comment(FILE *outputfile, const char *str);
 static CommentList *create_line_number_comment(const Game *game);
+static void add_line_number_marker(Game *current_game);
+static Boolean print_rewritten_game(Game *current_game, FILE *outputfile, Board *final_board);
 
 /* List, the order in which the tags should be output.
  * The first seven should be the Seven Tag Roster that should
@@ -175,6 +181,7 @@ which_output_format(const char *arg)
         { "XOLALG", XOLALG},
         { "xolalg", XOLALG},
         { "uci", UCI},
+        { "bin", BIN},
         { "cm", CM},
         { "", SOURCE},
         /* Add others before the terminating NULL. */
@@ -219,6 +226,7 @@ output_file_suffix(OutputFormat format)
     static const char EPD_suffix[] = ".epd";
     static const char FEN_suffix[] = ".fen";
     static const char CM_suffix[] = ".cm";
+    static const char BIN_suffix[] = ".bin";
 
     switch (format) {
         case SOURCE:
@@ -236,6 +244,8 @@ output_file_suffix(OutputFormat format)
             return FEN_suffix;
         case CM:
             return CM_suffix;
+        case BIN:
+            return BIN_suffix;
         default:
             return PGN_suffix;
     }
@@ -429,36 +439,44 @@ terminate_line(FILE *fp)
         line_length--;
     }
     if (line_length > 0) {
-        output_line[line_length] = '\0';
-        fprintf(fp, "%s\n", output_line);
+        /* output_line has room for the newline. */
+        output_line[line_length] = '\n';
+        (void) fwrite(output_line, 1, line_length + 1, fp);
         line_length = 0;
     }
 }
 
-/* Print str to fp and update how much of the line
- * has been printed on.
+/* Print the len characters of str to fp and update how much
+ * of the line has been printed on.
  */
-void
-print_str(FILE *fp, const char *str)
+static void
+print_chars(FILE *fp, const char *str, size_t len)
 {
-    size_t len = strlen(str);
-
     check_line_length(fp, len);
     if (len > GlobalState.max_line_length) {
         fprintf(GlobalState.logfile,
                 "String length %lu is too long for the line length of %lu:\n",
                 (unsigned long) len,
                 (unsigned long) GlobalState.max_line_length);
-        fprintf(GlobalState.logfile, "%s\n", str);
+        fprintf(GlobalState.logfile, "%.*s\n", (int) len, str);
         report_details(GlobalState.logfile);
-        fprintf(fp, "%s\n", str);
+        fprintf(fp, "%.*s\n", (int) len, str);
     }
     else {
-        sprintf(&(output_line[line_length]), "%s", str);
+        memcpy(&(output_line[line_length]), str, len);
         line_length += len;
     }
 }
 
+/* Print str to fp and update how much of the line
+ * has been printed on.
+ */
+void
+print_str(FILE *fp, const char *str)
+{
+    print_chars(fp, str, strlen(str));
+}
+
 /* Print the given str in separate space-separated
  * pieces to take account of line-breaks.
  * The str should not contain newline characters.
@@ -466,16 +484,21 @@ print_str(FILE *fp, const char *str)
 static void
 print_space_separated_str(FILE *fp, const char *str)
 {
-    char *copy = copy_string(str);
-    const char *chunk = strtok(copy, " ");
-    while (chunk != NULL) {
-        print_str(fp, chunk);
-        chunk = strtok((char *) NULL, " ");
-        if(chunk != NULL) {
-            print_separator(fp);
+    Boolean first = TRUE;
+    while (*str != '\0') {
+        while (*str == ' ') {
+            str++;
+        }
+        if (*str != '\0') {
+            size_t len = strcspn(str, " ");
+            if (!first) {
+                print_separator(fp);
+            }
+            print_chars(fp, str, len);
+            str += len;
+            first = FALSE;
         }
     }
-    (void) free((void *) copy);
 }
 
 static void
@@ -638,6 +661,30 @@ print_move_list(FILE *outputfile, unsigned move_number, Boolean white_to_move,
  */
 /* A length to accommodate move numbers. */
 #define SMALL_MOVE_NUMBER_LENGTH (20)
+/* How many move numbers are formatted once and then reused. */
+#define CACHED_MOVE_NUMBERS (512)
+
+/* Return the text of move_number as printed before a move. */
+static const char *
+move_number_text(unsigned move_number, Boolean white_to_move)
+{
+    static char *cached_text[2][CACHED_MOVE_NUMBERS];
+    static char small_number[SMALL_MOVE_NUMBER_LENGTH];
+    char **text = move_number < CACHED_MOVE_NUMBERS ?
+            &cached_text[white_to_move ? 0 : 1][move_number] : NULL;
+
+    if (text != NULL && *text != NULL) {
+        return *text;
+    }
+    /* @@@ Should 1... be written as 1. ... ? */
+    sprintf(small_number,
+            "%u.%s", move_number,
+            white_to_move ? "" : "..");
+    if (text != NULL) {
+        *text = copy_string(small_number);
+    }
+    return small_number;
+}
 
 static Boolean
 print_move(FILE *outputfile, unsigned move_number, Boolean print_move_number,
@@ -664,13 +711,7 @@ print_move(FILE *outputfile, unsigned move_number, Boolean print_move_number,
             if (*move_text != '\0') {
                 if (GlobalState.keep_move_numbers &&
                         (white_to_move || print_move_number)) {
-                    static char small_number[SMALL_MOVE_NUMBER_LENGTH];
-
-                    /* @@@ Should 1... be written as 1. ... ? */
-                    sprintf(small_number,
-                            "%u.%s", move_number,
-                            white_to_move ? "" : "..");
-                    print_str(outputfile, small_number);
+                    print_str(outputfile, move_number_text(move_number, white_to_move));
                     print_separator(outputfile);
                 }
                 switch (output_format) {
@@ -902,6 +943,8 @@ print_items_following_move(FILE *outputfile, const Move *move_details,
     Boolean something_printed = FALSE;
     Nag *nags = move_details->NAGs;
     Variation *variants = move_details->Variants;
+    const MoveAnnotation *annotation = move_details->annotation != NULL ?
+            move_details->annotation : &no_annotation;
     if (move_details->comment_list != NULL && GlobalState.keep_comments) {
         print_comment_list(outputfile, move_details->comment_list);
         something_printed = TRUE;
@@ -919,7 +962,7 @@ print_items_following_move(FILE *outputfile, const Move *move_details,
                 while(text != NULL) {
                     if(GlobalState.json_format) {
                         fprintf(outputfile, "\"%s\"", text->str);
-                        if(nags->next != NULL) {
+                        if(text->next != NULL || nags->next != NULL) {
                             fputs(", ", outputfile);
                         }
                     }
@@ -942,15 +985,15 @@ print_items_following_move(FILE *outputfile, const Move *move_details,
             fputs("] ", outputfile);
         }
     }
-    if (GlobalState.output_evaluation) {
+    if (GlobalState.output_evaluation && !annotation->no_evaluation) {
         if(GlobalState.json_format) {
             fprintf(outputfile, ", \"evaluation\" : \"%.2f\"", 
-                    move_details->evaluation);
+                    annotation->evaluation);
         } 
         else {
             const char valueSpace[] = "-012456789.00";
             char *evaluation = (char *) malloc_or_die(sizeof (valueSpace));
-            sprintf(evaluation, "%.2f", move_details->evaluation);
+            sprintf(evaluation, "%.2f", annotation->evaluation);
             if (strlen(evaluation) > strlen(valueSpace)) {
                 fprintf(GlobalState.logfile,
                         "Internal error: Overflow in evaluation space in print_items_following_move()\n");
@@ -963,17 +1006,17 @@ print_items_following_move(FILE *outputfile, const Move *move_details,
         }
     }
     if(GlobalState.add_FEN_comments) {
-        if(move_details->epd != NULL && move_details->fen_suffix != NULL) {
+        if(annotation->epd != NULL && annotation->fen_suffix != NULL) {
             if(GlobalState.json_format) {
                 fprintf(outputfile, ", \"FEN\" : \"%s %s\"", 
-                        move_details->epd,
-                        move_details->fen_suffix);
+                        annotation->epd,
+                        annotation->fen_suffix);
             }
             else {
                 start_comment(outputfile);
-                print_space_separated_str(outputfile, move_details->epd);
+                print_space_separated_str(outputfile, annotation->epd);
                 print_separator(outputfile);
-                print_space_separated_str(outputfile, move_details->fen_suffix);
+                print_space_separated_str(outputfile, annotation->fen_suffix);
                 end_comment(outputfile);
                 something_printed = TRUE;
             }
@@ -982,12 +1025,12 @@ print_items_following_move(FILE *outputfile, const Move *move_details,
     if (GlobalState.add_hashcode_comments) {
         if(GlobalState.json_format) {
             fprintf(outputfile, ", \"HashCode\" : \"");
-            fprintf(outputfile, "%016" PRIx64, move_details->zobrist);
+            fprintf(outputfile, "%016" PRIx64, annotation->zobrist);
             fprintf(outputfile, "\"");
         }
         else {
             char *hashcode = (char *) malloc_or_die(HASH_64_BIT_SPACE + 1);
-            sprintf(hashcode, "%016" PRIx64, move_details->zobrist);
+            sprintf(hashcode, "%016" PRIx64, annotation->zobrist);
             print_as_comment(outputfile, hashcode);
             (void) free((void *) hashcode);
             something_printed = TRUE;
@@ -1263,21 +1306,19 @@ output_cm_game(FILE *outputfile, unsigned move_number,
     putc('\n', outputfile);
 }
 
-/* Output the current game according to the required output format. */
-void
+/* Output the current game according to the required output format.
+ * Return TRUE if the game could be rewritten for output.
+ */
+Boolean
 format_game(Game *current_game, FILE *outputfile)
 {
-    Boolean white_to_move = TRUE;
-    unsigned move_number = 1;
-    Board *initial_board;
     /* The final board position, if available. */
     Board *final_board = NULL;
+    Boolean formatted;
+    ProfileMark mark;
 
-    if(GlobalState.line_number_marker != NULL) {
-	CommentList *comment = create_line_number_comment(current_game);
-	comment->next = current_game->prefix_comment;
-	current_game->prefix_comment = comment;
-    }
+    PROFILE_BEGIN(mark);
+    add_line_number_marker(current_game);
 
     /* We need a copy of the final board.
      * Combine the generation of this with a rewrite
@@ -1286,7 +1327,51 @@ format_game(Game *current_game, FILE *outputfile)
      * source form is required.
      */
     final_board = rewrite_game(current_game);
-    initial_board = new_game_board(current_game->tags[FEN_TAG]);
+    formatted = print_rewritten_game(current_game, outputfile, final_board);
+    free_board(final_board);
+    PROFILE_END(PROFILE_OUTPUT, mark);
+    return formatted;
+}
+
+/* Output a game whose moves have already been rewritten,
+ * with final_board being its final position.
+ */
+void
+format_rewritten_game(Game *current_game, FILE *outputfile, Board *final_board)
+{
+    ProfileMark mark;
+
+    PROFILE_BEGIN(mark);
+    add_line_number_marker(current_game);
+    (void) print_rewritten_game(current_game, outputfile, final_board);
+    PROFILE_END(PROFILE_OUTPUT, mark);
+}
+
+/* Add a comment of the game's line number to its prefix
+ * comment, if required.
+ */
+static void
+add_line_number_marker(Game *current_game)
+{
+    if(GlobalState.line_number_marker != NULL) {
+	CommentList *comment = create_line_number_comment(current_game);
+	comment->next = current_game->prefix_comment;
+	current_game->prefix_comment = comment;
+    }
+}
+
+/* Output a rewritten game in the required format.
+ * Return TRUE if final_board is available for it to be output.
+ */
+static Boolean
+print_rewritten_game(Game *current_game, FILE *outputfile, Board *final_board)
+{
+    Boolean white_to_move = TRUE;
+    unsigned move_number = 1;
+    Board *initial_board = new_game_board(current_game->tags[FEN_TAG]);
+    /* Where the game starts in outputfile, if that is known. */
+    long start_offset = PROFILING ?
+                            ftell(outputfile) : -1;
 
     /* If we aren't starting from the initial setup, then we
      * need to know the current move number and whose
@@ -1333,6 +1418,9 @@ format_game(Game *current_game, FILE *outputfile)
             case CM:
                 output_cm_game(outputfile, move_number, white_to_move, current_game);
                 break;
+            case BIN:
+                output_binary_game(current_game, outputfile);
+                break;
             default:
                 fprintf(GlobalState.logfile,
                         "Internal error: unknown output type %d in format_game().\n",
@@ -1340,9 +1428,16 @@ format_game(Game *current_game, FILE *outputfile)
                 break;
         }
         fflush(outputfile);
-        free_board(final_board);
+    }
+    if (start_offset >= 0) {
+        long end_offset = ftell(outputfile);
+        if (end_offset > start_offset) {
+            PROFILE_COUNT(PROFILE_BYTES_WRITTEN,
+                          (unsigned long) (end_offset - start_offset));
+        }
     }
     free_board(initial_board);
+    return final_board != NULL;
 }
 
 /* Add the given tag to the output ordering. */
@@ -1564,15 +1659,21 @@ print_EPD_move_list(Game *current_game, FILE *outputfile,
 {
     const char *game_comment = format_epd_game_comment(current_game->tags);
     const Move *move = current_game->moves;
+    /* What follows each EPD string on its line. */
+    size_t suffix_length = strlen(game_comment) + 2;
+    char *suffix = (char *) malloc_or_die(suffix_length + 1);
 
+    sprintf(suffix, " %s\n", game_comment);
     if (initial_board != NULL) {
         char epd[FEN_SPACE];
         build_basic_EPD_string(initial_board, epd);
-        fprintf(outputfile, "%s %s\n", epd, game_comment);
+        fputs(epd, outputfile);
+        (void) fwrite(suffix, 1, suffix_length, outputfile);
     }
     while (move != NULL) {
-        if (move->epd != NULL) {
-            fprintf(outputfile, "%s %s\n", move->epd, game_comment);
+        if (move->annotation != NULL && move->annotation->epd != NULL) {
+            fputs(move->annotation->epd, outputfile);
+            (void) fwrite(suffix, 1, suffix_length, outputfile);
         }
         else {
             fprintf(GlobalState.logfile, "Internal error: Missing EPD\n");
@@ -1581,9 +1682,21 @@ print_EPD_move_list(Game *current_game, FILE *outputfile,
         }
         move = move->next;
     }
+    (void) free((void *) suffix);
     (void) free((void *) game_comment);
 }
 
+/* Print the FEN string of board on a line of its own. */
+static void
+print_FEN_line(const Board *board)
+{
+    char fen[FEN_SPACE];
+    size_t length = build_FEN_string(board, fen);
+
+    fen[length] = '\n';
+    (void) fwrite(fen, 1, length + 1, GlobalState.outputfile);
+}
+
 static void print_FEN_move_list(Game *current_game, FILE *outputfile,
         unsigned move_number, Boolean white_to_move,
         Board *initial_board)
@@ -1603,17 +1716,13 @@ static void print_FEN_move_list(Game *current_game, FILE *outputfile,
     }
     else {
         keepPrinting = TRUE;
-        const char *FEN_string = get_FEN_string(board);
-        fprintf(GlobalState.outputfile, "%s\n", FEN_string);
-        free((void *) FEN_string);
+        print_FEN_line(board);
     }
 
     while (move != NULL && keepPrinting) {
         if (move->move[0] != '\0') {
             if(apply_move(move, board)) {
-                const char *FEN_string = get_FEN_string(board);
-                fprintf(GlobalState.outputfile, "%s\n", FEN_string);
-                free((void *) FEN_string);
+                print_FEN_line(board);
             }
             else {
                 keepPrinting = FALSE;
@@ -1730,7 +1839,7 @@ void add_plycount(const Game *game)
     sprintf(formatted_count, "%u", count);
 
     if (game->tags[PLY_COUNT_TAG] != NULL) {
-        (void) free(game->tags[PLY_COUNT_TAG]);
+        free_tag_value(game->tags[PLY_COUNT_TAG]);
     }
     game->tags[PLY_COUNT_TAG] = copy_string(formatted_count);
 }
@@ -1746,7 +1855,7 @@ void add_total_plycount(const Game *game, Boolean count_variations)
     sprintf(formatted_count, "%u", count);
 
     if (game->tags[TOTAL_PLY_COUNT_TAG] != NULL) {
-        (void) free(game->tags[TOTAL_PLY_COUNT_TAG]);
+        free_tag_value(game->tags[TOTAL_PLY_COUNT_TAG]);
     }
     game->tags[TOTAL_PLY_COUNT_TAG] = copy_string(formatted_count);
 }
@@ -1762,7 +1871,7 @@ static void add_hashcode_tag(const Game *game)
     sprintf(formatted_code, "%08x", (unsigned) hashcode);
 
     if (game->tags[HASHCODE_TAG] != NULL) {
-        (void) free(game->tags[HASHCODE_TAG]);
+        free_tag_value(game->tags[HASHCODE_TAG]);
     }
     game->tags[HASHCODE_TAG] = copy_string(formatted_code);
 }
@@ -1789,7 +1898,7 @@ static CommentList *create_line_number_comment(const Game *game)
 	exit(1);
     }
     StringList *current_comment = save_string_list_item(NULL, line_number_comment);
-    CommentList *comment = (CommentList*) malloc_or_die(sizeof (*comment));
+    CommentList *comment = (CommentList*) arena_malloc(sizeof (*comment));
 
     comment->comment = current_comment;
     comment->next = NULL;
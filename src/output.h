@@ -22,7 +22,8 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
-void format_game(Game *current_game,FILE *outputfile);
+Boolean format_game(Game *current_game,FILE *outputfile);
+void format_rewritten_game(Game *current_game, FILE *outputfile, Board *final_board);
 void print_str(FILE *fp, const char *str);
 void terminate_line(FILE *fp);
 OutputFormat which_output_format(const char *arg);
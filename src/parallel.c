@@ -0,0 +1,658 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for --threads N.
+ * The games are matched and formatted by N worker processes and
+ * then output, in their original order, by the parent process.
+ * Each worker is forked once the arguments have been processed,
+ * so it has its own copy of the matching criteria and of all the
+ * state that is otherwise shared by the functions that deal with
+ * a single game.
+ * Every worker walks the whole of each input file, finding the same
+ * chunks of complete games, and lexes only every Nth chunk, starting
+ * with its own number.  For each game it sends the parent a record
+ * of whether it matched, its hash values, a few of its tags, any log
+ * output and the formatted text of the game.  The parent reads the records of each
+ * chunk in turn and disposes of the games exactly as if it had
+ * matched them itself, so the output is the same as without --threads.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define PARALLEL_GAMES 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if PARALLEL_GAMES
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "grammar.h"
+#include "apply.h"
+#include "parallel.h"
+#include "profile.h"
+#include "compress.h"
+#include "engine.h"
+#include "statistics.h"
+
+#if PARALLEL_GAMES
+
+/* The minimum size of a chunk of input, in characters.
+ * Chunks should contain enough games to even out the
+ * differing times taken to process individual games.
+ */
+#define CHUNK_SIZE (64 * 1024)
+
+typedef enum {
+    GAME_RECORD, END_OF_CHUNK, END_OF_INPUT
+} RecordKind;
+
+/* The tags that the parent needs in order to report
+ * on a game and select its output file.
+ */
+static const TagName recorded_tags[] = {
+    WHITE_TAG, BLACK_TAG, EVENT_TAG, SITE_TAG, DATE_TAG, ECO_TAG
+};
+#define NUM_RECORDED_TAGS (sizeof(recorded_tags) / sizeof(*recorded_tags))
+
+/* What a worker sends to the parent about each game.
+ * A record is followed by log_length characters of log output,
+ * the values of the recorded tags that are present,
+ * text_length characters of the formatted game and
+ * format_log_length characters of log output from formatting it.
+ * The latter is only written by the parent if the game is output.
+ * END_OF_CHUNK and END_OF_INPUT records have only log output.
+ */
+typedef struct {
+    RecordKind kind;
+    unsigned file_number;
+    Boolean wanted;
+    Boolean moves_ok;
+    Boolean has_text;
+    unsigned plycount;
+    HashCode final_hash_value;
+    HashCode cumulative_hash_value;
+    HashCode fuzzy_duplicate_hash;
+    size_t log_length;
+    /* The length of each recorded tag; -1 if it is not present. */
+    long tag_lengths[NUM_RECORDED_TAGS];
+    size_t text_length;
+    size_t format_log_length;
+} GameRecord;
+
+static Boolean parallel_processing_possible(void);
+static void run_worker(unsigned worker, unsigned num_workers);
+static void record_game(Game *game, unsigned plycount, Boolean wanted);
+static void send_record(GameRecord *record, char **tags, const char *text,
+        const char *format_log);
+static void start_log_capture(void);
+static void discard_captured_log(void);
+static void flush_captured_log(void);
+static void receive_records(FILE **results, unsigned num_workers);
+static void receive_statistics(FILE **results, unsigned num_workers,
+        unsigned finished);
+static void read_or_die(void *data, size_t length, FILE *fp);
+
+/* Where a worker writes its records. */
+static FILE *worker_results = NULL;
+/* The real logfile, while a worker captures its log output. */
+static FILE *worker_logfile = NULL;
+/* The log output captured by a worker. */
+static char *captured_log = NULL;
+static size_t captured_log_length = 0;
+
+/* Process all of the input with GlobalState.num_threads workers.
+ * Return FALSE, having done nothing, if that is not possible,
+ * in which case the input must be processed by yyparse as normal.
+ */
+Boolean
+process_in_parallel(void)
+{
+    if (!parallel_processing_possible()) {
+        return FALSE;
+    }
+    else {
+        const unsigned num_workers = GlobalState.num_threads;
+        FILE **results = (FILE **) malloc_or_die(num_workers * sizeof(*results));
+        pid_t *workers = (pid_t *) malloc_or_die(num_workers * sizeof(*workers));
+        unsigned w;
+
+        /* Nothing buffered must be written twice. */
+        fflush(NULL);
+        for (w = 0; w < num_workers; w++) {
+            int fds[2];
+
+            if (pipe(fds) != 0) {
+                perror("pipe");
+                exit(1);
+            }
+            workers[w] = fork();
+            if (workers[w] < 0) {
+                perror("fork");
+                exit(1);
+            }
+            else if (workers[w] == 0) {
+                unsigned other;
+
+                for (other = 0; other < w; other++) {
+                    (void) fclose(results[other]);
+                }
+                (void) close(fds[0]);
+                worker_results = fdopen(fds[1], "w");
+                if (worker_results == NULL) {
+                    perror("fdopen");
+                    exit(1);
+                }
+                run_worker(w, num_workers);
+                stop_engines();
+                /* Avoid flushing the parent's buffers or running its
+                 * exit handlers.
+                 */
+                _exit(0);
+            }
+            else {
+                (void) close(fds[1]);
+                results[w] = fdopen(fds[0], "r");
+                if (results[w] == NULL) {
+                    perror("fdopen");
+                    exit(1);
+                }
+            }
+        }
+
+        receive_records(results, num_workers);
+
+        for (w = 0; w < num_workers; w++) {
+            /* Workers may still be running if processing finished early.
+             * Those that are profiled are left to report, unless they
+             * are stopped by the closing of their pipe.
+             */
+            if (!PROFILING) {
+                (void) kill(workers[w], SIGTERM);
+            }
+            (void) fclose(results[w]);
+            (void) waitpid(workers[w], NULL, 0);
+        }
+        (void) free((void *) results);
+        (void) free((void *) workers);
+        return TRUE;
+    }
+}
+
+/* Whether the current options and input permit parallel processing. */
+static Boolean
+parallel_processing_possible(void)
+{
+    const char *unsupported = NULL;
+    unsigned file_number;
+
+    if (GlobalState.num_threads < 2) {
+        return FALSE;
+    }
+    if (input_file_name(0) == NULL) {
+        unsupported = "standard input";
+    }
+    for (file_number = 0; unsupported == NULL &&
+            input_file_name(file_number) != NULL; file_number++) {
+        struct stat file_details;
+
+        /* Every worker must be able to read every file,
+         * and find its chunks in a mapping of it.
+         */
+        if (stat(input_file_name(file_number), &file_details) != 0 ||
+                !S_ISREG(file_details.st_mode) ||
+                compressed_input_file(input_file_name(file_number))) {
+            unsupported = input_file_name(file_number);
+        }
+    }
+    if (unsupported == NULL) {
+        if (GlobalState.json_format) {
+            unsupported = "--json";
+        }
+        else if (GlobalState.output_format == BIN) {
+            unsupported = "-Wbin";
+        }
+        else if (GlobalState.delete_same_setup) {
+            unsupported = "--deletesamesetup";
+        }
+        else if (GlobalState.position_index_file != NULL) {
+            unsupported = "--posindex";
+        }
+        else if (GlobalState.statistics_key != NULL &&
+                (GlobalState.suppress_duplicates || GlobalState.suppress_originals ||
+                 GlobalState.first_game_number > 1 || GlobalState.game_limit != ~0UL ||
+                 GlobalState.matching_game_numbers != NULL ||
+                 GlobalState.skip_game_numbers != NULL ||
+                 GlobalState.maximum_matches > 0)) {
+            /* The workers tally the games they match, before the parent
+             * selects which of them to output.
+             */
+            unsupported = "--stats and -D, -U, --firstgame, --gamelimit, --selectonly, --skipmatching or --stopafter";
+        }
+    }
+    if (unsupported != NULL) {
+        fprintf(GlobalState.logfile,
+                "--threads is not supported with %s; using a single thread.\n",
+                unsupported);
+        return FALSE;
+    }
+    else {
+        return TRUE;
+    }
+}
+
+/* Match and format the games in every num_workers-th chunk of the
+ * input, starting with chunk number worker.
+ */
+static void
+run_worker(unsigned worker, unsigned num_workers)
+{
+    GameRecord record;
+    unsigned long chunk = 0;
+    unsigned file_number;
+    Boolean ok = TRUE;
+
+    worker_logfile = GlobalState.logfile;
+    start_log_capture();
+    atexit(flush_captured_log);
+    set_game_recorder(record_game);
+
+    for (file_number = 0; ok && input_file_name(file_number) != NULL;
+            file_number++) {
+        Boolean opened = open_chunked_input(file_number);
+
+        if (file_number == 0 || chunk % num_workers != worker) {
+            /* Only the worker with the file's first chunk reports on it,
+             * and the parent has already opened the first file.
+             */
+            discard_captured_log();
+        }
+        else if (!opened) {
+            fprintf(GlobalState.logfile, "Unable to open the PGN file: %s\n",
+                    input_file_name(file_number));
+        }
+        if (!opened) {
+            ok = FALSE;
+        }
+        else {
+            Boolean mine = chunk % num_workers == worker;
+
+            while (GlobalState.split_input_by_offset ?
+                    next_offset_chunk(CHUNK_SIZE, mine) :
+                    next_input_chunk(CHUNK_SIZE, mine)) {
+                if (mine) {
+                    (void) yyparse(GlobalState.current_file_type);
+                    memset((void *) &record, 0, sizeof(record));
+                    record.kind = END_OF_CHUNK;
+                    send_record(&record, NULL, NULL, NULL);
+                    fflush(worker_results);
+                }
+                chunk++;
+                mine = chunk % num_workers == worker;
+            }
+        }
+    }
+    if (PROFILING) {
+        /* Report before the parent is told that the worker has finished. */
+        char process[20];
+
+        sprintf(process, "worker %u", worker + 1);
+        report_profile(worker_logfile, process);
+        fflush(worker_logfile);
+    }
+    memset((void *) &record, 0, sizeof(record));
+    record.kind = END_OF_INPUT;
+    if (GlobalState.statistics_key != NULL) {
+        /* The tallies are sent as the text of the record. */
+        char *statistics = serialise_statistics(&record.text_length);
+
+        record.has_text = TRUE;
+        send_record(&record, NULL, statistics, "");
+        (void) free((void *) statistics);
+    }
+    else {
+        send_record(&record, NULL, NULL, NULL);
+    }
+    fflush(worker_results);
+}
+
+/* The GameRecorder for a worker: format the game, if it might
+ * be output, and send its details to the parent.
+ */
+static void
+record_game(Game *game, unsigned plycount, Boolean wanted)
+{
+    GameRecord record;
+    char *text = NULL;
+    size_t text_length = 0;
+    char *format_log = NULL;
+    size_t format_log_length = 0;
+
+    memset((void *) &record, 0, sizeof(record));
+    record.kind = GAME_RECORD;
+    record.file_number = current_file_number();
+    record.wanted = wanted;
+    record.plycount = plycount;
+    record.final_hash_value = game->final_hash_value;
+    record.cumulative_hash_value = game->cumulative_hash_value;
+    record.fuzzy_duplicate_hash = game->fuzzy_duplicate_hash;
+
+    if (GlobalState.current_file_type != CHECKFILE) {
+        /* Anticipate the requirements of dispose_of_game. */
+        Boolean format_it;
+
+        if (GlobalState.non_matching_file != NULL) {
+            if (!wanted && !game->moves_checked) {
+                unsigned full_plycount;
+
+                (void) apply_move_list(game, &full_plycount, 0);
+            }
+            format_it = wanted || game->moves_ok || GlobalState.keep_broken_games;
+        }
+        else {
+            format_it = wanted && !GlobalState.check_only;
+        }
+        if (format_it) {
+            FILE *log = GlobalState.logfile;
+            FILE *fp = open_memstream(&text, &text_length);
+
+            GlobalState.logfile = open_memstream(&format_log, &format_log_length);
+            if (fp == NULL || GlobalState.logfile == NULL) {
+                GlobalState.logfile = log;
+                perror("open_memstream");
+                exit(1);
+            }
+            output_game(game, fp);
+            (void) fclose(fp);
+            (void) fclose(GlobalState.logfile);
+            GlobalState.logfile = log;
+            record.has_text = TRUE;
+            record.text_length = text_length;
+            record.format_log_length = format_log_length;
+        }
+    }
+    if (GlobalState.statistics_key != NULL && wanted &&
+            GlobalState.current_file_type != CHECKFILE) {
+        tally_game_statistics(game);
+    }
+    record.moves_ok = game->moves_ok;
+    send_record(&record, game->tags, text, format_log);
+    if (text != NULL) {
+        (void) free((void *) text);
+    }
+    if (format_log != NULL) {
+        (void) free((void *) format_log);
+    }
+}
+
+/* Send record, along with the log output captured since the
+ * previous record, and the tags and text of the game that it
+ * describes, if any.
+ */
+static void
+send_record(GameRecord *record, char **tags, const char *text,
+        const char *format_log)
+{
+    Boolean ok;
+    unsigned t;
+
+    for (t = 0; t < NUM_RECORDED_TAGS; t++) {
+        const char *value = tags != NULL ? tags[recorded_tags[t]] : NULL;
+
+        record->tag_lengths[t] = value != NULL ? (long) strlen(value) : -1;
+    }
+    (void) fclose(GlobalState.logfile);
+    record->log_length = captured_log_length;
+    ok = fwrite((const void *) record, sizeof(*record), 1, worker_results) == 1 &&
+            fwrite((const void *) captured_log, sizeof(char),
+                   record->log_length, worker_results) == record->log_length;
+    for (t = 0; ok && t < NUM_RECORDED_TAGS; t++) {
+        if (record->tag_lengths[t] > 0) {
+            ok = fwrite((const void *) tags[recorded_tags[t]], sizeof(char),
+                    (size_t) record->tag_lengths[t], worker_results) ==
+                    (size_t) record->tag_lengths[t];
+        }
+    }
+    if (ok && record->has_text && text != NULL) {
+        ok = fwrite((const void *) text, sizeof(char),
+                record->text_length, worker_results) == record->text_length &&
+             fwrite((const void *) format_log, sizeof(char),
+                record->format_log_length, worker_results) ==
+                    record->format_log_length;
+    }
+    if (!ok) {
+        /* The parent has stopped reading. */
+        _exit(1);
+    }
+    (void) free((void *) captured_log);
+    start_log_capture();
+}
+
+/* Capture a worker's log output, to be sent to the parent. */
+static void
+start_log_capture(void)
+{
+    captured_log = NULL;
+    captured_log_length = 0;
+    GlobalState.logfile = open_memstream(&captured_log, &captured_log_length);
+    if (GlobalState.logfile == NULL) {
+        GlobalState.logfile = worker_logfile;
+        perror("open_memstream");
+        exit(1);
+    }
+}
+
+/* Throw away the log output captured since the previous record. */
+static void
+discard_captured_log(void)
+{
+    (void) fclose(GlobalState.logfile);
+    (void) free((void *) captured_log);
+    start_log_capture();
+}
+
+/* Write any captured log output directly if a worker exits
+ * because of an error.
+ */
+static void
+flush_captured_log(void)
+{
+    if (GlobalState.logfile != worker_logfile) {
+        (void) fclose(GlobalState.logfile);
+        GlobalState.logfile = worker_logfile;
+        (void) fwrite((const void *) captured_log, sizeof(char),
+                captured_log_length, worker_logfile);
+        fflush(worker_logfile);
+    }
+}
+
+/* Dispose of the games described by the workers' records, taking
+ * the chunks from the workers in turn.
+ */
+static void
+receive_records(FILE **results, unsigned num_workers)
+{
+    unsigned w = 0;
+    Boolean finished = FALSE;
+    /* Space for the text of a record. */
+    char *text = NULL;
+    size_t text_space = 0;
+    char *tags[ORIGINAL_NUMBER_OF_TAGS];
+    unsigned t;
+
+    for (t = 0; t < ORIGINAL_NUMBER_OF_TAGS; t++) {
+        tags[t] = NULL;
+    }
+
+    while (!finished) {
+        GameRecord record;
+        size_t needed;
+
+        read_or_die((void *) &record, sizeof(record), results[w]);
+        needed = record.log_length + record.text_length +
+                record.format_log_length + 1;
+        for (t = 0; t < NUM_RECORDED_TAGS; t++) {
+            if (record.tag_lengths[t] >= 0) {
+                needed += (size_t) record.tag_lengths[t] + 1;
+            }
+        }
+        if (needed > text_space) {
+            text = (char *) realloc_or_die((void *) text, needed);
+            text_space = needed;
+        }
+        read_or_die((void *) text, record.log_length, results[w]);
+        (void) fwrite((const void *) text, sizeof(char), record.log_length,
+                GlobalState.logfile);
+
+        switch (record.kind) {
+            case GAME_RECORD:
+            {
+                Game game;
+                FormattedGame formatted;
+                char *next = text;
+
+                for (t = 0; t < NUM_RECORDED_TAGS; t++) {
+                    if (record.tag_lengths[t] >= 0) {
+                        size_t length = (size_t) record.tag_lengths[t];
+
+                        read_or_die((void *) next, length, results[w]);
+                        next[length] = '\0';
+                        tags[recorded_tags[t]] = next;
+                        next += length + 1;
+                    }
+                    else {
+                        tags[recorded_tags[t]] = NULL;
+                    }
+                }
+                formatted.text = next;
+                formatted.text_length = record.text_length;
+                read_or_die((void *) next, record.text_length, results[w]);
+                next += record.text_length;
+                formatted.log = next;
+                formatted.log_length = record.format_log_length;
+                read_or_die((void *) next, record.format_log_length, results[w]);
+
+                memset((void *) &game, 0, sizeof(game));
+                game.tags = tags;
+                game.tags_length = ORIGINAL_NUMBER_OF_TAGS;
+                game.moves_checked = TRUE;
+                game.moves_ok = record.moves_ok;
+                game.final_hash_value = record.final_hash_value;
+                game.cumulative_hash_value = record.cumulative_hash_value;
+                game.fuzzy_duplicate_hash = record.fuzzy_duplicate_hash;
+
+                if (GlobalState.current_input_file !=
+                        input_file_name(record.file_number)) {
+                    select_input_file(record.file_number);
+                }
+                dispose_of_game(&game, record.plycount, record.wanted,
+                        &formatted);
+                finished = finished_processing();
+                break;
+            }
+            case END_OF_CHUNK:
+                w = (w + 1) % num_workers;
+                break;
+            case END_OF_INPUT:
+                read_or_die((void *) text, record.text_length, results[w]);
+                if (GlobalState.statistics_key != NULL) {
+                    merge_statistics(text, record.text_length);
+                    receive_statistics(results, num_workers, w);
+                }
+                finished = TRUE;
+                break;
+        }
+    }
+    if (text != NULL) {
+        (void) free((void *) text);
+    }
+}
+
+/* Merge the tallies of --stats that the workers other than finished
+ * send with their END_OF_INPUT records, once all of the chunks have
+ * been received.
+ */
+static void
+receive_statistics(FILE **results, unsigned num_workers, unsigned finished)
+{
+    unsigned w;
+
+    for (w = 0; w < num_workers; w++) {
+        if (w != finished) {
+            GameRecord record;
+            char *data;
+
+            read_or_die((void *) &record, sizeof(record), results[w]);
+            if (record.kind != END_OF_INPUT) {
+                fprintf(GlobalState.logfile,
+                        "Internal error: missing end of input from a --threads worker.\n");
+                exit(1);
+            }
+            data = (char *) malloc_or_die(record.log_length + record.text_length + 1);
+            /* Any log output is discarded, as it is without --stats. */
+            read_or_die((void *) data, record.log_length, results[w]);
+            read_or_die((void *) data, record.text_length, results[w]);
+            merge_statistics(data, record.text_length);
+            (void) free((void *) data);
+        }
+    }
+}
+
+/* Read length bytes of a record from fp, or exit if the worker
+ * has failed.
+ */
+static void
+read_or_die(void *data, size_t length, FILE *fp)
+{
+    if (length > 0 && fread(data, 1, length, fp) != length) {
+        fprintf(GlobalState.logfile,
+                "A --threads worker process failed.\n");
+        exit(1);
+    }
+}
+
+#else
+
+/* Parallel processing is only available on POSIX systems. */
+Boolean
+process_in_parallel(void)
+{
+    if (GlobalState.num_threads > 1) {
+        fprintf(GlobalState.logfile,
+                "--threads is not supported on this system; using a single thread.\n");
+    }
+    return FALSE;
+}
+
+#endif
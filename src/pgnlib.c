@@ -0,0 +1,225 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* The library interface of pgn-extract: see pgnlib.h. */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define MEMORY_STREAMS 1
+#endif
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bool.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "grammar.h"
+#include "main.h"
+#include "argsfile.h"
+#include "pgnlib.h"
+
+/* Whether pgn_extract_init has been called, and whether it succeeded. */
+static Boolean init_called = FALSE;
+static Boolean initialised = FALSE;
+/* Where pgn_extract_init returns to after an error in the options. */
+static jmp_buf options_error;
+
+/* Return from pgn_extract_init after an error in the options. */
+static void
+return_options_error(void)
+{
+    longjmp(options_error, 1);
+}
+
+/* Check that the options given to pgn_extract_init name no input
+ * files and select nothing that needs more than one buffer of games
+ * or writes the games matched to files of its own.
+ */
+static Boolean
+library_options_ok(void)
+{
+    const char *unsupported = NULL;
+
+    if (input_file_name(0) != NULL) {
+        unsupported = "Input files";
+    }
+    else if (GlobalState.outputfile != stdout) {
+        unsupported = "-o and -a";
+    }
+    else if (GlobalState.games_per_file > 0) {
+        unsupported = "-#";
+    }
+    else if (GlobalState.ECO_level != DONT_DIVIDE) {
+        unsupported = "-E";
+    }
+    else if (GlobalState.num_threads > 1) {
+        unsupported = "--threads";
+    }
+    else if (GlobalState.position_index_file != NULL) {
+        unsupported = "--posindex";
+    }
+    else if (GlobalState.batch_file != NULL) {
+        unsupported = "--batch";
+    }
+    else if (GlobalState.checkpoint_file != NULL) {
+        unsupported = "--checkpoint";
+    }
+    else if (GlobalState.async_output) {
+        unsupported = "--asyncoutput";
+    }
+    else if (GlobalState.duplicate_scan_prefix != NULL ||
+            GlobalState.duplicate_merge_file != NULL ||
+            GlobalState.duplicate_resolve_prefix != NULL) {
+        unsupported = "--dupscan, --dupmerge and --dupresolve";
+    }
+    if (unsupported != NULL) {
+        fprintf(GlobalState.logfile,
+                "%s cannot be used with the library interface.\n",
+                unsupported);
+        return FALSE;
+    }
+    else {
+        return TRUE;
+    }
+}
+
+/* Prepare to process games with the options in argv, given in the
+ * same way as to the program, from argv[1] onwards.
+ * This must be called once, before any buffer is processed.
+ * Return 0 if the options are usable, or -1 if not, having
+ * reported why to the log.
+ */
+int
+pgn_extract_init(int argc, char *argv[])
+{
+    if (init_called) {
+        fprintf(GlobalState.logfile,
+                "pgn_extract_init must only be called once.\n");
+        return -1;
+    }
+    init_called = TRUE;
+    init_program();
+    set_argument_error_handler(return_options_error);
+    if (setjmp(options_error) != 0) {
+        set_argument_error_handler(NULL);
+        return -1;
+    }
+    process_program_arguments(argc, argv);
+    if (!library_options_ok()) {
+        set_argument_error_handler(NULL);
+        return -1;
+    }
+    prepare_to_read_games();
+    set_argument_error_handler(NULL);
+    initialised = TRUE;
+    return 0;
+}
+
+#if MEMORY_STREAMS
+/* Process the length bytes of PGN text in pgn and fill in result.
+ * The counts of games, the game numbers of --selectonly and
+ * --skipmatching, and --stopafter apply to each buffer separately,
+ * but games are found to be duplicates of those in earlier buffers.
+ * Return 0 if the buffer was processed, or -1 if it could not be.
+ */
+int
+pgn_extract_buffer(const char *pgn, size_t length, PgnExtractResult *result)
+{
+    FILE *logfile = GlobalState.logfile;
+    FILE *input = NULL;
+    FILE *output, *log;
+
+    memset((void *) result, 0, sizeof(*result));
+    if (!initialised) {
+        return -1;
+    }
+    /* An empty buffer has no games, and fmemopen need not accept it. */
+    if (length > 0) {
+        input = fmemopen((void *) pgn, length, "r");
+        if (input == NULL) {
+            return -1;
+        }
+    }
+    output = open_memstream(&result->output, &result->output_length);
+    log = open_memstream(&result->log, &result->log_length);
+    if (output == NULL || log == NULL) {
+        if (input != NULL) {
+            (void) fclose(input);
+        }
+        if (output != NULL) {
+            (void) fclose(output);
+        }
+        if (log != NULL) {
+            (void) fclose(log);
+        }
+        pgn_extract_free_result(result);
+        return -1;
+    }
+
+    GlobalState.outputfile = output;
+    GlobalState.logfile = log;
+    GlobalState.num_games_processed = 0;
+    GlobalState.num_games_matched = 0;
+    GlobalState.next_game_number_to_output = GlobalState.matching_game_numbers;
+    GlobalState.next_game_number_to_skip = GlobalState.skip_game_numbers;
+    if (input != NULL) {
+        open_input_stream(input, "buffer");
+        yyparse(GlobalState.current_file_type);
+        close_input();
+    }
+    finish_json_output();
+    result->games_processed = GlobalState.num_games_processed;
+    result->games_matched = GlobalState.num_games_matched;
+
+    GlobalState.outputfile = stdout;
+    GlobalState.logfile = logfile;
+    (void) fclose(output);
+    (void) fclose(log);
+    return 0;
+}
+#else
+int
+pgn_extract_buffer(const char *pgn, size_t length, PgnExtractResult *result)
+{
+    memset((void *) result, 0, sizeof(*result));
+    fprintf(GlobalState.logfile,
+            "pgn_extract_buffer is not supported on this system.\n");
+    return -1;
+}
+#endif
+
+/* Free the output and log of result. */
+void
+pgn_extract_free_result(PgnExtractResult *result)
+{
+    free((void *) result->output);
+    free((void *) result->log);
+    result->output = NULL;
+    result->log = NULL;
+    result->output_length = 0;
+    result->log_length = 0;
+}
@@ -0,0 +1,68 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* The interface for using pgn-extract as a library, built as
+ * libpgn-extract.a, so that games can be processed without
+ * starting a new process for each set of them.
+ * The selection and output options are fixed by pgn_extract_init,
+ * which takes the same options as the program, and each buffer of
+ * games is then processed as if it were the program's input.
+ * Errors in the games are reported in the log of each buffer.
+ * pgn_extract_init reports errors in the options to stderr, or the
+ * file of -l, and returns -1, after which the library cannot be used.
+ *
+ * Limitations:
+ * The library keeps its state in the same global variables as the
+ * program, so it is not reentrant: there can be only one set of
+ * options in a process, and only one thread may use it at a time.
+ * Fatal errors, such as running out of memory, an internal error,
+ * or a file of -t or -v that cannot be opened, still end
+ * the process, as do -h and --version.
+ */
+
+#ifndef PGNLIB_H
+#define PGNLIB_H
+
+#include <stddef.h>
+
+/* The result of processing a buffer of games.
+ * output and log are allocated with malloc and are freed
+ * by pgn_extract_free_result.
+ */
+typedef struct {
+    /* The games output, in the format selected by the options. */
+    char *output;
+    size_t output_length;
+    /* Any warnings and errors, and -r's report. */
+    char *log;
+    size_t log_length;
+    /* The number of games read and the number that matched. */
+    unsigned long games_processed;
+    unsigned long games_matched;
+} PgnExtractResult;
+
+int pgn_extract_init(int argc, char *argv[]);
+int pgn_extract_buffer(const char *pgn, size_t length, PgnExtractResult *result);
+void pgn_extract_free_result(PgnExtractResult *result);
+
+#endif	// PGNLIB_H
+
@@ -0,0 +1,649 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for --posindex file.
+ * A position index records where every position of every game in
+ * a set of input files occurs, so that a later search of the
+ * same files for positions (-x) need only read the games that
+ * contain one of them.
+ * Positions are identified by the piece placement component of
+ * their polyglot hash value, because -x matches regardless of
+ * castling rights and the player to move.
+ * Games are located by the chunks of the input found by
+ * next_input_chunk, each of which holds one game.
+ * If the index does not exist, or the input files have changed
+ * since it was built, then the input is processed as normal and
+ * the index is built along the way.
+ * Otherwise, if the only positional criteria are positions to be matched,
+ * just the games that contain one of them are processed, so the
+ * games matched are the same as from processing all of the input.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define POSITION_INDEX 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if POSITION_INDEX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "grammar.h"
+#include "apply.h"
+#include "posindex.h"
+#include "compress.h"
+
+#if POSITION_INDEX
+
+#define POSITION_INDEX_MAGIC "PGNPOSIX"
+#define POSITION_INDEX_VERSION 1
+
+/* The minimum chunk size that results in a chunk per game. */
+#define GAME_CHUNK_SIZE 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_files;
+    uint64_t num_chunks;
+    uint64_t num_positions;
+    /* The number of games in all of the files. */
+    uint64_t num_games;
+    /* The number of bytes in the pool of file names. */
+    uint64_t name_space;
+} PositionIndexHeader;
+
+/* The details of an input file at the time of indexing. */
+typedef struct {
+    int64_t size;
+    int64_t time;
+    /* Offset of the file's name in the name pool. */
+    uint32_t name;
+    uint32_t unused;
+} IndexedFile;
+
+typedef struct {
+    /* Offsets of the start and end of the chunk in its file. */
+    uint64_t start, end;
+    /* The number of lines before the start. */
+    uint64_t first_line;
+    /* The number of games processed before the chunk. */
+    uint64_t games_before;
+    uint32_t file_number;
+    uint32_t unused;
+} IndexedChunk;
+
+typedef struct {
+    uint64_t placement;
+    uint32_t chunk;
+    /* The earliest ply at which the position occurs in the chunk. */
+    uint32_t ply;
+} IndexedPosition;
+
+/* The index, either as built or as read from the file. */
+static struct {
+    const IndexedFile *files;
+    uint32_t num_files;
+    const IndexedChunk *chunks;
+    size_t num_chunks;
+    const IndexedPosition *positions;
+    size_t num_positions;
+    uint64_t num_games;
+    const char *names;
+} position_index;
+
+/* The index being built as the input is processed. */
+static struct {
+    Boolean active;
+    IndexedChunk *chunks;
+    size_t num_chunks, max_chunks;
+    IndexedPosition *positions;
+    size_t num_positions, max_positions;
+} index_build = { FALSE, NULL, 0, 0, NULL, 0, 0 };
+
+static Boolean position_index_possible(void);
+static Boolean load_position_index(const char *index_file);
+static void build_position_index(const char *index_file);
+static void save_position_index(const char *index_file);
+static Boolean position_query_possible(void);
+static void answer_position_query(const uint64_t *placements, size_t count);
+static void record_position(uint64_t placement, unsigned ply);
+static int compare_indexed_positions(const void *p1, const void *p2);
+static int compare_chunk_numbers(const void *c1, const void *c2);
+static Boolean open_indexed_file(unsigned file_number);
+
+/* Process all of the input with the help of GlobalState.position_index_file.
+ * Return FALSE, having done nothing, if the index cannot help,
+ * in which case the input must be processed by yyparse as normal.
+ */
+Boolean
+process_with_position_index(void)
+{
+    const char *index_file = GlobalState.position_index_file;
+
+    if (index_file == NULL || !position_index_possible()) {
+        return FALSE;
+    }
+    else if (!load_position_index(index_file)) {
+        build_position_index(index_file);
+        return TRUE;
+    }
+    else {
+        size_t count;
+        const uint64_t *placements = position_query_placements(&count);
+
+        if (placements != NULL && position_query_possible()) {
+            answer_position_query(placements, count);
+            return TRUE;
+        }
+        else {
+            /* All of the input must be processed. */
+            return FALSE;
+        }
+    }
+}
+
+/* Whether the index is being built from the games being processed. */
+Boolean
+building_position_index(void)
+{
+    return index_build.active;
+}
+
+/* Add the positions of game to the index being built. */
+void
+index_game_positions(Game *game)
+{
+    if (index_build.active && GlobalState.current_file_type == NORMALFILE) {
+        visit_game_positions(game, record_position);
+    }
+}
+
+/* Whether every input file can be indexed. */
+static Boolean
+position_index_possible(void)
+{
+    const char *unsupported = NULL;
+    unsigned file_number;
+
+    if (input_file_name(0) == NULL) {
+        unsupported = "standard input";
+    }
+    for (file_number = 0; unsupported == NULL &&
+            input_file_name(file_number) != NULL; file_number++) {
+        struct stat file_details;
+
+        if (stat(input_file_name(file_number), &file_details) != 0 ||
+                !S_ISREG(file_details.st_mode) ||
+                compressed_input_file(input_file_name(file_number))) {
+            unsupported = input_file_name(file_number);
+        }
+    }
+    if (unsupported != NULL) {
+        fprintf(GlobalState.logfile,
+                "--posindex is not supported with %s; it is ignored.\n",
+                unsupported);
+        return FALSE;
+    }
+    else {
+        return TRUE;
+    }
+}
+
+/* Read the index in index_file, if it exists and was built from
+ * the current state of the input files. Return TRUE if so.
+ */
+static Boolean
+load_position_index(const char *index_file)
+{
+    FILE *fp = fopen(index_file, "rb");
+    PositionIndexHeader header;
+    size_t length = 0, expected;
+    void *contents;
+    Boolean up_to_date = TRUE;
+    uint32_t file_number;
+
+    if (fp == NULL) {
+        return FALSE;
+    }
+    if (fseek(fp, 0L, SEEK_END) == 0) {
+        long end = ftell(fp);
+        if (end > 0) {
+            length = (size_t) end;
+        }
+    }
+    if (length < sizeof (header) || fseek(fp, 0L, SEEK_SET) != 0 ||
+            fread((void *) &header, sizeof (header), 1, fp) != 1 ||
+            memcmp(header.magic, POSITION_INDEX_MAGIC, sizeof (header.magic)) != 0) {
+        fprintf(GlobalState.logfile, "%s is not a position index file.\n", index_file);
+        exit(1);
+    }
+    expected = sizeof (header) + header.num_files * sizeof (IndexedFile) +
+            header.num_chunks * sizeof (IndexedChunk) +
+            header.num_positions * sizeof (IndexedPosition) + header.name_space;
+    if (header.version != POSITION_INDEX_VERSION || expected != length) {
+        /* It will be rebuilt. */
+        (void) fclose(fp);
+        return FALSE;
+    }
+    contents = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (contents == MAP_FAILED) {
+        contents = malloc_or_die(length);
+        if (fseek(fp, 0L, SEEK_SET) != 0 ||
+                fread(contents, 1, length, fp) != length) {
+            fprintf(GlobalState.logfile,
+                    "Unable to read the position index %s\n", index_file);
+            exit(1);
+        }
+    }
+    (void) fclose(fp);
+
+    position_index.num_files = header.num_files;
+    position_index.files = (const IndexedFile *) ((const char *) contents + sizeof (header));
+    position_index.num_chunks = (size_t) header.num_chunks;
+    position_index.chunks = (const IndexedChunk *) (position_index.files + header.num_files);
+    position_index.num_positions = (size_t) header.num_positions;
+    position_index.positions =
+            (const IndexedPosition *) (position_index.chunks + position_index.num_chunks);
+    position_index.names =
+            (const char *) (position_index.positions + position_index.num_positions);
+    position_index.num_games = header.num_games;
+
+    /* The index must be of the same files, unchanged. */
+    for (file_number = 0; up_to_date && file_number < header.num_files; file_number++) {
+        const IndexedFile *file = &position_index.files[file_number];
+        const char *name = input_file_name(file_number);
+        struct stat file_details;
+
+        up_to_date = name != NULL && file->name < header.name_space &&
+                strcmp(&position_index.names[file->name], name) == 0 &&
+                stat(name, &file_details) == 0 &&
+                (int64_t) file_details.st_size == file->size &&
+                (int64_t) file_details.st_mtime == file->time;
+    }
+    if (up_to_date && input_file_name(header.num_files) != NULL) {
+        up_to_date = FALSE;
+    }
+    return up_to_date;
+}
+
+/* Process all of the input, building an index of it in index_file. */
+static void
+build_position_index(const char *index_file)
+{
+    unsigned file_number;
+    Boolean complete = TRUE;
+
+    index_build.active = TRUE;
+    for (file_number = 0; complete && input_file_name(file_number) != NULL;
+            file_number++) {
+        if (!open_indexed_file(file_number)) {
+            fprintf(GlobalState.logfile, "Unable to open the PGN file: %s\n",
+                    input_file_name(file_number));
+            complete = FALSE;
+        }
+        else {
+            while (complete && next_input_chunk(GAME_CHUNK_SIZE, TRUE)) {
+                IndexedChunk *chunk;
+                size_t start, end;
+                unsigned long first_line;
+
+                if (index_build.num_chunks == index_build.max_chunks) {
+                    index_build.max_chunks = index_build.max_chunks == 0 ?
+                            1024 : 2 * index_build.max_chunks;
+                    index_build.chunks = (IndexedChunk *) realloc_or_die(
+                            (void *) index_build.chunks,
+                            index_build.max_chunks * sizeof (*index_build.chunks));
+                }
+                chunk = &index_build.chunks[index_build.num_chunks];
+                last_input_chunk(&start, &end, &first_line);
+                chunk->start = start;
+                chunk->end = end;
+                chunk->first_line = first_line;
+                chunk->games_before = GlobalState.num_games_processed;
+                chunk->file_number = file_number;
+                chunk->unused = 0;
+                index_build.num_chunks++;
+
+                (void) yyparse(GlobalState.current_file_type);
+                if (finished_processing()) {
+                    complete = FALSE;
+                }
+            }
+        }
+    }
+    index_build.active = FALSE;
+    if (complete) {
+        save_position_index(index_file);
+    }
+    else if (!finished_processing()) {
+        /* An input file could not be read. */
+    }
+    else {
+        fprintf(GlobalState.logfile,
+                "The position index %s was not written because not all of the games were processed.\n",
+                index_file);
+    }
+}
+
+/* Write the index that has just been built to index_file. */
+static void
+save_position_index(const char *index_file)
+{
+    PositionIndexHeader header;
+    IndexedFile *files;
+    char *names;
+    size_t name_space = 0, i, kept;
+    unsigned file_number, num_files = 0;
+    char *temp_name;
+    FILE *fp;
+    Boolean ok;
+
+    while (input_file_name(num_files) != NULL) {
+        name_space += strlen(input_file_name(num_files)) + 1;
+        num_files++;
+    }
+    files = (IndexedFile *) malloc_or_die((num_files > 0 ? num_files : 1) * sizeof (*files));
+    names = (char *) malloc_or_die(name_space > 0 ? name_space : 1);
+    name_space = 0;
+    for (file_number = 0; file_number < num_files; file_number++) {
+        const char *name = input_file_name(file_number);
+        struct stat file_details;
+
+        if (stat(name, &file_details) != 0) {
+            file_details.st_size = 0;
+            file_details.st_mtime = 0;
+        }
+        files[file_number].size = (int64_t) file_details.st_size;
+        files[file_number].time = (int64_t) file_details.st_mtime;
+        files[file_number].name = (uint32_t) name_space;
+        files[file_number].unused = 0;
+        strcpy(&names[name_space], name);
+        name_space += strlen(name) + 1;
+    }
+
+    /* Keep only the earliest occurrence of a position in each chunk. */
+    if (index_build.num_positions > 0) {
+        qsort((void *) index_build.positions, index_build.num_positions,
+              sizeof (*index_build.positions), compare_indexed_positions);
+    }
+    kept = 0;
+    for (i = 0; i < index_build.num_positions; i++) {
+        if (kept == 0 ||
+                index_build.positions[kept - 1].placement != index_build.positions[i].placement ||
+                index_build.positions[kept - 1].chunk != index_build.positions[i].chunk) {
+            index_build.positions[kept++] = index_build.positions[i];
+        }
+    }
+    index_build.num_positions = kept;
+
+    memset((void *) &header, 0, sizeof (header));
+    memcpy(header.magic, POSITION_INDEX_MAGIC, sizeof (header.magic));
+    header.version = POSITION_INDEX_VERSION;
+    header.num_files = num_files;
+    header.num_chunks = index_build.num_chunks;
+    header.num_positions = index_build.num_positions;
+    header.num_games = GlobalState.num_games_processed;
+    header.name_space = name_space;
+
+    temp_name = (char *) malloc_or_die(strlen(index_file) + strlen(".tmp") + 1);
+    strcpy(temp_name, index_file);
+    strcat(temp_name, ".tmp");
+    fp = fopen(temp_name, "wb");
+    if (fp == NULL) {
+        fprintf(GlobalState.logfile,
+                "Unable to write the position index %s\n", temp_name);
+        ok = FALSE;
+    }
+    else {
+        ok = fwrite((void *) &header, sizeof (header), 1, fp) == 1 &&
+                fwrite((void *) files, sizeof (*files), num_files, fp) == num_files &&
+                fwrite((void *) index_build.chunks, sizeof (*index_build.chunks),
+                       index_build.num_chunks, fp) == index_build.num_chunks &&
+                fwrite((void *) index_build.positions, sizeof (*index_build.positions),
+                       index_build.num_positions, fp) == index_build.num_positions &&
+                fwrite((void *) names, 1, name_space, fp) == name_space;
+        if (fclose(fp) != 0) {
+            ok = FALSE;
+        }
+        if (ok && rename(temp_name, index_file) != 0) {
+            /* Some systems will not rename over an existing file. */
+            (void) remove(index_file);
+            ok = rename(temp_name, index_file) == 0;
+        }
+        if (!ok) {
+            fprintf(GlobalState.logfile,
+                    "Unable to write the position index %s\n", index_file);
+            (void) remove(temp_name);
+        }
+    }
+    (void) free((void *) temp_name);
+    (void) free((void *) files);
+    (void) free((void *) names);
+    (void) free((void *) index_build.chunks);
+    (void) free((void *) index_build.positions);
+    index_build.chunks = NULL;
+    index_build.positions = NULL;
+    index_build.num_chunks = index_build.max_chunks = 0;
+    index_build.num_positions = index_build.max_positions = 0;
+}
+
+/* Whether the games that match can be found from the index alone.
+ * A game not containing one of the positions could still be output
+ * as a non-matching game, be needed for duplicate detection,
+ * or need to be checked.
+ */
+static Boolean
+position_query_possible(void)
+{
+    unsigned file_number;
+
+    if (GlobalState.non_matching_file != NULL || GlobalState.check_only ||
+            GlobalState.suppress_duplicates || GlobalState.suppress_originals ||
+            GlobalState.duplicate_file != NULL ||
+            GlobalState.duplicate_index_file != NULL ||
+            GlobalState.delete_same_setup) {
+        return FALSE;
+    }
+    for (file_number = 0; input_file_name(file_number) != NULL; file_number++) {
+        if (input_file_type(file_number) != NORMALFILE) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Process just the games of the index that contain one of the
+ * given placements.
+ */
+static void
+answer_position_query(const uint64_t *placements, size_t count)
+{
+    uint32_t *chunks = NULL;
+    size_t num_chunks = 0, max_chunks = 0;
+    size_t p, c;
+    long current_file = -1;
+
+    for (p = 0; p < count; p++) {
+        size_t low = 0, high = position_index.num_positions;
+
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (position_index.positions[mid].placement < placements[p]) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+        for (; low < position_index.num_positions &&
+                position_index.positions[low].placement == placements[p]; low++) {
+            if (num_chunks == max_chunks) {
+                max_chunks = max_chunks == 0 ? 64 : 2 * max_chunks;
+                chunks = (uint32_t *) realloc_or_die((void *) chunks,
+                        max_chunks * sizeof (*chunks));
+            }
+            chunks[num_chunks++] = position_index.positions[low].chunk;
+        }
+    }
+    /* Process the chunks in their order in the input. */
+    if (num_chunks > 0) {
+        qsort((void *) chunks, num_chunks, sizeof (*chunks), compare_chunk_numbers);
+    }
+
+    for (c = 0; c < num_chunks && !finished_processing(); c++) {
+        const IndexedChunk *chunk;
+
+        if (c > 0 && chunks[c] == chunks[c - 1]) {
+            continue;
+        }
+        if (chunks[c] >= position_index.num_chunks) {
+            break;
+        }
+        chunk = &position_index.chunks[chunks[c]];
+        if ((long) chunk->file_number != current_file) {
+            current_file = (long) chunk->file_number;
+            if (!open_indexed_file(chunk->file_number)) {
+                fprintf(GlobalState.logfile, "Unable to open the PGN file: %s\n",
+                        input_file_name(chunk->file_number));
+                break;
+            }
+        }
+        if (select_input_chunk((size_t) chunk->start, (size_t) chunk->end,
+                               (unsigned long) chunk->first_line)) {
+            GlobalState.num_games_processed = (unsigned long) chunk->games_before;
+            (void) yyparse(GlobalState.current_file_type);
+        }
+    }
+    if (!finished_processing()) {
+        /* Account for the games not containing the positions. */
+        GlobalState.num_games_processed = (unsigned long) position_index.num_games;
+    }
+    (void) free((void *) chunks);
+}
+
+/* Open the given input file to be read in chunks.
+ * The first file has already been opened and reported on
+ * by open_first_file.
+ */
+static Boolean
+open_indexed_file(unsigned file_number)
+{
+    int verbosity = GlobalState.verbosity;
+    Boolean opened;
+
+    if (file_number == 0 && GlobalState.verbosity > 1) {
+        GlobalState.verbosity = 1;
+    }
+    opened = open_chunked_input(file_number);
+    GlobalState.verbosity = verbosity;
+    return opened;
+}
+
+/* The PositionVisitor for the games of the index being built. */
+static void
+record_position(uint64_t placement, unsigned ply)
+{
+    IndexedPosition *position;
+
+    if (index_build.num_positions == index_build.max_positions) {
+        index_build.max_positions = index_build.max_positions == 0 ?
+                64 * 1024 : 2 * index_build.max_positions;
+        index_build.positions = (IndexedPosition *) realloc_or_die(
+                (void *) index_build.positions,
+                index_build.max_positions * sizeof (*index_build.positions));
+    }
+    position = &index_build.positions[index_build.num_positions++];
+    position->placement = placement;
+    position->chunk = (uint32_t) (index_build.num_chunks - 1);
+    position->ply = ply;
+}
+
+/* Order positions on their placement, then chunk, then ply. */
+static int
+compare_indexed_positions(const void *p1, const void *p2)
+{
+    const IndexedPosition *position1 = (const IndexedPosition *) p1;
+    const IndexedPosition *position2 = (const IndexedPosition *) p2;
+
+    if (position1->placement != position2->placement) {
+        return position1->placement < position2->placement ? -1 : 1;
+    }
+    else if (position1->chunk != position2->chunk) {
+        return position1->chunk < position2->chunk ? -1 : 1;
+    }
+    else if (position1->ply != position2->ply) {
+        return position1->ply < position2->ply ? -1 : 1;
+    }
+    else {
+        return 0;
+    }
+}
+
+static int
+compare_chunk_numbers(const void *c1, const void *c2)
+{
+    uint32_t chunk1 = *(const uint32_t *) c1;
+    uint32_t chunk2 = *(const uint32_t *) c2;
+
+    return chunk1 < chunk2 ? -1 : (chunk1 > chunk2 ? 1 : 0);
+}
+
+#else
+
+/* A position index is only available on POSIX systems. */
+Boolean
+process_with_position_index(void)
+{
+    if (GlobalState.position_index_file != NULL) {
+        fprintf(GlobalState.logfile,
+                "--posindex is not supported on this system; it is ignored.\n");
+    }
+    return FALSE;
+}
+
+Boolean
+building_position_index(void)
+{
+    return FALSE;
+}
+
+void
+index_game_positions(Game *game)
+{
+    (void) game;
+}
+
+#endif
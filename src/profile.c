@@ -0,0 +1,200 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+/* Support for --profile.
+ * The wall-clock and CPU time spent in each of the main stages of
+ * processing is accumulated, along with counters of the work done,
+ * and reported at the end of the run.
+ * Nothing is measured unless profiling has been started: see the
+ * macros in profile.h.
+ */
+
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define POSIX_CLOCKS 1
+#endif
+
+#include <stdio.h>
+#include <time.h>
+#include "bool.h"
+#include "defs.h"
+#include "typedef.h"
+#include "profile.h"
+
+static const char *const stage_names[NUM_PROFILE_STAGES] = {
+    "lex", "parse", "apply", "position_match", "eco", "duplicates", "output",
+};
+
+static const char *const counter_names[NUM_PROFILE_COUNTERS] = {
+    "plies_applied", "bytes_written",
+};
+
+static const char *const table_names[NUM_PROFILE_TABLES] = {
+    "log_table", "eco_table",
+};
+
+static struct {
+    unsigned long calls;
+    double wall, cpu;
+} stages[NUM_PROFILE_STAGES];
+
+static unsigned long counters[NUM_PROFILE_COUNTERS];
+
+static struct {
+    unsigned long lookups, probes, longest;
+} tables[NUM_PROFILE_TABLES];
+
+/* The clocks when profiling started. */
+static ProfileMark start_of_run;
+
+static void
+read_clocks(ProfileMark *mark)
+{
+#if POSIX_CLOCKS
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    mark->wall = now.tv_sec + now.tv_nsec / 1e9;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    mark->cpu = now.tv_sec + now.tv_nsec / 1e9;
+#else
+    mark->cpu = (double) clock() / CLOCKS_PER_SEC;
+    mark->wall = mark->cpu;
+#endif
+}
+
+/* Start accumulating the profile, to be reported in format. */
+void
+start_profile(ProfileFormat format)
+{
+    GlobalState.profile_format = format;
+    read_clocks(&start_of_run);
+}
+
+/* Note the start of a stage. */
+void
+profile_begin(ProfileMark *mark)
+{
+    read_clocks(mark);
+}
+
+/* Add the time since mark to that of stage. */
+void
+profile_end(ProfileStage stage, const ProfileMark *mark)
+{
+    ProfileMark now;
+
+    read_clocks(&now);
+    stages[stage].calls++;
+    stages[stage].wall += now.wall - mark->wall;
+    stages[stage].cpu += now.cpu - mark->cpu;
+}
+
+void
+profile_count(ProfileCounter counter, unsigned long amount)
+{
+    counters[counter] += amount;
+}
+
+/* Record a lookup in table that took the given number of probes. */
+void
+profile_probes(ProfileTable table, unsigned long probes)
+{
+    tables[table].lookups++;
+    tables[table].probes += probes;
+    if (probes > tables[table].longest) {
+        tables[table].longest = probes;
+    }
+}
+
+/* Add the wall-clock time of each stage so far to the progress line. */
+void
+profile_progress(FILE *fp)
+{
+    int stage;
+
+    for (stage = 0; stage < NUM_PROFILE_STAGES; stage++) {
+        if (stages[stage].calls > 0) {
+            fprintf(fp, " %s %.1fs", stage_names[stage], stages[stage].wall);
+        }
+    }
+}
+
+/* Report the profile to fp.
+ * process identifies which process is reporting, for --threads.
+ */
+void
+report_profile(FILE *fp, const char *process)
+{
+    ProfileMark end_of_run;
+    int i;
+
+    read_clocks(&end_of_run);
+    if (GlobalState.profile_format == PROFILE_JSON) {
+        fprintf(fp, "{\"process\": \"%s\", \"games_processed\": %lu, "
+                "\"games_matched\": %lu, \"wall_seconds\": %.6f, "
+                "\"cpu_seconds\": %.6f, \"stages\": {",
+                process, GlobalState.num_games_processed,
+                GlobalState.num_games_matched,
+                end_of_run.wall - start_of_run.wall,
+                end_of_run.cpu - start_of_run.cpu);
+        for (i = 0; i < NUM_PROFILE_STAGES; i++) {
+            fprintf(fp, "%s\"%s\": {\"calls\": %lu, \"wall_seconds\": %.6f, "
+                    "\"cpu_seconds\": %.6f}",
+                    i > 0 ? ", " : "", stage_names[i], stages[i].calls,
+                    stages[i].wall, stages[i].cpu);
+        }
+        fputs("}", fp);
+        for (i = 0; i < NUM_PROFILE_COUNTERS; i++) {
+            fprintf(fp, ", \"%s\": %lu", counter_names[i], counters[i]);
+        }
+        for (i = 0; i < NUM_PROFILE_TABLES; i++) {
+            fprintf(fp, ", \"%s\": {\"lookups\": %lu, \"probes\": %lu, "
+                    "\"longest_probe\": %lu}",
+                    table_names[i], tables[i].lookups, tables[i].probes,
+                    tables[i].longest);
+        }
+        fputs("}\n", fp);
+    }
+    else if (GlobalState.profile_format == PROFILE_TEXT) {
+        fprintf(fp, "Profile of %s: %.3fs wall, %.3fs CPU\n", process,
+                end_of_run.wall - start_of_run.wall,
+                end_of_run.cpu - start_of_run.cpu);
+        fprintf(fp, "%-16s %12s %12s %12s\n", "stage", "calls", "wall(s)", "cpu(s)");
+        for (i = 0; i < NUM_PROFILE_STAGES; i++) {
+            fprintf(fp, "%-16s %12lu %12.3f %12.3f\n", stage_names[i],
+                    stages[i].calls, stages[i].wall, stages[i].cpu);
+        }
+        fprintf(fp, "%-16s %12lu\n", "games_processed",
+                GlobalState.num_games_processed);
+        fprintf(fp, "%-16s %12lu\n", "games_matched",
+                GlobalState.num_games_matched);
+        for (i = 0; i < NUM_PROFILE_COUNTERS; i++) {
+            fprintf(fp, "%-16s %12lu\n", counter_names[i], counters[i]);
+        }
+        for (i = 0; i < NUM_PROFILE_TABLES; i++) {
+            fprintf(fp, "%-16s %12lu lookups, %lu probes, longest %lu\n",
+                    table_names[i], tables[i].lookups, tables[i].probes,
+                    tables[i].longest);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* The stages whose times are reported by --profile.
+ * The time of a stage includes that of any stage it calls.
+ */
+typedef enum {
+    PROFILE_LEX, PROFILE_PARSE, PROFILE_APPLY, PROFILE_POSITION_MATCH,
+    PROFILE_ECO, PROFILE_DUPLICATES, PROFILE_OUTPUT,
+    NUM_PROFILE_STAGES
+} ProfileStage;
+
+typedef enum {
+    PROFILE_PLIES_APPLIED, PROFILE_BYTES_WRITTEN,
+    NUM_PROFILE_COUNTERS
+} ProfileCounter;
+
+/* The hash tables whose probe lengths are reported. */
+typedef enum {
+    PROFILE_LOG_TABLE, PROFILE_ECO_TABLE,
+    NUM_PROFILE_TABLES
+} ProfileTable;
+
+/* The clocks at the start of a stage. */
+typedef struct {
+    double wall, cpu;
+} ProfileMark;
+
+/* The profile is only accumulated for --profile, and tested for
+ * before each call so as to cost little otherwise.
+ */
+#define PROFILING (GlobalState.profile_format != NO_PROFILE)
+#define PROFILE_BEGIN(mark) \
+    do { if (PROFILING) profile_begin(&(mark)); } while (0)
+#define PROFILE_END(stage, mark) \
+    do { if (PROFILING) profile_end((stage), &(mark)); } while (0)
+#define PROFILE_COUNT(counter, amount) \
+    do { if (PROFILING) profile_count((counter), (amount)); } while (0)
+#define PROFILE_PROBES(table, probes) \
+    do { if (PROFILING) profile_probes((table), (probes)); } while (0)
+
+void start_profile(ProfileFormat format);
+void profile_begin(ProfileMark *mark);
+void profile_end(ProfileStage stage, const ProfileMark *mark);
+void profile_count(ProfileCounter counter, unsigned long amount);
+void profile_probes(ProfileTable table, unsigned long probes);
+void profile_progress(FILE *fp);
+void report_profile(FILE *fp, const char *process);
+
+#endif	// PROFILE_H
+
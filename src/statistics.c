@@ -0,0 +1,477 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+
+
+/* Support for --stats.
+ * The results of the games matched are tallied in an aggregate
+ * keyed by the value of a tag, by each of the players, or by each
+ * position reached within a given number of plies, and the totals
+ * are written as CSV or JSON at the end of the run, without any
+ * games having to be output.
+ * With --threads, each worker tallies the games it matches and
+ * sends its aggregate to the parent to be merged into its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "bool.h"
+#include "mymalloc.h"
+#include "defs.h"
+#include "typedef.h"
+#include "tokens.h"
+#include "taglist.h"
+#include "lex.h"
+#include "apply.h"
+#include "output.h"
+#include "zobrist.h"
+#include "statistics.h"
+
+/* The outcomes counted for each key.
+ * For a player, WHITE_WIN and BLACK_WIN count the games won
+ * and lost by that player.
+ */
+typedef enum {
+    WHITE_WIN, DRAW, BLACK_WIN, UNFINISHED,
+    NUM_OUTCOMES
+} Outcome;
+
+/* The totals for one value of the key. */
+typedef struct {
+    /* The tag value, player or EPD of the position. */
+    char *key;
+    /* The hash of key, or the hash code of the position. */
+    uint64_t hash;
+    unsigned long games;
+    unsigned long outcomes[NUM_OUTCOMES];
+    /* The number of the last game tallied, so that a position
+     * is only counted once for each game reaching it.
+     */
+    unsigned long last_game;
+} Aggregate;
+
+/* What precedes the key of each aggregate sent by a worker. */
+typedef struct {
+    uint64_t hash;
+    unsigned long games;
+    unsigned long outcomes[NUM_OUTCOMES];
+    size_t key_length;
+} SerialisedAggregate;
+
+typedef enum {
+    TAG_KEY, PLAYER_KEY, POSITION_KEY
+} KeyKind;
+
+static KeyKind key_kind = TAG_KEY;
+/* The tag of TAG_KEY. */
+static TagName key_tag;
+/* The number of plies of POSITION_KEY. */
+static unsigned key_plies = 0;
+
+/* An open-addressing hash table of the aggregates.
+ * Free slots have a NULL key. It is kept at most half full.
+ */
+static Aggregate *aggregates = NULL;
+static size_t table_size = 0;
+static size_t num_aggregates = 0;
+static unsigned long games_tallied = 0;
+/* The outcome of the game whose positions are being tallied. */
+static Outcome game_outcome;
+
+/* Set the key of --stats: a tag name, Player for both players,
+ * or the number of plies within which positions are tallied.
+ */
+void
+set_statistics_key(const char *key)
+{
+    unsigned plies;
+
+    if (isdigit((unsigned char) *key)) {
+        if (sscanf(key, "%u", &plies) == 1 && plies > 0) {
+            key_kind = POSITION_KEY;
+            key_plies = plies;
+        }
+        else {
+            fprintf(GlobalState.logfile,
+                    "--stats requires a tag name or a number of plies greater than zero.\n");
+            exit(1);
+        }
+    }
+    else {
+        TagName tag = lookup_tag(key);
+
+        key_kind = tag == PSEUDO_PLAYER_TAG ? PLAYER_KEY : TAG_KEY;
+        key_tag = tag;
+    }
+    GlobalState.statistics_key = copy_string(key);
+}
+
+/* The FNV-1a hash of the len characters of key. */
+static uint64_t
+hash_key(const char *key, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Return the slot of the aggregate for hash and key, or the free
+ * slot where it belongs. Positions are identified by hash alone.
+ */
+static size_t
+find_slot(uint64_t hash, const char *key)
+{
+    size_t slot = (size_t) hash & (table_size - 1);
+
+    while (aggregates[slot].key != NULL &&
+            (aggregates[slot].hash != hash ||
+             (key_kind != POSITION_KEY && strcmp(aggregates[slot].key, key) != 0))) {
+        slot = (slot + 1) & (table_size - 1);
+    }
+    return slot;
+}
+
+/* Make room in the table for one more aggregate. */
+static void
+grow_table(void)
+{
+    if (2 * (num_aggregates + 1) > table_size) {
+        Aggregate *old = aggregates;
+        size_t old_size = table_size;
+        size_t i;
+
+        table_size = table_size == 0 ? 1024 : 2 * table_size;
+        aggregates = (Aggregate *) malloc_or_die(table_size * sizeof(*aggregates));
+        for (i = 0; i < table_size; i++) {
+            aggregates[i].key = NULL;
+        }
+        for (i = 0; i < old_size; i++) {
+            if (old[i].key != NULL) {
+                aggregates[find_slot(old[i].hash, old[i].key)] = old[i];
+            }
+        }
+        if (old != NULL) {
+            (void) free((void *) old);
+        }
+    }
+}
+
+/* Return the aggregate for hash and key, adding it if it isn't there.
+ * key is copied if it is added.
+ */
+static Aggregate *
+find_aggregate(uint64_t hash, const char *key)
+{
+    size_t slot;
+
+    grow_table();
+    slot = find_slot(hash, key);
+    if (aggregates[slot].key == NULL) {
+        Aggregate *aggregate = &aggregates[slot];
+
+        memset((void *) aggregate, 0, sizeof(*aggregate));
+        aggregate->key = copy_string(key);
+        aggregate->hash = hash;
+        num_aggregates++;
+    }
+    return &aggregates[slot];
+}
+
+/* Count outcome against key. */
+static void
+tally_value(const char *key, Outcome outcome)
+{
+    Aggregate *aggregate = find_aggregate(hash_key(key, strlen(key)), key);
+
+    aggregate->games++;
+    aggregate->outcomes[outcome]++;
+}
+
+/* Count the outcome of the current game against board,
+ * if it has not already been counted for this game.
+ */
+static void
+tally_position(const Board *board)
+{
+    uint64_t hash = generate_zobrist_hash_from_board(board);
+    size_t slot;
+    Aggregate *aggregate;
+
+    grow_table();
+    slot = find_slot(hash, "");
+    if (aggregates[slot].key == NULL) {
+        char epd[FEN_SPACE];
+
+        build_basic_EPD_string(board, epd);
+        aggregate = find_aggregate(hash, epd);
+    }
+    else {
+        aggregate = &aggregates[slot];
+    }
+    if (aggregate->last_game != games_tallied) {
+        aggregate->last_game = games_tallied;
+        aggregate->games++;
+        aggregate->outcomes[game_outcome]++;
+    }
+}
+
+/* Tally the result of game against its key values. */
+void
+tally_game_statistics(Game *game)
+{
+    const char *result = game->tags[RESULT_TAG];
+    Outcome outcome = UNFINISHED;
+
+    if (result != NULL) {
+        if (strcmp(result, "1-0") == 0) {
+            outcome = WHITE_WIN;
+        }
+        else if (strcmp(result, "0-1") == 0) {
+            outcome = BLACK_WIN;
+        }
+        else if (strcmp(result, "1/2-1/2") == 0) {
+            outcome = DRAW;
+        }
+    }
+    games_tallied++;
+
+    switch (key_kind) {
+        case TAG_KEY:
+        {
+            const char *value = key_tag < (unsigned) game->tags_length ?
+                    game->tags[key_tag] : NULL;
+
+            tally_value(value != NULL ? value : "?", outcome);
+            break;
+        }
+        case PLAYER_KEY:
+        {
+            const char *white = game->tags[WHITE_TAG];
+            const char *black = game->tags[BLACK_TAG];
+
+            tally_value(white != NULL ? white : "?", outcome);
+            /* A win for White is a loss for Black. */
+            if (outcome == WHITE_WIN || outcome == BLACK_WIN) {
+                outcome = outcome == WHITE_WIN ? BLACK_WIN : WHITE_WIN;
+            }
+            tally_value(black != NULL ? black : "?", outcome);
+            break;
+        }
+        case POSITION_KEY:
+            game_outcome = outcome;
+            visit_main_line(game, key_plies, tally_position);
+            break;
+    }
+}
+
+/* Return the aggregates in the form in which a --threads worker
+ * sends them to be merged, setting length to its size.
+ */
+char *
+serialise_statistics(size_t *length)
+{
+    size_t space = sizeof(games_tallied);
+    char *data, *next;
+    size_t i;
+
+    for (i = 0; i < table_size; i++) {
+        if (aggregates[i].key != NULL) {
+            space += sizeof(SerialisedAggregate) + strlen(aggregates[i].key);
+        }
+    }
+    data = (char *) malloc_or_die(space);
+    memcpy((void *) data, (const void *) &games_tallied, sizeof(games_tallied));
+    next = data + sizeof(games_tallied);
+    for (i = 0; i < table_size; i++) {
+        if (aggregates[i].key != NULL) {
+            SerialisedAggregate details;
+
+            memset((void *) &details, 0, sizeof(details));
+            details.hash = aggregates[i].hash;
+            details.games = aggregates[i].games;
+            memcpy((void *) details.outcomes, (const void *) aggregates[i].outcomes,
+                    sizeof(details.outcomes));
+            details.key_length = strlen(aggregates[i].key);
+            memcpy((void *) next, (const void *) &details, sizeof(details));
+            next += sizeof(details);
+            memcpy((void *) next, (const void *) aggregates[i].key, details.key_length);
+            next += details.key_length;
+        }
+    }
+    *length = space;
+    return data;
+}
+
+/* Merge the aggregates of data, from serialise_statistics. */
+void
+merge_statistics(const char *data, size_t length)
+{
+    const char *end = data + length;
+    unsigned long games;
+
+    if (length < sizeof(games)) {
+        return;
+    }
+    memcpy((void *) &games, (const void *) data, sizeof(games));
+    games_tallied += games;
+    data += sizeof(games);
+    while (end - data >= (long) sizeof(SerialisedAggregate)) {
+        SerialisedAggregate details;
+        char *key;
+        Aggregate *aggregate;
+        unsigned outcome;
+
+        memcpy((void *) &details, (const void *) data, sizeof(details));
+        data += sizeof(details);
+        if ((size_t) (end - data) < details.key_length) {
+            break;
+        }
+        key = (char *) malloc_or_die(details.key_length + 1);
+        memcpy((void *) key, (const void *) data, details.key_length);
+        key[details.key_length] = '\0';
+        data += details.key_length;
+
+        aggregate = find_aggregate(details.hash, key);
+        aggregate->games += details.games;
+        for (outcome = 0; outcome < NUM_OUTCOMES; outcome++) {
+            aggregate->outcomes[outcome] += details.outcomes[outcome];
+        }
+        (void) free((void *) key);
+    }
+}
+
+/* The order of the report: most games first, then by key. */
+static int
+compare_aggregates(const void *first, const void *second)
+{
+    const Aggregate *a1 = *(const Aggregate * const *) first;
+    const Aggregate *a2 = *(const Aggregate * const *) second;
+
+    if (a1->games != a2->games) {
+        return a1->games > a2->games ? -1 : 1;
+    }
+    else {
+        return strcmp(a1->key, a2->key);
+    }
+}
+
+/* Write value to fp as a CSV field. */
+static void
+print_csv_field(FILE *fp, const char *value)
+{
+    if (strpbrk(value, ",\"\n") == NULL) {
+        fputs(value, fp);
+    }
+    else {
+        putc('"', fp);
+        for (; *value != '\0'; value++) {
+            if (*value == '"') {
+                putc('"', fp);
+            }
+            putc(*value, fp);
+        }
+        putc('"', fp);
+    }
+}
+
+/* Write the totals of the aggregates to the --statsfile,
+ * or standard output.
+ */
+void
+report_statistics(void)
+{
+    static const char *const outcome_names[NUM_OUTCOMES] = {
+        "white_wins", "draws", "black_wins", "unfinished",
+    };
+    static const char *const player_outcome_names[NUM_OUTCOMES] = {
+        "wins", "draws", "losses", "unfinished",
+    };
+    const char *const *names =
+            key_kind == PLAYER_KEY ? player_outcome_names : outcome_names;
+    const char *key_name = key_kind == POSITION_KEY ? "Position" :
+            key_kind == PLAYER_KEY ? "Player" : tag_header_string(key_tag);
+    FILE *fp = stdout;
+    Aggregate **sorted;
+    size_t i, n = 0;
+    unsigned outcome;
+
+    if (GlobalState.statistics_file != NULL) {
+        fp = fopen(GlobalState.statistics_file, "w");
+        if (fp == NULL) {
+            fprintf(GlobalState.logfile, "Unable to open %s for writing.\n",
+                    GlobalState.statistics_file);
+            exit(1);
+        }
+    }
+    sorted = (Aggregate **) malloc_or_die((num_aggregates + 1) * sizeof(*sorted));
+    for (i = 0; i < table_size; i++) {
+        if (aggregates[i].key != NULL) {
+            sorted[n++] = &aggregates[i];
+        }
+    }
+    if (n > 1) {
+        qsort((void *) sorted, n, sizeof(*sorted), compare_aggregates);
+    }
+
+    if (GlobalState.statistics_json) {
+        fprintf(fp, "{\"key\": \"%s\", \"games\": %lu, \"values\": [",
+                key_name, games_tallied);
+        for (i = 0; i < n; i++) {
+            fprintf(fp, "%s\n  {\"%s\": \"%s\", \"games\": %lu", i > 0 ? "," : "",
+                    key_name, sorted[i]->key, sorted[i]->games);
+            for (outcome = 0; outcome < NUM_OUTCOMES; outcome++) {
+                fprintf(fp, ", \"%s\": %lu", names[outcome],
+                        sorted[i]->outcomes[outcome]);
+            }
+            fputs("}", fp);
+        }
+        fputs("\n]}\n", fp);
+    }
+    else {
+        fprintf(fp, "%s,games", key_name);
+        for (outcome = 0; outcome < NUM_OUTCOMES; outcome++) {
+            fprintf(fp, ",%s", names[outcome]);
+        }
+        putc('\n', fp);
+        for (i = 0; i < n; i++) {
+            print_csv_field(fp, sorted[i]->key);
+            fprintf(fp, ",%lu", sorted[i]->games);
+            for (outcome = 0; outcome < NUM_OUTCOMES; outcome++) {
+                fprintf(fp, ",%lu", sorted[i]->outcomes[outcome]);
+            }
+            putc('\n', fp);
+        }
+    }
+    (void) free((void *) sorted);
+    if (fp != stdout) {
+        (void) fclose(fp);
+    }
+    else {
+        fflush(fp);
+    }
+}
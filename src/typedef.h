@@ -36,11 +36,13 @@
      *            non-capture and capture moves respectively.
      *     XOLALG: As XLALG but with O-O and O-O-O for castling moves.
      *     UCI: UCI-compatible format - actually LALG.
+     *     BIN: A compact binary form of the games, for reading back in
+     *          later (see binary.c).
      */
 #ifndef TYPEDEF_H
 #define TYPEDEF_H
 
-typedef enum { SOURCE, SAN, EPD, FEN, CM, LALG, HALG, ELALG, XLALG, XOLALG, UCI } OutputFormat;
+typedef enum { SOURCE, SAN, EPD, FEN, CM, LALG, HALG, ELALG, XLALG, XOLALG, UCI, BIN } OutputFormat;
 
     /* Define a type to specify whether a move gives check, checkmate,
      * or nocheck.
@@ -89,34 +91,19 @@ typedef struct nag {
  */
 #define MAX_MOVE_LEN 15
 
-        /* Retain the text of a move and any associated 
-         * NAGs and comments.
+        /* Details of a move that are only needed for particular
+         * forms of output, so they are kept out of line and only
+         * allocated (by annotate_move) when one of them is set.
          */
-typedef struct move {
-    /* This array is of type unsigned char,
-     * in order to accommodate full 8-bit letters without
-     * sign extension.
-     */
-    unsigned char move[MAX_MOVE_LEN+1];
-    /* Class of move, e.g. PAWN_MOVE, PIECE_MOVE. */
-    MoveClass class;
-    Col from_col;
-    Rank from_rank;
-    Col to_col;
-    Rank to_rank;
-    Piece piece_to_move;
-    /* captured_piece is EMPTY if there is no capture. */
-    Piece captured_piece;
-    /* promoted_piece is EMPTY if class is not PAWN_MOVE_WITH_PROMOTION. */
-    Piece promoted_piece;
-    /* Whether this move gives check. */
-    CheckStatus check_status;
+typedef struct move_annotation {
     /* An EPD representation of the board immediately before this move
      * has been played.
+     * Only set for EPD output or GlobalState.add_FEN_comments.
      */
     char *epd;
     /* The move count additions to the EPD representation to complete
-     * a FEN description. Only relevant if (epd != NULL).
+     * a FEN description. Only relevant if (epd != NULL), whose
+     * allocation it shares.
      */
     char *fen_suffix;
     /* zobrist hash code of the position after this move has been played.
@@ -127,8 +114,40 @@ typedef struct move {
      * This is primarily a hook for anyone wanting to build a proper
      * evaluation function (see apply.c) or interface to an external
      * engine, say.
+     * Only set if GlobalState.output_evaluation.
      */
     double evaluation;
+    /* Whether there is no evaluation because --engine reported no score. */
+    Boolean no_evaluation;
+} MoveAnnotation;
+
+        /* Retain the text of a move and any associated 
+         * NAGs and comments.
+         * The enumerated fields are held in single bytes to keep
+         * the structure compact.
+         */
+typedef struct move {
+    /* This array is of type unsigned char,
+     * in order to accommodate full 8-bit letters without
+     * sign extension.
+     */
+    unsigned char move[MAX_MOVE_LEN+1];
+    /* Class of move, e.g. PAWN_MOVE, PIECE_MOVE: a MoveClass. */
+    unsigned char class;
+    Col from_col;
+    Rank from_rank;
+    Col to_col;
+    Rank to_rank;
+    /* The Piece values. */
+    unsigned char piece_to_move;
+    /* captured_piece is EMPTY if there is no capture. */
+    unsigned char captured_piece;
+    /* promoted_piece is EMPTY if class is not PAWN_MOVE_WITH_PROMOTION. */
+    unsigned char promoted_piece;
+    /* Whether this move gives check: a CheckStatus. */
+    unsigned char check_status;
+    /* Any output details; NULL if none have been set. */
+    MoveAnnotation *annotation;
     Nag *NAGs;
     CommentList *comment_list;
     /* terminating_result holds the result of the current list of moves. */
@@ -186,6 +205,14 @@ typedef struct {
  */
 typedef enum { NORMALFILE, CHECKFILE, ECOFILE } SourceFileType;
 
+/* The form of the per-stage timings and counters report (--profile). */
+typedef enum { NO_PROFILE, PROFILE_TEXT, PROFILE_JSON } ProfileFormat;
+
+/* How a file of games is compressed. */
+typedef enum {
+    NO_COMPRESSION, GZIP_COMPRESSION, XZ_COMPRESSION, ZSTD_COMPRESSION
+} Compression;
+
 /*    0 = don't divide on ECO code.
  *    1 = divide by letter.
  *    2 = divide by letter and single digit.
@@ -268,8 +295,6 @@ typedef struct {
     /* Maximum output line length. */
     unsigned max_line_length;
     
-    /* Whether to use a virtual hash table or not. */
-    Boolean use_virtual_hash_table;
     /* Whether to match on the number of moves in a game. */
     Boolean check_move_bounds;
     /* Whether to match only games ending in checkmate. */
@@ -386,6 +411,34 @@ typedef struct {
      * 0 => no limit.
      */
     unsigned split_depth_limit;
+    /* The number of worker processes for matching games (--threads).
+     * 0 or 1 => games are matched by the main process.
+     */
+    unsigned num_threads;
+    /* Whether --threads workers find chunk boundaries by offset
+     * rather than by following the whole input (--offsetchunks).
+     */
+    Boolean split_input_by_offset;
+    /* Whether to report the time spent in each stage (--profile). */
+    ProfileFormat profile_format;
+    /* How the output files of -# and -E are compressed (--compress). */
+    Compression output_compression;
+    /* Whether output files are written by a separate thread (--asyncoutput). */
+    Boolean async_output;
+    /* The command of the UCI engines that evaluate positions (--engine). */
+    const char *engine_command;
+    /* How many engines are run (--engines). */
+    unsigned num_engines;
+    /* The depth to which engines search each position (--enginedepth). */
+    unsigned engine_depth;
+    /* Where engine evaluations are kept between runs (--evalcache). */
+    const char *evaluation_cache_file;
+    /* The key by which the games matched are tallied (--stats). */
+    const char *statistics_key;
+    /* Where the tallies are written (--statsfile). */
+    const char *statistics_file;
+    /* Whether the tallies are written as JSON rather than CSV (--statsformat). */
+    Boolean statistics_json;
     /* Whether this is a CHECKFILE or a NORMALFILE. */
     SourceFileType current_file_type;
     /* Whether SETUP_TAGs are ok in extracted games. */
@@ -405,10 +458,36 @@ typedef struct {
     const char *current_input_file;
     /* File of ECO lines. */
     const char *eco_file;
+    /* Compiled form of eco_file (--ecoindex). */
+    const char *eco_index_file;
     /* Where to write the extracted games. */
     FILE *outputfile;
     /* Output file name. */
     const char *output_filename;
+    /* File of hash values of games met in earlier runs (--dupindex). */
+    const char *duplicate_index_file;
+    /* Where to write the hash values of games, for --dupmerge (--dupscan). */
+    const char *duplicate_scan_prefix;
+    /* Where to write the duplicates of the shard files (--dupmerge). */
+    const char *duplicate_merge_file;
+    /* The merged duplicates to use (--dupresolve). */
+    const char *duplicate_resolve_prefix;
+    /* The number of shard files (--dupshards). */
+    unsigned duplicate_shards;
+    /* Index of the positions in the input files (--posindex). */
+    const char *position_index_file;
+    /* Whether to build and use the game index of each input file (--gameindex). */
+    Boolean game_index;
+    /* The file of jobs to run over the input (--batch). */
+    const char *batch_file;
+    /* The name of the job being run by this process, if any. */
+    const char *batch_job;
+    /* Where the progress of the run is recorded (--checkpoint). */
+    const char *checkpoint_file;
+    /* How many games to process between checkpoints (--checkpointevery). */
+    unsigned long checkpoint_interval;
+    /* Whether to carry on from checkpoint_file (--resume). */
+    Boolean resume;
     /* Where to write errors and running commentary. */
     FILE *logfile;
     /* Where to write duplicate games. */
@@ -430,6 +509,9 @@ typedef struct {
  */
 extern StateInfo GlobalState;
 FILE *must_open_file(const char *filename,const char *mode);
+FILE *must_open_output_file(const char *filename,const char *mode);
+void buffer_output_file(FILE *fp);
+void close_output_file(FILE *fp);
 
 #endif	// TYPEDEF_H
 
@@ -568,55 +568,27 @@ generate_zobrist_hash_from_fen(const char *fen)
     }
 }
 
-/* Generate a Zobrist hash value from the Board passed as argument. */
+/* Return the Zobrist value for the given piece of the given colour
+ * on the given square.
+ * make_move() uses this to maintain board->zobrist incrementally.
+ */
 uint64_t
-generate_zobrist_hash_from_board(const Board *board)
+zobrist_piece_hash(Col col, Rank rank, Piece piece, Colour colour)
 {
-    uint64_t hash = 0;
+    /* The pieces are in the order of FEN_pieces, black before white. */
+    int piece_id = 2 * (piece - PAWN) + (colour == WHITE ? 1 : 0);
+    return piece_section[64 * piece_id + (8 * (rank - FIRSTRANK)) + (col - FIRSTCOL)];
+}
 
-    /* The board. */
-    /* Attempt to iterate over the board as fast as possible
-     * as it is the main time consumer for this function.
-     */
-    int board_rank_index = RankConvert(FIRSTRANK);
-    for (int r = 0; r < BOARDSIZE; r++, board_rank_index++) {
-        int board_col_index = ColConvert(FIRSTCOL);
-        for (int c = 0; c < BOARDSIZE; c++, board_col_index++) {
-            int piece_id = -1;
-            switch((int) board->board[board_rank_index][board_col_index]) {
-                case B(PAWN):
-                    piece_id = 0; break;
-                case W(PAWN):
-                    piece_id = 1; break;
-                case B(KNIGHT):
-                    piece_id = 2; break;
-                case W(KNIGHT):
-                    piece_id = 3; break;
-                case B(BISHOP):
-                    piece_id = 4; break;
-                case W(BISHOP):
-                    piece_id = 5; break;
-                case B(ROOK):
-                    piece_id = 6; break;
-                case W(ROOK):
-                    piece_id = 7; break;
-                case B(QUEEN):
-                    piece_id = 8; break;
-                case W(QUEEN):
-                    piece_id = 9; break;
-                case B(KING):
-                    piece_id = 10; break;
-                case W(KING):
-                    piece_id = 11; break;
-                case EMPTY:
-                default:
-                    break;
-            }
-            if (piece_id >= 0) {
-		hash ^= piece_section[64 * piece_id + (8 * r) + c];
-            }
-        }
-    }
+/* Generate a Zobrist hash value from the Board passed as argument.
+ * The piece placement component is maintained incrementally
+ * in board->zobrist, so only the castling, en-passant and
+ * side-to-move components have to be added here.
+ */
+uint64_t
+generate_zobrist_hash_from_board(const Board *board)
+{
+    uint64_t hash = board->zobrist;
 
     if(board->to_move == WHITE) {
 	hash ^= white_to_move_element[0];
@@ -25,5 +25,6 @@
 uint64_t generate_zobrist_hash_from_board(const Board *board);
 uint64_t generate_zobrist_hash_from_fen(const char *fen);
 uint64_t piece_hash(char piece, int rank, int col);
+uint64_t zobrist_piece_hash(Col col, Rank rank, Piece piece, Colour colour);
 #endif
 
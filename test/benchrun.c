@@ -0,0 +1,130 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+/* Run a command several times for the bench target of the test Makefile
+ * and report the best of its times, along with its throughput and
+ * peak memory use, as a single line of JSON:
+ *     benchrun runs mode corpus games bytes command [args ...]
+ * The command's standard output is discarded.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static double
+seconds(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int runs, run;
+    const char *mode, *corpus;
+    double games, bytes;
+    double best_wall = -1.0, best_cpu = 0.0;
+    long peak_rss = 0;
+    int status = 0;
+
+    if(argc < 7) {
+        fprintf(stderr,
+                "Usage: %s runs mode corpus games bytes command [args ...]\n",
+                argv[0]);
+        return 2;
+    }
+    runs = atoi(argv[1]);
+    mode = argv[2];
+    corpus = argv[3];
+    games = atof(argv[4]);
+    bytes = atof(argv[5]);
+    if(runs < 1) {
+        runs = 1;
+    }
+
+    for(run = 0; run < runs; run++) {
+        struct rusage usage;
+        double start = now(), wall;
+        pid_t pid = fork();
+
+        if(pid < 0) {
+            perror("fork");
+            return 2;
+        }
+        else if(pid == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if(devnull >= 0) {
+                dup2(devnull, STDOUT_FILENO);
+                close(devnull);
+            }
+            execvp(argv[6], &argv[6]);
+            perror(argv[6]);
+            _exit(127);
+        }
+        if(wait4(pid, &status, 0, &usage) < 0) {
+            perror("wait4");
+            return 2;
+        }
+        wall = now() - start;
+        if(best_wall < 0.0 || wall < best_wall) {
+            best_wall = wall;
+            best_cpu = seconds(&usage.ru_utime) + seconds(&usage.ru_stime);
+        }
+        if(usage.ru_maxrss > peak_rss) {
+            peak_rss = usage.ru_maxrss;
+        }
+        if(!WIFEXITED(status)) {
+            break;
+        }
+    }
+    if(best_wall <= 0.0) {
+        best_wall = 1e-6;
+    }
+    /* ru_maxrss is in kilobytes on Linux, but bytes on macOS. */
+#ifdef __APPLE__
+    peak_rss /= 1024;
+#endif
+    printf("{\"mode\": \"%s\", \"corpus\": \"%s\", \"games\": %.0f, \"bytes\": %.0f, "
+           "\"runs\": %d, \"seconds\": %.3f, \"cpu_seconds\": %.3f, "
+           "\"games_per_s\": %.1f, \"mb_per_s\": %.2f, \"peak_rss_kb\": %ld, "
+           "\"exit_status\": %d}\n",
+           mode, corpus, games, bytes, runs, best_wall, best_cpu,
+           games / best_wall, bytes / (1024.0 * 1024.0) / best_wall, peak_rss,
+           WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# A stand-in for a UCI engine, for test-engine.
+# The score of each position, from the point of view of the side to
+# move, is the length of the piece placement of its FEN string,
+# after a bound that should be ignored.
+# With the argument unscored, positions where that length is odd
+# are given no score.
+while read -r command fen placement rest; do
+    case $command in
+    uci)
+        echo "id name fake-uci"
+        echo "uciok"
+        ;;
+    isready)
+        echo "readyok"
+        ;;
+    position)
+        score=${#placement}
+        ;;
+    go)
+        echo "info depth 1 score cp 999 lowerbound"
+        if [ "$1" != unscored ] || [ $((score % 2)) -eq 0 ]; then
+            echo "info depth 2 score cp $score nodes 1 pv e2e4"
+        fi
+        echo "bestmove e2e4"
+        ;;
+    quit)
+        exit 0
+        ;;
+    esac
+done
@@ -0,0 +1,89 @@
+/*
+ *  This file is part of pgn-extract: a Portable Game Notation (PGN) extractor.
+ *  Copyright (C) 1994-2022 David J. Barnes
+ *
+ *  pgn-extract is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  pgn-extract is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with pgn-extract. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  David J. Barnes may be contacted as d.j.barnes@kent.ac.uk
+ *  https://www.cs.kent.ac.uk/people/staff/djb/
+ */
+
+/* Process a file of games through the library interface of pgnlib.h
+ * for the test-library target of the test Makefile:
+ *     libtest input output [options ...]
+ * The games are processed twice, to check that the library can be
+ * reused, and the output of the second is written to output.
+ * The exit status is 3 if pgn_extract_init rejects the options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pgnlib.h"
+
+int
+main(int argc, char *argv[])
+{
+    FILE *fp;
+    char *pgn;
+    long length;
+    PgnExtractResult first, second;
+
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s input output [options ...]\n", argv[0]);
+        return 2;
+    }
+    fp = fopen(argv[1], "rb");
+    if(fp == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    fseek(fp, 0L, SEEK_END);
+    length = ftell(fp);
+    rewind(fp);
+    pgn = malloc(length > 0 ? length : 1);
+    if(pgn == NULL || fread(pgn, 1, length, fp) != (size_t) length) {
+        perror(argv[1]);
+        return 2;
+    }
+    fclose(fp);
+
+    /* The options follow the file names. */
+    if(pgn_extract_init(argc - 2, &argv[2]) != 0) {
+        return 3;
+    }
+    if(pgn_extract_buffer(pgn, length, &first) != 0 ||
+            pgn_extract_buffer(pgn, length, &second) != 0) {
+        fprintf(stderr, "pgn_extract_buffer failed\n");
+        return 1;
+    }
+    fwrite(first.log, 1, first.log_length, stderr);
+    if(first.games_matched != second.games_matched ||
+            first.output_length != second.output_length ||
+            memcmp(first.output, second.output, first.output_length) != 0) {
+        fprintf(stderr, "The output differs when the games are processed again\n");
+        return 1;
+    }
+    fp = fopen(argv[2], "wb");
+    if(fp == NULL) {
+        perror(argv[2]);
+        return 2;
+    }
+    fwrite(second.output, 1, second.output_length, fp);
+    fclose(fp);
+    pgn_extract_free_result(&first);
+    pgn_extract_free_result(&second);
+    free(pgn);
+    return 0;
+}